@@ -0,0 +1,79 @@
+// Builds the memory-mapped credential store (users.db) read by server_grp.
+//
+// Usage: ./build_userdb [--iterations N] <users.txt> <users.db>
+//        ./build_userdb [--iterations N] --generate COUNT <users.db>
+//
+// users.txt uses the usual "username:password" lines. --generate writes
+// COUNT synthetic accounts (user<i>:pass<i>) for startup benchmarks.
+// The output is replaced atomically, so a running server picks it up
+// through its inotify watch without a restart.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "credential_store.hpp"
+
+std::vector<std::pair<std::string, std::string>> read_users_file(const std::string& filename) {
+    std::vector<std::pair<std::string, std::string>> users;
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t delimiter = line.find(":");
+        if (delimiter != std::string::npos) {
+            std::string username = line.substr(0, delimiter);
+            std::string password = line.substr(delimiter + 1);
+
+            // Trim possible extra whitespace/newlines
+            username.erase(username.find_last_not_of(" \n\r\t") + 1);
+            password.erase(password.find_last_not_of(" \n\r\t") + 1);
+
+            users.emplace_back(username, password);
+        }
+    }
+    return users;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t iterations = USERDB_DEFAULT_ITERATIONS;
+    long generate = -1;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--generate" && i + 1 < argc) {
+            generate = std::stol(argv[++i]);
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != (generate >= 0 ? 1u : 2u)) {
+        std::cerr << "Usage: " << argv[0] << " [--iterations N] <users.txt> <users.db>\n"
+                  << "       " << argv[0] << " [--iterations N] --generate COUNT <users.db>\n";
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> users;
+    if (generate >= 0) {
+        users.reserve(generate);
+        for (long i = 0; i < generate; ++i) {
+            users.emplace_back("user" + std::to_string(i), "pass" + std::to_string(i));
+        }
+    } else {
+        users = read_users_file(paths[0]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string error;
+    if (!write_credential_store(paths.back(), users, iterations, error)) {
+        std::cerr << "[Error] " << error << "\n";
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Wrote " << users.size() << " account(s) to " << paths.back()
+              << " in " << seconds << " s (" << iterations << " PBKDF2 iterations).\n";
+    return 0;
+}
@@ -0,0 +1,245 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+// Compact binary capture of the commands a server receives (--capture).
+//
+// The file starts with a CaptureHeader and continues with variable-length
+// records. Integers are LEB128 varints; times are nanoseconds on the
+// server's steady clock, stored as the zig-zag encoded difference from the
+// previous record (connection threads append out of order by a little).
+//
+//   kind:u8 | connection:varint | time delta:varint | body
+//   CONNECT     body = length:varint, username
+//   COMMAND     body = service time:varint, length:varint, command line
+//   DISCONNECT  body = (none)
+//
+// Connection IDs are assigned per login and never reused, unlike socket
+// descriptors. Passwords are never recorded, and neither are the raw bytes
+// after a /chunk line (only their length, which is part of the command).
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr char CAPTURE_MAGIC[8] = {'C', 'H', 'A', 'T', 'C', 'A', 'P', '1'};
+constexpr uint32_t CAPTURE_VERSION = 1;
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t start_unix_ns;   // wall-clock time of the first record, for reference
+};
+static_assert(sizeof(CaptureHeader) == 24, "CaptureHeader layout is part of the file format");
+
+enum CaptureKind : uint8_t { CAPTURE_CONNECT = 1, CAPTURE_COMMAND = 2, CAPTURE_DISCONNECT = 3 };
+
+struct CaptureRecord {
+    CaptureKind kind;
+    uint64_t connection;
+    uint64_t time_ns;          // since the start of the capture
+    uint64_t service_ns = 0;   // COMMAND: from reading the line to finishing its handler
+    std::string data;          // username or command line
+};
+
+// -----------------------------------
+// CaptureWriter: shared by all connection threads
+// -----------------------------------
+class CaptureWriter {
+private:
+    std::ofstream file;
+    std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::condition_variable written_cv;   // signalled when a write_out() finishes
+    std::string buffer;
+    uint64_t last_time_ns = 0;
+    uint64_t next_connection = 1;
+    bool flushing = false;   // write_out() is writing to file without holding the mutex
+    bool stopping = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread flusher;
+
+    static constexpr size_t FLUSH_THRESHOLD = 1 << 20;
+
+    static void put_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    void put_header(CaptureKind kind, uint64_t connection, uint64_t time_ns) {
+        int64_t delta = int64_t(time_ns - last_time_ns);
+        last_time_ns = time_ns;
+        buffer.push_back(char(kind));
+        put_varint(buffer, connection);
+        put_varint(buffer, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+    }
+
+    // The flusher and connection threads both call this. Only one batch is
+    // written at a time, and the buffer is taken only after the previous batch
+    // is in, so batches reach the file in the order their deltas assume.
+    void write_out(std::unique_lock<std::mutex>& lock) {
+        written_cv.wait(lock, [this] { return !flushing; });
+        if (buffer.empty()) return;
+        std::string pending;
+        pending.swap(buffer);
+        flushing = true;
+        lock.unlock();
+        file.write(pending.data(), pending.size());
+        file.flush();
+        lock.lock();
+        flushing = false;
+        written_cv.notify_all();
+    }
+
+    // Writes the buffer at least once a second, so a killed server loses little
+    void flush_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            flush_cv.wait_for(lock, std::chrono::seconds(1));
+            if (!buffer.empty()) write_out(lock);
+        }
+    }
+
+    void append_locked(std::unique_lock<std::mutex>& lock) {
+        if (buffer.size() >= FLUSH_THRESHOLD) write_out(lock);
+    }
+
+public:
+    CaptureWriter() = default;
+
+    ~CaptureWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flush_cv.notify_all();
+        if (flusher.joinable()) flusher.join();
+        std::unique_lock<std::mutex> lock(mutex);
+        written_cv.wait(lock, [this] { return !flushing; });
+        file.write(buffer.data(), buffer.size());
+    }
+
+    bool open(const std::string& path) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+        CaptureHeader header{};
+        memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        header.version = CAPTURE_VERSION;
+        header.start_unix_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        flusher = std::thread(&CaptureWriter::flush_loop, this);
+        return static_cast<bool>(file);
+    }
+
+    uint64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t connect(const std::string& username) {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t connection = next_connection++;
+        put_header(CAPTURE_CONNECT, connection, now_ns());
+        put_varint(buffer, username.size());
+        buffer += username;
+        append_locked(lock);
+        return connection;
+    }
+
+    void command(uint64_t connection, uint64_t arrival_ns, uint64_t service_ns, const std::string& line) {
+        std::unique_lock<std::mutex> lock(mutex);
+        put_header(CAPTURE_COMMAND, connection, arrival_ns);
+        put_varint(buffer, service_ns);
+        put_varint(buffer, line.size());
+        buffer += line;
+        append_locked(lock);
+    }
+
+    void disconnect(uint64_t connection) {
+        std::unique_lock<std::mutex> lock(mutex);
+        put_header(CAPTURE_DISCONNECT, connection, now_ns());
+        append_locked(lock);
+    }
+};
+
+// Records one command when it goes out of scope, timing its handler
+class CaptureScope {
+private:
+    CaptureWriter* writer;
+    uint64_t connection;
+    const std::string& line;
+    uint64_t arrival_ns;
+
+public:
+    CaptureScope(CaptureWriter* writer, uint64_t connection, const std::string& line)
+        : writer(writer), connection(connection), line(line), arrival_ns(writer ? writer->now_ns() : 0) {}
+
+    ~CaptureScope() {
+        if (writer) writer->command(connection, arrival_ns, writer->now_ns() - arrival_ns, line);
+    }
+};
+
+// Reads a whole capture, sorted by time. Returns false on a malformed file;
+// records read before a truncated tail (a server that was killed) are kept.
+inline bool read_capture(const std::string& path, std::vector<CaptureRecord>& records, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CaptureHeader header{};
+    if (data.size() < sizeof(header)) {
+        error = "cannot read " + path;
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || header.version != CAPTURE_VERSION) {
+        error = path + " is not a chat capture";
+        return false;
+    }
+
+    size_t pos = sizeof(header);
+    auto get_varint = [&](uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            uint8_t byte = data[pos++];
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    };
+
+    uint64_t time_ns = 0;
+    while (pos < data.size()) {
+        CaptureRecord record{};
+        uint8_t kind = data[pos++];
+        uint64_t zigzag = 0, length = 0;
+        if (kind < CAPTURE_CONNECT || kind > CAPTURE_DISCONNECT ||
+            !get_varint(record.connection) || !get_varint(zigzag)) {
+            break;
+        }
+        record.kind = CaptureKind(kind);
+        time_ns += int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+        record.time_ns = time_ns;
+        if (kind == CAPTURE_COMMAND && !get_varint(record.service_ns)) break;
+        if (kind != CAPTURE_DISCONNECT) {
+            if (!get_varint(length) || length > data.size() - pos) break;
+            record.data = data.substr(pos, length);
+            pos += length;
+        }
+        records.push_back(std::move(record));
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const CaptureRecord& a, const CaptureRecord& b) { return a.time_ns < b.time_ns; });
+    return true;
+}
+
+#endif // CAPTURE_HPP
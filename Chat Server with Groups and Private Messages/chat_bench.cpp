@@ -0,0 +1,535 @@
+// In-process microbenchmarks for the chat core.
+//
+// Builds server_grp.cpp without its main() and with a contention-counting
+// mutex in place of std::mutex, then drives GroupManager, BroadcastMessage
+// and PrivateMessage directly. Recipients are descriptors dup()'d from a few
+// socketpairs whose other ends a background thread drains, so every send is
+// a real syscall into a real socket buffer, but no TCP or client process is
+// involved. Each case reports:
+//   - ns/op:        wall time per command, over all sender threads
+//   - deliveries/s: messages written to recipient sockets
+//   - MB/s:         fan-out bytes that reached the sinks
+//   - contended:    share of lock acquisitions that had to wait, and the
+//                   average wait per command
+//
+// Usage: ./chat_bench [--quick] [--time-ms MS] [--max-group-size N] [--max-senders N]
+// Group sizes need one descriptor per member; sizes above the open-file
+// limit (ulimit -n) are skipped.
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+using BenchClock = std::chrono::steady_clock;
+
+// -----------------------------------
+// CountingMutex: std::mutex that records how often callers had to wait
+// -----------------------------------
+struct LockCounters {
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+
+    void reset() {
+        acquisitions = 0;
+        contended = 0;
+        wait_ns = 0;
+    }
+};
+inline LockCounters lock_counters;
+
+class CountingMutex {
+private:
+    std::mutex inner;
+
+public:
+    void lock() {
+        lock_counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (inner.try_lock()) return;
+        auto start = BenchClock::now();
+        inner.lock();
+        auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+        lock_counters.contended.fetch_add(1, std::memory_order_relaxed);
+        lock_counters.wait_ns.fetch_add(waited, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if (!inner.try_lock()) return false;
+        lock_counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() { inner.unlock(); }
+};
+
+#define CHAT_MUTEX CountingMutex
+#define CHAT_SERVER_NO_MAIN
+#include "server_grp.cpp"
+
+struct BenchOptions {
+    int time_ms = 500;              // per case
+    size_t max_group_size = 100000;
+    int max_senders = 64;
+};
+
+// -----------------------------------
+// SinkPool: recipient descriptors backed by drained socketpairs
+// -----------------------------------
+class SinkPool {
+private:
+    static constexpr int PAIRS = 8;
+    int write_ends[PAIRS];
+    int read_ends[PAIRS];
+    std::vector<int> handed_out;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> bytes{0};
+    std::thread drainer;
+
+    void drain() {
+        std::vector<char> buffer(256 * 1024);
+        pollfd fds[PAIRS];
+        for (int i = 0; i < PAIRS; ++i) fds[i] = {read_ends[i], POLLIN, 0};
+        while (!stopping.load()) {
+            if (poll(fds, PAIRS, 50) <= 0) continue;
+            for (int i = 0; i < PAIRS; ++i) {
+                if (!(fds[i].revents & POLLIN)) continue;
+                ssize_t n;
+                while ((n = recv(read_ends[i], buffer.data(), buffer.size(), MSG_DONTWAIT)) > 0) {
+                    bytes.fetch_add(n, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+public:
+    SinkPool() {
+        for (int i = 0; i < PAIRS; ++i) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+                perror("socketpair");
+                exit(EXIT_FAILURE);
+            }
+            int size = 4 * 1024 * 1024;
+            setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            setsockopt(pair[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            write_ends[i] = pair[0];
+            read_ends[i] = pair[1];
+        }
+        drainer = std::thread(&SinkPool::drain, this);
+    }
+
+    ~SinkPool() {
+        release();
+        stopping = true;
+        drainer.join();
+        for (int i = 0; i < PAIRS; ++i) {
+            close(write_ends[i]);
+            close(read_ends[i]);
+        }
+    }
+
+    // `count` new recipient descriptors, or none if the open-file limit is too low
+    std::vector<int> acquire(size_t count) {
+        std::vector<int> fds;
+        for (size_t i = 0; i < count; ++i) {
+            int fd = dup(write_ends[i % PAIRS]);
+            if (fd < 0) {
+                for (int f : fds) close(f);
+                return {};
+            }
+            fds.push_back(fd);
+        }
+        handed_out.insert(handed_out.end(), fds.begin(), fds.end());
+        return fds;
+    }
+
+    void release() {
+        for (int fd : handed_out) close(fd);
+        handed_out.clear();
+    }
+
+    uint64_t bytes_drained() const { return bytes.load(); }
+
+    // Wait until everything written so far has been read
+    void settle() {
+        for (int i = 0; i < 200; ++i) {
+            bool empty = true;
+            for (int p = 0; p < PAIRS && empty; ++p) {
+                int queued = 0;
+                ioctl(read_ends[p], FIONREAD, &queued);
+                empty = queued == 0;
+            }
+            if (empty) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+};
+
+// -----------------------------------
+// Runner: times one case and prints a row
+// -----------------------------------
+struct CaseResult {
+    uint64_t ops = 0;
+    double seconds = 0;
+};
+
+// Runs op(thread_index, rng) on `senders` threads until the time budget is spent
+template <typename Op>
+CaseResult run_case(int senders, int time_ms, Op op) {
+    std::atomic<uint64_t> total_ops{0};
+    std::atomic<bool> go{false};
+    BenchClock::time_point deadline;   // published to the threads by `go`
+    std::vector<std::thread> threads;
+    for (int t = 0; t < senders; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(t * 7919 + 1);
+            while (!go.load()) std::this_thread::yield();
+            uint64_t ops = 0;
+            do {
+                for (int i = 0; i < 16; ++i) op(t, rng);
+                ops += 16;
+            } while (BenchClock::now() < deadline);
+            total_ops += ops;
+        });
+    }
+    lock_counters.reset();
+    auto start = BenchClock::now();
+    deadline = start + std::chrono::milliseconds(time_ms);
+    go = true;
+    for (auto& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+    return {total_ops.load(), seconds};
+}
+
+void print_header() {
+    std::cout << std::left << std::setw(16) << "Benchmark"
+              << std::right << std::setw(9) << "Groups"
+              << std::setw(9) << "Size"
+              << std::setw(9) << "Senders"
+              << std::setw(12) << "ns/op"
+              << std::setw(15) << "deliveries/s"
+              << std::setw(10) << "MB/s"
+              << std::setw(12) << "contended"
+              << std::setw(14) << "wait ns/op" << "\n";
+}
+
+void print_row(const std::string& name, size_t groups, size_t size, int senders, const CaseResult& result,
+               uint64_t deliveries_per_op, uint64_t bytes) {
+    double ops = std::max<uint64_t>(result.ops, 1);
+    uint64_t acquisitions = std::max<uint64_t>(lock_counters.acquisitions.load(), 1);
+    std::cout << std::left << std::setw(16) << name
+              << std::right << std::setw(9) << groups
+              << std::setw(9) << size
+              << std::setw(9) << senders
+              << std::fixed << std::setprecision(0)
+              << std::setw(12) << result.seconds * 1e9 / ops
+              << std::setw(15) << ops * deliveries_per_op / result.seconds
+              << std::setprecision(1)
+              << std::setw(10) << bytes / result.seconds / 1e6
+              << std::setw(11) << 100.0 * lock_counters.contended.load() / acquisitions << "%"
+              << std::setprecision(0)
+              << std::setw(14) << lock_counters.wait_ns.load() / ops << "\n";
+}
+
+std::vector<int> sender_counts(int max_senders) {
+    std::vector<int> counts;
+    for (int n = 1; n <= max_senders; n *= 2) counts.push_back(n);
+    return counts;
+}
+
+const std::string PAYLOAD = "The quick brown fox jumps over the lazy dog, benchmarking the chat core";
+
+// -----------------------------------
+// Cases
+// -----------------------------------
+// One group of `size` members; a single sender fans out to all of them
+void bench_group_fanout(SinkPool& sinks, const BenchOptions& options) {
+    for (size_t size = 1; size <= options.max_group_size; size *= 10) {
+        std::vector<int> fds = sinks.acquire(size + 1);
+        if (fds.empty()) {
+            std::cout << "group_msg: skipping size " << size << " and up (open-file limit; raise ulimit -n)\n";
+            break;
+        }
+        GroupManager groups;
+        groups.add_members("bench", "owner", fds);
+        int sender = fds[0];
+
+        sinks.settle();
+        uint64_t before = sinks.bytes_drained();
+        CaseResult result = run_case(1, options.time_ms, [&](int, std::mt19937&) {
+            groups.send_group_message(sender, "owner", "bench", PAYLOAD);
+        });
+        sinks.settle();
+        print_row("group_msg", 1, size, 1, result, size, sinks.bytes_drained() - before);
+        sinks.release();
+    }
+}
+
+// Few vs many small groups, with 1..max_senders threads sending concurrently.
+// Every sender is a member of every group; each message goes to one random group.
+void bench_group_concurrency(SinkPool& sinks, const BenchOptions& options) {
+    constexpr size_t MEMBERS_PER_GROUP = 8;
+    for (size_t group_count : {size_t(4), size_t(4096)}) {
+        for (int senders : sender_counts(options.max_senders)) {
+            std::vector<int> sender_fds = sinks.acquire(senders);
+            std::vector<int> member_fds = sinks.acquire(std::min<size_t>(group_count * MEMBERS_PER_GROUP, 4096));
+            if (sender_fds.empty() || member_fds.empty()) {
+                std::cout << "group_concurrent: not enough descriptors (raise ulimit -n)\n";
+                sinks.release();
+                return;
+            }
+            GroupManager groups(GroupLimits{group_count, 100000, std::chrono::seconds(300)});
+            std::vector<std::string> names;
+            for (size_t g = 0; g < group_count; ++g) {
+                names.push_back("group" + std::to_string(g));
+                std::vector<int> members = sender_fds;
+                for (size_t m = 0; m < MEMBERS_PER_GROUP; ++m) {
+                    members.push_back(member_fds[(g * MEMBERS_PER_GROUP + m) % member_fds.size()]);
+                }
+                groups.add_members(names.back(), "owner", members);
+            }
+            uint64_t recipients = MEMBERS_PER_GROUP + senders - 1;
+
+            sinks.settle();
+            uint64_t before = sinks.bytes_drained();
+            CaseResult result = run_case(senders, options.time_ms, [&](int t, std::mt19937& rng) {
+                groups.send_group_message(sender_fds[t], "sender", names[rng() % group_count], PAYLOAD);
+            });
+            sinks.settle();
+            print_row("group_concurrent", group_count, MEMBERS_PER_GROUP, senders, result, recipients,
+                      sinks.bytes_drained() - before);
+            sinks.release();
+        }
+    }
+}
+
+// Group messages while 0..10000 pattern subscriptions exist (the Groups
+// column): one pattern matches each group, the rest never match. Finding
+// the subscribers walks the group name, so ns/op should not grow with them.
+void bench_subscriptions(SinkPool& sinks, const BenchOptions& options) {
+    constexpr size_t GROUPS = 16, MEMBERS_PER_GROUP = 8, SUBSCRIBERS = 64;
+    for (size_t patterns : {size_t(0), size_t(100), size_t(10000)}) {
+        std::vector<int> fds = sinks.acquire(1 + GROUPS * MEMBERS_PER_GROUP + SUBSCRIBERS);
+        if (fds.empty()) {
+            std::cout << "pattern_fanout: not enough descriptors (raise ulimit -n)\n";
+            return;
+        }
+        GroupLimits limits;
+        limits.max_subscriptions = patterns + GROUPS;
+        GroupManager groups(limits);
+        int sender = fds[0];
+        std::vector<std::string> names;
+        for (size_t g = 0; g < GROUPS; ++g) {
+            names.push_back("room" + std::to_string(g) + ".cpu");
+            std::vector<int> members{sender};
+            members.insert(members.end(), fds.begin() + 1 + g * MEMBERS_PER_GROUP,
+                           fds.begin() + 1 + (g + 1) * MEMBERS_PER_GROUP);
+            groups.add_members(names.back(), "owner", members);
+        }
+        const int* subscribers = fds.data() + 1 + GROUPS * MEMBERS_PER_GROUP;
+        for (size_t p = 0; p < patterns; ++p) {
+            std::string pattern = p < GROUPS ? "room" + std::to_string(p) + ".*" : "zone" + std::to_string(p) + ".*";
+            groups.subscribe(subscribers[p % SUBSCRIBERS], pattern);
+        }
+        uint64_t recipients = MEMBERS_PER_GROUP + (patterns >= GROUPS ? 1 : 0);
+
+        sinks.settle();
+        uint64_t before = sinks.bytes_drained();
+        CaseResult result = run_case(1, options.time_ms, [&](int, std::mt19937& rng) {
+            groups.send_group_message(sender, "owner", names[rng() % GROUPS], PAYLOAD);
+        });
+        sinks.settle();
+        print_row("pattern_fanout", patterns, MEMBERS_PER_GROUP, 1, result, recipients, sinks.bytes_drained() - before);
+        sinks.release();
+    }
+}
+
+// join_group/leave_group churn on few vs many groups
+void bench_group_churn(SinkPool& sinks, const BenchOptions& options) {
+    for (size_t group_count : {size_t(4), size_t(4096)}) {
+        for (int senders : {1, std::min(8, options.max_senders), options.max_senders}) {
+            std::vector<int> fds = sinks.acquire(senders);
+            if (fds.empty()) {
+                std::cout << "join_leave: not enough descriptors (raise ulimit -n)\n";
+                return;
+            }
+            GroupManager groups(GroupLimits{group_count, 100000, std::chrono::seconds(300)});
+            std::vector<std::string> names;
+            for (size_t g = 0; g < group_count; ++g) {
+                names.push_back("group" + std::to_string(g));
+                groups.add_members(names.back(), "owner", {});
+            }
+
+            sinks.settle();
+            uint64_t before = sinks.bytes_drained();
+            CaseResult result = run_case(senders, options.time_ms, [&](int t, std::mt19937& rng) {
+                const std::string& name = names[rng() % group_count];
+                groups.join_group(fds[t], "user", name);
+                groups.leave_group(fds[t], "user", name);
+            });
+            sinks.settle();
+            print_row("join_leave", group_count, 0, senders, result, 0, sinks.bytes_drained() - before);
+            sinks.release();
+        }
+    }
+}
+
+// Broadcast to `size` connected clients, then sender concurrency at a fixed size
+void bench_broadcast(SinkPool& sinks, const BenchOptions& options) {
+    auto run = [&](size_t size, int senders) {
+        std::vector<int> fds = sinks.acquire(size);
+        if (fds.empty()) return false;
+        std::unordered_map<int, std::string> clients;
+        ChatMutex clients_mutex;
+        for (size_t i = 0; i < fds.size(); ++i) clients[fds[i]] = "user" + std::to_string(i);
+        DeliveryLogs logs;
+        BroadcastMessage broadcast(clients, clients_mutex, logs);
+
+        sinks.settle();
+        uint64_t before = sinks.bytes_drained();
+        CaseResult result = run_case(senders, options.time_ms, [&](int t, std::mt19937&) {
+            broadcast.send_broadcast(fds[t % fds.size()], PAYLOAD);
+        });
+        sinks.settle();
+        print_row("broadcast", 0, size, senders, result, size - 1, sinks.bytes_drained() - before);
+        sinks.release();
+        return true;
+    };
+
+    for (size_t size = 10; size <= options.max_group_size; size *= 10) {
+        if (!run(size, 1)) {
+            std::cout << "broadcast: skipping " << size << " clients and up (open-file limit; raise ulimit -n)\n";
+            break;
+        }
+    }
+    for (int senders : sender_counts(options.max_senders)) {
+        if (senders > 1) run(std::max<size_t>(100, senders), senders);
+    }
+}
+
+// A 1 KB broadcast to recipients that all negotiated /compress deflate, next
+// to the same broadcast sent plain: compression costs one deflate() per
+// fan-out and shrinks every copy
+void bench_broadcast_compressed(SinkPool& sinks, const BenchOptions& options) {
+    std::string text;
+    while (text.size() < 1024) text += PAYLOAD + ". ";
+
+    for (size_t size = 10; size <= std::min<size_t>(options.max_group_size, 10000); size *= 10) {
+        for (bool compress : {false, true}) {
+            std::vector<int> fds = sinks.acquire(size);
+            if (fds.empty()) {
+                std::cout << "broadcast_1k: skipping " << size << " clients and up (open-file limit; raise ulimit -n)\n";
+                return;
+            }
+            std::unordered_map<int, std::string> clients;
+            ChatMutex clients_mutex;
+            for (size_t i = 0; i < fds.size(); ++i) {
+                clients[fds[i]] = "user" + std::to_string(i);
+                Transport::set_compression(fds[i], compress);
+            }
+            DeliveryLogs logs;
+            BroadcastMessage broadcast(clients, clients_mutex, logs);
+
+            sinks.settle();
+            uint64_t before = sinks.bytes_drained();
+            CaseResult result = run_case(1, options.time_ms, [&](int, std::mt19937&) {
+                broadcast.send_broadcast(fds[0], text);
+            });
+            sinks.settle();
+            print_row(compress ? "broadcast_1k_z" : "broadcast_1k", 0, size, 1, result, size - 1,
+                      sinks.bytes_drained() - before);
+            for (int fd : fds) Transport::set_compression(fd, false);
+            sinks.release();
+        }
+    }
+}
+
+// Private messages: the recipient lookup scans the client table
+void bench_private(SinkPool& sinks, const BenchOptions& options) {
+    auto run = [&](size_t size, int senders) {
+        std::vector<int> fds = sinks.acquire(size);
+        if (fds.empty()) return false;
+        std::unordered_map<int, std::string> clients;
+        ChatMutex clients_mutex;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            names.push_back("user" + std::to_string(i));
+            clients[fds[i]] = names.back();
+        }
+        DeliveryLogs logs;
+        PrivateMessage private_msg(clients, clients_mutex, logs);
+
+        sinks.settle();
+        uint64_t before = sinks.bytes_drained();
+        CaseResult result = run_case(senders, options.time_ms, [&](int t, std::mt19937& rng) {
+            private_msg.send_private_message(fds[t % fds.size()], names[rng() % names.size()], PAYLOAD);
+        });
+        sinks.settle();
+        print_row("private_msg", 0, size, senders, result, 1, sinks.bytes_drained() - before);
+        sinks.release();
+        return true;
+    };
+
+    for (size_t size = 10; size <= options.max_group_size; size *= 10) {
+        if (!run(size, 1)) {
+            std::cout << "private_msg: skipping " << size << " clients and up (open-file limit; raise ulimit -n)\n";
+            break;
+        }
+    }
+    for (int senders : sender_counts(options.max_senders)) {
+        if (senders > 1) run(1000, senders);
+    }
+}
+
+// Every group size needs a descriptor per member
+void raise_fd_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.time_ms = 100;
+            options.max_group_size = 10000;
+            options.max_senders = 16;
+        } else if (arg == "--time-ms" && i + 1 < argc) {
+            options.time_ms = std::max(10, std::stoi(argv[++i]));
+        } else if (arg == "--max-group-size" && i + 1 < argc) {
+            options.max_group_size = std::stoul(argv[++i]);
+        } else if (arg == "--max-senders" && i + 1 < argc) {
+            options.max_senders = std::max(1, std::stoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--quick] [--time-ms MS] [--max-group-size N] [--max-senders N]\n";
+            return 1;
+        }
+    }
+    raise_fd_limit();
+
+    SinkPool sinks;
+    print_header();
+    bench_group_fanout(sinks, options);
+    bench_group_concurrency(sinks, options);
+    bench_group_churn(sinks, options);
+    bench_subscriptions(sinks, options);
+    bench_broadcast(sinks, options);
+    bench_broadcast_compressed(sinks, options);
+    bench_private(sinks, options);
+    return 0;
+}
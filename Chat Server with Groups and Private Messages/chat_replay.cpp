@@ -0,0 +1,353 @@
+// Replays a capture recorded with `server_grp --capture` against a server.
+//
+// Every captured connection logs in again under the same username (passwords
+// come from --users, or user<i>:pass<i> for build_userdb --generate
+// accounts) and sends its commands at the captured times, scaled by --speed:
+// 1 for real time, 10 for ten times faster, "max" for no pacing at all.
+// /chunk payloads were not captured; the same number of filler bytes is sent.
+//
+// After a replay it prints how closely the schedule was kept (send lag) and
+// the achieved command rate against the original. To compare server-side
+// latency, start the target server with its own --capture and diff the two:
+//
+//   ./server_grp --capture replay.cap &
+//   ./chat_replay --speed 10 original.cap
+//   ./chat_replay --diff original.cap replay.cap
+//
+// Usage: ./chat_replay [--speed 1|10|max] [--users FILE] [--unix PATH] CAPTURE
+//        ./chat_replay --diff ORIGINAL REPLAY
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "capture.hpp"
+#include "common.hpp"
+#include "latency_histogram.hpp"
+#include "transport.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct ReplayOptions {
+    double speed = 1;                 // 0 = as fast as possible
+    std::string users_file = "users.txt";
+    std::string unix_path;            // connect over the Unix socket instead of TCP
+};
+
+// First word of a command line ("/group_msg"), used to group statistics
+std::string command_type(const std::string& line) {
+    return line.substr(0, line.find(' '));
+}
+
+std::unordered_map<std::string, std::string> read_passwords(const std::string& filename) {
+    std::unordered_map<std::string, std::string> passwords;
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t delimiter = line.find(':');
+        if (delimiter == std::string::npos) continue;
+        std::string username = line.substr(0, delimiter);
+        std::string password = line.substr(delimiter + 1);
+        username.erase(username.find_last_not_of(" \n\r\t") + 1);
+        password.erase(password.find_last_not_of(" \n\r\t") + 1);
+        passwords[username] = password;
+    }
+    return passwords;
+}
+
+std::string password_for(const std::unordered_map<std::string, std::string>& passwords, const std::string& username) {
+    auto it = passwords.find(username);
+    if (it != passwords.end()) return it->second;
+    // Accounts made by build_userdb --generate
+    if (username.starts_with("user") && username.size() > 4 &&
+        std::all_of(username.begin() + 4, username.end(), ::isdigit)) {
+        return "pass" + username.substr(4);
+    }
+    return "";
+}
+
+int connect_server(const ReplayOptions& options) {
+    if (!options.unix_path.empty()) return connect_unix(options.unix_path);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(PORT);
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// -----------------------------------
+// Drainer: reads and discards whatever the server sends to replayed clients
+// -----------------------------------
+class Drainer {
+private:
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> auth_failures{0};
+    std::thread thread;
+
+    void run() {
+        std::vector<char> buffer(64 * 1024);
+        epoll_event events[256];
+        while (!stopping.load()) {
+            int n = epoll_wait(epoll_fd, events, 256, 50);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                ssize_t got = recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                if (got > 0) {
+                    bytes += got;
+                    if (std::string_view(buffer.data(), got).find("Authentication failed") != std::string_view::npos) {
+                        ++auth_failures;
+                    }
+                } else if (got == 0) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                }
+            }
+        }
+    }
+
+public:
+    Drainer() : thread(&Drainer::run, this) {}
+
+    ~Drainer() {
+        stopping = true;
+        thread.join();
+        close(epoll_fd);
+    }
+
+    void watch(int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void forget(int fd) { epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr); }
+
+    uint64_t received_bytes() const { return bytes.load(); }
+    uint64_t failed_logins() const { return auth_failures.load(); }
+};
+
+// -----------------------------------
+// Replay
+// -----------------------------------
+int replay(const std::vector<CaptureRecord>& records, const ReplayOptions& options) {
+    auto passwords = read_passwords(options.users_file);
+    std::unordered_map<uint64_t, int> sockets;   // capture connection id -> socket
+    LatencyHistogram lag;
+    uint64_t commands = 0, connect_failures = 0, send_errors = 0, skipped = 0, bad_chunks = 0;
+
+    Drainer drainer;
+    auto send_line = [&](int fd, const std::string& data) {
+        if (send(fd, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t)data.size()) ++send_errors;
+    };
+
+    uint64_t first = records.front().time_ns;
+    uint64_t last = records.back().time_ns;
+    uint64_t captured = std::count_if(records.begin(), records.end(),
+                                      [](const CaptureRecord& r) { return r.kind == CAPTURE_COMMAND; });
+    auto start = Clock::now();
+    for (const CaptureRecord& record : records) {
+        uint64_t offset = record.time_ns - first;
+        auto due = start + std::chrono::nanoseconds(options.speed > 0 ? uint64_t(offset / options.speed) : 0);
+        if (options.speed > 0) std::this_thread::sleep_until(due);
+        auto now = Clock::now();
+        if (options.speed > 0) lag.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count());
+
+        switch (record.kind) {
+            case CAPTURE_CONNECT: {
+                int fd = connect_server(options);
+                if (fd < 0) {
+                    ++connect_failures;
+                    break;
+                }
+                sockets[record.connection] = fd;
+                drainer.watch(fd);
+                // Credentials are pipelined; the server reads them line by line
+                send_line(fd, record.data + "\n" + password_for(passwords, record.data) + "\n");
+                break;
+            }
+            case CAPTURE_COMMAND: {
+                auto it = sockets.find(record.connection);
+                if (it == sockets.end()) {
+                    ++skipped;   // its login is missing from the capture
+                    break;
+                }
+                std::string data = record.data + "\n";
+                if (record.data.starts_with("/chunk ")) {
+                    // Parsed as the server does; a length it would reject has no payload to rebuild
+                    std::istringstream args(record.data.substr(7));
+                    std::string stream_id;
+                    size_t length = 0;
+                    if (!(args >> stream_id >> length) || length > STREAM_CHUNK_MAX) {
+                        ++bad_chunks;
+                        break;
+                    }
+                    data.append(length, '\0');
+                }
+                send_line(it->second, data);
+                ++commands;
+                break;
+            }
+            case CAPTURE_DISCONNECT: {
+                auto it = sockets.find(record.connection);
+                if (it == sockets.end()) break;
+                drainer.forget(it->second);
+                close(it->second);
+                sockets.erase(it);
+                break;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));   // let the last replies arrive
+    for (auto& [id, fd] : sockets) close(fd);
+
+    double original = (last - first) / 1e9;
+    std::ostringstream pace;
+    if (options.speed > 0) pace << options.speed << "x";
+    else pace << "max speed";
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Replayed " << commands << " commands on " << records.size() << " records at " << pace.str() << "\n";
+    std::cout << "  original:  " << original << " s, " << captured / std::max(original, 1e-9) << " commands/s\n";
+    std::cout << "  replay:    " << elapsed << " s, " << commands / std::max(elapsed, 1e-9) << " commands/s";
+    if (options.speed > 0 && original > 0) {
+        std::cout << " (" << 100.0 * (original / options.speed) / std::max(elapsed, 1e-9) << "% of target rate)";
+    }
+    std::cout << "\n";
+    if (options.speed > 0) {
+        std::cout << "  send lag:  p50 " << lag.value_at_percentile(50) / 1e3 << " us, p99 "
+                  << lag.value_at_percentile(99) / 1e3 << " us, max " << lag.max() / 1e3 << " us\n";
+    }
+    std::cout << "  received:  " << drainer.received_bytes() << " bytes\n";
+    std::cout << "  errors:    " << connect_failures << " connect, " << drainer.failed_logins() << " login, "
+              << send_errors << " send, " << skipped << " commands without a captured login, "
+              << bad_chunks << " malformed /chunk lines skipped\n";
+    return 0;
+}
+
+// -----------------------------------
+// Diff: server-side service time and throughput of two captures
+// -----------------------------------
+struct CaptureSummary {
+    std::map<std::string, LatencyHistogram> service;   // by command type
+    LatencyHistogram all;
+    uint64_t commands = 0;
+    double seconds = 0;
+
+    explicit CaptureSummary(const std::vector<CaptureRecord>& records) {
+        uint64_t first = UINT64_MAX, last = 0;
+        for (const CaptureRecord& record : records) {
+            if (record.kind != CAPTURE_COMMAND) continue;
+            service[command_type(record.data)].record(record.service_ns);
+            all.record(record.service_ns);
+            first = std::min(first, record.time_ns);
+            last = std::max(last, record.time_ns);
+            ++commands;
+        }
+        seconds = commands > 1 ? (last - first) / 1e9 : 0;
+    }
+
+    double rate() const { return seconds > 0 ? commands / seconds : 0; }
+};
+
+void print_drift(const std::string& name, const LatencyHistogram& a, const LatencyHistogram& b) {
+    auto drift = [](double before, double after) {
+        return before > 0 ? 100.0 * (after - before) / before : 0.0;
+    };
+    std::cout << std::left << std::setw(18) << name << std::right
+              << std::setw(10) << a.count() << std::setw(10) << b.count();
+    for (double p : {50.0, 99.0}) {
+        double before = a.value_at_percentile(p) / 1e3, after = b.value_at_percentile(p) / 1e3;
+        std::cout << std::setw(11) << before << std::setw(11) << after
+                  << std::setw(8) << std::showpos << drift(before, after) << "%" << std::noshowpos;
+    }
+    std::cout << "\n";
+}
+
+int diff(const std::vector<CaptureRecord>& original, const std::vector<CaptureRecord>& replayed) {
+    CaptureSummary a(original), b(replayed);
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Throughput: original " << a.rate() << " commands/s over " << a.seconds << " s, replay "
+              << b.rate() << " commands/s over " << b.seconds << " s (x" << std::setprecision(2)
+              << (a.rate() > 0 ? b.rate() / a.rate() : 0.0) << ")\n" << std::setprecision(1);
+    std::cout << "Service time (us, from reading a command to finishing its handler):\n";
+    std::cout << std::left << std::setw(18) << "Command" << std::right
+              << std::setw(10) << "orig" << std::setw(10) << "replay"
+              << std::setw(11) << "p50 orig" << std::setw(11) << "p50 rep" << std::setw(9) << "drift"
+              << std::setw(11) << "p99 orig" << std::setw(11) << "p99 rep" << std::setw(9) << "drift" << "\n";
+    for (const auto& [type, histogram] : a.service) {
+        auto it = b.service.find(type);
+        print_drift(type, histogram, it != b.service.end() ? it->second : LatencyHistogram());
+    }
+    for (const auto& [type, histogram] : b.service) {
+        if (!a.service.count(type)) print_drift(type, LatencyHistogram(), histogram);
+    }
+    print_drift("all", a.all, b.all);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    ReplayOptions options;
+    std::vector<std::string> paths;
+    bool diff_mode = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--speed" && i + 1 < argc) {
+            std::string speed = argv[++i];
+            options.speed = speed == "max" ? 0 : std::max(0.001, std::stod(speed));
+        } else if (arg == "--users" && i + 1 < argc) {
+            options.users_file = argv[++i];
+        } else if (arg == "--unix" && i + 1 < argc) {
+            options.unix_path = argv[++i];
+        } else if (arg == "--diff") {
+            diff_mode = true;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != (diff_mode ? 2u : 1u)) {
+        std::cerr << "Usage: " << argv[0] << " [--speed 1|10|max] [--users FILE] [--unix PATH] CAPTURE\n"
+                  << "       " << argv[0] << " --diff ORIGINAL REPLAY\n";
+        return 1;
+    }
+
+    std::vector<std::vector<CaptureRecord>> captures(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::string error;
+        if (!read_capture(paths[i], captures[i], error)) {
+            std::cerr << "[Error] " << error << "\n";
+            return 1;
+        }
+    }
+    if (diff_mode) return diff(captures[0], captures[1]);
+    if (captures[0].empty()) {
+        std::cerr << "[Error] " << paths[0] << " holds no records.\n";
+        return 1;
+    }
+
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return replay(captures[0], options);
+}
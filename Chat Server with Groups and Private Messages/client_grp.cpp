@@ -8,50 +8,554 @@
 #include <unordered_set>
 #include <vector>
 #include <sstream>
+#include <fstream>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <arpa/inet.h>
 
-#define BUFFER_SIZE 1024
+#include "common.hpp"
+#include "compression.hpp"
+#include "transport.hpp"
 
 std::mutex cout_mutex;
 
+// Flow-control state of our outgoing transfers, updated by the receive thread.
+// A stream id missing from the map means the server aborted that transfer.
+std::mutex streams_mutex;
+std::condition_variable streams_cv;
+std::unordered_map<std::string, uint64_t> stream_acked;   // stream id -> bytes acknowledged
+
+// Incoming transfers, saved as stream_<id>_<name> in the working directory
+std::unordered_map<std::string, std::ofstream> incoming_streams;
+
+// Sender side: "[Upload <id>] ack <bytes>|complete|aborted" for our own transfers.
+// Returns true if the line should not be printed.
+bool handle_upload_status(const std::string& line) {
+    std::istringstream fields(line.substr(8));
+    std::string stream_id, event;
+    fields >> stream_id >> event;
+    if (stream_id.empty() || stream_id.back() != ']') return false;
+    stream_id.pop_back();
+
+    std::lock_guard<std::mutex> lock(streams_mutex);
+    if (event == "ack") {
+        uint64_t acked = 0;
+        fields >> acked;
+        if (stream_acked.count(stream_id)) stream_acked[stream_id] = acked;
+        streams_cv.notify_all();
+        return true;
+    }
+    stream_acked.erase(stream_id);
+    streams_cv.notify_all();
+    return false;
+}
+
+// Recipient side: "[Stream <id>] end|aborted" closes the output file
+void handle_stream_status(const std::string& line) {
+    std::istringstream fields(line.substr(8));
+    std::string stream_id, event;
+    fields >> stream_id >> event;
+    if (stream_id.empty() || stream_id.back() != ']') return;
+    stream_id.pop_back();
+    incoming_streams.erase(stream_id);
+}
+
+// "[Stream <id> from <user> to <target>] begin <size> <name>": open the output file
+void handle_stream_begin(const std::string& line) {
+    std::istringstream fields(line.substr(8));
+    std::string stream_id, name;
+    fields >> stream_id;
+    size_t marker = line.find("] begin ");
+    if (marker == std::string::npos) return;
+    std::istringstream tail(line.substr(marker + 8));
+    uint64_t size = 0;
+    tail >> size;
+    std::getline(tail >> std::ws, name);
+
+    // Never let the sender pick a path outside the working directory
+    name = name.substr(name.find_last_of('/') + 1);
+    if (name.empty()) name = "data";
+    incoming_streams[stream_id].open("stream_" + stream_id + "_" + name, std::ios::binary);
+}
+
+// "[Deflate <length> <original length>]" announces a compressed message
+bool parse_deflate_header(const std::string& line, size_t& length, size_t& original) {
+    std::istringstream fields(line.substr(9));
+    return static_cast<bool>(fields >> length >> original);
+}
+
 void handle_server_messages(int server_socket) {
-    char buffer[BUFFER_SIZE];
+    LineReader reader(server_socket);
+    std::string line, payload;
     while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_received = recv(server_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0) {
+        if (!reader.read_line(line)) {
             std::lock_guard<std::mutex> lock(cout_mutex);
             std::cout << "Disconnected from server." << std::endl;
-            close(server_socket);
+            Transport::close(server_socket);
             exit(0);
         }
+
+        // "[Chunk <id> <length>]" is followed by exactly <length> raw bytes
+        if (line.starts_with("[Chunk ")) {
+            std::istringstream fields(line.substr(7));
+            std::string stream_id;
+            size_t length = 0;
+            fields >> stream_id >> length;
+            if (!reader.read_bytes(length, payload)) continue;
+            auto it = incoming_streams.find(stream_id);
+            if (it != incoming_streams.end()) it->second.write(payload.data(), payload.size());
+            continue;
+        }
+        // Compressed chat messages: print the lines they inflate to
+        if (line.starts_with(DEFLATE_FRAME_PREFIX)) {
+            size_t length = 0, original = 0;
+            std::string text;
+            if (!parse_deflate_header(line, length, original) || !reader.read_bytes(length, payload)) continue;
+            std::lock_guard<std::mutex> lock(cout_mutex);
+            if (!inflate_frame(payload, original, text)) {
+                std::cout << "[Error] Cannot decompress a message from the server." << std::endl;
+                continue;
+            }
+            if (!text.empty() && text.back() == '\n') text.pop_back();
+            std::cout << text << std::endl;
+            continue;
+        }
+        if (line.starts_with("[Upload ") && handle_upload_status(line)) continue;
+        if (line.starts_with("[Stream ")) {
+            if (line.find("] begin ") != std::string::npos) handle_stream_begin(line);
+            else handle_stream_status(line);
+        }
+
         std::lock_guard<std::mutex> lock(cout_mutex);
-        std::cout << buffer << std::endl;
+        std::cout << line << std::endl;
+    }
+}
+
+// /send_file <group_name|@username> <path>: stream a file in chunks, keeping at
+// most STREAM_WINDOW bytes unacknowledged. Runs on its own thread so the user
+// can keep chatting during the transfer.
+void send_file(int server_socket, const std::string& target, const std::string& path) {
+    static std::atomic<int> next_stream{1};
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        std::cout << "Cannot open " << path << "." << std::endl;
+        return;
+    }
+    uint64_t size = file.tellg();
+    file.seekg(0);
+
+    std::string stream_id = std::to_string(next_stream++);
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex);
+        stream_acked[stream_id] = 0;
+    }
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    send_message(server_socket, "/stream_begin " + stream_id + " " + target + " "
+                                + std::to_string(size) + " " + name + "\n");
+
+    std::vector<char> chunk(STREAM_CHUNK_MAX);
+    uint64_t sent = 0;
+    while (sent < size) {
+        {
+            std::unique_lock<std::mutex> lock(streams_mutex);
+            streams_cv.wait(lock, [&] {
+                auto it = stream_acked.find(stream_id);
+                return it == stream_acked.end() || sent - it->second + STREAM_CHUNK_MAX <= STREAM_WINDOW;
+            });
+            if (!stream_acked.count(stream_id)) return;   // rejected or aborted by the server
+        }
+        size_t length = file.read(chunk.data(), chunk.size()).gcount();
+        if (length == 0) break;
+
+        std::string frame = "/chunk " + stream_id + " " + std::to_string(length) + "\n";
+        frame.append(chunk.data(), length);
+        send_message(server_socket, frame);
+        sent += length;
     }
 }
 
-int main() {
+int connect_tcp() {
     int client_socket;
     sockaddr_in server_address{};
 
     client_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (client_socket < 0) {
         std::cerr << "Error creating socket." << std::endl;
-        return 1;
+        return -1;
     }
 
     server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(12345);
+    server_address.sin_port = htons(PORT);
     server_address.sin_addr.s_addr = inet_addr("127.0.0.1");
 
     if (connect(client_socket, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
         std::cerr << "Error connecting to server." << std::endl;
+        close(client_socket);
+        return -1;
+    }
+    return client_socket;
+}
+
+// -----------------------------------
+// Scripted mode (--script FILE|-)
+// -----------------------------------
+// One thread multiplexes the script and a non-blocking server socket with
+// poll(). Commands are pipelined as soon as they are read instead of one per
+// round trip, server output is framed into lines in a receive buffer, and
+// everything printed during one wakeup goes to stdout in a single write().
+
+constexpr size_t SCRIPT_OUTBOUND_MAX = 1 << 20;   // stop reading the script above this much unsent data
+constexpr size_t SCRIPT_READ_SIZE = 64 * 1024;
+
+const std::string USERNAME_PROMPT = "Enter username: ";
+const std::string PASSWORD_PROMPT = "Enter password: ";
+
+struct ScriptTransfer {
+    std::string stream_id;
+    std::ifstream file;
+    uint64_t size = 0;
+    uint64_t sent = 0;
+};
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+void write_stdout(std::string& output) {
+    size_t written = 0;
+    while (written < output.size()) {
+        ssize_t n = write(STDOUT_FILENO, output.data() + written, output.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    output.clear();
+}
+
+// Returns the exit status: 0 once the server closes a logged-in session
+int run_script(int server_socket, int script_fd, const std::string& username, const std::string& password,
+               bool compress) {
+    set_nonblocking(server_socket);
+    if (script_fd != STDIN_FILENO || isatty(script_fd) == 0) set_nonblocking(script_fd);
+
+    std::string outbound, inbound, script, output;
+    size_t outbound_sent = 0;
+    std::vector<ScriptTransfer> transfers;
+    int next_stream = 1;
+
+    // Credentials from the command line go first; otherwise they are the
+    // script's first two lines, which are sent without interpretation
+    int credential_lines = 2;
+    if (!username.empty()) {
+        outbound = username + "\n" + password + "\n";
+        credential_lines = 0;
+        if (compress) outbound += "/compress deflate\n";
+    }
+    int prompts_left = 2;
+    bool authenticated = false;
+    bool script_done = false, write_closed = false;
+
+    // Raw bytes still owed to the current "[Chunk <id> <length>]"
+    std::string chunk_stream;
+    size_t chunk_remaining = 0;
+
+    auto queue_file = [&](const std::string& args) {
+        // /send_file <group_name|@username> <path>
+        std::istringstream fields(args);
+        std::string target, path;
+        fields >> target;
+        std::getline(fields >> std::ws, path);
+
+        ScriptTransfer transfer;
+        transfer.file.open(path, std::ios::binary | std::ios::ate);
+        if (!transfer.file) {
+            output += "Cannot open " + path + ".\n";
+            return;
+        }
+        transfer.size = transfer.file.tellg();
+        transfer.file.seekg(0);
+        transfer.stream_id = std::to_string(next_stream++);
+        {
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            stream_acked[transfer.stream_id] = 0;
+        }
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        outbound += "/stream_begin " + transfer.stream_id + " " + target + " "
+                    + std::to_string(transfer.size) + " " + name + "\n";
+        transfers.push_back(std::move(transfer));
+    };
+
+    // Same window as send_file(), but filled from the event loop
+    auto pump_transfers = [&] {
+        std::vector<char> chunk(STREAM_CHUNK_MAX);
+        for (size_t i = 0; i < transfers.size();) {
+            ScriptTransfer& transfer = transfers[i];
+            uint64_t acked = 0;
+            bool alive;
+            {
+                std::lock_guard<std::mutex> lock(streams_mutex);
+                auto it = stream_acked.find(transfer.stream_id);
+                alive = it != stream_acked.end();
+                if (alive) acked = it->second;
+            }
+            while (alive && transfer.sent < transfer.size && outbound.size() - outbound_sent < SCRIPT_OUTBOUND_MAX &&
+                   transfer.sent - acked + STREAM_CHUNK_MAX <= STREAM_WINDOW) {
+                size_t length = transfer.file.read(chunk.data(), chunk.size()).gcount();
+                if (length == 0) break;
+                outbound += "/chunk " + transfer.stream_id + " " + std::to_string(length) + "\n";
+                outbound.append(chunk.data(), length);
+                transfer.sent += length;
+            }
+            if (!alive || transfer.sent >= transfer.size || !transfer.file) {
+                transfers.erase(transfers.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+    };
+
+    auto handle_script_line = [&](std::string line) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (credential_lines > 0) {
+            --credential_lines;
+            outbound += line + "\n";
+            if (credential_lines == 0 && compress) outbound += "/compress deflate\n";
+            return;
+        }
+        if (line.empty()) return;
+        if (line.starts_with("/send_file ")) {
+            queue_file(line.substr(11));
+            return;
+        }
+        outbound += line + "\n";
+        if (line == "/exit") script_done = true;
+    };
+
+    auto handle_line = [&](const std::string& line) {
+        if (line.starts_with("[Upload ") && handle_upload_status(line)) return;
+        if (line.starts_with("[Stream ")) {
+            if (line.find("] begin ") != std::string::npos) handle_stream_begin(line);
+            else handle_stream_status(line);
+        }
+        if (!authenticated && line.starts_with("Authentication successful")) authenticated = true;
+        output += line;
+        output += '\n';
+    };
+
+    // Frames everything buffered from the server; returns false on a bad frame
+    auto handle_inbound = [&] {
+        size_t pos = 0;
+        while (pos < inbound.size()) {
+            if (chunk_remaining > 0) {
+                size_t length = std::min(chunk_remaining, inbound.size() - pos);
+                auto it = incoming_streams.find(chunk_stream);
+                if (it != incoming_streams.end()) it->second.write(inbound.data() + pos, length);
+                pos += length;
+                chunk_remaining -= length;
+                continue;
+            }
+
+            // The login prompts are the only output without a trailing newline
+            if (prompts_left > 0) {
+                const std::string& prompt = prompts_left == 2 ? USERNAME_PROMPT : PASSWORD_PROMPT;
+                size_t available = std::min(prompt.size(), inbound.size() - pos);
+                if (inbound.compare(pos, available, prompt, 0, available) == 0) {
+                    if (available < prompt.size()) break;
+                    pos += prompt.size();
+                    --prompts_left;
+                    continue;
+                }
+            }
+
+            size_t newline = inbound.find('\n', pos);
+            if (newline == std::string::npos) {
+                if (inbound.size() - pos > MAX_LINE_LENGTH) return false;
+                break;
+            }
+            std::string line = inbound.substr(pos, newline - pos);
+
+            if (line.starts_with("[Chunk ")) {
+                pos = newline + 1;
+                std::istringstream fields(line.substr(7));
+                fields >> chunk_stream >> chunk_remaining;
+                continue;
+            }
+            if (line.starts_with(DEFLATE_FRAME_PREFIX)) {
+                // Wait for the whole body; the frame stays buffered until then
+                size_t length = 0, original = 0;
+                std::string text;
+                if (!parse_deflate_header(line, length, original)) return false;
+                if (inbound.size() - (newline + 1) < length) break;
+                if (!inflate_frame(inbound.substr(newline + 1, length), original, text)) return false;
+                pos = newline + 1 + length;
+                size_t start = 0, end;
+                while ((end = text.find('\n', start)) != std::string::npos) {
+                    handle_line(text.substr(start, end - start));
+                    start = end + 1;
+                }
+                continue;
+            }
+            pos = newline + 1;
+            handle_line(line);
+        }
+        inbound.erase(0, pos);
+        return true;
+    };
+
+    std::vector<char> buffer(SCRIPT_READ_SIZE);
+    while (true) {
+        pump_transfers();
+
+        // Half-close once everything is sent, so the server ends the session
+        // after answering the last command
+        if (script_done && transfers.empty() && outbound_sent == outbound.size() && !write_closed) {
+            shutdown(server_socket, SHUT_WR);
+            write_closed = true;
+        }
+
+        pollfd fds[2];
+        fds[0] = {server_socket, POLLIN, 0};
+        if (outbound_sent < outbound.size()) fds[0].events |= POLLOUT;
+        bool read_script = !script_done && outbound.size() - outbound_sent < SCRIPT_OUTBOUND_MAX;
+        fds[1] = {read_script ? script_fd : -1, POLLIN, 0};
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(script_fd, buffer.data(), buffer.size());
+            if (n > 0) {
+                script.append(buffer.data(), n);
+                size_t pos = 0, newline;
+                while (!script_done && (newline = script.find('\n', pos)) != std::string::npos) {
+                    handle_script_line(script.substr(pos, newline - pos));
+                    pos = newline + 1;
+                }
+                script.erase(0, pos);
+            } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                if (!script_done && !script.empty()) handle_script_line(script);
+                script_done = true;
+            }
+        }
+
+        if (fds[0].revents & POLLOUT) {
+            ssize_t n = ::send(server_socket, outbound.data() + outbound_sent, outbound.size() - outbound_sent,
+                               MSG_NOSIGNAL);
+            if (n > 0) outbound_sent += n;
+            if (outbound_sent == outbound.size() || outbound_sent > SCRIPT_OUTBOUND_MAX) {
+                outbound.erase(0, outbound_sent);
+                outbound_sent = 0;
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            bool connected = true;
+            while (true) {
+                ssize_t n = ::recv(server_socket, buffer.data(), buffer.size(), 0);
+                if (n > 0) {
+                    inbound.append(buffer.data(), n);
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) connected = false;
+                break;
+            }
+            if (!handle_inbound()) connected = false;
+            if (!connected) {
+                if (!inbound.empty() && chunk_remaining == 0 && !inbound.starts_with(DEFLATE_FRAME_PREFIX)) {
+                    output += inbound + "\n";
+                }
+                output += "Disconnected from server.\n";
+                write_stdout(output);
+                close(server_socket);
+                return authenticated ? 0 : 1;
+            }
+        }
+
+        write_stdout(output);
+    }
+
+    close(server_socket);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    // Transport selection: TCP by default, or --unix [path] / --shm for co-located clients
+    // --script FILE|- runs commands non-interactively (see run_script)
+    // --compress asks for deflate-compressed chat messages (compression.hpp)
+    std::string unix_path, script_path, script_user, script_password;
+    bool use_shm = false, compress = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--unix") {
+            unix_path = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : UNIX_SOCKET_PATH;
+        } else if (arg == "--shm") {
+            use_shm = true;
+            if (unix_path.empty()) unix_path = UNIX_SOCKET_PATH;
+        } else if (arg == "--script" && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (arg == "--user" && i + 1 < argc) {
+            script_user = argv[++i];
+        } else if (arg == "--password" && i + 1 < argc) {
+            script_password = argv[++i];
+        } else if (arg == "--compress") {
+            compress = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--unix [PATH]] [--shm] [--compress]"
+                      << " [--script FILE|- [--user NAME --password PASSWORD]]" << std::endl;
+            return 1;
+        }
+    }
+    if (!script_path.empty() && use_shm) {
+        std::cerr << "--script uses a socket transport; it cannot be combined with --shm." << std::endl;
+        return 1;
+    }
+    if (script_path.empty() && !(script_user.empty() && script_password.empty())) {
+        std::cerr << "--user and --password are only used with --script." << std::endl;
         return 1;
     }
 
+    int script_fd = STDIN_FILENO;
+    if (!script_path.empty() && script_path != "-") {
+        script_fd = open(script_path.c_str(), O_RDONLY);
+        if (script_fd < 0) {
+            std::cerr << "Cannot open " << script_path << "." << std::endl;
+            return 1;
+        }
+    }
+
+    int client_socket;
+    if (unix_path.empty()) {
+        client_socket = connect_tcp();
+    } else {
+        client_socket = connect_unix(unix_path);
+        if (client_socket < 0) {
+            std::cerr << "Error connecting to " << unix_path << "." << std::endl;
+        }
+    }
+    if (client_socket < 0) {
+        return 1;
+    }
+
+    if (use_shm && !upgrade_to_shm(client_socket)) {
+        std::cerr << "Error setting up the shared-memory transport." << std::endl;
+        close(client_socket);
+        return 1;
+    }
+
+    if (!script_path.empty()) {
+        return run_script(client_socket, script_fd, script_user, script_password, compress);
+    }
+
     std::cout << "Connected to the server." << std::endl;
 
     // Authentication
@@ -59,29 +563,32 @@ int main() {
     char buffer[BUFFER_SIZE];
 
     memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the user name" for the server
+    Transport::recv(client_socket, buffer, BUFFER_SIZE - 1); // Receive the message "Enter the user name" for the server
     // You should have a line like this in the server.cpp code: send_message(client_socket, "Enter username: ");
  
     std::cout << buffer;
     std::getline(std::cin, username);
-    send(client_socket, username.c_str(), username.size(), 0);
+    send_message(client_socket, username + "\n");
 
     memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the password" for the server
+    Transport::recv(client_socket, buffer, BUFFER_SIZE - 1); // Receive the message "Enter the password" for the server
     std::cout << buffer;
     std::getline(std::cin, password);
-    send(client_socket, password.c_str(), password.size(), 0);
+    send_message(client_socket, password + "\n");
 
     memset(buffer, 0, BUFFER_SIZE);
     // Depending on whether the authentication passes or not, receive the message "Authentication Failed" or "Welcome to the server"
-    recv(client_socket, buffer, BUFFER_SIZE, 0); 
+    Transport::recv(client_socket, buffer, BUFFER_SIZE - 1); 
     std::cout << buffer << std::endl;
 
     if (std::string(buffer).find("Authentication failed") != std::string::npos) {
-        close(client_socket);
+        Transport::close(client_socket);
         return 1;
     }
 
+    // Ask for compressed chat messages; the reply comes through the receive thread
+    if (compress) send_message(client_socket, "/compress deflate\n");
+
     // Start thread for receiving messages from server
     std::thread receive_thread(handle_server_messages, client_socket);
     // We use detach because we want this thread to run in the background while the main thread continues running
@@ -94,10 +601,21 @@ int main() {
 
         if (message.empty()) continue;
 
-        send(client_socket, message.c_str(), message.size(), 0);
+        if (message.starts_with("/send_file ")) {
+            // /send_file <group_name|@username> <path>
+            std::istringstream args(message.substr(11));
+            std::string target, path;
+            args >> target;
+            std::getline(args >> std::ws, path);
+            std::thread(send_file, client_socket, target, path).detach();
+            continue;
+        }
+
+        // Commands are newline-terminated so the server can frame them
+        send_message(client_socket, message + "\n");
 
         if (message == "/exit") {
-            close(client_socket);
+            Transport::close(client_socket);
             break;
         }
     }
@@ -18,4 +18,18 @@
 constexpr int PORT = 12345;
 constexpr int BUFFER_SIZE = 1024;
 
+// Commands are newline-terminated; longer lines are truncated by the server.
+constexpr size_t MAX_LINE_LENGTH = 64 * 1024;
+
+// Local transports for clients running on the same host as the server
+constexpr const char* UNIX_SOCKET_PATH = "/tmp/chat_server.sock";
+constexpr size_t SHM_RING_CAPACITY = 1 << 20;   // bytes per direction
+
+// Chunked streaming of large or binary payloads (/stream_begin, /chunk)
+constexpr size_t STREAM_CHUNK_MAX = 16 * 1024;          // payload bytes per chunk
+constexpr size_t STREAM_WINDOW = 256 * 1024;            // unacknowledged bytes per transfer
+constexpr size_t STREAM_MAX_SIZE = 64 * 1024 * 1024;    // bytes per transfer
+constexpr size_t STREAM_MAX_ACTIVE = 8;                 // concurrent transfers per connection
+constexpr size_t STREAM_RECIPIENT_BUFFER = 1024 * 1024;  // bytes queued per recipient before it is dropped
+
 #endif // COMMON_HPP
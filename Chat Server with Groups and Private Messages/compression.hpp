@@ -0,0 +1,177 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+// Per-message compression, negotiated after login with "/compress deflate".
+//
+// A compressed message is sent as
+//
+//   [Deflate <length> <original length>]\n
+//   <length> bytes of raw deflate (RFC 1951) data
+//
+// which inflates to one or more complete, newline-terminated lines. Each
+// message is compressed on its own against DEFLATE_DICTIONARY, a preset
+// dictionary both sides share, so there is no per-connection stream state:
+// one compressed copy serves every recipient of a fan-out. Messages shorter
+// than the server's --compress-min (or that would not shrink) go out as plain
+// lines, and so does everything that is not a chat message.
+
+#include "transport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+constexpr size_t COMPRESS_MIN_SIZE = 256;   // default --compress-min, in bytes
+constexpr int COMPRESS_LEVEL = 6;
+constexpr const char* DEFLATE_FRAME_PREFIX = "[Deflate ";
+
+// The server's own fixed strings, and common English after them: deflate
+// prefers the nearest match, so the most frequent strings go last.
+// Changing this breaks compatibility with existing clients.
+constexpr char DEFLATE_DICTIONARY[] =
+    "that with have this will your from they know want been good much some time very when come here "
+    "just like long make many more only over such take than them well were what would there their "
+    "about could other which people should think because before after again please thanks meeting "
+    "tomorrow today everyone anyone message group https://www. .com the and for you are not but "
+    " has joined the chat.\n has left the chat.\n joined the group  left the group "
+    "[Private #1 from [Broadcast #1 from ]: \n[Group ";
+
+// Counters reported by /stats
+struct CompressionStats {
+    std::atomic<uint64_t> messages{0};       // payloads compressed
+    std::atomic<uint64_t> skipped{0};        // sent plain: too short, or would not shrink
+    std::atomic<uint64_t> input_bytes{0};
+    std::atomic<uint64_t> output_bytes{0};
+    std::atomic<uint64_t> compress_ns{0};    // time spent in deflate()
+    std::atomic<uint64_t> deliveries{0};     // compressed copies sent
+    std::atomic<uint64_t> saved_bytes{0};    // egress saved over all deliveries
+};
+
+// -----------------------------------
+// Compression: deflate state and per-connection negotiation
+// -----------------------------------
+class Compression {
+private:
+    // A deflate stream costs ~270 KB, so streams are pooled rather than
+    // kept per connection thread; fan-outs hold a lock while they compress,
+    // so few are ever in use at once
+    struct Deflater {
+        z_stream stream{};
+        Deflater() { deflateInit2(&stream, COMPRESS_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY); }
+        ~Deflater() { deflateEnd(&stream); }
+    };
+
+    inline static std::mutex pool_mutex;
+    inline static std::vector<std::unique_ptr<Deflater>> pool;
+    inline static std::atomic<size_t> min_size{COMPRESS_MIN_SIZE};
+
+public:
+    inline static CompressionStats stats;
+
+    static void set_min_size(size_t bytes) { min_size = bytes; }
+    static size_t threshold() { return min_size.load(std::memory_order_relaxed); }
+
+    // Compresses `message` into a complete frame; false if it would not shrink
+    static bool deflate_frame(const std::string& message, std::string& frame) {
+        std::unique_ptr<Deflater> deflater;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (!pool.empty()) {
+                deflater = std::move(pool.back());
+                pool.pop_back();
+            }
+        }
+        if (!deflater) deflater = std::make_unique<Deflater>();
+
+        auto start = std::chrono::steady_clock::now();
+        z_stream& stream = deflater->stream;
+        deflateReset(&stream);
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(DEFLATE_DICTIONARY),
+                             sizeof(DEFLATE_DICTIONARY) - 1);
+        std::string body(deflateBound(&stream, message.size()), '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(message.data()));
+        stream.avail_in = message.size();
+        stream.next_out = reinterpret_cast<Bytef*>(body.data());
+        stream.avail_out = body.size();
+        bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+        body.resize(body.size() - stream.avail_out);
+        stats.compress_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            pool.push_back(std::move(deflater));
+        }
+
+        frame = std::string(DEFLATE_FRAME_PREFIX) + std::to_string(body.size()) + " "
+              + std::to_string(message.size()) + "]\n";
+        if (!ok || frame.size() + body.size() >= message.size()) {
+            frame.clear();
+            stats.skipped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        frame += body;
+        stats.messages.fetch_add(1, std::memory_order_relaxed);
+        stats.input_bytes.fetch_add(message.size(), std::memory_order_relaxed);
+        stats.output_bytes.fetch_add(frame.size(), std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// Inflates a frame body back into the lines it carries; false if corrupt
+inline bool inflate_frame(const std::string& body, size_t original_size, std::string& out) {
+    if (original_size > STREAM_MAX_SIZE) return false;
+    z_stream stream{};
+    if (inflateInit2(&stream, -15) != Z_OK) return false;
+    inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(DEFLATE_DICTIONARY), sizeof(DEFLATE_DICTIONARY) - 1);
+    out.assign(original_size, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+    stream.avail_in = body.size();
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = out.size();
+    bool ok = inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.avail_out == 0;
+    inflateEnd(&stream);
+    return ok;
+}
+
+// -----------------------------------
+// Outgoing: one message on its way to one or many recipients. It is
+// compressed at most once, when the first recipient that negotiated
+// compression is reached, and that copy is reused for the rest.
+// -----------------------------------
+class Outgoing {
+private:
+    const std::string& message;
+    std::string frame;
+    enum { UNTRIED, COMPRESSED, PLAIN } state = UNTRIED;
+
+public:
+    explicit Outgoing(const std::string& message) : message(message) {}
+
+    void send(int fd) {
+        if (!Transport::compresses(fd)) {
+            send_message(fd, message);
+            return;
+        }
+        if (state == UNTRIED) {
+            if (message.size() < Compression::threshold()) {
+                Compression::stats.skipped.fetch_add(1, std::memory_order_relaxed);
+                state = PLAIN;
+            } else {
+                state = Compression::deflate_frame(message, frame) ? COMPRESSED : PLAIN;
+            }
+        }
+        if (state == PLAIN) {
+            send_message(fd, message);
+            return;
+        }
+        send_message(fd, frame);
+        Compression::stats.deliveries.fetch_add(1, std::memory_order_relaxed);
+        Compression::stats.saved_bytes.fetch_add(message.size() - frame.size(), std::memory_order_relaxed);
+    }
+};
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,240 @@
+#ifndef CREDENTIAL_STORE_HPP
+#define CREDENTIAL_STORE_HPP
+
+// Compact, memory-mapped credential store (users.db).
+//
+// Built offline from users.txt by build_userdb. The file holds fixed-size
+// records sorted by a 64-bit hash of the username, followed by a blob with
+// the usernames themselves. Passwords are stored as salted
+// PBKDF2-HMAC-SHA256 digests, never in plaintext.
+//
+// Opening the store only maps the file and checks the header, so startup
+// cost does not depend on the number of accounts; pages are faulted in by the
+// lookups that touch them. Layout is native-endian.
+//
+//   StoreHeader | UserRecord[count] (sorted by name_hash, then name) | names
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+constexpr char USERDB_MAGIC[8] = {'C', 'H', 'A', 'T', 'U', 'D', 'B', '1'};
+constexpr uint32_t USERDB_VERSION = 1;
+constexpr uint32_t USERDB_DEFAULT_ITERATIONS = 10000;
+constexpr size_t USERDB_SALT_SIZE = 16;
+constexpr size_t USERDB_HASH_SIZE = 32;
+
+struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t iterations;      // PBKDF2 rounds used for every record
+    uint64_t count;           // number of UserRecords
+    uint64_t names_size;      // bytes in the name blob after the records
+};
+
+struct UserRecord {
+    uint64_t name_hash;
+    uint32_t name_offset;     // into the name blob
+    uint16_t name_length;
+    uint16_t reserved;
+    uint8_t salt[USERDB_SALT_SIZE];
+    uint8_t password_hash[USERDB_HASH_SIZE];
+};
+static_assert(sizeof(StoreHeader) == 32, "StoreHeader layout is part of the file format");
+static_assert(sizeof(UserRecord) == 64, "UserRecord layout is part of the file format");
+
+// FNV-1a, 64-bit
+inline uint64_t username_hash(std::string_view name) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline bool derive_password_hash(const std::string& password, const uint8_t* salt, uint32_t iterations,
+                                 uint8_t* out) {
+    return PKCS5_PBKDF2_HMAC(password.data(), password.size(), salt, USERDB_SALT_SIZE, iterations,
+                             EVP_sha256(), USERDB_HASH_SIZE, out) == 1;
+}
+
+// -----------------------------------
+// CredentialStore: read-only view of a mapped users.db
+// -----------------------------------
+class CredentialStore {
+private:
+    void* base = nullptr;
+    size_t mapped_size = 0;
+    const StoreHeader* header = nullptr;
+    const UserRecord* records = nullptr;
+    const char* names = nullptr;
+
+    CredentialStore() = default;
+
+    std::string_view record_name(const UserRecord& record) const {
+        if ((uint64_t)record.name_offset + record.name_length > header->names_size) return {};
+        return std::string_view(names + record.name_offset, record.name_length);
+    }
+
+    const UserRecord* find(std::string_view username) const {
+        uint64_t hash = username_hash(username);
+        const UserRecord* end = records + header->count;
+        const UserRecord* it = std::lower_bound(records, end, hash,
+            [](const UserRecord& record, uint64_t value) { return record.name_hash < value; });
+        for (; it != end && it->name_hash == hash; ++it) {
+            if (record_name(*it) == username) return it;
+        }
+        return nullptr;
+    }
+
+public:
+    ~CredentialStore() {
+        if (base) munmap(base, mapped_size);
+    }
+
+    CredentialStore(const CredentialStore&) = delete;
+    CredentialStore& operator=(const CredentialStore&) = delete;
+
+    // Maps the file and validates its header; O(1) in the number of accounts
+    static std::shared_ptr<const CredentialStore> open(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(StoreHeader)) {
+            ::close(fd);
+            error = path + " is too small to be a credential store";
+            return nullptr;
+        }
+
+        size_t size = st.st_size;
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED) {
+            error = "cannot map " + path;
+            return nullptr;
+        }
+
+        std::shared_ptr<CredentialStore> store(new CredentialStore());
+        store->base = mem;
+        store->mapped_size = size;
+        store->header = static_cast<const StoreHeader*>(mem);
+
+        const StoreHeader& h = *store->header;
+        uint64_t body = size - sizeof(StoreHeader);
+        if (memcmp(h.magic, USERDB_MAGIC, sizeof(USERDB_MAGIC)) != 0 || h.version != USERDB_VERSION ||
+            h.iterations == 0 || h.count > body / sizeof(UserRecord) ||
+            h.names_size != body - h.count * sizeof(UserRecord)) {
+            error = path + " is not a valid credential store";
+            return nullptr;
+        }
+        store->records = reinterpret_cast<const UserRecord*>(store->header + 1);
+        store->names = reinterpret_cast<const char*>(store->records + h.count);
+        return store;
+    }
+
+    size_t size() const { return header->count; }
+
+    bool verify(const std::string& username, const std::string& password) const {
+        const UserRecord* record = find(username);
+        if (!record) return false;
+
+        uint8_t digest[USERDB_HASH_SIZE];
+        if (!derive_password_hash(password, record->salt, header->iterations, digest)) return false;
+        return CRYPTO_memcmp(digest, record->password_hash, USERDB_HASH_SIZE) == 0;
+    }
+};
+
+// Writes a store for the given username/password pairs to path. The file is
+// written under a temporary name and renamed into place, so a running server
+// never sees a half-written store.
+inline bool write_credential_store(const std::string& path,
+                                   const std::vector<std::pair<std::string, std::string>>& users,
+                                   uint32_t iterations, std::string& error) {
+    std::vector<UserRecord> records;
+    records.reserve(users.size());
+    std::string blob;
+    for (const auto& [username, password] : users) {
+        if (username.size() > UINT16_MAX || blob.size() + username.size() > UINT32_MAX) {
+            error = "username or name table too large";
+            return false;
+        }
+        UserRecord record{};
+        record.name_hash = username_hash(username);
+        record.name_offset = blob.size();
+        record.name_length = username.size();
+        if (RAND_bytes(record.salt, USERDB_SALT_SIZE) != 1 ||
+            !derive_password_hash(password, record.salt, iterations, record.password_hash)) {
+            error = "failed to hash password for " + username;
+            return false;
+        }
+        blob += username;
+        records.push_back(record);
+    }
+
+    std::sort(records.begin(), records.end(), [&](const UserRecord& a, const UserRecord& b) {
+        if (a.name_hash != b.name_hash) return a.name_hash < b.name_hash;
+        return blob.compare(a.name_offset, a.name_length, blob, b.name_offset, b.name_length) < 0;
+    });
+    for (size_t i = 1; i < records.size(); ++i) {
+        const UserRecord& a = records[i - 1];
+        const UserRecord& b = records[i];
+        if (a.name_hash == b.name_hash &&
+            blob.compare(a.name_offset, a.name_length, blob, b.name_offset, b.name_length) == 0) {
+            error = "duplicate username " + blob.substr(b.name_offset, b.name_length);
+            return false;
+        }
+    }
+
+    StoreHeader header{};
+    memcpy(header.magic, USERDB_MAGIC, sizeof(USERDB_MAGIC));
+    header.version = USERDB_VERSION;
+    header.iterations = iterations;
+    header.count = records.size();
+    header.names_size = blob.size();
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error = "cannot create " + tmp_path;
+        return false;
+    }
+    auto write_all = [fd](const void* data, size_t len) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t n = ::write(fd, p, len);
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    };
+    bool ok = write_all(&header, sizeof(header)) &&
+              write_all(records.data(), records.size() * sizeof(UserRecord)) &&
+              write_all(blob.data(), blob.size()) &&
+              fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        error = "failed to write " + path;
+        return false;
+    }
+    return true;
+}
+
+#endif // CREDENTIAL_STORE_HPP
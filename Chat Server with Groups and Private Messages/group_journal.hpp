@@ -0,0 +1,339 @@
+#ifndef GROUP_JOURNAL_HPP
+#define GROUP_JOURNAL_HPP
+
+// Durable group state (--state PATH): a snapshot plus write-ahead logs.
+//
+// PATH holds the latest snapshot of group definitions and memberships, keyed
+// by username. PATH.wal.<generation> logs the membership changes made after
+// the snapshot of that generation was started. Restoring means loading the
+// snapshot and replaying its generation's log and any later ones, in order.
+//
+// Integers are LEB128 varints and strings are length-prefixed.
+//
+//   Snapshot:  SnapshotHeader
+//              GROUP  name | owner | last sequence number      (header.groups times)
+//              USER   username | count | group index * count   (header.users times)
+//   Log:       kind:u8 | group | username (owner for CREATE, empty for DELETE)
+//
+// Memberships are stored per user because that is how they are restored:
+// one entry per user rather than one per membership. USER records are
+// written in username_hash() order, so the restored table needs no sort.
+//
+// A log that ends in a partial record (the server was killed mid-write) is
+// replayed up to that record.
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr char SNAPSHOT_MAGIC[8] = {'C', 'H', 'A', 'T', 'S', 'N', 'P', '1'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation;      // the log continuing this snapshot is PATH.wal.<generation>
+    uint64_t groups;
+    uint64_t users;
+    uint64_t memberships;
+};
+static_assert(sizeof(SnapshotHeader) == 48, "SnapshotHeader layout is part of the file format");
+
+enum JournalKind : uint8_t { JOURNAL_CREATE = 1, JOURNAL_DELETE = 2, JOURNAL_JOIN = 3, JOURNAL_LEAVE = 4 };
+
+inline void journal_put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+inline void journal_put_string(std::string& out, std::string_view value) {
+    journal_put_varint(out, value.size());
+    out.append(value);
+}
+
+inline std::string journal_log_path(const std::string& path, uint64_t generation) {
+    return path + ".wal." + std::to_string(generation);
+}
+
+// Reads a whole file; false if it does not exist
+inline bool journal_read_file(const std::string& path, std::string& data) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat info {};
+    fstat(fd, &info);
+    data.resize(info.st_size);
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::read(fd, data.data() + done, data.size() - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    data.resize(done);
+    ::close(fd);
+    return true;
+}
+
+inline bool journal_write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Cursor over a snapshot or log held in memory
+class JournalReader {
+private:
+    const std::string& data;
+    size_t pos;
+
+public:
+    JournalReader(const std::string& data, size_t pos) : data(data), pos(pos) {}
+
+    bool done() const { return pos >= data.size(); }
+
+    bool get_byte(uint8_t& value) {
+        if (pos >= data.size()) return false;
+        value = data[pos++];
+        return true;
+    }
+
+    bool get_varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            uint8_t byte = data[pos++];
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool get_string(std::string_view& value) {
+        uint64_t length;
+        if (!get_varint(length) || length > data.size() - pos) return false;
+        value = std::string_view(data).substr(pos, length);
+        pos += length;
+        return true;
+    }
+};
+
+// Loads PATH and replays the logs after it into `state`, which provides
+//   restore_reserve(groups, users, memberships), restore_group(name, owner, last_seq),
+//   restore_user(username, group indices), restore_delete(name),
+//   restore_join(name, username), restore_leave(name, username).
+// Group indices count the snapshot's restore_group() calls, from 0.
+// Sets `generation` to the first unused log generation and `oldest` to the
+// oldest log still on disk. Returns false on a corrupt snapshot.
+template <class State>
+bool restore_journal(const std::string& path, State& state, uint64_t& generation, uint64_t& oldest,
+                     size_t& groups, size_t& memberships, size_t& records, std::string& error) {
+    generation = oldest = 0;
+    groups = memberships = records = 0;
+
+    std::string data;
+    if (journal_read_file(path, data)) {
+        SnapshotHeader header{};
+        if (data.size() < sizeof(header)) {
+            error = path + " is truncated";
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION) {
+            error = path + " is not a group snapshot";
+            return false;
+        }
+
+        JournalReader reader(data, sizeof(header));
+        state.restore_reserve(header.groups, header.users, header.memberships);
+        std::vector<uint32_t> user_groups;
+        for (uint64_t i = 0; i < header.groups; ++i) {
+            std::string_view name, owner;
+            uint64_t last_seq;
+            if (!reader.get_string(name) || !reader.get_string(owner) || !reader.get_varint(last_seq)) {
+                error = path + " is truncated";
+                return false;
+            }
+            state.restore_group(name, owner, last_seq);
+        }
+        for (uint64_t i = 0; i < header.users; ++i) {
+            std::string_view username;
+            uint64_t count, index;
+            if (!reader.get_string(username) || !reader.get_varint(count)) {
+                error = path + " is truncated";
+                return false;
+            }
+            user_groups.clear();
+            for (uint64_t j = 0; j < count; ++j) {
+                if (!reader.get_varint(index) || index >= header.groups) {
+                    error = path + " is truncated";
+                    return false;
+                }
+                user_groups.push_back(uint32_t(index));
+            }
+            state.restore_user(username, user_groups);
+        }
+        generation = oldest = header.generation;
+        groups = header.groups;
+        memberships = header.memberships;
+    }
+
+    // Logs older than the snapshot are left over from a crash right after it
+    // was renamed into place; they are already part of it
+    for (uint64_t stale = generation; stale-- > 0;) {
+        if (unlink(journal_log_path(path, stale).c_str()) != 0) break;
+    }
+
+    while (journal_read_file(journal_log_path(path, generation), data)) {
+        JournalReader reader(data, 0);
+        while (!reader.done()) {
+            uint8_t kind;
+            std::string_view group, username;
+            if (!reader.get_byte(kind) || !reader.get_string(group) || !reader.get_string(username)) break;
+            switch (kind) {
+                case JOURNAL_CREATE: state.restore_group(group, username, 0); break;
+                case JOURNAL_DELETE: state.restore_delete(group); break;
+                case JOURNAL_JOIN: state.restore_join(group, username); break;
+                case JOURNAL_LEAVE: state.restore_leave(group, username); break;
+                default: break;
+            }
+            ++records;
+        }
+        ++generation;
+    }
+    return true;
+}
+
+// -----------------------------------
+// GroupJournal: the write-ahead log, appended under the groups lock
+// -----------------------------------
+// Records are buffered and written at least once a second by a background
+// thread, so a crash loses at most the last second of membership changes.
+class GroupJournal {
+private:
+    std::string path;
+    int fd = -1;
+    uint64_t generation = 0;
+    uint64_t oldest = 0;           // oldest log generation still on disk
+    uint64_t unsnapshotted = 0;    // records since the last snapshot started
+    std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::condition_variable written_cv;   // signalled when a write_out() finishes
+    std::string buffer;
+    bool flushing = false;         // write_out() is writing to fd without holding the mutex
+    bool stopping = false;
+    std::thread flusher;
+
+    // The write happens without the mutex, so log() never waits for the disk.
+    // `flushing` keeps rotate() from writing newer records to fd, or closing
+    // it, until this batch is in.
+    void write_out(std::unique_lock<std::mutex>& lock) {
+        std::string pending;
+        pending.swap(buffer);
+        int target = fd;
+        flushing = true;
+        lock.unlock();
+        journal_write_all(target, pending.data(), pending.size());
+        lock.lock();
+        flushing = false;
+        written_cv.notify_all();
+    }
+
+    void flush_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            flush_cv.wait_for(lock, std::chrono::seconds(1));
+            if (!buffer.empty()) write_out(lock);
+        }
+    }
+
+    int open_log(uint64_t log_generation) {
+        return ::open(journal_log_path(path, log_generation).c_str(),
+                      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+
+public:
+    GroupJournal() = default;
+
+    ~GroupJournal() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flush_cv.notify_all();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) {
+            journal_write_all(fd, buffer.data(), buffer.size());
+            ::close(fd);
+        }
+    }
+
+    // Continue at `first_unused` (from restore_journal); older logs from
+    // `oldest_on_disk` on are kept until a snapshot covers them
+    bool open(const std::string& state_path, uint64_t first_unused, uint64_t oldest_on_disk) {
+        path = state_path;
+        generation = first_unused;
+        oldest = oldest_on_disk;
+        fd = open_log(generation);
+        if (fd < 0) return false;
+        flusher = std::thread(&GroupJournal::flush_loop, this);
+        return true;
+    }
+
+    void log(JournalKind kind, std::string_view group, std::string_view username = {}) {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.push_back(char(kind));
+        journal_put_string(buffer, group);
+        journal_put_string(buffer, username);
+        ++unsnapshotted;
+    }
+
+    bool dirty() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return unsnapshotted > 0;
+    }
+
+    // Starts the next log generation and returns it. Called with the groups
+    // lock held, at the instant the snapshot is taken, so every change before
+    // it is in an older log and every change after it in the new one.
+    uint64_t rotate() {
+        std::unique_lock<std::mutex> lock(mutex);
+        written_cv.wait(lock, [this] { return !flushing; });
+        int next = open_log(generation + 1);
+        if (next < 0) return 0;
+        journal_write_all(fd, buffer.data(), buffer.size());
+        buffer.clear();
+        ::close(fd);
+        fd = next;
+        unsnapshotted = 0;
+        return ++generation;
+    }
+
+    // A snapshot of `snapshot_generation` is safely on disk
+    void remove_before(uint64_t snapshot_generation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (; oldest < snapshot_generation; ++oldest) {
+            unlink(journal_log_path(path, oldest).c_str());
+        }
+    }
+
+    const std::string& state_path() const { return path; }
+};
+
+#endif // GROUP_JOURNAL_HPP
@@ -0,0 +1,100 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+// HdrHistogram-style latency histogram with log-linear buckets.
+//
+// Values below 2048 are counted exactly. Above that every power-of-two range
+// is split into 1024 equal sub-buckets, so any recorded value is reproduced
+// within 0.1% (three significant digits) over the whole range. Recording is
+// a few shifts and an increment; histograms from several threads are merged
+// after the run. Values are unit-agnostic; the load tools record nanoseconds.
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+class LatencyHistogram {
+private:
+    static constexpr int SUB_BUCKET_BITS = 11;                         // 2048 exact values
+    static constexpr uint64_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+    static constexpr uint64_t HALF_COUNT = SUB_BUCKET_COUNT / 2;
+    static constexpr int MAX_VALUE_BITS = 42;                           // ~73 minutes in ns
+    static constexpr uint64_t MAX_VALUE = (1ull << MAX_VALUE_BITS) - 1;
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t min_value = std::numeric_limits<uint64_t>::max();
+    uint64_t max_value = 0;
+    long double sum = 0;
+
+    static size_t index_of(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) return value;
+        int shift = (63 - __builtin_clzll(value)) - (SUB_BUCKET_BITS - 1);
+        return SUB_BUCKET_COUNT + (shift - 1) * HALF_COUNT + ((value >> shift) - HALF_COUNT);
+    }
+
+    // Highest value that maps to the bucket, so percentiles never under-report
+    static uint64_t value_of(size_t index) {
+        if (index < SUB_BUCKET_COUNT) return index;
+        size_t shift = (index - SUB_BUCKET_COUNT) / HALF_COUNT + 1;
+        uint64_t sub = (index - SUB_BUCKET_COUNT) % HALF_COUNT + HALF_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(index_of(MAX_VALUE) + 1, 0) {}
+
+    void record(uint64_t value) {
+        value = std::min(value, MAX_VALUE);
+        ++counts[index_of(value)];
+        ++total;
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+        sum += value;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); ++i) counts[i] += other.counts[i];
+        total += other.total;
+        min_value = std::min(min_value, other.min_value);
+        max_value = std::max(max_value, other.max_value);
+        sum += other.sum;
+    }
+
+    void reset() { *this = LatencyHistogram(); }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? min_value : 0; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total ? static_cast<double>(sum / total) : 0.0; }
+
+    // percentile in [0, 100]
+    uint64_t value_at_percentile(double percentile) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(value_of(i), max_value);
+        }
+        return max_value;
+    }
+
+    // {"count":..,"min":..,"mean":..,"p50":..,"p90":..,"p99":..,"p99.9":..,"max":..}
+    // with every value divided by unit (e.g. 1000 to print microseconds)
+    void write_json(std::ostream& out, double unit = 1.0) const {
+        out << "{\"count\": " << total
+            << ", \"min\": " << min() / unit
+            << ", \"mean\": " << mean() / unit
+            << ", \"p50\": " << value_at_percentile(50) / unit
+            << ", \"p90\": " << value_at_percentile(90) / unit
+            << ", \"p99\": " << value_at_percentile(99) / unit
+            << ", \"p99.9\": " << value_at_percentile(99.9) / unit
+            << ", \"max\": " << max() / unit << "}";
+    }
+};
+
+#endif // LATENCY_HISTOGRAM_HPP
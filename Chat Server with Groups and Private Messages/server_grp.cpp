@@ -2,18 +2,38 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <deque>
 #include <fstream>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cstdlib>
 #include <unistd.h>
 #include <arpa/inet.h>
-
-#define BUFFER_SIZE 1024
-#define PORT 12345
-#define MAX_CLIENTS 10
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/un.h>
+
+#include "capture.hpp"
+#include "common.hpp"
+#include "compression.hpp"
+#include "credential_store.hpp"
+#include "group_journal.hpp"
+#include "transport.hpp"
+
+#define MAX_CLIENTS SOMAXCONN   // listen backlog; load tests open thousands of connections at once
+#define LAG_REPORT_LINES 50     // consumers listed by /lag
+
+// Lock guarding the shared client and group tables. chat_bench builds this
+// file with a contention-counting mutex in its place.
+#ifndef CHAT_MUTEX
+#define CHAT_MUTEX std::mutex
+#endif
+using ChatMutex = CHAT_MUTEX;
 
 // Enum for message types (optional/enumerative use)
 enum class MessageType {
@@ -26,49 +46,117 @@ enum class MessageType {
     UNKNOWN
 };
 
+// Split a comma-separated list ("alice,bob,,alice") into unique, non-empty names
+std::vector<std::string> split_unique_list(const std::string& list) {
+    std::vector<std::string> names;
+    std::unordered_set<std::string> seen;
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (!name.empty() && seen.insert(name).second) {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+
 // -----------------------------------
 // ErrorHandler Class
 // -----------------------------------
 class ErrorHandler {
 public:
     static void send_error(int client_socket, const std::string& message) {
-        send(client_socket, message.c_str(), message.size(), 0);
+        send_message(client_socket, message);
     }
 
     static void authentication_failed(int client_socket) {
         std::string msg = "[Error] Authentication failed. Invalid username or password.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
-        close(client_socket);
+        send_message(client_socket, msg);
+        Transport::close(client_socket);
     }
 
     static void unknown_command(int client_socket) {
         std::string msg = "[Error] Unknown command. Use /help for available commands.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
     }
 
     static void not_a_group_member(int client_socket) {
         std::string msg = "[Error] You are not a member of this group. Join first using /join_group.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
     }
 
     static void group_not_exist(int client_socket) {
         std::string msg = "[Error] Group does not exist. Create one using /create_group.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
     }
 
     static void group_already_exists(int client_socket) {
         std::string msg = "[Error] Group already exists. Try joining using /join_group.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
     }
 
     static void user_not_found(int client_socket) {
         std::string msg = "[Error] User not found. Check the username and try again.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
     }
 
     static void not_in_group(int client_socket) {
         std::string msg = "[Error] You are not in this group or the group does not exist.\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+        send_message(client_socket, msg);
+    }
+
+    static void invalid_stream(int client_socket) {
+        std::string msg = "[Error] Unknown stream id. Start a transfer with /stream_begin.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void stream_rejected(int client_socket, const std::string& stream_id, const std::string& reason) {
+        std::string msg = "[Error] Stream " + stream_id + " rejected: " + reason + "\n"
+                        + "[Upload " + stream_id + "] aborted\n";
+        send_message(client_socket, msg);
+    }
+
+    static void not_group_owner(int client_socket) {
+        std::string msg = "[Error] Only the group's owner can delete it.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void group_limit_reached(int client_socket) {
+        std::string msg = "[Error] The server has reached its group limit. Try again later.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void group_full(int client_socket) {
+        std::string msg = "[Error] This group is full.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void unknown_compression(int client_socket) {
+        std::string msg = "[Error] Unknown compression. Use /compress deflate or /compress off.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void invalid_pattern(int client_socket) {
+        std::string msg = "[Error] A pattern is a group name prefix followed by *, e.g. alerts.*\n";
+        send_message(client_socket, msg);
+    }
+
+    static void not_subscribed(int client_socket) {
+        std::string msg = "[Error] You are not subscribed to this pattern.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void subscription_limit_reached(int client_socket) {
+        std::string msg = "[Error] You have reached the subscription limit. Unsubscribe from a pattern first.\n";
+        send_message(client_socket, msg);
+    }
+
+    static void history_trimmed(int client_socket, const std::string& stream, uint64_t first, uint64_t last) {
+        std::string range = first == last ? "Message " + std::to_string(first) + " of " + stream + " is"
+                                          : "Messages " + std::to_string(first) + "-" + std::to_string(last)
+                                            + " of " + stream + " are";
+        std::string msg = "[Error] " + range + " no longer retained.\n";
+        send_message(client_socket, msg);
     }
 
     static void socket_creation_failed() {
@@ -91,38 +179,184 @@ public:
     }
 };
 
+// Totals over many MessageLogs, for /stats
+struct LogStats {
+    size_t history_messages = 0;
+    size_t history_bytes = 0;
+    size_t consumers = 0;          // (stream, user) pairs that acknowledge
+    uint64_t max_lag_messages = 0;
+    uint64_t max_lag_bytes = 0;
+};
+
+struct ConsumerLag {
+    std::string stream;
+    std::string consumer;
+    uint64_t messages;
+    uint64_t bytes;
+};
+
+// -----------------------------------
+// MessageLog Class
+// Sequence numbers and retained history of one delivery stream: a group, the
+// broadcast channel or one user's private messages. Every message gets the
+// next number of its stream, so clients can detect gaps (after a reconnect,
+// say) and fetch what they missed with /resend. Users who send cumulative
+// /ack's are tracked as consumers: history they have all acknowledged is
+// dropped, and their lag is what /stats and /lag report. At most `retain`
+// messages are kept either way. Callers hold the lock of the owning table.
+// -----------------------------------
+class MessageLog {
+private:
+    struct Entry {
+        uint64_t seq;
+        uint64_t end_bytes;   // stream bytes up to and including this message
+        std::string line;
+    };
+    struct Consumer {
+        uint64_t acked = 0;
+        uint64_t acked_bytes = 0;
+    };
+
+    uint64_t head = 0;         // last number handed out
+    uint64_t head_bytes = 0;
+    std::deque<Entry> history;
+    size_t history_bytes = 0;
+    std::unordered_map<std::string, Consumer> consumers;   // keyed by username
+    size_t retain;
+
+    void drop_oldest() {
+        history_bytes -= history.front().line.size();
+        history.pop_front();
+    }
+
+    // Drop what every consumer has acknowledged. New messages never change
+    // this, so it only runs when the consumers do.
+    void trim_acknowledged() {
+        if (consumers.empty()) return;
+        uint64_t floor = head;
+        for (const auto& [name, consumer] : consumers) floor = std::min(floor, consumer.acked);
+        while (!history.empty() && history.front().seq <= floor) drop_oldest();
+    }
+
+    // Stream bytes through `seq`. Once that message is trimmed this
+    // overestimates, so the byte lag derived from it is a lower bound.
+    uint64_t bytes_through(uint64_t seq) const {
+        if (seq >= head || history.empty()) return head_bytes;
+        if (seq < history.front().seq) return history.front().end_bytes - history.front().line.size();
+        return history[seq - history.front().seq].end_bytes;
+    }
+
+public:
+    explicit MessageLog(size_t retain = 256) : retain(retain) {}
+
+    // Number for the next message; the caller formats it into the line and
+    // passes that to record()
+    uint64_t assign() { return ++head; }
+
+    void record(const std::string& line) {
+        head_bytes += line.size();
+        if (retain == 0) return;
+        history.push_back({head, head_bytes, line});
+        history_bytes += line.size();
+        if (history.size() > retain) drop_oldest();
+    }
+
+    // Cumulative: everything up to `seq` has been received by `consumer`
+    void ack(const std::string& consumer, uint64_t seq) {
+        seq = std::min(seq, head);
+        auto [it, added] = consumers.try_emplace(consumer);
+        if (added || seq > it->second.acked) {
+            it->second.acked = seq;
+            it->second.acked_bytes = bytes_through(seq);
+        }
+        trim_acknowledged();
+    }
+
+    void forget(const std::string& consumer) {
+        if (consumers.erase(consumer)) trim_acknowledged();
+    }
+
+    // Appends the retained messages numbered above `after` to `out`; returns
+    // the lowest number that is still retained (head + 1 if none is)
+    uint64_t resend(uint64_t after, std::string& out) const {
+        uint64_t first = history.empty() ? head + 1 : history.front().seq;
+        for (size_t i = after >= first ? after - first + 1 : 0; i < history.size(); ++i) {
+            out += history[i].line;
+        }
+        return first;
+    }
+
+    uint64_t last() const { return head; }
+
+    // Continue the numbering of a stream restored from a snapshot
+    void continue_from(uint64_t seq) { head = seq; }
+
+    void add_stats(LogStats& stats) const {
+        stats.history_messages += history.size();
+        stats.history_bytes += history_bytes;
+        stats.consumers += consumers.size();
+        for (const auto& [name, consumer] : consumers) {
+            stats.max_lag_messages = std::max(stats.max_lag_messages, head - consumer.acked);
+            stats.max_lag_bytes = std::max(stats.max_lag_bytes, head_bytes - consumer.acked_bytes);
+        }
+    }
+
+    void add_lag(const std::string& stream, std::vector<ConsumerLag>& out) const {
+        for (const auto& [name, consumer] : consumers) {
+            out.push_back({stream, name, head - consumer.acked, head_bytes - consumer.acked_bytes});
+        }
+    }
+};
+
+// Broadcast and private-message streams, guarded by clients_mutex
+struct DeliveryLogs {
+    size_t retain;
+    MessageLog broadcast;
+    std::unordered_map<std::string, MessageLog> private_messages;   // by recipient
+
+    explicit DeliveryLogs(size_t retain = 256) : retain(retain), broadcast(retain) {}
+
+    MessageLog& private_log(const std::string& username) {
+        return private_messages.try_emplace(username, retain).first->second;
+    }
+};
+
 // -----------------------------------
 // BroadcastMessage Class
 // -----------------------------------
 class BroadcastMessage {
 private:
     std::unordered_map<int, std::string>& clients;
-    std::mutex& clients_mutex;
+    ChatMutex& clients_mutex;
+    DeliveryLogs& logs;
 public:
-    BroadcastMessage(std::unordered_map<int, std::string>& clients, std::mutex& clients_mutex)
-        : clients(clients), clients_mutex(clients_mutex) {}
+    BroadcastMessage(std::unordered_map<int, std::string>& clients, ChatMutex& clients_mutex, DeliveryLogs& logs)
+        : clients(clients), clients_mutex(clients_mutex), logs(logs) {}
 
     void send_broadcast(int sender_socket, const std::string& message) {
-        std::lock_guard<std::mutex> lock(clients_mutex);
+        std::lock_guard<ChatMutex> lock(clients_mutex);
 
         // Safely confirm we know the sender
         if (clients.find(sender_socket) == clients.end()) {
             // If for some reason the sender isn't recognized (e.g. disconnected),
             // we can ignore or send an error back:
             std::string err = "[Error] You are not recognized as an active user.\n";
-            send(sender_socket, err.c_str(), err.size(), 0);
+            send_message(sender_socket, err);
             return;
         }
 
         // Get sender's username
         std::string sender_name = clients[sender_socket];
         // Build the broadcast message
-        std::string broadcast_msg = "[Broadcast from " + sender_name + "]: " + message + "\n";
+        uint64_t seq = logs.broadcast.assign();
+        std::string broadcast_msg = "[Broadcast #" + std::to_string(seq) + " from " + sender_name + "]: " + message + "\n";
+        logs.broadcast.record(broadcast_msg);
 
         // Send to all connected users except the sender
+        Outgoing outgoing(broadcast_msg);
         for (const auto& [socket, username] : clients) {
             if (socket != sender_socket) {
-                send(socket, broadcast_msg.c_str(), broadcast_msg.size(), 0);
+                outgoing.send(socket);
             }
         }
     }
@@ -130,10 +364,10 @@ public:
 
     // Utility to let others know who joined/left (optional but typical in chat)
     void announce(const std::string& announcement) {
-        std::lock_guard<std::mutex> lock(clients_mutex);
+        std::lock_guard<ChatMutex> lock(clients_mutex);
         std::string msg = announcement + "\n";
         for (const auto& [socket, username] : clients) {
-            send(socket, msg.c_str(), msg.size(), 0);
+            send_message(socket, msg);
         }
     }
 };
@@ -144,18 +378,27 @@ public:
 class PrivateMessage {
 private:
     std::unordered_map<int, std::string>& clients;
-    std::mutex& clients_mutex;
+    ChatMutex& clients_mutex;
+    DeliveryLogs& logs;
+
+    // "[Private #<seq> from <sender>]: <message>", numbered in the recipient's stream
+    std::string format(const std::string& sender, const std::string& recipient, const std::string& message) {
+        MessageLog& log = logs.private_log(recipient);
+        std::string line = "[Private #" + std::to_string(log.assign()) + " from " + sender + "]: " + message + "\n";
+        log.record(line);
+        return line;
+    }
 
 public:
-    PrivateMessage(std::unordered_map<int, std::string>& clients, std::mutex& clients_mutex)
-        : clients(clients), clients_mutex(clients_mutex) {}
+    PrivateMessage(std::unordered_map<int, std::string>& clients, ChatMutex& clients_mutex, DeliveryLogs& logs)
+        : clients(clients), clients_mutex(clients_mutex), logs(logs) {}
 
     void send_private_message(int client_socket, const std::string& recipient, const std::string& message) {
-        std::lock_guard<std::mutex> lock(clients_mutex);
+        std::lock_guard<ChatMutex> lock(clients_mutex);
 
         if (clients.find(client_socket) == clients.end()) {
             std::string err = "[Error] You are not recognized as an active user.\n";
-            send(client_socket, err.c_str(), err.size(), 0);
+            send_message(client_socket, err);
             return;
         }
 
@@ -171,16 +414,286 @@ public:
         }
         if (!found) {
             std::string err = "[Error] User not active.\n";
-            send(client_socket, err.c_str(), err.size(), 0);
+            send_message(client_socket, err);
             return;
         }
 
         std::string sender = clients[client_socket];
-        std::string formatted_message = "[Private from " + sender + "]: " + message + "\n";
+        std::string formatted_message = format(sender, recipient, message);
 
         // Send to recipient
-        send(recipient_socket, formatted_message.c_str(), formatted_message.size(), 0);
+        Outgoing(formatted_message).send(recipient_socket);
+    }
+
+    // Send one message to many users: a single pass over the clients table
+    // under one lock. Each copy carries its recipient's sequence number.
+    void send_private_message_many(int client_socket, const std::vector<std::string>& recipients, const std::string& message) {
+        std::lock_guard<ChatMutex> lock(clients_mutex);
+
+        auto sender = clients.find(client_socket);
+        if (sender == clients.end()) {
+            std::string err = "[Error] You are not recognized as an active user.\n";
+            send_message(client_socket, err);
+            return;
+        }
+
+        // Like /msg, each user receives the message on one connection only
+        std::unordered_set<std::string> pending(recipients.begin(), recipients.end());
+        for (const auto& [socket, user] : clients) {
+            if (pending.empty()) break;
+            if (pending.erase(user)) {
+                std::string line = format(sender->second, user, message);
+                Outgoing(line).send(socket);
+            }
+        }
+
+        if (!pending.empty()) {
+            std::string err = "[Error] User not active:";
+            for (const std::string& user : recipients) {
+                if (pending.count(user)) err += " " + user;
+            }
+            send_message(client_socket, err + "\n");
+        }
+    }
+};
+
+// Per-server caps on group state
+struct GroupLimits {
+    size_t max_groups = 10000;
+    size_t max_group_size = 10000;
+    std::chrono::seconds empty_ttl{300};   // empty groups are reclaimed after this long
+    size_t history = 256;                  // messages retained per stream for /resend
+    size_t max_subscriptions = 256;        // patterns per connection
+};
+
+struct GroupStats {
+    size_t groups = 0;
+    size_t memberships = 0;
+    size_t bytes = 0;
+    size_t pending_memberships = 0;   // restored, waiting for their user to log in
+    size_t subscriptions = 0;
+    size_t subscription_nodes = 0;
+};
+
+// -----------------------------------
+// RestoredMemberships Class
+// Memberships restored at startup, by username, held until the user logs in.
+// Snapshot users sit in one array sorted by username hash (like the user
+// database) with their group ids in another, because restoring millions of
+// them is bound by allocation: a hash-table node per user costs far more.
+// Users that only appear in a replayed log go into a small map instead.
+// -----------------------------------
+class RestoredMemberships {
+private:
+    struct User {
+        uint64_t hash;
+        std::string name;
+        uint32_t offset;   // into ids
+        uint32_t count;    // 0 once taken
+    };
+
+    std::vector<User> users;
+    std::vector<uint32_t> ids;
+    bool sorted = true;
+    std::unordered_map<std::string, std::vector<uint32_t>> replayed;
+    std::vector<uint32_t> per_group;   // group id -> memberships still waiting for it
+    size_t total = 0;
+
+    void count(uint32_t id, int delta) {
+        if (id >= per_group.size()) per_group.resize(id + 1);
+        per_group[id] += delta;
+    }
+
+    User* find(std::string_view username) {
+        if (!sorted) {
+            std::sort(users.begin(), users.end(), [](const User& a, const User& b) { return a.hash < b.hash; });
+            sorted = true;
+        }
+        uint64_t hash = username_hash(username);
+        auto it = std::lower_bound(users.begin(), users.end(), hash,
+            [](const User& user, uint64_t value) { return user.hash < value; });
+        for (; it != users.end() && it->hash == hash; ++it) {
+            if (it->name == username) return &*it;
+        }
+        return nullptr;
+    }
+
+public:
+    void reserve(size_t user_count, size_t membership_count) {
+        users.reserve(user_count);
+        ids.reserve(membership_count);
+    }
+
+    // A snapshot USER record; each user appears once
+    void add_user(std::string_view username, const std::vector<uint32_t>& group_ids) {
+        uint64_t hash = username_hash(username);
+        if (!users.empty() && hash < users.back().hash) sorted = false;
+        users.push_back({hash, std::string(username), uint32_t(ids.size()), uint32_t(group_ids.size())});
+        ids.insert(ids.end(), group_ids.begin(), group_ids.end());
+        for (uint32_t id : group_ids) count(id, 1);
+        total += group_ids.size();
+    }
+
+    void add(std::string_view username, uint32_t id) {
+        if (User* user = find(username)) {
+            auto begin = ids.begin() + user->offset, end = begin + user->count;
+            if (std::find(begin, end, id) != end) return;
+        }
+        std::vector<uint32_t>& extra = replayed[std::string(username)];
+        if (std::find(extra.begin(), extra.end(), id) != extra.end()) return;
+        extra.push_back(id);
+        count(id, 1);
+        ++total;
+    }
+
+    void remove(std::string_view username, uint32_t id) {
+        if (User* user = find(username)) {
+            auto begin = ids.begin() + user->offset, end = begin + user->count;
+            auto it = std::find(begin, end, id);
+            if (it != end) {
+                *it = *(end - 1);
+                --user->count;
+                count(id, -1);
+                --total;
+            }
+        }
+        auto extra = replayed.find(std::string(username));
+        if (extra != replayed.end() && std::erase(extra->second, id)) {
+            count(id, -1);
+            --total;
+            if (extra->second.empty()) replayed.erase(extra);
+        }
+    }
+
+    // Hands over the user's restored group ids, at login
+    std::vector<uint32_t> take(const std::string& username) {
+        std::vector<uint32_t> result;
+        if (User* user = find(username)) {
+            result.assign(ids.begin() + user->offset, ids.begin() + user->offset + user->count);
+            user->count = 0;
+        }
+        auto extra = replayed.find(username);
+        if (extra != replayed.end()) {
+            result.insert(result.end(), extra->second.begin(), extra->second.end());
+            replayed.erase(extra);
+        }
+        for (uint32_t id : result) count(id, -1);
+        total -= result.size();
+        return result;
+    }
+
+    // Whether some user has yet to log in and claim a membership of the group
+    bool waiting_for(uint32_t id) const {
+        return id < per_group.size() && per_group[id] > 0;
+    }
+
+    // f(username, group id) for every membership still waiting
+    template <class F>
+    void for_each(F f) const {
+        for (const User& user : users) {
+            for (uint32_t i = 0; i < user.count; ++i) f(std::string_view(user.name), ids[user.offset + i]);
+        }
+        for (const auto& [username, extra] : replayed) {
+            for (uint32_t id : extra) f(std::string_view(username), id);
+        }
+    }
+
+    size_t size() const { return total; }
+};
+
+// -----------------------------------
+// SubscriptionTrie Class
+// Pattern subscriptions (/subscribe alerts.*), stored under their prefix in
+// a trie of group names. The subscribers of a group are found by walking
+// its name once and collecting the sockets on every node passed, so the
+// cost grows with the name's length, not with the number of patterns.
+// -----------------------------------
+class SubscriptionTrie {
+private:
+    struct Node {
+        std::unordered_map<char, std::unique_ptr<Node>> children;
+        std::vector<int> subscribers;   // sockets subscribed to exactly this prefix
+    };
+
+    Node root;
+    std::unordered_map<int, std::vector<std::string>> by_socket;   // socket -> its prefixes
+    size_t nodes = 1;
+    size_t count = 0;
+
+    bool erase(const std::string& prefix, int socket) {
+        std::vector<Node*> path{&root};
+        for (char c : prefix) {
+            auto it = path.back()->children.find(c);
+            if (it == path.back()->children.end()) return false;
+            path.push_back(it->second.get());
+        }
+        if (std::erase(path.back()->subscribers, socket) == 0) return false;
+        // Prune the branch back to the deepest node still in use
+        for (size_t depth = prefix.size(); depth > 0; --depth) {
+            if (!path[depth]->subscribers.empty() || !path[depth]->children.empty()) break;
+            path[depth - 1]->children.erase(prefix[depth - 1]);
+            --nodes;
+        }
+        --count;
+        return true;
     }
+
+public:
+    // False if the socket already holds this subscription
+    bool add(const std::string& prefix, int socket) {
+        Node* node = &root;
+        for (char c : prefix) {
+            std::unique_ptr<Node>& child = node->children[c];
+            if (!child) {
+                child = std::make_unique<Node>();
+                ++nodes;
+            }
+            node = child.get();
+        }
+        if (std::find(node->subscribers.begin(), node->subscribers.end(), socket) != node->subscribers.end()) {
+            return false;
+        }
+        node->subscribers.push_back(socket);
+        by_socket[socket].push_back(prefix);
+        ++count;
+        return true;
+    }
+
+    bool remove(const std::string& prefix, int socket) {
+        if (!erase(prefix, socket)) return false;
+        auto it = by_socket.find(socket);
+        std::erase(it->second, prefix);
+        if (it->second.empty()) by_socket.erase(it);
+        return true;
+    }
+
+    void remove_socket(int socket) {
+        auto it = by_socket.find(socket);
+        if (it == by_socket.end()) return;
+        for (const std::string& prefix : it->second) erase(prefix, socket);
+        by_socket.erase(it);
+    }
+
+    const std::vector<std::string>* prefixes_of(int socket) const {
+        auto it = by_socket.find(socket);
+        return it == by_socket.end() ? nullptr : &it->second;
+    }
+
+    // Appends the subscribers of group `name`. A socket subscribed through
+    // several matching prefixes is appended once per prefix.
+    void collect(const std::string& name, std::vector<int>& out) const {
+        const Node* node = &root;
+        out.insert(out.end(), node->subscribers.begin(), node->subscribers.end());
+        for (char c : name) {
+            auto it = node->children.find(c);
+            if (it == node->children.end()) return;
+            node = it->second.get();
+            out.insert(out.end(), node->subscribers.begin(), node->subscribers.end());
+        }
+    }
+
+    size_t size() const { return count; }
+    size_t node_count() const { return nodes; }
 };
 
 // -----------------------------------
@@ -188,37 +701,199 @@ public:
 // -----------------------------------
 class GroupManager {
 private:
-    std::unordered_map<std::string, std::unordered_set<int>> groups;
-    std::mutex groups_mutex;
+    struct Group {
+        std::string owner;                 // username of the creator; only they may delete it
+        std::unordered_set<int> members;   // member sockets
+        std::chrono::steady_clock::time_point empty_since;   // meaningful while members is empty
+        MessageLog log;                    // sequence numbers of the group's messages
+        uint32_t restored_id = NOT_RESTORED;   // index into restored_groups
+    };
+
+    static constexpr uint32_t NOT_RESTORED = UINT32_MAX;
+
+    std::unordered_map<std::string, Group> groups;
+    ChatMutex groups_mutex;
+    GroupLimits limits;
+
+    // Durable state (--state). Memberships are persisted by username, so the
+    // manager learns whose each socket is at login, and keeps memberships
+    // restored at startup until their user logs in again. Those refer to
+    // groups by restored id, which only matches the group it was restored
+    // as, not a later one of the same name.
+    std::unordered_map<int, std::string> socket_users;
+    std::unordered_map<std::string, std::vector<int>> user_sockets;
+    std::vector<std::string> restored_groups;                          // restored id -> group name
+    RestoredMemberships pending;
+    GroupJournal* journal = nullptr;
+
+    SubscriptionTrie subscriptions;   // per connection, like live memberships; not persisted
+
+    void mark_if_empty(Group& group) {
+        if (group.members.empty()) group.empty_since = std::chrono::steady_clock::now();
+    }
+
+    // Whether the user is also in the group through another connection; the
+    // durable membership only ends with their last one
+    bool member_elsewhere(const Group& group, int client_socket, const std::string& username) const {
+        auto it = user_sockets.find(username);
+        if (it == user_sockets.end()) return false;
+        for (int socket : it->second) {
+            if (socket != client_socket && group.members.count(socket)) return true;
+        }
+        return false;
+    }
+
+    // Subscribers of a group who do not already get its messages as members
+    // (nor sent them), each once
+    void subscribers_outside(const std::string& group_name, const std::unordered_set<int>& members,
+                             int sender_socket, std::vector<int>& out) const {
+        size_t start = out.size();
+        subscriptions.collect(group_name, out);
+        auto first = out.begin() + start;
+        out.erase(std::remove_if(first, out.end(), [&](int socket) {
+            return socket == sender_socket || members.count(socket);
+        }), out.end());
+        std::sort(out.begin() + start, out.end());
+        out.erase(std::unique(out.begin() + start, out.end()), out.end());
+    }
+
+    // The group a restored id still refers to, or null
+    Group* restored_group(uint32_t id) {
+        auto it = groups.find(restored_groups[id]);
+        return it != groups.end() && it->second.restored_id == id ? &it->second : nullptr;
+    }
+
+    void log_membership(JournalKind kind, const Group& group, const std::string& group_name,
+                        int client_socket, const std::string& username) {
+        if (journal && !member_elsewhere(group, client_socket, username)) journal->log(kind, group_name, username);
+    }
+
+    // Runs in the forked child: serializes the tables as they were at fork()
+    bool write_snapshot(const std::string& path, uint64_t generation) {
+        SnapshotHeader header{};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.generation = generation;
+        header.groups = groups.size();
+
+        std::string out(sizeof(header), '\0');
+        std::unordered_map<std::string_view, uint64_t> index;
+        index.reserve(groups.size());
+        for (const auto& [gname, group] : groups) {
+            index.emplace(gname, index.size());
+            journal_put_string(out, gname);
+            journal_put_string(out, group.owner);
+            journal_put_varint(out, group.log.last());
+        }
+        // Memberships go out per user: live ones by socket owner (once, however
+        // many of the user's connections are in a group), then restored ones
+        std::unordered_map<std::string_view, std::vector<uint64_t>> by_user;
+        uint64_t group_index = 0;   // same iteration order as above
+        for (const auto& [gname, group] : groups) {
+            for (int socket : group.members) {
+                auto user = socket_users.find(socket);
+                if (user == socket_users.end()) continue;
+                std::vector<uint64_t>& indices = by_user[user->second];
+                if (indices.empty() || indices.back() != group_index) indices.push_back(group_index);
+            }
+            ++group_index;
+        }
+        pending.for_each([&](std::string_view username, uint32_t id) {
+            if (restored_group(id)) by_user[username].push_back(index.at(restored_groups[id]));
+        });
+        // In username hash order, so the restore needs no sort
+        std::vector<std::pair<uint64_t, const decltype(by_user)::value_type*>> order;
+        order.reserve(by_user.size());
+        for (const auto& entry : by_user) order.emplace_back(username_hash(entry.first), &entry);
+        std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (const auto& [hash, entry] : order) {
+            const auto& [username, indices] = *entry;
+            journal_put_string(out, username);
+            journal_put_varint(out, indices.size());
+            for (uint64_t i : indices) journal_put_varint(out, i);
+            ++header.users;
+            header.memberships += indices.size();
+        }
+        memcpy(out.data(), &header, sizeof(header));
+
+        std::string temp = path + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = journal_write_all(fd, out.data(), out.size()) && fsync(fd) == 0;
+        ::close(fd);
+        return ok && rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    // Heap bytes behind a std::string; short names live in the small-string buffer
+    static size_t string_heap_bytes(const std::string& s) {
+        return s.capacity() > 15 ? s.capacity() + 1 : 0;
+    }
 
 public:
+    explicit GroupManager(const GroupLimits& limits = GroupLimits{}) : limits(limits) {}
+
     // Create a group
-    void create_group(int client_socket, const std::string& group_name) {
-        std::lock_guard<std::mutex> lock(groups_mutex);
-        if (groups.find(group_name) == groups.end()) {
-            groups[group_name].insert(client_socket);
-            std::string msg = "Group " + group_name + " created.\n";
-            send(client_socket, msg.c_str(), msg.size(), 0);
-        } else {
+    void create_group(int client_socket, const std::string& username, const std::string& group_name) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        if (groups.find(group_name) != groups.end()) {
             ErrorHandler::group_already_exists(client_socket);
+        } else if (groups.size() >= limits.max_groups) {
+            ErrorHandler::group_limit_reached(client_socket);
+        } else {
+            Group& group = groups.try_emplace(group_name, Group{username, {}, {}, MessageLog(limits.history)}).first->second;
+            group.members.insert(client_socket);
+            if (journal) {
+                journal->log(JOURNAL_CREATE, group_name, username);
+                journal->log(JOURNAL_JOIN, group_name, username);
+            }
+            std::string msg = "Group " + group_name + " created.\n";
+            send_message(client_socket, msg);
+        }
+    }
+
+    // Delete a group (owner only); remaining members are told it is gone
+    void delete_group(int client_socket, const std::string& username, const std::string& group_name) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        auto it = groups.find(group_name);
+        if (it == groups.end()) {
+            ErrorHandler::group_not_exist(client_socket);
+            return;
+        }
+        if (it->second.owner != username) {
+            ErrorHandler::not_group_owner(client_socket);
+            return;
         }
+
+        std::string announce_msg = "[Group " + group_name + "] deleted by " + username + ".\n";
+        for (int sock : it->second.members) {
+            if (sock != client_socket) send_message(sock, announce_msg);
+        }
+        groups.erase(it);
+        if (journal) journal->log(JOURNAL_DELETE, group_name);
+        std::string msg = "Group " + group_name + " deleted.\n";
+        send_message(client_socket, msg);
     }
 
     // Join a group
     void join_group(int client_socket,const std::string& username, const std::string& group_name) {
-        std::lock_guard<std::mutex> lock(groups_mutex);
+        std::lock_guard<ChatMutex> lock(groups_mutex);
         auto it = groups.find(group_name);
         if (it != groups.end()) {
-            groups[group_name].insert(client_socket);
+            if (!it->second.members.count(client_socket) && it->second.members.size() >= limits.max_group_size) {
+                ErrorHandler::group_full(client_socket);
+                return;
+            }
+            if (it->second.members.insert(client_socket).second) {
+                log_membership(JOURNAL_JOIN, it->second, group_name, client_socket, username);
+            }
             std::string msg = "You joined the group " + group_name + ".\n";
-            send(client_socket, msg.c_str(), msg.size(), 0);
+            send_message(client_socket, msg);
                 // Build announcement for all group members
             std::string announce_msg = "[Group " + group_name + "] " + username + " has joined.\n";
 
-            for (int sock : it->second) {
-                
-                if (sock == client_socket) continue; 
-                send(sock, announce_msg.c_str(), announce_msg.size(), 0);
+            for (int sock : it->second.members) {
+                if (sock == client_socket) continue;
+                send_message(sock, announce_msg);
             }
         } else {
             ErrorHandler::group_not_exist(client_socket);
@@ -227,17 +902,20 @@ public:
 
     // Leave a group
     void leave_group(int client_socket, const std::string& username,const std::string& group_name) {
-        std::lock_guard<std::mutex> lock(groups_mutex);
+        std::lock_guard<ChatMutex> lock(groups_mutex);
         auto it = groups.find(group_name);
         if (it != groups.end()) {
-            if (it->second.erase(client_socket) > 0) {
+            if (it->second.members.erase(client_socket) > 0) {
+                mark_if_empty(it->second);
+                it->second.log.forget(username);
+                log_membership(JOURNAL_LEAVE, it->second, group_name, client_socket, username);
                 std::string msg = "You left the group " + group_name + ".\n";
-                send(client_socket, msg.c_str(), msg.size(), 0);
+                send_message(client_socket, msg);
 
                 // Announce to group members
                 std::string announce_msg = "[Group " + group_name + "] " + username + " has left.\n";
-                for (int sock : it->second) {
-                    send(sock, announce_msg.c_str(), announce_msg.size(), 0);
+                for (int sock : it->second.members) {
+                    send_message(sock, announce_msg);
                 }
             } else {
                 ErrorHandler::not_in_group(client_socket);
@@ -249,34 +927,576 @@ public:
 
     // Send a group message
     void send_group_message(int client_socket, const std::string& sender_username,  const std::string& group_name, const std::string& message) {
-        std::lock_guard<std::mutex> lock(groups_mutex);
+        std::lock_guard<ChatMutex> lock(groups_mutex);
         auto it = groups.find(group_name);
         if (it == groups.end()) {
             ErrorHandler::group_not_exist(client_socket);
             return;
         }
         // Check membership
-        if (!it->second.count(client_socket)) {
+        if (!it->second.members.count(client_socket)) {
             ErrorHandler::not_a_group_member(client_socket);
             return;
         }
 
         // Relay message to all in group
-        std::string group_msg = "[Group " + group_name +"] "+  sender_username + " "  + message + "\n";
-        for (int socket : it->second) {
+        uint64_t seq = it->second.log.assign();
+        std::string group_msg = "[Group " + group_name + " #" + std::to_string(seq) + "] " + sender_username + " " + message + "\n";
+        it->second.log.record(group_msg);
+        Outgoing outgoing(group_msg);
+        for (int socket : it->second.members) {
             if (socket != client_socket) {
-                send(socket, group_msg.c_str(), group_msg.size(), 0);
+                outgoing.send(socket);
+            }
+        }
+        std::vector<int> subscribers;
+        subscribers_outside(group_name, it->second.members, client_socket, subscribers);
+        for (int socket : subscribers) {
+            outgoing.send(socket);
+        }
+    }
+
+    // Send one message to several groups under a single lock. Users who are in
+    // more than one target group receive it once; the header lists every group
+    // and, in the same order, the message's number in each of them.
+    void send_group_message_many(int client_socket, const std::string& sender_username, const std::vector<std::string>& group_names, const std::string& message) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+
+        std::unordered_set<int> recipients;
+        std::vector<int> subscribers;
+        std::vector<Group*> targets;
+        std::string target_list, seq_list;
+        for (const std::string& group_name : group_names) {
+            auto it = groups.find(group_name);
+            if (it == groups.end()) {
+                ErrorHandler::group_not_exist(client_socket);
+                continue;
+            }
+            if (!it->second.members.count(client_socket)) {
+                ErrorHandler::not_a_group_member(client_socket);
+                continue;
+            }
+            recipients.insert(it->second.members.begin(), it->second.members.end());
+            subscribers.clear();
+            subscriptions.collect(group_name, subscribers);
+            recipients.insert(subscribers.begin(), subscribers.end());
+            target_list += (target_list.empty() ? "" : ",") + group_name;
+            seq_list += (seq_list.empty() ? "#" : ",") + std::to_string(it->second.log.assign());
+            targets.push_back(&it->second);
+        }
+        if (target_list.empty()) return;
+        recipients.erase(client_socket);
+
+        std::string group_msg = "[Group " + target_list + " " + seq_list + "] " + sender_username + " " + message + "\n";
+        for (Group* group : targets) group->log.record(group_msg);
+        Outgoing outgoing(group_msg);
+        for (int socket : recipients) {
+            outgoing.send(socket);
+        }
+    }
+
+    // Collect the members a stream to this group goes to (everyone but the sender)
+    bool stream_recipients(int client_socket, const std::string& group_name, std::vector<int>& recipients) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        auto it = groups.find(group_name);
+        if (it == groups.end()) {
+            ErrorHandler::group_not_exist(client_socket);
+            return false;
+        }
+        if (!it->second.members.count(client_socket)) {
+            ErrorHandler::not_a_group_member(client_socket);
+            return false;
+        }
+        for (int socket : it->second.members) {
+            if (socket != client_socket) recipients.push_back(socket);
+        }
+        subscribers_outside(group_name, it->second.members, client_socket, recipients);
+        return true;
+    }
+
+    // /subscribe <prefix>*: receive the messages of every group whose name
+    // starts with prefix, existing or created later, without joining them
+    void subscribe(int client_socket, const std::string& pattern) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        const std::vector<std::string>* held = subscriptions.prefixes_of(client_socket);
+        if (held && held->size() >= limits.max_subscriptions) {
+            ErrorHandler::subscription_limit_reached(client_socket);
+            return;
+        }
+        subscriptions.add(pattern.substr(0, pattern.size() - 1), client_socket);
+        send_message(client_socket, "You subscribed to " + pattern + ".\n");
+    }
+
+    void unsubscribe(int client_socket, const std::string& pattern) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        if (!subscriptions.remove(pattern.substr(0, pattern.size() - 1), client_socket)) {
+            ErrorHandler::not_subscribed(client_socket);
+            return;
+        }
+        send_message(client_socket, "You unsubscribed from " + pattern + ".\n");
+    }
+
+    void list_subscriptions(int client_socket) {
+        std::string out;
+        {
+            std::lock_guard<ChatMutex> lock(groups_mutex);
+            if (const std::vector<std::string>* held = subscriptions.prefixes_of(client_socket)) {
+                for (const std::string& prefix : *held) out += "[Subscribed] " + prefix + "*\n";
             }
         }
+        send_message(client_socket, out.empty() ? "You have no subscriptions.\n" : out);
+    }
+
+    // Add many sockets at once, creating the group if needed, without the
+    // per-join announcements (which make building an n-member group O(n^2)).
+    // Used by chat_bench to set up large groups.
+    void add_members(const std::string& group_name, const std::string& owner, const std::vector<int>& sockets) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        Group& group = groups.try_emplace(group_name, Group{owner, {}, {}, MessageLog(limits.history)}).first->second;
+        group.members.insert(sockets.begin(), sockets.end());
+        mark_if_empty(group);
     }
 
     // Remove a socket from ALL groups (for when client disconnects)
     void remove_socket_from_all_groups(int client_socket) {
-        std::lock_guard<std::mutex> lock(groups_mutex);
-        for (auto& [gname, members] : groups) {
-            members.erase(client_socket);
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        subscriptions.remove_socket(client_socket);
+        auto user = socket_users.find(client_socket);
+        for (auto& [gname, group] : groups) {
+            if (group.members.erase(client_socket)) {
+                mark_if_empty(group);
+                if (user != socket_users.end()) log_membership(JOURNAL_LEAVE, group, gname, client_socket, user->second);
+            }
         }
+        if (user == socket_users.end()) return;
+        auto sockets = user_sockets.find(user->second);
+        std::erase(sockets->second, client_socket);
+        if (sockets->second.empty()) user_sockets.erase(sockets);
+        socket_users.erase(user);
     }
+
+    // A user logged in on client_socket: put it back into the groups it was
+    // restored into, and tell the user which those are
+    void attach(int client_socket, const std::string& username) {
+        std::string rejoined;
+        {
+            std::lock_guard<ChatMutex> lock(groups_mutex);
+            socket_users[client_socket] = username;
+            user_sockets[username].push_back(client_socket);
+
+            if (pending.size() == 0) return;
+            for (uint32_t id : pending.take(username)) {
+                Group* group = restored_group(id);
+                if (!group) continue;
+                group->members.insert(client_socket);
+                rejoined += "You rejoined the group " + restored_groups[id] + ".\n";
+            }
+        }
+        if (!rejoined.empty()) send_message(client_socket, rejoined);
+    }
+
+    void set_journal(GroupJournal* group_journal) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        journal = group_journal;
+    }
+
+    // Copy-on-write snapshot: under the lock, start the next log generation
+    // and fork(). The child writes the tables as they were at that instant
+    // while this process carries on; only fork() itself holds up other
+    // threads. Returns the child's pid (or -1) and the snapshot's generation.
+    pid_t start_snapshot(uint64_t& generation) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        generation = journal->rotate();
+        if (generation == 0) return -1;
+        pid_t pid = fork();
+        if (pid == 0) _exit(write_snapshot(journal->state_path(), generation) ? 0 : 1);
+        return pid;
+    }
+
+    // Replay targets for restore_journal(); called before any client connects.
+    // Snapshot groups are restored first, so their ids are their indices.
+    void restore_reserve(size_t group_count, size_t user_count, size_t membership_count) {
+        groups.reserve(group_count);
+        restored_groups.reserve(group_count);
+        pending.reserve(user_count, membership_count);
+    }
+
+    void restore_group(std::string_view name, std::string_view owner, uint64_t last_seq) {
+        Group group{std::string(owner), {}, std::chrono::steady_clock::now(), MessageLog(limits.history),
+                    uint32_t(restored_groups.size())};
+        group.log.continue_from(last_seq);
+        restored_groups.emplace_back(name);
+        groups.insert_or_assign(restored_groups.back(), std::move(group));
+    }
+
+    void restore_user(std::string_view username, const std::vector<uint32_t>& ids) {
+        pending.add_user(username, ids);
+    }
+
+    void restore_delete(std::string_view name) {
+        groups.erase(std::string(name));
+    }
+
+    void restore_join(std::string_view name, std::string_view username) {
+        auto group = groups.find(std::string(name));
+        if (group == groups.end()) return;
+        pending.add(username, group->second.restored_id);
+    }
+
+    void restore_leave(std::string_view name, std::string_view username) {
+        auto group = groups.find(std::string(name));
+        if (group == groups.end()) return;
+        pending.remove(username, group->second.restored_id);
+    }
+
+    // /ack <group> <seq>: members acknowledge the group's messages cumulatively
+    void ack(int client_socket, const std::string& username, const std::string& group_name, uint64_t seq) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        auto it = groups.find(group_name);
+        if (it == groups.end() || !it->second.members.count(client_socket)) {
+            ErrorHandler::not_in_group(client_socket);
+            return;
+        }
+        it->second.log.ack(username, seq);
+    }
+
+    // /resend <group> <seq>: retained group messages numbered above seq
+    void resend(int client_socket, const std::string& group_name, uint64_t after) {
+        std::string out;
+        uint64_t first;
+        {
+            std::lock_guard<ChatMutex> lock(groups_mutex);
+            auto it = groups.find(group_name);
+            if (it == groups.end() || !it->second.members.count(client_socket)) {
+                ErrorHandler::not_in_group(client_socket);
+                return;
+            }
+            first = it->second.log.resend(after, out);
+        }
+        if (first > after + 1) ErrorHandler::history_trimmed(client_socket, group_name, after + 1, first - 1);
+        if (!out.empty()) Outgoing(out).send(client_socket);
+    }
+
+    void log_stats(LogStats& stats, std::vector<ConsumerLag>* lag = nullptr) {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        for (const auto& [gname, group] : groups) {
+            group.log.add_stats(stats);
+            if (lag) group.log.add_lag(gname, *lag);
+        }
+    }
+
+    // Drop groups that have had no members for longer than the TTL. A restored
+    // group is kept while memberships restored into it wait for their users;
+    // its TTL starts over when the last of them leaves.
+    size_t reclaim_empty_groups() {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        auto now = std::chrono::steady_clock::now();
+        size_t reclaimed = 0;
+        for (auto it = groups.begin(); it != groups.end();) {
+            Group& group = it->second;
+            if (group.restored_id != NOT_RESTORED && pending.waiting_for(group.restored_id)) {
+                ++it;
+                continue;
+            }
+            if (group.members.empty() && now - group.empty_since >= limits.empty_ttl) {
+                if (journal) journal->log(JOURNAL_DELETE, it->first);
+                it = groups.erase(it);
+                ++reclaimed;
+            } else {
+                ++it;
+            }
+        }
+        return reclaimed;
+    }
+
+    // Group count, membership count and an estimate of the heap bytes they use
+    // (hash buckets, nodes and out-of-line strings, as laid out by libstdc++)
+    GroupStats stats() {
+        std::lock_guard<ChatMutex> lock(groups_mutex);
+        GroupStats result;
+        result.groups = groups.size();
+        result.bytes = groups.bucket_count() * sizeof(void*);
+        for (const auto& [gname, group] : groups) {
+            result.memberships += group.members.size();
+            // node: next pointer + key/value pair + cached hash
+            result.bytes += sizeof(void*) + sizeof(std::pair<const std::string, Group>) + sizeof(size_t);
+            result.bytes += string_heap_bytes(gname) + string_heap_bytes(group.owner);
+            // member set: bucket array + one node (next pointer + int, padded) per socket
+            result.bytes += group.members.bucket_count() * sizeof(void*);
+            result.bytes += group.members.size() * (sizeof(void*) + sizeof(void*));
+        }
+        result.pending_memberships = pending.size();
+        result.subscriptions = subscriptions.size();
+        result.subscription_nodes = subscriptions.node_count();
+        return result;
+    }
+};
+
+// -----------------------------------
+// StreamOutbox Class
+// Per-recipient queues for relayed stream frames. Senders only append; each
+// recipient connection gets one writer thread, started with its first frame
+// and kept until it disconnects, that does the blocking writes, so a slow
+// reader never stalls the sending connection. Each queue belongs to one
+// logged-in connection: a socket number reused by a later login gets a new
+// queue and never receives frames meant for the previous owner.
+// -----------------------------------
+class StreamOutbox {
+public:
+    struct Recipient {
+        int socket;
+        uint64_t connection;   // 0: not logged in, or dropped from the transfer
+    };
+
+    enum class Push { Queued, Full, Gone };
+
+private:
+    struct Queue {
+        uint64_t connection;
+        std::deque<std::shared_ptr<const std::string>> frames;
+        size_t bytes = 0;        // queued or being written
+        bool sending = false;    // the writer is inside a blocking write
+        bool closed = false;     // disconnected, or a write failed
+        std::condition_variable ready;   // frames queued, or closed
+        std::thread writer;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<int, std::shared_ptr<Queue>> queues;   // socket->current connection's queue
+    uint64_t next_connection = 1;
+
+    void write_loop(int socket, std::shared_ptr<Queue> queue) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queue->ready.wait(lock, [&] { return queue->closed || !queue->frames.empty(); });
+            if (queue->closed) return;
+            std::shared_ptr<const std::string> frame = std::move(queue->frames.front());
+            queue->frames.pop_front();
+            queue->sending = true;
+            lock.unlock();
+            bool sent = Transport::send_all(socket, frame->data(), frame->size()) >= 0;
+            lock.lock();
+            queue->sending = false;
+            queue->bytes -= frame->size();
+            if (!sent) queue->closed = true;   // the reader's own thread cleans up
+        }
+    }
+
+public:
+    // The socket finished logging in
+    void connect(int socket) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto queue = std::make_shared<Queue>();
+        queue->connection = next_connection++;
+        queues[socket] = std::move(queue);
+    }
+
+    Recipient recipient(int socket) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = queues.find(socket);
+        return {socket, it == queues.end() ? 0 : it->second->connection};
+    }
+
+    // Control frames (begin, end, aborted) are small and pass a full queue,
+    // so a recipient dropped for overflow still learns its transfer ended
+    Push push(const Recipient& to, const std::shared_ptr<const std::string>& frame, bool control) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = queues.find(to.socket);
+        if (it == queues.end() || it->second->connection != to.connection || it->second->closed) {
+            return Push::Gone;
+        }
+        Queue& queue = *it->second;
+        if (!control && queue.bytes + frame->size() > STREAM_RECIPIENT_BUFFER) return Push::Full;
+
+        queue.bytes += frame->size();
+        queue.frames.push_back(frame);
+        if (!queue.writer.joinable()) {
+            queue.writer = std::thread(&StreamOutbox::write_loop, this, to.socket, it->second);
+        }
+        queue.ready.notify_one();
+        return Push::Queued;
+    }
+
+    // Must run before the descriptor is closed: drops pending frames, fails a
+    // write blocked on the socket and joins the writer, so nothing reaches the
+    // socket once the number can be reused
+    void disconnect(int socket) {
+        std::shared_ptr<Queue> queue;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = queues.find(socket);
+            if (it == queues.end()) return;
+            queue = std::move(it->second);
+            queues.erase(it);
+            queue->closed = true;
+            queue->frames.clear();
+            if (queue->sending) Transport::shutdown(socket);
+            queue->ready.notify_one();
+        }
+        if (queue->writer.joinable()) queue->writer.join();
+    }
+};
+
+// -----------------------------------
+// StreamRelay Class
+// Relays chunked, length-prefixed transfers (files, snippets, binary data).
+// One instance per connection: transfers belong to the sending connection's
+// thread and need no locking. Chunks are queued to the recipients as soon as
+// they arrive and acknowledged back, so the sender keeps at most STREAM_WINDOW
+// bytes of each transfer unacknowledged, and other commands interleave between
+// chunks. A recipient more than STREAM_RECIPIENT_BUFFER bytes behind is
+// dropped from the transfer rather than slowing it down.
+// -----------------------------------
+class StreamRelay {
+private:
+    struct Transfer {
+        uint64_t id;                                      // server-wide id seen by the recipients
+        std::vector<StreamOutbox::Recipient> recipients;  // resolved once, when the transfer starts
+        uint64_t size;
+        uint64_t received = 0;
+    };
+
+    inline static std::atomic<uint64_t> next_id{1};
+
+    int client_socket;
+    std::string username;
+    std::unordered_map<int, std::string>& clients;
+    ChatMutex& clients_mutex;
+    GroupManager& group_manager;
+    StreamOutbox& outbox;
+    std::unordered_map<std::string, Transfer> transfers;   // keyed by the sender's stream id
+
+    // Every push re-checks that the socket still belongs to the connection the
+    // transfer started with; recipients that left or fell behind are skipped
+    // for the rest of the transfer
+    void forward(Transfer& transfer, std::string frame, bool control = false) {
+        auto shared = std::make_shared<const std::string>(std::move(frame));
+        for (auto& recipient : transfer.recipients) {
+            if (recipient.connection == 0) continue;
+            StreamOutbox::Push result = outbox.push(recipient, shared, control);
+            if (result == StreamOutbox::Push::Full) {
+                auto aborted = std::make_shared<const std::string>("[Stream " + std::to_string(transfer.id) + "] aborted\n");
+                outbox.push(recipient, aborted, true);
+            }
+            if (result != StreamOutbox::Push::Queued) recipient.connection = 0;
+        }
+    }
+
+    void finish(const std::string& stream_id, Transfer& transfer) {
+        forward(transfer, "[Stream " + std::to_string(transfer.id) + "] end\n", true);
+        send_message(client_socket, "[Upload " + stream_id + "] complete\n");
+        transfers.erase(stream_id);
+    }
+
+public:
+    StreamRelay(int client_socket, const std::string& username,
+                std::unordered_map<int, std::string>& clients, ChatMutex& clients_mutex,
+                GroupManager& group_manager, StreamOutbox& outbox)
+        : client_socket(client_socket), username(username), clients(clients),
+          clients_mutex(clients_mutex), group_manager(group_manager), outbox(outbox) {}
+
+    // /stream_begin <id> <group_name|@username> <size> <name>
+    void begin(const std::string& stream_id, const std::string& target, uint64_t size, const std::string& name) {
+        if (transfers.count(stream_id)) {
+            ErrorHandler::stream_rejected(client_socket, stream_id, "id already in use");
+            return;
+        }
+        if (transfers.size() >= STREAM_MAX_ACTIVE || size > STREAM_MAX_SIZE) {
+            ErrorHandler::stream_rejected(client_socket, stream_id, "too many transfers or payload too large");
+            return;
+        }
+
+        Transfer transfer{next_id++, {}, size};
+        if (target.starts_with("@")) {
+            std::lock_guard<ChatMutex> lock(clients_mutex);
+            for (const auto& [socket, user] : clients) {
+                if (user == target.substr(1)) {
+                    transfer.recipients.push_back(outbox.recipient(socket));
+                    break;
+                }
+            }
+            if (transfer.recipients.empty()) {
+                ErrorHandler::stream_rejected(client_socket, stream_id, "user not active");
+                return;
+            }
+        } else {
+            std::vector<int> sockets;
+            if (!group_manager.stream_recipients(client_socket, target, sockets)) {
+                send_message(client_socket, "[Upload " + stream_id + "] aborted\n");
+                return;
+            }
+            for (int socket : sockets) transfer.recipients.push_back(outbox.recipient(socket));
+        }
+
+        forward(transfer, "[Stream " + std::to_string(transfer.id) + " from " + username + " to " + target
+                          + "] begin " + std::to_string(size) + " " + name + "\n", true);
+        auto& active = transfers.emplace(stream_id, std::move(transfer)).first->second;
+        if (size == 0) finish(stream_id, active);
+    }
+
+    // /chunk <id> <length> followed by <length> raw bytes. The payload is always
+    // consumed, even when rejected, to keep the command framing intact. A
+    // connection dropped mid-payload surfaces on the caller's next read.
+    void chunk(const std::string& stream_id, size_t length, LineReader& reader) {
+        auto it = transfers.find(stream_id);
+        if (it == transfers.end() || length > STREAM_CHUNK_MAX ||
+            it->second.received + length > it->second.size) {
+            if (!reader.skip_bytes(length)) return;
+            if (it == transfers.end()) {
+                ErrorHandler::invalid_stream(client_socket);
+            } else {
+                abort(stream_id);
+                ErrorHandler::stream_rejected(client_socket, stream_id, "chunk too large or beyond announced size");
+            }
+            return;
+        }
+
+        // Header and payload go out in one write, so frames never interleave
+        Transfer& transfer = it->second;
+        std::string payload;
+        if (!reader.read_bytes(length, payload)) return;
+        std::string frame = "[Chunk " + std::to_string(transfer.id) + " " + std::to_string(length) + "]\n";
+        frame += payload;
+        forward(transfer, std::move(frame));
+        transfer.received += length;
+
+        send_message(client_socket, "[Upload " + stream_id + "] ack " + std::to_string(transfer.received) + "\n");
+        if (transfer.received == transfer.size) finish(stream_id, transfer);
+    }
+
+    // /stream_abort <id>
+    void abort(const std::string& stream_id) {
+        auto it = transfers.find(stream_id);
+        if (it == transfers.end()) {
+            ErrorHandler::invalid_stream(client_socket);
+            return;
+        }
+        forward(it->second, "[Stream " + std::to_string(it->second.id) + "] aborted\n", true);
+        transfers.erase(it);
+    }
+
+    // Sender disconnected: tell recipients their partial transfers are gone
+    void abort_all() {
+        for (auto& [stream_id, transfer] : transfers) {
+            forward(transfer, "[Stream " + std::to_string(transfer.id) + "] aborted\n", true);
+        }
+        transfers.clear();
+    }
+};
+
+// -----------------------------------
+// ServerConfig: command-line options
+// -----------------------------------
+struct ServerConfig {
+    bool tcp_enabled = true;
+    std::string unix_path = UNIX_SOCKET_PATH;   // empty disables the Unix-domain listener
+    bool shm_enabled = true;                    // allow local clients to upgrade to shared memory
+    GroupLimits group_limits;
+    std::string userdb_path = "users.db";       // falls back to users.txt while this is missing
+    std::string capture_path;                   // record inbound commands here (--capture)
+    std::string state_path;                     // group snapshot; logs go next to it (--state)
+    std::chrono::seconds snapshot_interval{60};
+    size_t compress_min = COMPRESS_MIN_SIZE;    // shorter messages are never compressed
 };
 
 // -----------------------------------
@@ -284,12 +1504,21 @@ public:
 // -----------------------------------
 class ServerManager {
 private:
-    std::unordered_map<std::string, std::string> users;   // Valid username->password pairs
+    ServerConfig config;
+    std::unordered_map<std::string, std::string> users;   // Plaintext fallback: username->password
+    // Current credential store; swapped atomically on reload, while in-flight
+    // authentications keep using the mapping they loaded
+    std::atomic<std::shared_ptr<const CredentialStore>> credential_store;
     std::unordered_map<int, std::string> clients;         // socket->username
-    std::mutex clients_mutex;
+    ChatMutex clients_mutex;
+    DeliveryLogs delivery_logs;                            // broadcast and private streams, under clients_mutex
 
     // Single GroupManager shared by all connections
     GroupManager group_manager;
+    StreamOutbox stream_outbox;   // relayed stream frames waiting for slow recipients
+
+    std::unique_ptr<CaptureWriter> capture;   // null unless --capture was given
+    std::unique_ptr<GroupJournal> journal;    // null unless --state was given
 
     // Load users from file
     void load_users(const std::string& filename) {
@@ -310,15 +1539,74 @@ private:
         }
     }
 
-public:
-    void start() {
-        load_users("users.txt");
+    bool load_credential_store() {
+        auto start = std::chrono::steady_clock::now();
+        std::string error;
+        auto store = CredentialStore::open(config.userdb_path, error);
+        if (!store) {
+            std::cerr << "[Server] Credential store not loaded: " << error << ".\n";
+            return false;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "[Server] Credential store " << config.userdb_path << ": " << store->size()
+                  << " account(s) mapped in " << ms << " ms.\n";
+        credential_store.store(std::move(store));
+        return true;
+    }
+
+    // Reload the store whenever build_userdb replaces it. The directory is
+    // watched because the file is renamed into place, which replaces its inode.
+    void watch_credential_store() {
+        std::string path = config.userdb_path;
+        size_t slash = path.find_last_of('/');
+        std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+        std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+        int fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            std::cerr << "[Server] Cannot watch " << path << " for changes.\n";
+            if (fd >= 0) close(fd);
+            return;
+        }
 
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t len = read(fd, buffer, sizeof(buffer));
+            if (len < 0 && errno == EINTR) continue;
+            if (len <= 0) {
+                std::cerr << "[Server] Stopped watching " << path << ": "
+                          << (len < 0 ? strerror(errno) : "watch closed") << ". Restart to pick up new credentials.\n";
+                close(fd);
+                return;
+            }
+            bool changed = false;
+            for (char* p = buffer; p < buffer + len;) {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                if (event->len && name == event->name) changed = true;
+                p += sizeof(inotify_event) + event->len;
+            }
+            if (changed) load_credential_store();
+        }
+    }
+
+    bool authenticate(const std::string& username, const std::string& password) {
+        if (auto store = credential_store.load()) {
+            return store->verify(username, password);
+        }
+        auto it = users.find(username);
+        return it != users.end() && it->second == password;
+    }
+
+    int open_tcp_listener() {
         int server_socket = socket(AF_INET, SOCK_STREAM, 0);
         if (server_socket < 0) {
             ErrorHandler::socket_creation_failed();
         }
 
+        // Restart without waiting out TIME_WAIT from the previous run's connections
+        int reuse = 1;
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
         sockaddr_in server_address{};
         server_address.sin_family = AF_INET;
         server_address.sin_addr.s_addr = INADDR_ANY;
@@ -333,53 +1621,301 @@ public:
         }
 
         std::cout << "[Server] Running on port " << PORT << "...\n";
+        return server_socket;
+    }
 
-        while (true) {
-            sockaddr_in client_address;
-            socklen_t client_address_len = sizeof(client_address);
-            int client_socket = accept(server_socket, (sockaddr*)&client_address, &client_address_len);
+    int open_unix_listener(const std::string& path) {
+        int server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            ErrorHandler::socket_creation_failed();
+        }
+
+        sockaddr_un server_address{};
+        server_address.sun_family = AF_UNIX;
+        strncpy(server_address.sun_path, path.c_str(), sizeof(server_address.sun_path) - 1);
+
+        // A stale socket file from a previous run would make bind() fail
+        unlink(path.c_str());
+        if (bind(server_socket, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
+            ErrorHandler::binding_failed();
+        }
+
+        if (listen(server_socket, MAX_CLIENTS) < 0) {
+            ErrorHandler::listening_failed();
+        }
+
+        std::cout << "[Server] Listening on unix socket " << path << "...\n";
+        return server_socket;
+    }
+
+    // Switch a local connection onto the shared-memory rings named by the client
+    bool accept_shm_upgrade(int client_socket, const std::string& shm_name) {
+        auto channel = ShmChannel::attach(shm_name);
+        if (!channel) {
+            send_message(client_socket, "SHM ERROR\n");
+            return false;
+        }
+        // The acknowledgement still travels over the socket; everything after it uses the rings
+        send_message(client_socket, "SHM OK\n");
+        return Transport::attach_shm(client_socket, std::move(channel));
+    }
+
+    // Load the snapshot and logs, then keep logging membership changes and
+    // snapshot them periodically
+    void restore_state() {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t generation, oldest;
+        size_t groups, memberships, records;
+        std::string error;
+        if (!restore_journal(config.state_path, group_manager, generation, oldest, groups, memberships, records, error)) {
+            std::cerr << "[Error] Cannot restore group state: " << error << "\n";
+            exit(EXIT_FAILURE);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "[Server] Restored " << groups << " group(s) and " << memberships << " membership(s) from "
+                  << config.state_path << ", then " << records << " log record(s), in " << ms << " ms.\n";
+
+        journal = std::make_unique<GroupJournal>();
+        if (!journal->open(config.state_path, generation, oldest)) {
+            std::cerr << "[Error] Cannot write " << journal_log_path(config.state_path, generation) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        group_manager.set_journal(journal.get());
+
+        std::thread([this] {
+            while (true) {
+                std::this_thread::sleep_for(config.snapshot_interval);
+                if (journal->dirty()) take_snapshot();
+            }
+        }).detach();
+    }
+
+    void take_snapshot() {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t generation;
+        pid_t pid = group_manager.start_snapshot(generation);
+        double fork_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "[Server] Snapshot of " << config.state_path << " failed; keeping its logs.\n";
+            return;
+        }
+        journal->remove_before(generation);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "[Server] Snapshot " << generation << " written in " << ms << " ms (fork held the groups lock "
+                  << fork_ms << " ms).\n";
+    }
+
+    // Bytes in/out of deflate, and what compression saved across all recipients
+    static std::string compression_report() {
+        const CompressionStats& stats = Compression::stats;
+        uint64_t messages = stats.messages.load(), input = stats.input_bytes.load(), output = stats.output_bytes.load();
+        uint64_t compress_ns = stats.compress_ns.load();
+        char ratio[32], per_message[32];
+        snprintf(ratio, sizeof(ratio), "%.2f", output ? double(input) / output : 0.0);
+        snprintf(per_message, sizeof(per_message), "%.1f", messages ? compress_ns / 1e3 / messages : 0.0);
+        return " compressed_messages=" + std::to_string(messages)
+             + " compress_skipped=" + std::to_string(stats.skipped.load())
+             + " compress_in_bytes=" + std::to_string(input)
+             + " compress_out_bytes=" + std::to_string(output)
+             + " compress_ratio=" + ratio
+             + " compress_cpu_us=" + std::to_string(compress_ns / 1000)
+             + " compress_us_per_message=" + per_message
+             + " compressed_deliveries=" + std::to_string(stats.deliveries.load())
+             + " egress_saved_bytes=" + std::to_string(stats.saved_bytes.load());
+    }
+
+    std::string stats_report() {
+        size_t client_count;
+        {
+            std::lock_guard<ChatMutex> lock(clients_mutex);
+            client_count = clients.size();
+        }
+        GroupStats groups = group_manager.stats();
+        LogStats logs;
+        collect_log_stats(logs);
+        return "[Stats] clients=" + std::to_string(client_count)
+             + " groups=" + std::to_string(groups.groups)
+             + " memberships=" + std::to_string(groups.memberships)
+             + " group_bytes=" + std::to_string(groups.bytes)
+             + " pending_memberships=" + std::to_string(groups.pending_memberships)
+             + " subscriptions=" + std::to_string(groups.subscriptions)
+             + " subscription_nodes=" + std::to_string(groups.subscription_nodes)
+             + " history_messages=" + std::to_string(logs.history_messages)
+             + " history_bytes=" + std::to_string(logs.history_bytes)
+             + " consumers=" + std::to_string(logs.consumers)
+             + " max_lag_messages=" + std::to_string(logs.max_lag_messages)
+             + " max_lag_bytes=" + std::to_string(logs.max_lag_bytes)
+             + compression_report() + "\n";
+    }
+
+    void collect_log_stats(LogStats& stats, std::vector<ConsumerLag>* lag = nullptr) {
+        {
+            std::lock_guard<ChatMutex> lock(clients_mutex);
+            delivery_logs.broadcast.add_stats(stats);
+            if (lag) delivery_logs.broadcast.add_lag("*", *lag);
+            for (const auto& [user, log] : delivery_logs.private_messages) {
+                log.add_stats(stats);
+                if (lag) log.add_lag("@" + user, *lag);
+            }
+        }
+        group_manager.log_stats(stats, lag);
+    }
+
+    // /lag: acknowledging consumers, furthest behind first
+    std::string lag_report() {
+        LogStats stats;
+        std::vector<ConsumerLag> lag;
+        collect_log_stats(stats, &lag);
+        std::sort(lag.begin(), lag.end(), [](const ConsumerLag& a, const ConsumerLag& b) {
+            return a.messages != b.messages ? a.messages > b.messages : a.bytes > b.bytes;
+        });
+        std::string report;
+        for (size_t i = 0; i < lag.size() && i < LAG_REPORT_LINES; ++i) {
+            report += "[Lag] " + lag[i].stream + " " + lag[i].consumer + " messages=" + std::to_string(lag[i].messages)
+                    + " bytes=" + std::to_string(lag[i].bytes) + "\n";
+        }
+        return report + "[Lag] " + std::to_string(lag.size()) + " consumer(s)\n";
+    }
+
+    // /ack and /resend name a stream as <group_name>, * (broadcast) or @ (your private messages)
+    void ack(int client_socket, const std::string& username, const std::string& stream, uint64_t seq) {
+        if (stream == "*" || stream == "@") {
+            std::lock_guard<ChatMutex> lock(clients_mutex);
+            MessageLog& log = stream == "*" ? delivery_logs.broadcast : delivery_logs.private_log(username);
+            log.ack(username, seq);
+        } else {
+            group_manager.ack(client_socket, username, stream, seq);
+        }
+    }
+
+    void resend(int client_socket, const std::string& username, const std::string& stream, uint64_t after) {
+        if (stream != "*" && stream != "@") {
+            group_manager.resend(client_socket, stream, after);
+            return;
+        }
+        std::string out;
+        uint64_t first;
+        {
+            std::lock_guard<ChatMutex> lock(clients_mutex);
+            MessageLog& log = stream == "*" ? delivery_logs.broadcast : delivery_logs.private_log(username);
+            first = log.resend(after, out);
+        }
+        if (first > after + 1) ErrorHandler::history_trimmed(client_socket, stream, after + 1, first - 1);
+        if (!out.empty()) Outgoing(out).send(client_socket);
+    }
 
-            if (client_socket < 0) {
-                ErrorHandler::client_accept_failed();
+public:
+    explicit ServerManager(const ServerConfig& config)
+        : config(config), delivery_logs(config.group_limits.history), group_manager(config.group_limits) {}
+
+    void start() {
+        Compression::set_min_size(config.compress_min);
+        if (!load_credential_store()) {
+            std::cout << "[Server] Using plaintext users.txt; run ./build_userdb users.txt "
+                      << config.userdb_path << " to switch to hashed credentials.\n";
+            load_users("users.txt");
+        }
+        std::thread(&ServerManager::watch_credential_store, this).detach();
+
+        if (!config.state_path.empty()) restore_state();
+
+        if (!config.capture_path.empty()) {
+            capture = std::make_unique<CaptureWriter>();
+            if (!capture->open(config.capture_path)) {
+                std::cerr << "[Error] Cannot write capture file " << config.capture_path << "\n";
+                exit(EXIT_FAILURE);
+            }
+            std::cout << "[Server] Capturing inbound commands to " << config.capture_path << ".\n";
+        }
+
+        std::vector<pollfd> listeners;
+        std::vector<bool> is_local;
+        if (config.tcp_enabled) {
+            listeners.push_back({open_tcp_listener(), POLLIN, 0});
+            is_local.push_back(false);
+        }
+        if (!config.unix_path.empty()) {
+            listeners.push_back({open_unix_listener(config.unix_path), POLLIN, 0});
+            is_local.push_back(true);
+        }
+
+        // Reclaim empty groups in the background, checking a few times per TTL
+        auto reap_interval = std::clamp(config.group_limits.empty_ttl / 4,
+                                        std::chrono::seconds(1), std::chrono::seconds(60));
+        std::thread([this, reap_interval] {
+            while (true) {
+                std::this_thread::sleep_for(reap_interval);
+                if (size_t reclaimed = group_manager.reclaim_empty_groups()) {
+                    std::cout << "[Server] Reclaimed " << reclaimed << " empty group(s).\n";
+                }
+            }
+        }).detach();
+
+        while (true) {
+            if (poll(listeners.data(), listeners.size(), -1) < 0) {
                 continue;
             }
 
-            std::cout << "[Server] New client connected.\n";
+            for (size_t i = 0; i < listeners.size(); ++i) {
+                if (!(listeners[i].revents & POLLIN)) continue;
+
+                int client_socket = accept(listeners[i].fd, nullptr, nullptr);
+                if (client_socket < 0) {
+                    ErrorHandler::client_accept_failed();
+                    continue;
+                }
+
+                std::cout << "[Server] New client connected.\n";
 
-            // Handle this client in a dedicated thread
-            std::thread(&ServerManager::handle_client, this, client_socket).detach();
+                // Handle this client in a dedicated thread
+                std::thread(&ServerManager::handle_client, this, client_socket, is_local[i]).detach();
+            }
         }
 
-        close(server_socket);
+        for (const pollfd& listener : listeners) {
+            close(listener.fd);
+        }
     }
 
     // Handle client: authentication + command loop
-    void handle_client(int client_socket) {
-        char buffer[BUFFER_SIZE];
-        memset(buffer, 0, BUFFER_SIZE);
+    void handle_client(int client_socket, bool local) {
+        LineReader reader(client_socket);
 
         // Prompt for username
-        {
-            std::string prompt = "Enter username: ";
-            send(client_socket, prompt.c_str(), prompt.size(), 0);
+        send_message(client_socket, "Enter username: ");
+        std::string username;
+        if (!reader.read_line(username)) {
+            Transport::close(client_socket);
+            return;
+        }
+
+        // Local clients may move onto shared memory before logging in
+        if (local && config.shm_enabled && username.starts_with("/shm ")) {
+            if (!accept_shm_upgrade(client_socket, username.substr(5))) {
+                Transport::close(client_socket);
+                return;
+            }
+            send_message(client_socket, "Enter username: ");
+            if (!reader.read_line(username)) {
+                Transport::close(client_socket);
+                return;
+            }
         }
-        recv(client_socket, buffer, BUFFER_SIZE, 0);
-        std::string username(buffer);
         // trim trailing newlines/spaces
         username.erase(username.find_last_not_of(" \n\r\t") + 1);
 
         // Prompt for password
-        {
-            std::string prompt = "Enter password: ";
-            send(client_socket, prompt.c_str(), prompt.size(), 0);
+        send_message(client_socket, "Enter password: ");
+        std::string password;
+        if (!reader.read_line(password)) {
+            Transport::close(client_socket);
+            return;
         }
-        memset(buffer, 0, BUFFER_SIZE);
-        recv(client_socket, buffer, BUFFER_SIZE, 0);
-        std::string password(buffer);
         password.erase(password.find_last_not_of(" \n\r\t") + 1);
 
         // Check authentication
-        if (users.find(username) == users.end() || users[username] != password) {
+        if (!authenticate(username, password)) {
             ErrorHandler::authentication_failed(client_socket);
             return;
         }
@@ -387,51 +1923,58 @@ public:
         // Auth successful
         {
             std::string msg = "Authentication successful!\n";
-            send(client_socket, msg.c_str(), msg.size(), 0);
+            send_message(client_socket, msg);
             std::cout << "[Server] User " << username << " authenticated.\n";
         }
 
         // Add to global clients list
         {
-            std::lock_guard<std::mutex> lock(clients_mutex);
+            std::lock_guard<ChatMutex> lock(clients_mutex);
             clients[client_socket] = username;
         }
+        stream_outbox.connect(client_socket);
+        group_manager.attach(client_socket, username);
 
         // Optional: announce to all that <username> joined
         {
-            BroadcastMessage broadcast(clients, clients_mutex);
+            BroadcastMessage broadcast(clients, clients_mutex, delivery_logs);
             broadcast.announce(username + " has joined the chat.");
         }
 
+        uint64_t connection_id = capture ? capture->connect(username) : 0;
+
         // Create message-handling helpers
-        BroadcastMessage broadcast(clients, clients_mutex);
-        PrivateMessage private_msg(clients, clients_mutex);
+        BroadcastMessage broadcast(clients, clients_mutex, delivery_logs);
+        PrivateMessage private_msg(clients, clients_mutex, delivery_logs);
+        StreamRelay streams(client_socket, username, clients, clients_mutex, group_manager, stream_outbox);
 
-        // Main receive loop
+        // Main receive loop: one newline-terminated command per iteration
+        std::string message;
         while (true) {
-            memset(buffer, 0, BUFFER_SIZE);
-            int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
-
-            if (bytes_received <= 0) {
+            if (!reader.read_line(message)) {
                 // Client disconnected or error
                 std::cout << "[Server] Client " << username << " disconnected.\n";
+                streams.abort_all();
+                if (capture) capture->disconnect(connection_id);
 
                 // Remove from clients
                 {
-                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    std::lock_guard<ChatMutex> lock(clients_mutex);
                     clients.erase(client_socket);
                 }
                 // Remove from groups
                 group_manager.remove_socket_from_all_groups(client_socket);
+                stream_outbox.disconnect(client_socket);
 
                 // Optional: broadcast user leaving
                 broadcast.announce(username + " has left the chat.");
 
-                close(client_socket);
+                Transport::close(client_socket);
                 return;
             }
 
-            std::string message(buffer);
+            // Logged with its handling time once this iteration ends
+            CaptureScope captured(capture.get(), connection_id, message);
 
             if (message.starts_with("/broadcast ")) {
                 // /broadcast <message>
@@ -446,11 +1989,33 @@ public:
                     private_msg.send_private_message(client_socket, recipient, pm);
                 }
 
+            } else if (message.starts_with("/msg_many ")) {
+                // /msg_many <user1,user2,...> <message>
+                size_t space_pos = message.find(' ', 10);
+                if (space_pos != std::string::npos) {
+                    std::vector<std::string> recipients = split_unique_list(message.substr(10, space_pos - 10));
+                    private_msg.send_private_message_many(client_socket, recipients, message.substr(space_pos + 1));
+                }
+
+            } else if (message.starts_with("/group_msg_many ")) {
+                // /group_msg_many <group1,group2,...> <message>
+                size_t space_pos = message.find(' ', 16);
+                if (space_pos != std::string::npos) {
+                    std::vector<std::string> group_names = split_unique_list(message.substr(16, space_pos - 16));
+                    group_manager.send_group_message_many(client_socket, username, group_names, message.substr(space_pos + 1));
+                }
+
             } else if (message.starts_with("/create_group ")) {
                 // /create_group <group_name>
                 std::string group_name = message.substr(14);
                 group_name.erase(group_name.find_last_not_of(" \n\r\t") + 1);
-                group_manager.create_group(client_socket, group_name);
+                group_manager.create_group(client_socket, username, group_name);
+
+            } else if (message.starts_with("/delete_group ")) {
+                // /delete_group <group_name>
+                std::string group_name = message.substr(14);
+                group_name.erase(group_name.find_last_not_of(" \n\r\t") + 1);
+                group_manager.delete_group(client_socket, username, group_name);
 
             } else if (message.starts_with("/join_group ")) {
                 // /join_group <group_name>
@@ -474,16 +2039,95 @@ public:
                     group_manager.send_group_message(client_socket,username, group_name, group_msg);
                 }
 
+            } else if (message.starts_with("/stream_begin ")) {
+                // /stream_begin <id> <group_name|@username> <size> <name>
+                std::istringstream args(message.substr(14));
+                std::string stream_id, target, name;
+                uint64_t size = 0;
+                if (args >> stream_id >> target >> size) {
+                    std::getline(args >> std::ws, name);
+                    streams.begin(stream_id, target, size, name);
+                } else {
+                    ErrorHandler::unknown_command(client_socket);
+                }
+
+            } else if (message.starts_with("/chunk ")) {
+                // /chunk <id> <length>, then exactly <length> raw bytes
+                std::istringstream args(message.substr(7));
+                std::string stream_id;
+                size_t length = 0;
+                if (!(args >> stream_id >> length)) {
+                    ErrorHandler::unknown_command(client_socket);
+                    continue;
+                }
+                streams.chunk(stream_id, length, reader);
+
+            } else if (message.starts_with("/stream_abort ")) {
+                // /stream_abort <id>
+                std::string stream_id = message.substr(14);
+                stream_id.erase(stream_id.find_last_not_of(" \n\r\t") + 1);
+                streams.abort(stream_id);
+
+            } else if (message.starts_with("/ack ") || message.starts_with("/resend ")) {
+                // /ack <group_name|*|@> <seq>, /resend <group_name|*|@> <seq>
+                std::istringstream args(message.substr(message.find(' ') + 1));
+                std::string stream;
+                uint64_t seq = 0;
+                if (!(args >> stream >> seq)) {
+                    ErrorHandler::unknown_command(client_socket);
+                } else if (message.starts_with("/ack ")) {
+                    ack(client_socket, username, stream, seq);
+                } else {
+                    resend(client_socket, username, stream, seq);
+                }
+
+            } else if (message.starts_with("/subscribe ") || message.starts_with("/unsubscribe ")) {
+                // /subscribe <prefix>*, /unsubscribe <prefix>*
+                std::string pattern = message.substr(message.find(' ') + 1);
+                pattern.erase(pattern.find_last_not_of(" \n\r\t") + 1);
+                if (pattern.empty() || pattern.back() != '*' || pattern.find('*') != pattern.size() - 1 ||
+                    pattern.find(' ') != std::string::npos) {
+                    ErrorHandler::invalid_pattern(client_socket);
+                } else if (message.starts_with("/subscribe ")) {
+                    group_manager.subscribe(client_socket, pattern);
+                } else {
+                    group_manager.unsubscribe(client_socket, pattern);
+                }
+
+            } else if (message == "/subscriptions") {
+                group_manager.list_subscriptions(client_socket);
+
+            } else if (message.starts_with("/compress ")) {
+                // /compress deflate|off: how this connection receives chat messages
+                std::string mode = message.substr(10);
+                if (mode == "deflate" || mode == "off") {
+                    Transport::set_compression(client_socket, mode == "deflate");
+                    send_message(client_socket, mode == "off" ? "Compression off.\n"
+                        : "Compression on: deflate, for messages of " + std::to_string(Compression::threshold())
+                          + " bytes or more.\n");
+                } else {
+                    ErrorHandler::unknown_compression(client_socket);
+                }
+
+            } else if (message == "/stats") {
+                send_message(client_socket, stats_report());
+
+            } else if (message == "/lag") {
+                send_message(client_socket, lag_report());
+
             } else if (message == "/exit") {
                 // Optional: let user type /exit to disconnect gracefully
                 std::cout << "[Server] User " << username << " requested /exit.\n";
+                streams.abort_all();
+                if (capture) capture->disconnect(connection_id);
                 {
-                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    std::lock_guard<ChatMutex> lock(clients_mutex);
                     clients.erase(client_socket);
                 }
                 group_manager.remove_socket_from_all_groups(client_socket);
+                stream_outbox.disconnect(client_socket);
                 broadcast.announce(username + " has left the chat.");
-                close(client_socket);
+                Transport::close(client_socket);
                 return;
 
             } else {
@@ -493,8 +2137,49 @@ public:
     }
 };
 
-int main() {
-    ServerManager server;
+// chat_bench includes this file for the classes above and brings its own main
+#ifndef CHAT_SERVER_NO_MAIN
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--unix" && i + 1 < argc) {
+            config.unix_path = argv[++i];
+        } else if (arg == "--no-unix") {
+            config.unix_path.clear();
+        } else if (arg == "--no-tcp") {
+            config.tcp_enabled = false;
+        } else if (arg == "--no-shm") {
+            config.shm_enabled = false;
+        } else if (arg == "--userdb" && i + 1 < argc) {
+            config.userdb_path = argv[++i];
+        } else if (arg == "--max-groups" && i + 1 < argc) {
+            config.group_limits.max_groups = std::stoul(argv[++i]);
+        } else if (arg == "--max-group-size" && i + 1 < argc) {
+            config.group_limits.max_group_size = std::stoul(argv[++i]);
+        } else if (arg == "--group-ttl" && i + 1 < argc) {
+            config.group_limits.empty_ttl = std::chrono::seconds(std::stol(argv[++i]));
+        } else if (arg == "--capture" && i + 1 < argc) {
+            config.capture_path = argv[++i];
+        } else if (arg == "--state" && i + 1 < argc) {
+            config.state_path = argv[++i];
+        } else if (arg == "--snapshot-interval" && i + 1 < argc) {
+            config.snapshot_interval = std::chrono::seconds(std::stol(argv[++i]));
+        } else if (arg == "--history" && i + 1 < argc) {
+            config.group_limits.history = std::stoul(argv[++i]);
+        } else if (arg == "--compress-min" && i + 1 < argc) {
+            config.compress_min = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--unix PATH | --no-unix] [--no-tcp] [--no-shm]"
+                      << " [--userdb PATH] [--max-groups N] [--max-group-size N] [--group-ttl SECONDS]"
+                      << " [--capture FILE] [--history N] [--state FILE [--snapshot-interval SECONDS]]"
+                      << " [--compress-min BYTES]\n";
+            return 1;
+        }
+    }
+
+    ServerManager server(config);
     server.start();
     return 0;
 }
+#endif // CHAT_SERVER_NO_MAIN
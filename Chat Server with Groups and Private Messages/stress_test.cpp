@@ -1,22 +1,59 @@
+// Event-driven, open-loop load generator for the chat server.
+//
+// A few threads, each with its own epoll instance, drive many non-blocking
+// client connections. Commands are issued on a Poisson schedule whose rate is
+// set per phase (ramp-up, steady state, spikes), independent of how fast the
+// server answers. Every chat message carries its *intended* send time
+// ("@T<ns>", CLOCK_MONOTONIC), so a stalled server shows up as latency
+// instead of silently lowering the offered load (coordinated omission).
+//
+// The workload comes from a scenario file (see scenario.txt) or, without
+// one, from the command-line flags. Progress goes to stderr; results are
+// printed to stdout as JSON, overall and for each phase separately.
+//
+// With --verify every message also carries a unique ID ("#<sender>:<seq>")
+// and the expected recipients are derived from the memberships the
+// generator saw confirmed. After the run, lost, duplicated and reordered
+// deliveries are reported per message type.
+//
+// Usage: ./stress_test [--scenario FILE] [--connections N] [--threads T]
+//                      [--duration S] [--interval-ms MS] [--unix PATH]
+//                      [--users FILE] [--verify]
+
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
 #include <thread>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <unordered_map>
 #include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <random>
-#include <chrono>
+
+#include "latency_histogram.hpp"
 
 // -------------------------------------------------------------------
 // Configuration
 // -------------------------------------------------------------------
 static const char* SERVER_HOST = "127.0.0.1";
 static const int   SERVER_PORT = 12345;
-static const int   NUM_CLIENTS = 1000; // number of simulated clients
-static const int   BUFFER_SIZE = 1024;
+static const int   READ_CHUNK  = 64 * 1024;
 
-// A set of valid users from users.txt (adjust as needed)
+// A set of valid users from users.txt (adjust as needed, or pass --users)
 static const std::vector<std::pair<std::string,std::string>> TEST_USERS = {
     {"alice",   "password123"},
     {"bob",     "qwerty456"},
@@ -42,194 +79,1058 @@ static const std::vector<std::string> GROUP_NAMES = {
     "CS425", "TestGroup", "Networkers", "CoolGroup", "FridayFun"
 };
 
+enum CommandType { BROADCAST, GROUP, PRIVATE, JOIN, LEAVE, COMMAND_TYPES };
+constexpr int MESSAGE_TYPES = 3;   // the first three commands deliver chat messages
+static const char* COMMAND_NAMES[COMMAND_TYPES] = {"broadcast", "group", "private", "join", "leave"};
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
 // -------------------------------------------------------------------
-// Utility: connect to server, read/write lines
+// Scenario: who connects, which groups exist, and what load to offer
 // -------------------------------------------------------------------
-int connect_to_server(const char* host, int port) {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        std::cerr << "[Error] Failed to create socket.\n";
-        return -1;
+struct Phase {
+    std::string name;
+    double duration_s = 0;
+    double rate_start = 0;       // commands per second over all users
+    double rate_end = 0;         // linear ramp from rate_start to rate_end
+};
+
+struct Scenario {
+    int users = 1000;                                         // concurrent connections
+    std::vector<std::pair<std::string,std::string>> accounts = TEST_USERS;
+    int threads = 4;
+    std::vector<std::string> groups = GROUP_NAMES;
+    double zipf_exponent = 0;                                 // 0 = uniform group sizes
+    int memberships = 1;                                      // groups joined per user at setup
+    double setup_s = 2;                                       // connect, log in and join
+    double drain_s = 1;                                       // keep reading after the last send
+    double mix[COMMAND_TYPES] = {1, 1, 1, 1, 1};              // relative command weights
+    size_t message_size = 0;                                  // pad payloads to this size
+    bool verify = false;                                      // track and check every delivery
+    std::string unix_path;                                    // Unix socket instead of TCP
+    std::vector<Phase> phases = {{"steady", 10, 1000, 1000}};
+
+    double load_seconds() const {
+        double total = 0;
+        for (const Phase& phase : phases) total += phase.duration_s;
+        return total;
+    }
+};
+
+std::vector<std::pair<std::string,std::string>> read_users_file(const std::string& filename) {
+    std::vector<std::pair<std::string,std::string>> users;
+    std::ifstream file(filename);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t delimiter = line.find(':');
+        if (delimiter == std::string::npos) continue;
+        std::string username = line.substr(0, delimiter);
+        std::string password = line.substr(delimiter + 1);
+        username.erase(username.find_last_not_of(" \n\r\t") + 1);
+        password.erase(password.find_last_not_of(" \n\r\t") + 1);
+        users.emplace_back(username, password);
+    }
+    return users;
+}
+
+// One "key value..." setting per line; '#' starts a comment. Phases are
+// listed in the order they run. Returns false with a message on bad input.
+bool load_scenario(const std::string& path, Scenario& scenario, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
     }
 
-    sockaddr_in server_addr;
-    std::memset(&server_addr, 0, sizeof(server_addr));
+    bool generated_accounts = false;
+    std::string accounts_file;
+    std::vector<Phase> phases;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string key;
+        if (!(in >> key)) continue;
 
-    server_addr.sin_family      = AF_INET;
-    server_addr.sin_port        = htons(port);
-    server_addr.sin_addr.s_addr = inet_addr(host);
+        bool ok = true;
+        if (key == "users") {
+            ok = static_cast<bool>(in >> scenario.users) && scenario.users > 0;
+        } else if (key == "accounts") {
+            std::string source;
+            ok = static_cast<bool>(in >> source);
+            generated_accounts = source == "generated";
+            if (!generated_accounts) accounts_file = source;
+        } else if (key == "threads") {
+            ok = static_cast<bool>(in >> scenario.threads) && scenario.threads > 0;
+        } else if (key == "groups") {
+            int count = 0;
+            ok = static_cast<bool>(in >> count) && count > 0;
+            scenario.groups.clear();
+            for (int i = 0; ok && i < count; ++i) scenario.groups.push_back("g" + std::to_string(i));
+        } else if (key == "group_size") {
+            std::string kind;
+            ok = static_cast<bool>(in >> kind);
+            if (kind == "zipf") ok = static_cast<bool>(in >> scenario.zipf_exponent) && scenario.zipf_exponent > 0;
+            else if (kind == "uniform") scenario.zipf_exponent = 0;
+            else ok = false;
+        } else if (key == "memberships") {
+            ok = static_cast<bool>(in >> scenario.memberships) && scenario.memberships >= 0;
+        } else if (key == "setup") {
+            ok = static_cast<bool>(in >> scenario.setup_s) && scenario.setup_s >= 0;
+        } else if (key == "drain") {
+            ok = static_cast<bool>(in >> scenario.drain_s) && scenario.drain_s >= 0;
+        } else if (key == "message_size") {
+            ok = static_cast<bool>(in >> scenario.message_size);
+        } else if (key == "unix") {
+            ok = static_cast<bool>(in >> scenario.unix_path);
+        } else if (key == "verify") {
+            std::string value;
+            ok = static_cast<bool>(in >> value) && (value == "on" || value == "off");
+            scenario.verify = value == "on";
+        } else if (key == "mix") {
+            std::fill(std::begin(scenario.mix), std::end(scenario.mix), 0.0);
+            std::string item;
+            while (ok && in >> item) {
+                size_t eq = item.find('=');
+                int type = -1;
+                for (int t = 0; t < COMMAND_TYPES; ++t) {
+                    if (eq != std::string::npos && item.compare(0, eq, COMMAND_NAMES[t]) == 0) type = t;
+                }
+                ok = type >= 0;
+                if (ok) scenario.mix[type] = std::stod(item.substr(eq + 1));
+            }
+        } else if (key == "phase") {
+            Phase phase;
+            ok = static_cast<bool>(in >> phase.name >> phase.duration_s >> phase.rate_start) &&
+                 phase.duration_s > 0 && phase.rate_start >= 0;
+            if (!(in >> phase.rate_end)) phase.rate_end = phase.rate_start;
+            phases.push_back(phase);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = path + ":" + std::to_string(line_number) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
 
-    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "[Error] Failed to connect to server.\n";
-        close(sockfd);
-        return -1;
+    if (generated_accounts) {
+        // Same naming as build_userdb --generate
+        scenario.accounts.clear();
+        for (int i = 0; i < scenario.users; ++i) {
+            scenario.accounts.emplace_back("user" + std::to_string(i), "pass" + std::to_string(i));
+        }
+    } else if (!accounts_file.empty()) {
+        scenario.accounts = read_users_file(accounts_file);
     }
-    return sockfd;
+    if (!phases.empty()) scenario.phases = phases;
+    return true;
 }
 
 // -------------------------------------------------------------------
-// Utility: receive a line (up to BUFFER_SIZE) from socket
-//          This is a simplistic approach; may read partial messages
+// Per-thread counters, merged after the run
 // -------------------------------------------------------------------
-std::string recv_line(int sockfd) {
-    char buffer[BUFFER_SIZE];
-    std::memset(buffer, 0, BUFFER_SIZE);
-    int n = recv(sockfd, buffer, BUFFER_SIZE-1, 0);
-    if (n <= 0) {
-        return ""; // indicates closed or error
+struct PhaseStats {
+    LatencyHistogram latency[MESSAGE_TYPES];   // intended send time -> delivery
+    LatencyHistogram send_lag;                 // intended send time -> actual send
+    uint64_t sent[COMMAND_TYPES] = {};
+    uint64_t delivered[MESSAGE_TYPES] = {};
+    uint64_t server_errors = 0;
+
+    void merge(const PhaseStats& other) {
+        for (int t = 0; t < MESSAGE_TYPES; ++t) {
+            latency[t].merge(other.latency[t]);
+            delivered[t] += other.delivered[t];
+        }
+        for (int t = 0; t < COMMAND_TYPES; ++t) sent[t] += other.sent[t];
+        send_lag.merge(other.send_lag);
+        server_errors += other.server_errors;
     }
-    return std::string(buffer);
-}
+};
+
+struct Stats {
+    std::vector<PhaseStats> phases;
+    uint64_t reordered[MESSAGE_TYPES] = {};   // arrived after a later message from the same sender
+    uint64_t established = 0;
+    uint64_t connect_failures = 0;
+    uint64_t auth_failures = 0;
+    uint64_t disconnects = 0;
+    uint64_t setup_errors = 0;       // "[Error]" replies before the first phase
+    uint64_t write_errors = 0;
+    uint64_t skipped = 0;            // arrivals with no connection able to take them
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+
+    explicit Stats(size_t phase_count = 0) : phases(phase_count) {}
+
+    void merge(const Stats& other) {
+        for (size_t p = 0; p < phases.size(); ++p) phases[p].merge(other.phases[p]);
+        for (int t = 0; t < MESSAGE_TYPES; ++t) reordered[t] += other.reordered[t];
+        established += other.established;
+        connect_failures += other.connect_failures;
+        auth_failures += other.auth_failures;
+        disconnects += other.disconnects;
+        setup_errors += other.setup_errors;
+        write_errors += other.write_errors;
+        skipped += other.skipped;
+        bytes_sent += other.bytes_sent;
+        bytes_received += other.bytes_received;
+    }
+};
 
 // -------------------------------------------------------------------
-// Utility: send a line with newline
+// Verification: what was sent to whom, and what actually arrived
 // -------------------------------------------------------------------
-void send_line(int sockfd, const std::string &line) {
-    // You can decide whether to append a newline
-    // The server code typically just reads up to buffer length.
-    // We'll send exactly the line as is, no extra newline unless you want it.
-    send(sockfd, line.c_str(), line.size(), 0);
-}
+struct SentRecord {
+    uint32_t sender;                 // connection index
+    uint32_t seq;                    // per-sender sequence number
+    int type;
+    int target;                      // group index, or account index for private messages
+    uint64_t sent_at;
+    std::vector<uint32_t> expected;  // sorted recipient connections (broadcast, group)
+};
+
+struct DeliveryRecord {
+    uint32_t sender;
+    uint32_t seq;
+    uint32_t recipient;
+};
+
+// Memberships as the generator has seen them confirmed, shared by all
+// workers. A join counts once the server has acknowledged it; a leave counts
+// as soon as it is sent, so a message racing a membership change is never
+// blamed on the server. Missing deliveries to a recipient that left the
+// group or disconnected after the message was sent are excused, not lost.
+//
+// Leave and disconnect times are taken under the same lock as expected()'s
+// snapshot: a recipient still in the snapshot left after it, and therefore
+// after the message's intended send time.
+//
+// The server answers a connection's commands in order, so a join
+// acknowledged while a later leave of the same group is still unanswered
+// is already undone: it is ignored rather than re-adding the member.
+class MembershipRegistry {
+private:
+    std::mutex mutex;
+    std::vector<std::vector<uint32_t>> members;                    // group -> sorted connections
+    std::vector<uint32_t> active;                                  // sorted logged-in connections
+    std::unordered_map<uint64_t, std::vector<uint64_t>> leave_times;  // (conn, group) -> times
+    std::unordered_map<uint64_t, uint32_t> unanswered_leaves;      // (conn, group) -> leaves in flight
+    std::vector<uint64_t> disconnected_at;                         // 0 while connected
+
+    static void insert_sorted(std::vector<uint32_t>& v, uint32_t value) {
+        auto it = std::lower_bound(v.begin(), v.end(), value);
+        if (it == v.end() || *it != value) v.insert(it, value);
+    }
+
+    static void erase_sorted(std::vector<uint32_t>& v, uint32_t value) {
+        auto it = std::lower_bound(v.begin(), v.end(), value);
+        if (it != v.end() && *it == value) v.erase(it);
+    }
+
+    static uint64_t key(uint32_t conn, int group) { return (uint64_t(conn) << 32) | uint32_t(group); }
+
+public:
+    MembershipRegistry(size_t groups, size_t connections)
+        : members(groups), disconnected_at(connections, 0) {}
+
+    void logged_in(uint32_t conn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert_sorted(active, conn);
+    }
+
+    void disconnected(uint32_t conn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t t = now_ns();
+        erase_sorted(active, conn);
+        for (size_t group = 0; group < members.size(); ++group) {
+            erase_sorted(members[group], conn);
+            unanswered_leaves.erase(key(conn, group));
+        }
+        disconnected_at[conn] = t;
+    }
+
+    void joined(uint32_t conn, int group) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = unanswered_leaves.find(key(conn, group));
+        if (it != unanswered_leaves.end() && it->second > 0) return;   // answers a join sent before the leave
+        insert_sorted(members[group], conn);
+    }
+
+    void leaving(uint32_t conn, int group) {
+        std::lock_guard<std::mutex> lock(mutex);
+        erase_sorted(members[group], conn);
+        leave_times[key(conn, group)].push_back(now_ns());
+        ++unanswered_leaves[key(conn, group)];
+    }
+
+    // "You left the group g." answers the oldest leave in flight. A leave the
+    // server rejects is never answered by name; its joins stay ignored, which
+    // can only turn deliveries into "unexpected", never into "lost".
+    void left(uint32_t conn, int group) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = unanswered_leaves.find(key(conn, group));
+        if (it != unanswered_leaves.end() && --it->second == 0) unanswered_leaves.erase(it);
+    }
+
+    // Recipients a broadcast (group < 0) or group message should reach
+    std::vector<uint32_t> expected(uint32_t sender, int group) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<uint32_t> result = group < 0 ? active : members[group];
+        erase_sorted(result, sender);
+        return result;
+    }
+
+    // Read after the workers have stopped
+    bool excused(uint32_t conn, int group, uint64_t sent_at) const {
+        if (disconnected_at[conn] != 0 && disconnected_at[conn] >= sent_at) return true;
+        if (group < 0) return false;
+        auto it = leave_times.find(key(conn, group));
+        if (it == leave_times.end()) return false;
+        for (uint64_t t : it->second) {
+            if (t >= sent_at) return true;
+        }
+        return false;
+    }
+};
+
+// -------------------------------------------------------------------
+// Timeline: absolute start/end of every phase, shared by all workers
+// -------------------------------------------------------------------
+class Timeline {
+private:
+    const Scenario& scenario;
+    std::vector<uint64_t> boundaries;    // phase p runs [boundaries[p], boundaries[p + 1])
+
+public:
+    Timeline(const Scenario& scenario, uint64_t load_start) : scenario(scenario) {
+        double offset = 0;
+        boundaries.push_back(load_start);
+        for (const Phase& phase : scenario.phases) {
+            offset += phase.duration_s;
+            boundaries.push_back(load_start + uint64_t(offset * 1e9));
+        }
+    }
+
+    uint64_t load_start() const { return boundaries.front(); }
+    uint64_t load_end() const { return boundaries.back(); }
+
+    // Phase index for a timestamp inside the load window, -1 outside
+    int phase_of(uint64_t t) const {
+        if (t < boundaries.front() || t >= boundaries.back()) return -1;
+        auto it = std::upper_bound(boundaries.begin(), boundaries.end(), t);
+        return int(it - boundaries.begin()) - 1;
+    }
+
+    // Offered rate (commands/s over all users) at time t
+    double rate_at(uint64_t t) const {
+        int p = phase_of(t);
+        if (p < 0) return 0;
+        const Phase& phase = scenario.phases[p];
+        double progress = double(t - boundaries[p]) / double(boundaries[p + 1] - boundaries[p]);
+        return phase.rate_start + (phase.rate_end - phase.rate_start) * progress;
+    }
+};
 
 // -------------------------------------------------------------------
-// Worker function: each thread simulates a single client
-// -------------------------------------------------------------------
-void simulate_client(int index) {
-    int sockfd = connect_to_server(SERVER_HOST, SERVER_PORT);
-    if (sockfd < 0) {
-        std::cerr << "[Client " << index << "] Unable to connect.\n";
-        return;
-    }
-
-    // Select user credentials (cycling or random)
-    auto user_cred = TEST_USERS[ index % TEST_USERS.size() ];
-    const std::string& username = user_cred.first;
-    const std::string& password = user_cred.second;
-
-    // Print which user we’re simulating
-    std::cout << "[Client " << index << "] Using credentials: ("
-              << username << ", " << password << ")\n";
-
-    // Read "Enter username:" prompt
-    std::string prompt1 = recv_line(sockfd);
-    if (prompt1.empty()) {
-        std::cerr << "[Client " << index << "] Server closed immediately.\n";
-        close(sockfd);
-        return;
-    }
-    // Send username
-    send_line(sockfd, username);
-
-    // Read "Enter password:"
-    std::string prompt2 = recv_line(sockfd);
-    if (prompt2.empty()) {
-        std::cerr << "[Client " << index << "] No password prompt.\n";
-        close(sockfd);
-        return;
-    }
-    // Send password
-    send_line(sockfd, password);
-
-    // Read auth response
-    std::string auth_resp = recv_line(sockfd);
-    if (auth_resp.find("failed") != std::string::npos ||
-        auth_resp.find("Error")  != std::string::npos)
-    {
-        std::cerr << "[Client " << index << "] Authentication failed for "
-                  << username << ".\n";
-        close(sockfd);
-        return;
-    }
-    // Otherwise, auth is successful
-    std::cout << "[Client " << index << "] Authenticated successfully.\n";
-
-    // Random engine and distributions
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dist_action(0, 5);   // pick an action
-    std::uniform_int_distribution<> dist_sleep(500, 1500); // ms
-    std::uniform_int_distribution<> dist_msgs(0, RANDOM_MESSAGES.size()-1);
-    std::uniform_int_distribution<> dist_groups(0, GROUP_NAMES.size()-1);
-    std::uniform_int_distribution<> dist_users(0, TEST_USERS.size()-1);
-
-    // Send 5 random commands
-    for (int i = 0; i < 5; ++i) {
-        int action = dist_action(gen);
+// Worker: one epoll loop driving a slice of the connections
+// -------------------------------------------------------------------
+class Worker {
+private:
+    enum class State { Connecting, Authenticating, Active, Closed };
+
+    struct Connection {
+        int fd = -1;
+        uint32_t id = 0;               // global connection index
+        State state = State::Connecting;
+        std::string username;
+        std::string password;
+        std::vector<int> groups;       // indices into scenario.groups
+        std::string in;
+        std::string out;
+        bool want_write = false;
+        uint32_t next_seq = 0;                                // IDs for messages we send
+        std::unordered_map<uint32_t, uint32_t> last_seq;      // sender -> highest seq seen
+    };
+
+    const Scenario& scenario;
+    const Timeline& timeline;
+    MembershipRegistry* registry;      // only with --verify
+    std::unordered_map<std::string, int> group_index;
+    int thread_count;
+    int epoll_fd = -1;
+    std::vector<Connection> connections;
+    std::mt19937_64 gen;
+    std::discrete_distribution<int> pick_group;     // Zipf (or uniform) over groups
+    std::discrete_distribution<int> pick_command;
+
+public:
+    Stats stats;
+    std::vector<SentRecord> sent_log;
+    std::vector<DeliveryRecord> delivery_log;
+
+    Worker(const Scenario& scenario, const Timeline& timeline, MembershipRegistry* registry,
+           int id, int thread_count)
+        : scenario(scenario), timeline(timeline), registry(registry), thread_count(thread_count),
+          gen(std::random_device{}() + id),
+          pick_command(std::begin(scenario.mix), std::end(scenario.mix)),
+          stats(scenario.phases.size()) {
+        std::vector<double> weights;
+        for (size_t k = 0; k < scenario.groups.size(); ++k) {
+            weights.push_back(1.0 / std::pow(double(k + 1), scenario.zipf_exponent));
+        }
+        pick_group = std::discrete_distribution<int>(weights.begin(), weights.end());
+        for (size_t k = 0; k < scenario.groups.size(); ++k) group_index[scenario.groups[k]] = k;
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        for (int i = id; i < scenario.users; i += thread_count) {
+            Connection conn;
+            conn.id = i;
+            const auto& account = scenario.accounts[i % scenario.accounts.size()];
+            conn.username = account.first;
+            conn.password = account.second;
+            int wanted = std::min<int>(scenario.memberships, scenario.groups.size());
+            while (int(conn.groups.size()) < wanted) {
+                int group = pick_group(gen);
+                if (std::find(conn.groups.begin(), conn.groups.end(), group) == conn.groups.end()) {
+                    conn.groups.push_back(group);
+                }
+            }
+            connections.push_back(std::move(conn));
+        }
+    }
+
+    ~Worker() {
+        for (auto& conn : connections) {
+            if (conn.fd >= 0) close(conn.fd);
+        }
+        close(epoll_fd);
+    }
+
+    void run(uint64_t stop_ns) {
+        for (size_t i = 0; i < connections.size(); ++i) open_connection(i);
+
+        // This worker's share of the arrivals: an independent Poisson process
+        // at rate / threads, which sums to the scenario rate over all workers.
+        uint64_t next_arrival = timeline.load_start();
+        std::vector<epoll_event> events(1024);
+        while (true) {
+            uint64_t now = now_ns();
+            if (now >= stop_ns) break;
+
+            // Open loop: every arrival that is due goes out now, however late
+            while (next_arrival <= now && next_arrival < timeline.load_end()) {
+                double rate = timeline.rate_at(next_arrival) / thread_count;
+                if (rate > 0) {
+                    send_command(next_arrival, now);
+                    std::exponential_distribution<double> gap(rate);
+                    next_arrival += std::max<uint64_t>(1, uint64_t(gap(gen) * 1e9));
+                } else {
+                    next_arrival += 1000000;   // idle phase: look again in 1 ms
+                }
+            }
+
+            uint64_t wake = stop_ns;
+            if (next_arrival < timeline.load_end()) wake = std::min(wake, next_arrival);
+            int timeout_ms = int(std::min<uint64_t>((wake - std::min(wake, now)) / 1000000, 100));
+
+            int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout_ms);
+            for (int i = 0; i < n; ++i) {
+                handle_event(events[i].data.u32, events[i].events);
+            }
+        }
+
+        // Log out cleanly so the server sees orderly departures
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (connections[i].state == State::Active) {
+                queue_write(i, "/exit\n");
+            }
+        }
+    }
+
+private:
+    void open_connection(size_t index) {
+        Connection& conn = connections[index];
+        bool local = !scenario.unix_path.empty();
+        conn.fd = socket(local ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0) {
+            ++stats.connect_failures;
+            conn.state = State::Closed;
+            return;
+        }
+
+        int rc;
+        if (local) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            strncpy(address.sun_path, scenario.unix_path.c_str(), sizeof(address.sun_path) - 1);
+            rc = connect(conn.fd, (sockaddr*)&address, sizeof(address));
+        } else {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(SERVER_PORT);
+            address.sin_addr.s_addr = inet_addr(SERVER_HOST);
+            rc = connect(conn.fd, (sockaddr*)&address, sizeof(address));
+        }
+        if (rc < 0 && errno != EINPROGRESS) {
+            ++stats.connect_failures;
+            close_connection(index, false);
+            return;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        event.data.u32 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &event);
+        conn.want_write = true;
+    }
+
+    void close_connection(size_t index, bool count_disconnect) {
+        Connection& conn = connections[index];
+        if (conn.state == State::Closed && conn.fd < 0) return;
+        if (count_disconnect) ++stats.disconnects;
+        if (registry && conn.state == State::Active) registry->disconnected(conn.id);
+        if (conn.fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+            close(conn.fd);
+        }
+        conn.fd = -1;
+        conn.state = State::Closed;
+        conn.out.clear();
+    }
+
+    void update_interest(size_t index) {
+        Connection& conn = connections[index];
+        bool want_write = !conn.out.empty() || conn.state == State::Connecting;
+        if (want_write == conn.want_write) return;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (want_write ? uint32_t(EPOLLOUT) : 0u);
+        event.data.u32 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.want_write = want_write;
+    }
+
+    void flush(size_t index) {
+        Connection& conn = connections[index];
+        while (!conn.out.empty()) {
+            ssize_t n = send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno == EINTR) continue;
+                ++stats.write_errors;
+                close_connection(index, true);
+                return;
+            }
+            stats.bytes_sent += n;
+            conn.out.erase(0, n);
+        }
+        update_interest(index);
+    }
+
+    void queue_write(size_t index, const std::string& data) {
+        Connection& conn = connections[index];
+        if (conn.fd < 0) return;
+        conn.out += data;
+        flush(index);
+    }
+
+    void handle_event(size_t index, uint32_t events) {
+        Connection& conn = connections[index];
+        if (conn.fd < 0) return;
+
+        if (conn.state == State::Connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error != 0) {
+                ++stats.connect_failures;
+                close_connection(index, false);
+                return;
+            }
+            // Credentials are pipelined; the server reads them line by line
+            conn.state = State::Authenticating;
+            queue_write(index, conn.username + "\n" + conn.password + "\n");
+            if (conn.fd < 0) return;
+        }
+
+        if (events & EPOLLIN) {
+            char buffer[READ_CHUNK];
+            while (true) {
+                ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    stats.bytes_received += n;
+                    conn.in.append(buffer, n);
+                    continue;
+                }
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    process_lines(index);
+                    close_connection(index, true);
+                    return;
+                }
+                if (errno != EINTR) break;
+            }
+            process_lines(index);
+            if (conn.fd < 0) return;
+        } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            close_connection(index, true);
+            return;
+        }
+
+        if ((events & EPOLLOUT) && !conn.out.empty()) flush(index);
+    }
+
+    void process_lines(size_t index) {
+        Connection& conn = connections[index];
+        size_t start = 0;
+        while (true) {
+            size_t pos = conn.in.find('\n', start);
+            if (pos == std::string::npos) break;
+            handle_line(index, std::string_view(conn.in).substr(start, pos - start));
+            if (conn.fd < 0) return;
+            start = pos + 1;
+        }
+        conn.in.erase(0, start);
+    }
+
+    void handle_line(size_t index, std::string_view line) {
+        Connection& conn = connections[index];
+        if (conn.state == State::Authenticating) {
+            if (line.find("Authentication successful") != std::string_view::npos) {
+                conn.state = State::Active;
+                ++stats.established;
+                if (registry) registry->logged_in(conn.id);
+                // Creating an existing group fails harmlessly; joining is idempotent
+                std::string setup;
+                for (int group : conn.groups) {
+                    setup += "/create_group " + scenario.groups[group] + "\n";
+                    setup += "/join_group " + scenario.groups[group] + "\n";
+                }
+                if (!setup.empty()) queue_write(index, setup);
+            } else if (line.find("Authentication failed") != std::string_view::npos) {
+                ++stats.auth_failures;
+                close_connection(index, false);
+            }
+            return;
+        }
+
+        if (registry) track_membership(conn, line);
+
+        if (line.starts_with("[Error]")) {
+            int phase = timeline.phase_of(now_ns());
+            if (phase >= 0) ++stats.phases[phase].server_errors;
+            else ++stats.setup_errors;
+            return;
+        }
+
+        int type;
+        if (line.starts_with("[Broadcast ")) type = BROADCAST;
+        else if (line.starts_with("[Private ")) type = PRIVATE;
+        else if (line.starts_with("[Group ")) type = GROUP;
+        else return;
+
+        size_t stamp = line.rfind("@T");
+        if (stamp == std::string_view::npos) return;   // announcements carry no timestamp
+        uint64_t sent_at = 0;
+        for (size_t i = stamp + 2; i < line.size() && line[i] >= '0' && line[i] <= '9'; ++i) {
+            sent_at = sent_at * 10 + (line[i] - '0');
+        }
+        int phase = timeline.phase_of(sent_at);
+        if (phase < 0) return;
+        uint64_t now = now_ns();
+        ++stats.phases[phase].delivered[type];
+        stats.phases[phase].latency[type].record(now > sent_at ? now - sent_at : 0);
+
+        if (registry) record_delivery(conn, type, line.substr(stamp));
+    }
+
+    // "Group g created." and "You joined the group g." confirm a membership;
+    // "You left the group g." answers a leave
+    void track_membership(const Connection& conn, std::string_view line) {
+        static constexpr std::string_view CREATED = "Group ", CREATED_END = " created.";
+        static constexpr std::string_view JOINED = "You joined the group ";
+        static constexpr std::string_view LEFT = "You left the group ";
+        std::string_view name;
+        bool joined = true;
+        if (line.starts_with(JOINED) && line.ends_with(".")) {
+            name = line.substr(JOINED.size(), line.size() - JOINED.size() - 1);
+        } else if (line.starts_with(CREATED) && line.ends_with(CREATED_END)) {
+            name = line.substr(CREATED.size(), line.size() - CREATED.size() - CREATED_END.size());
+        } else if (line.starts_with(LEFT) && line.ends_with(".")) {
+            name = line.substr(LEFT.size(), line.size() - LEFT.size() - 1);
+            joined = false;
+        } else {
+            return;
+        }
+        auto it = group_index.find(std::string(name));
+        if (it == group_index.end()) return;
+        if (joined) registry->joined(conn.id, it->second);
+        else registry->left(conn.id, it->second);
+    }
+
+    // tail is "@T<ns> #<sender>:<seq>"
+    void record_delivery(Connection& conn, int type, std::string_view tail) {
+        size_t hash = tail.find(" #");
+        size_t colon = tail.find(':', hash);
+        if (hash == std::string_view::npos || colon == std::string_view::npos) return;
+        uint32_t sender = std::stoul(std::string(tail.substr(hash + 2, colon - hash - 2)));
+        uint32_t seq = std::stoul(std::string(tail.substr(colon + 1)));
+
+        // A sender's commands are handled in order by one server thread, so
+        // its messages must arrive in sequence on every connection
+        auto [it, first] = conn.last_seq.try_emplace(sender, seq);
+        if (!first) {
+            if (seq < it->second) ++stats.reordered[type];
+            else it->second = seq;
+        }
+        delivery_log.push_back({sender, seq, conn.id});
+    }
+
+    std::string payload() {
+        std::uniform_int_distribution<> dist_msgs(0, RANDOM_MESSAGES.size() - 1);
+        std::string text = RANDOM_MESSAGES[dist_msgs(gen)];
+        if (text.size() < scenario.message_size) text.resize(scenario.message_size, '.');
+        return text;
+    }
+
+    // Issues one command for an arrival scheduled at `intended`
+    void send_command(uint64_t intended, uint64_t now) {
+        std::uniform_int_distribution<size_t> dist_conn(0, connections.size() - 1);
+        size_t index = dist_conn(gen);
+        for (size_t tries = 0; tries < connections.size() && connections[index].state != State::Active; ++tries) {
+            index = (index + 1) % connections.size();
+        }
+        if (connections[index].state != State::Active) {
+            ++stats.skipped;
+            return;
+        }
+        Connection& conn = connections[index];
+
+        int type = pick_command(gen);
+        if (type == GROUP && conn.groups.empty()) type = BROADCAST;
+        if (type == LEAVE && conn.groups.empty()) type = JOIN;
+
+        std::string stamp = " @T" + std::to_string(intended);
+        SentRecord record{conn.id, 0, type, -1, intended, {}};
+        if (registry && type < MESSAGE_TYPES) {
+            record.seq = conn.next_seq++;
+            stamp += " #" + std::to_string(conn.id) + ":" + std::to_string(record.seq);
+        }
         std::string cmd;
+        switch (type) {
+            case BROADCAST:
+                cmd = "/broadcast " + payload() + stamp;
+                break;
+            case GROUP: {
+                std::uniform_int_distribution<size_t> dist_own(0, conn.groups.size() - 1);
+                record.target = conn.groups[dist_own(gen)];
+                cmd = "/group_msg " + scenario.groups[record.target] + " " + payload() + stamp;
+                break;
+            }
+            case PRIVATE: {
+                std::uniform_int_distribution<int> dist_user(0, scenario.users - 1);
+                record.target = dist_user(gen) % scenario.accounts.size();
+                cmd = "/msg " + scenario.accounts[record.target].first + " " + payload() + stamp;
+                break;
+            }
+            case JOIN: {
+                int group = pick_group(gen);
+                if (std::find(conn.groups.begin(), conn.groups.end(), group) == conn.groups.end()) {
+                    conn.groups.push_back(group);
+                }
+                cmd = "/join_group " + scenario.groups[group];
+                break;
+            }
+            case LEAVE: {
+                std::uniform_int_distribution<size_t> dist_own(0, conn.groups.size() - 1);
+                size_t pos = dist_own(gen);
+                cmd = "/leave_group " + scenario.groups[conn.groups[pos]];
+                if (registry) registry->leaving(conn.id, conn.groups[pos]);
+                conn.groups.erase(conn.groups.begin() + pos);
+                break;
+            }
+        }
 
-        switch (action) {
-            case 0: {
-                // /broadcast <message>
-                int msg_idx = dist_msgs(gen);
-                cmd = "/broadcast " + RANDOM_MESSAGES[msg_idx];
-            } break;
-            case 1: {
-                // /group_msg <group_name> <message>
-                int g_idx = dist_groups(gen);
-                int msg_idx = dist_msgs(gen);
-                cmd = "/group_msg " + GROUP_NAMES[g_idx] + " " + RANDOM_MESSAGES[msg_idx];
-            } break;
-            case 2: {
-                // /msg <username> <message>
-                int usr_idx = dist_users(gen);
-                int msg_idx = dist_msgs(gen);
-                cmd = "/msg " + TEST_USERS[usr_idx].first + " " + RANDOM_MESSAGES[msg_idx];
-            } break;
-            case 3: {
-                // /create_group <group_name>
-                int g_idx = dist_groups(gen);
-                cmd = "/create_group " + GROUP_NAMES[g_idx];
-            } break;
-            case 4: {
-                // /join_group <group_name>
-                int g_idx = dist_groups(gen);
-                cmd = "/join_group " + GROUP_NAMES[g_idx];
-            } break;
-            case 5: {
-                // /leave_group <group_name>
-                int g_idx = dist_groups(gen);
-                cmd = "/leave_group " + GROUP_NAMES[g_idx];
-            } break;
-        }
-
-        // **Print the command** for visibility
-        std::cout << "[Client " << index << "] Sending command: " << cmd << "\n";
-
-        // Send it
-        send_line(sockfd, cmd);
-
-        // Sleep 0.5 to 1.5 seconds
-        int ms = dist_sleep(gen);
-        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
-    }
-
-    // Disconnect
-    std::string exit_cmd = "/exit";
-    std::cout << "[Client " << index << "] Sending command: " << exit_cmd << "\n";
-    send_line(sockfd, exit_cmd);
-
-    close(sockfd);
-    std::cout << "[Client " << index << "] Disconnected.\n";
+        if (registry && type < MESSAGE_TYPES) {
+            if (type != PRIVATE) record.expected = registry->expected(conn.id, record.target);
+            sent_log.push_back(std::move(record));
+        }
+
+        PhaseStats& phase = stats.phases[timeline.phase_of(intended)];
+        ++phase.sent[type];
+        phase.send_lag.record(now - intended);
+        queue_write(index, cmd + "\n");
+    }
+};
+
+// -------------------------------------------------------------------
+// Delivery verification, run once all workers have stopped
+// -------------------------------------------------------------------
+struct VerifyResult {
+    uint64_t messages = 0;
+    uint64_t expected = 0;       // deliveries the generator predicted
+    uint64_t delivered = 0;      // distinct deliveries that arrived
+    uint64_t lost = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+    uint64_t unexpected = 0;     // arrived at a connection not in the snapshot (late join)
+    uint64_t excused = 0;        // missing, but the recipient left or disconnected meanwhile
+};
+
+// Matches every sent message against the deliveries logged for its ID
+void verify_deliveries(const std::vector<std::unique_ptr<Worker>>& workers, const MembershipRegistry& registry,
+                       const Stats& total, VerifyResult (&results)[MESSAGE_TYPES]) {
+    std::vector<const SentRecord*> sent;
+    std::vector<DeliveryRecord> deliveries;
+    for (const auto& worker : workers) {
+        for (const SentRecord& record : worker->sent_log) sent.push_back(&record);
+        deliveries.insert(deliveries.end(), worker->delivery_log.begin(), worker->delivery_log.end());
+    }
+    auto id_less = [](uint32_t s1, uint32_t q1, uint32_t s2, uint32_t q2) {
+        return s1 != s2 ? s1 < s2 : q1 < q2;
+    };
+    std::sort(sent.begin(), sent.end(), [&](const SentRecord* a, const SentRecord* b) {
+        return id_less(a->sender, a->seq, b->sender, b->seq);
+    });
+    std::sort(deliveries.begin(), deliveries.end(), [&](const DeliveryRecord& a, const DeliveryRecord& b) {
+        if (a.sender != b.sender || a.seq != b.seq) return id_less(a.sender, a.seq, b.sender, b.seq);
+        return a.recipient < b.recipient;
+    });
+
+    size_t d = 0;
+    std::vector<uint32_t> received;
+    for (const SentRecord* message : sent) {
+        while (d < deliveries.size() && id_less(deliveries[d].sender, deliveries[d].seq, message->sender, message->seq)) {
+            ++d;
+        }
+        received.clear();
+        for (; d < deliveries.size() && deliveries[d].sender == message->sender && deliveries[d].seq == message->seq; ++d) {
+            received.push_back(deliveries[d].recipient);
+        }
+
+        VerifyResult& result = results[message->type];
+        ++result.messages;
+        size_t before = received.size();
+        received.erase(std::unique(received.begin(), received.end()), received.end());
+        result.duplicated += before - received.size();
+
+        if (message->type == PRIVATE) {
+            // The server picks one connection logged in under the target name
+            ++result.expected;
+            if (received.empty()) {
+                ++result.lost;
+            } else {
+                ++result.delivered;
+                result.duplicated += received.size() - 1;
+            }
+            continue;
+        }
+
+        int group = message->type == GROUP ? message->target : -1;
+        result.expected += message->expected.size();
+        result.delivered += received.size();
+        std::vector<uint32_t> missing, extra;
+        std::set_difference(message->expected.begin(), message->expected.end(),
+                            received.begin(), received.end(), std::back_inserter(missing));
+        std::set_difference(received.begin(), received.end(),
+                            message->expected.begin(), message->expected.end(), std::back_inserter(extra));
+        result.unexpected += extra.size();
+        for (uint32_t recipient : missing) {
+            if (registry.excused(recipient, group, message->sent_at)) ++result.excused;
+            else ++result.lost;
+        }
+    }
+    for (int t = 0; t < MESSAGE_TYPES; ++t) results[t].reordered = total.reordered[t];
+}
+
+void write_verify_json(std::ostream& out, const VerifyResult (&results)[MESSAGE_TYPES]) {
+    out << "  \"verification\": {";
+    for (int t = 0; t < MESSAGE_TYPES; ++t) {
+        const VerifyResult& r = results[t];
+        out << (t ? "," : "") << "\n    \"" << COMMAND_NAMES[t] << "\": {\"messages\": " << r.messages
+            << ", \"expected\": " << r.expected << ", \"delivered\": " << r.delivered
+            << ", \"lost\": " << r.lost << ", \"duplicated\": " << r.duplicated
+            << ", \"reordered\": " << r.reordered << ", \"unexpected\": " << r.unexpected
+            << ", \"excused\": " << r.excused << "}";
+    }
+    out << "\n  },\n";
 }
 
 // -------------------------------------------------------------------
-// Main: spawn multiple client threads
+// Report
 // -------------------------------------------------------------------
-int main() {
-    std::vector<std::thread> threads;
-    threads.reserve(NUM_CLIENTS);
+// Throughput, per-type latency and errors for one phase (or the whole run)
+void write_phase_json(std::ostream& out, const PhaseStats& stats, double seconds, const std::string& indent) {
+    uint64_t sent = 0, delivered = 0;
+    LatencyHistogram all;
+    for (int t = 0; t < COMMAND_TYPES; ++t) sent += stats.sent[t];
+    for (int t = 0; t < MESSAGE_TYPES; ++t) {
+        delivered += stats.delivered[t];
+        all.merge(stats.latency[t]);
+    }
 
-    for (int i = 0; i < NUM_CLIENTS; i++) {
-        threads.emplace_back(simulate_client, i);
-        // Optionally stagger starts slightly
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    out << indent << "\"sent\": {";
+    for (int t = 0; t < COMMAND_TYPES; ++t) out << (t ? ", " : "") << "\"" << COMMAND_NAMES[t] << "\": " << stats.sent[t];
+    out << "},\n";
+    out << indent << "\"delivered\": {";
+    for (int t = 0; t < MESSAGE_TYPES; ++t) out << (t ? ", " : "") << "\"" << COMMAND_NAMES[t] << "\": " << stats.delivered[t];
+    out << "},\n";
+    out << indent << "\"throughput\": {\"commands_per_sec\": " << sent / seconds
+        << ", \"deliveries_per_sec\": " << delivered / seconds << "},\n";
+    out << indent << "\"latency_us\": {";
+    for (int t = 0; t < MESSAGE_TYPES; ++t) {
+        out << "\n" << indent << "  \"" << COMMAND_NAMES[t] << "\": ";
+        stats.latency[t].write_json(out, 1000.0);
+        out << ",";
     }
+    out << "\n" << indent << "  \"all\": ";
+    all.write_json(out, 1000.0);
+    out << "\n" << indent << "},\n";
+    out << indent << "\"send_lag_us\": ";
+    stats.send_lag.write_json(out, 1000.0);
+    out << ",\n";
+    out << indent << "\"server_errors\": " << stats.server_errors << "\n";
+}
+
+void print_report(const Scenario& scenario, const Stats& total, const VerifyResult (*verification)[MESSAGE_TYPES]) {
+    std::ostream& out = std::cout;
+    out << std::fixed << std::setprecision(1);
+    out << "{\n";
+    out << "  \"config\": {\"users\": " << scenario.users
+        << ", \"threads\": " << scenario.threads
+        << ", \"groups\": " << scenario.groups.size()
+        << ", \"zipf_exponent\": " << scenario.zipf_exponent
+        << ", \"memberships\": " << scenario.memberships
+        << ", \"transport\": \"" << (scenario.unix_path.empty() ? "tcp" : "unix") << "\"},\n";
+    out << "  \"connections\": {\"established\": " << total.established
+        << ", \"connect_failures\": " << total.connect_failures
+        << ", \"auth_failures\": " << total.auth_failures
+        << ", \"disconnects\": " << total.disconnects << "},\n";
+    out << "  \"errors\": {\"setup_errors\": " << total.setup_errors
+        << ", \"write_errors\": " << total.write_errors
+        << ", \"skipped_arrivals\": " << total.skipped << "},\n";
+    out << "  \"bytes\": {\"sent\": " << total.bytes_sent << ", \"received\": " << total.bytes_received << "},\n";
+    if (verification) write_verify_json(out, *verification);
 
-    // Wait for all
+    out << "  \"phases\": [";
+    PhaseStats overall;
+    for (size_t p = 0; p < scenario.phases.size(); ++p) {
+        const Phase& phase = scenario.phases[p];
+        overall.merge(total.phases[p]);
+        out << (p ? "," : "") << "\n    {\n";
+        out << "      \"name\": \"" << phase.name << "\", \"duration_s\": " << phase.duration_s
+            << ", \"offered_rate\": [" << phase.rate_start << ", " << phase.rate_end << "],\n";
+        write_phase_json(out, total.phases[p], phase.duration_s, "      ");
+        out << "    }";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"overall\": {\n";
+    write_phase_json(out, overall, scenario.load_seconds(), "    ");
+    out << "  }\n";
+    out << "}\n";
+}
+
+// Tens of thousands of sockets need more than the default 1024 descriptors
+void raise_fd_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// -------------------------------------------------------------------
+// Main: spread the connections over a few epoll threads
+// -------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    // Without a scenario file the flags describe a single steady phase where
+    // every connection issues a command about once per interval.
+    Scenario scenario;
+    double duration_s = 10, interval_ms = 1000;
+    bool custom_phase = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string error;
+        if (arg == "--scenario" && i + 1 < argc) {
+            if (!load_scenario(argv[++i], scenario, error)) {
+                std::cerr << "[Error] " << error << "\n";
+                return 1;
+            }
+        } else if (arg == "--connections" && i + 1 < argc) {
+            scenario.users = std::max(1, std::stoi(argv[++i]));
+            custom_phase = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            scenario.threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--duration" && i + 1 < argc) {
+            duration_s = std::stod(argv[++i]);
+            custom_phase = true;
+        } else if (arg == "--interval-ms" && i + 1 < argc) {
+            interval_ms = std::max(0.001, std::stod(argv[++i]));
+            custom_phase = true;
+        } else if (arg == "--unix" && i + 1 < argc) {
+            scenario.unix_path = argv[++i];
+        } else if (arg == "--users" && i + 1 < argc) {
+            scenario.accounts = read_users_file(argv[++i]);
+        } else if (arg == "--verify") {
+            scenario.verify = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--scenario FILE] [--connections N] [--threads T]"
+                      << " [--duration S] [--interval-ms MS] [--unix PATH] [--users FILE] [--verify]\n";
+            return 1;
+        }
+    }
+    if (custom_phase) {
+        double rate = scenario.users * 1000.0 / interval_ms;
+        scenario.phases = {{"steady", duration_s, rate, rate}};
+    }
+    if (scenario.accounts.empty()) {
+        std::cerr << "[Error] No users to log in as.\n";
+        return 1;
+    }
+    scenario.threads = std::min(scenario.threads, scenario.users);
+    raise_fd_limit();
+
+    std::cerr << "Driving " << scenario.users << " connections from " << scenario.threads
+              << " threads: " << scenario.setup_s << " s setup, then";
+    for (const Phase& phase : scenario.phases) {
+        std::cerr << " " << phase.name << " " << phase.duration_s << " s";
+    }
+    std::cerr << "...\n";
+
+    uint64_t load_start = now_ns() + uint64_t(scenario.setup_s * 1e9);
+    Timeline timeline(scenario, load_start);
+    uint64_t stop = timeline.load_end() + uint64_t(scenario.drain_s * 1e9);
+
+    std::unique_ptr<MembershipRegistry> registry;
+    if (scenario.verify) {
+        registry = std::make_unique<MembershipRegistry>(scenario.groups.size(), scenario.users);
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0; t < scenario.threads; ++t) {
+        workers.push_back(std::make_unique<Worker>(scenario, timeline, registry.get(), t, scenario.threads));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(&Worker::run, worker.get(), stop);
+    }
     for (auto& t : threads) {
         t.join();
     }
 
-    std::cout << "Stress test complete." << std::endl;
+    Stats total(scenario.phases.size());
+    for (auto& worker : workers) {
+        total.merge(worker->stats);
+    }
+    VerifyResult verification[MESSAGE_TYPES];
+    if (registry) verify_deliveries(workers, *registry, total, verification);
+    print_report(scenario, total, registry ? &verification : nullptr);
     return 0;
 }
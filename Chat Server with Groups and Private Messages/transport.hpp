@@ -0,0 +1,507 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+// Transport layer shared by the server, the client and the benchmark tools.
+//
+// Every connection is identified by a socket descriptor (TCP or Unix domain).
+// Local clients may additionally upgrade their Unix socket to a pair of
+// shared-memory SPSC rings; the socket then only serves as the connection's
+// identity and as a lifeline to detect a dead peer. All reads and writes go
+// through Transport so the rest of the code never needs to know which one
+// is in use.
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+constexpr uint32_t SHM_MAGIC = 0x43485352;   // "CHSR"
+constexpr uint32_t SHM_VERSION = 1;
+constexpr int SHM_WAIT_MS = 100;             // futex wait slice between liveness checks
+constexpr int SHM_SPIN_ITERATIONS = 2000;    // busy-poll before sleeping on the futex
+constexpr const char* SHM_NAME_PREFIX = "/chat_shm_";   // every segment name upgrade_to_shm() picks
+constexpr size_t SHM_NAME_MAX = 64;
+
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms) {
+    timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>* word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// -----------------------------------
+// ShmRing: single-producer/single-consumer byte ring in shared memory.
+// head/tail are free-running byte counters; the data area follows the header.
+//
+// Everything in the segment is writable by the peer, so the operations take
+// the capacity from the caller's private copy (ShmChannel) rather than from
+// the shared header, which is only read once when the segment is attached.
+// -----------------------------------
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;       // bytes published by the producer
+    alignas(64) std::atomic<uint64_t> tail;       // bytes consumed by the consumer
+    alignas(64) std::atomic<uint32_t> data_seq;   // futex word, bumped after publishing
+    std::atomic<uint32_t> space_seq;               // futex word, bumped after consuming
+    std::atomic<uint32_t> reader_waiting;
+    std::atomic<uint32_t> writer_waiting;
+    uint64_t declared_capacity;                    // set by the creator, validated at attach
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    // The peer may be untrusted, so never believe more than capacity bytes are in flight
+    uint64_t used(uint64_t capacity) const {
+        uint64_t n = head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        return std::min(n, capacity);
+    }
+
+    size_t write_some(const char* buf, size_t len, uint64_t capacity) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        size_t n = std::min<uint64_t>(len, capacity - used(capacity));
+        if (n == 0) return 0;
+
+        size_t offset = h % capacity;
+        size_t first = std::min<size_t>(n, capacity - offset);
+        memcpy(data() + offset, buf, first);
+        memcpy(data(), buf + first, n - first);
+        head.store(h + n, std::memory_order_release);
+
+        data_seq.fetch_add(1);
+        if (reader_waiting.load()) futex_wake(&data_seq);
+        return n;
+    }
+
+    size_t read_some(char* buf, size_t len, uint64_t capacity) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        size_t n = std::min<uint64_t>(len, used(capacity));
+        if (n == 0) return 0;
+
+        size_t offset = t % capacity;
+        size_t first = std::min<size_t>(n, capacity - offset);
+        memcpy(buf, data() + offset, first);
+        memcpy(buf + first, data(), n - first);
+        tail.store(t + n, std::memory_order_release);
+
+        space_seq.fetch_add(1);
+        if (writer_waiting.load()) futex_wake(&space_seq);
+        return n;
+    }
+
+    // Spin briefly, then sleep on the futex for at most timeout_ms
+    bool wait_readable(int timeout_ms, uint64_t capacity) {
+        for (int i = 0; i < SHM_SPIN_ITERATIONS; ++i) {
+            if (used(capacity) > 0) return true;
+        }
+        reader_waiting.store(1);
+        uint32_t seq = data_seq.load();
+        if (used(capacity) == 0) futex_wait(&data_seq, seq, timeout_ms);
+        reader_waiting.store(0);
+        return used(capacity) > 0;
+    }
+
+    bool wait_writable(int timeout_ms, uint64_t capacity) {
+        for (int i = 0; i < SHM_SPIN_ITERATIONS; ++i) {
+            if (used(capacity) < capacity) return true;
+        }
+        writer_waiting.store(1);
+        uint32_t seq = space_seq.load();
+        if (used(capacity) == capacity) futex_wait(&space_seq, seq, timeout_ms);
+        writer_waiting.store(0);
+        return used(capacity) < capacity;
+    }
+
+    static size_t footprint(size_t capacity) {
+        return (sizeof(ShmRing) + capacity + 63) & ~size_t(63);
+    }
+};
+
+// Segment header; the client-to-server ring and the server-to-client ring follow it
+struct ShmSegment {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_capacity;                        // set by the creator, validated at attach
+    std::atomic<uint32_t> closed;
+
+    static size_t header_size() { return (sizeof(ShmSegment) + 63) & ~size_t(63); }
+    static size_t total_size(size_t capacity) { return header_size() + 2 * ShmRing::footprint(capacity); }
+
+    ShmRing* ring(int index, uint64_t capacity) {
+        char* base = reinterpret_cast<char*>(this) + header_size();
+        return reinterpret_cast<ShmRing*>(base + index * ShmRing::footprint(capacity));
+    }
+
+    // Names the server agrees to open: SHM_NAME_PREFIX followed by digits and '_'
+    static bool valid_name(const std::string& name) {
+        if (name.size() > SHM_NAME_MAX || !name.starts_with(SHM_NAME_PREFIX)) return false;
+        return std::all_of(name.begin() + strlen(SHM_NAME_PREFIX), name.end(),
+                           [](char c) { return (c >= '0' && c <= '9') || c == '_'; });
+    }
+};
+
+// -----------------------------------
+// ShmChannel: one mapped segment, seen from either the client or the server side
+// -----------------------------------
+class ShmChannel {
+private:
+    ShmSegment* segment = nullptr;
+    size_t mapped_size = 0;
+    uint64_t capacity = 0;   // private copy; the shared header may change under us
+    ShmRing* tx = nullptr;
+    ShmRing* rx = nullptr;
+
+    ShmChannel(ShmSegment* segment, size_t mapped_size, uint64_t capacity, bool server_side)
+        : segment(segment), mapped_size(mapped_size), capacity(capacity) {
+        tx = segment->ring(server_side ? 1 : 0, capacity);
+        rx = segment->ring(server_side ? 0 : 1, capacity);
+    }
+
+public:
+    ~ShmChannel() {
+        close();
+        munmap(segment, mapped_size);
+    }
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    // Client side: create and initialise a fresh segment
+    static std::unique_ptr<ShmChannel> create(const std::string& name, size_t capacity) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return nullptr;
+
+        size_t size = ShmSegment::total_size(capacity);
+        if (ftruncate(fd, size) < 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        // ftruncate zero-fills, which is a valid initial state for both rings
+        auto* segment = static_cast<ShmSegment*>(mem);
+        segment->magic = SHM_MAGIC;
+        segment->version = SHM_VERSION;
+        segment->ring_capacity = capacity;
+        segment->ring(0, capacity)->declared_capacity = capacity;
+        segment->ring(1, capacity)->declared_capacity = capacity;
+        return std::unique_ptr<ShmChannel>(new ShmChannel(segment, size, capacity, false));
+    }
+
+    // Server side: map a segment created by a client and unlink its name.
+    // Only names of the form upgrade_to_shm() generates are opened.
+    static std::unique_ptr<ShmChannel> attach(const std::string& name) {
+        if (!ShmSegment::valid_name(name)) return nullptr;
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) return nullptr;
+        shm_unlink(name.c_str());
+
+        struct stat st{};
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)ShmSegment::header_size()) {
+            ::close(fd);
+            return nullptr;
+        }
+        size_t size = st.st_size;
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED) return nullptr;
+
+        auto* segment = static_cast<ShmSegment*>(mem);
+        uint64_t capacity = segment->ring_capacity;
+        if (segment->magic != SHM_MAGIC || segment->version != SHM_VERSION || capacity == 0 ||
+            capacity > (1ull << 30) || ShmSegment::total_size(capacity) != size ||
+            segment->ring(0, capacity)->declared_capacity != capacity ||
+            segment->ring(1, capacity)->declared_capacity != capacity) {
+            munmap(mem, size);
+            return nullptr;
+        }
+        return std::unique_ptr<ShmChannel>(new ShmChannel(segment, size, capacity, true));
+    }
+
+    bool is_closed() const { return segment->closed.load() != 0; }
+
+    void close() {
+        segment->closed.store(1);
+        futex_wake(&tx->data_seq);
+        futex_wake(&rx->space_seq);
+    }
+
+    // Blocks while the ring is full; returns false once the channel is closed
+    bool write_all(const char* buf, size_t len) {
+        while (len > 0) {
+            if (is_closed()) return false;
+            size_t n = tx->write_some(buf, len, capacity);
+            if (n == 0) {
+                tx->wait_writable(SHM_WAIT_MS, capacity);
+                continue;
+            }
+            buf += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Blocks until data arrives; returns 0 once the channel is closed or the
+    // lifeline socket reports that the peer went away
+    ssize_t read(char* buf, size_t len, int lifeline_fd) {
+        while (true) {
+            size_t n = rx->read_some(buf, len, capacity);
+            if (n > 0) return n;
+            if (is_closed()) return 0;
+            if (rx->wait_readable(SHM_WAIT_MS, capacity)) continue;
+
+            pollfd pfd{lifeline_fd, POLLRDHUP, 0};
+            if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+                return 0;
+            }
+        }
+    }
+};
+
+// -----------------------------------
+// Transport: per-descriptor send/receive dispatch
+// -----------------------------------
+class Transport {
+private:
+    static constexpr int MAX_FDS = 65536;
+
+    // The write mutex keeps concurrent senders from interleaving partial writes
+    struct Slot {
+        std::mutex write_mutex;
+        std::atomic<std::shared_ptr<ShmChannel>> shm;
+        std::atomic<bool> deflate;   // the peer negotiated compression (compression.hpp); zero-initialized
+    };
+    inline static Slot slots[MAX_FDS];
+
+    static Slot* slot(int fd) {
+        return (fd >= 0 && fd < MAX_FDS) ? &slots[fd] : nullptr;
+    }
+
+    static ssize_t socket_send_all(int fd, const char* data, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            sent += n;
+        }
+        return sent;
+    }
+
+public:
+    static ssize_t send_all(int fd, const char* data, size_t len) {
+        Slot* s = slot(fd);
+        if (!s) return socket_send_all(fd, data, len);
+
+        std::lock_guard<std::mutex> lock(s->write_mutex);
+        if (auto channel = s->shm.load()) {
+            return channel->write_all(data, len) ? (ssize_t)len : -1;
+        }
+        return socket_send_all(fd, data, len);
+    }
+
+    // Only the thread that owns the connection reads from it
+    static ssize_t recv(int fd, char* buf, size_t len) {
+        Slot* s = slot(fd);
+        if (s) {
+            if (auto channel = s->shm.load()) {
+                return channel->read(buf, len, fd);
+            }
+        }
+        ssize_t n;
+        do {
+            n = ::recv(fd, buf, len, 0);
+        } while (n < 0 && errno == EINTR);
+        return n;
+    }
+
+    static bool attach_shm(int fd, std::unique_ptr<ShmChannel> channel) {
+        Slot* s = slot(fd);
+        if (!s) return false;
+        std::lock_guard<std::mutex> lock(s->write_mutex);
+        s->shm.store(std::shared_ptr<ShmChannel>(std::move(channel)));
+        return true;
+    }
+
+    static bool is_shm(int fd) {
+        Slot* s = slot(fd);
+        return s && s->shm.load() != nullptr;
+    }
+
+    static void set_compression(int fd, bool enabled) {
+        if (Slot* s = slot(fd)) s->deflate.store(enabled);
+    }
+
+    static bool compresses(int fd) {
+        Slot* s = slot(fd);
+        return s && s->deflate.load(std::memory_order_relaxed);
+    }
+
+    // Fails blocked and later writes to fd without releasing the descriptor
+    static void shutdown(int fd) {
+        if (Slot* s = slot(fd)) {
+            if (auto channel = s->shm.load()) channel->close();
+        }
+        ::shutdown(fd, SHUT_RDWR);
+    }
+
+    // Drops any shared-memory channel and closes the descriptor
+    static void close(int fd) {
+        if (Slot* s = slot(fd)) {
+            if (auto channel = s->shm.exchange(nullptr)) channel->close();
+            s->deflate.store(false);
+        }
+        ::close(fd);
+    }
+};
+
+inline void send_message(int fd, const std::string& message) {
+    Transport::send_all(fd, message.data(), message.size());
+}
+
+// -----------------------------------
+// LineReader: newline framing on top of Transport::recv
+// -----------------------------------
+class LineReader {
+private:
+    int fd;
+    std::string pending;
+    bool discarding = false;   // inside an over-long line
+
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    // Returns false when the peer disconnects. The trailing '\n' (and '\r')
+    // is stripped; lines over MAX_LINE_LENGTH are cut and the rest dropped.
+    bool read_line(std::string& line) {
+        size_t scanned = 0;
+        while (true) {
+            size_t pos = pending.find('\n', scanned);
+            if (pos != std::string::npos) {
+                bool drop = discarding;
+                discarding = false;
+                if (!drop) {
+                    line.assign(pending, 0, pos);
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                }
+                pending.erase(0, pos + 1);
+                if (drop) {
+                    scanned = 0;
+                    continue;
+                }
+                return true;
+            }
+            if (pending.size() > MAX_LINE_LENGTH) {
+                if (!discarding) {
+                    line.assign(pending, 0, MAX_LINE_LENGTH);
+                    pending.clear();
+                    discarding = true;
+                    return true;
+                }
+                pending.clear();
+            }
+            scanned = pending.size();
+
+            char buffer[16 * 1024];
+            ssize_t n = Transport::recv(fd, buffer, sizeof(buffer));
+            if (n <= 0) return false;
+            pending.append(buffer, n);
+        }
+    }
+
+    // Reads exactly n raw bytes following the last line; payloads may hold
+    // any byte value, including '\n' and NUL
+    bool read_bytes(size_t n, std::string& out) {
+        char buffer[16 * 1024];
+        while (pending.size() < n) {
+            ssize_t got = Transport::recv(fd, buffer, sizeof(buffer));
+            if (got <= 0) return false;
+            pending.append(buffer, got);
+        }
+        out.assign(pending, 0, n);
+        pending.erase(0, n);
+        return true;
+    }
+
+    // Drops n raw bytes without buffering them all (rejected payloads)
+    bool skip_bytes(size_t n) {
+        char buffer[16 * 1024];
+        size_t from_pending = std::min(n, pending.size());
+        pending.erase(0, from_pending);
+        n -= from_pending;
+        while (n > 0) {
+            ssize_t got = Transport::recv(fd, buffer, std::min(n, sizeof(buffer)));
+            if (got <= 0) return false;
+            n -= got;
+        }
+        return true;
+    }
+
+    // Bytes already received but not yet consumed as a line
+    std::string& buffered() { return pending; }
+};
+
+// -----------------------------------
+// Client-side helpers for the local transports
+// -----------------------------------
+inline int connect_unix(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Asks the server to move this Unix-socket connection onto shared memory.
+// Anything the server sent before acknowledging (the first prompt) is dropped;
+// the server repeats it over the rings.
+inline bool upgrade_to_shm(int fd, size_t capacity = SHM_RING_CAPACITY) {
+    static std::atomic<int> counter{0};
+    std::string name = SHM_NAME_PREFIX + std::to_string(getpid()) + "_" + std::to_string(counter++);
+
+    auto channel = ShmChannel::create(name, capacity);
+    if (!channel) return false;
+
+    std::string request = "/shm " + name + "\n";
+    if (Transport::send_all(fd, request.data(), request.size()) < 0) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    std::string reply;
+    char buffer[256];
+    while (reply.find("SHM OK\n") == std::string::npos) {
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0 || reply.find("SHM ERROR\n") != std::string::npos) {
+            shm_unlink(name.c_str());
+            return false;
+        }
+        reply.append(buffer, n);
+    }
+    return Transport::attach_shm(fd, std::move(channel));
+}
+
+#endif // TRANSPORT_HPP
@@ -0,0 +1,206 @@
+// Transport benchmark for the chat server.
+//
+// Logs in over TCP loopback, the Unix domain socket and the shared-memory
+// rings in turn, and sends private messages to itself:
+//   - latency:    one message in flight, round trip per message
+//   - throughput: up to --pipeline messages in flight
+//
+// Usage: ./transport_bench [--messages N] [--pipeline W] [--user U --password P]
+//                          [--unix PATH] [--transports tcp,unix,shm]
+// Use a username that no other client is logged in as, or the echoes will be
+// delivered elsewhere.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <arpa/inet.h>
+
+#include "common.hpp"
+#include "transport.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    std::string user = "alice";
+    std::string password = "password123";
+    std::string unix_path = UNIX_SOCKET_PATH;
+    std::vector<std::string> transports = {"tcp", "unix", "shm"};
+    int messages = 20000;
+    int pipeline = 64;
+};
+
+struct BenchResult {
+    double messages_per_sec = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+int connect_tcp_loopback() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in server_address{};
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(PORT);
+    server_address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int open_connection(const std::string& transport, const BenchOptions& options) {
+    if (transport == "tcp") return connect_tcp_loopback();
+
+    int fd = connect_unix(options.unix_path);
+    if (fd < 0 || transport == "unix") return fd;
+
+    if (!upgrade_to_shm(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Credentials are pipelined; the prompts arrive without newlines and end up
+// on the same line as the authentication result.
+bool login(int fd, LineReader& reader, const BenchOptions& options) {
+    send_message(fd, options.user + "\n" + options.password + "\n");
+
+    std::string line;
+    while (reader.read_line(line)) {
+        if (line.find("Authentication successful") != std::string::npos) return true;
+        if (line.find("Authentication failed") != std::string::npos) return false;
+    }
+    return false;
+}
+
+// Waits for the next echo of our own private message, "[Private #<n> from <user>]: <i>",
+// and returns the payload number <i>
+long next_echo(LineReader& reader, const std::string& marker) {
+    std::string line;
+    while (reader.read_line(line)) {
+        size_t pos = line.find(marker);
+        if (line.starts_with("[Private ") && pos != std::string::npos) {
+            return std::stol(line.substr(pos + marker.size()));
+        }
+    }
+    return -1;
+}
+
+bool run_transport(const std::string& transport, const BenchOptions& options, BenchResult& result) {
+    int fd = open_connection(transport, options);
+    if (fd < 0) {
+        std::cerr << "[" << transport << "] Unable to connect.\n";
+        return false;
+    }
+    LineReader reader(fd);
+    if (!login(fd, reader, options)) {
+        std::cerr << "[" << transport << "] Authentication failed.\n";
+        Transport::close(fd);
+        return false;
+    }
+
+    const std::string command = "/msg " + options.user + " ";
+    const std::string echo_marker = " from " + options.user + "]: ";
+
+    // Latency: strictly one message in flight
+    std::vector<double> samples;
+    samples.reserve(options.messages);
+    for (int i = 0; i < options.messages; ++i) {
+        auto start = Clock::now();
+        send_message(fd, command + std::to_string(i) + "\n");
+        long seq;
+        do {
+            seq = next_echo(reader, echo_marker);
+        } while (seq >= 0 && seq != i);
+        if (seq < 0) {
+            std::cerr << "[" << transport << "] Connection lost.\n";
+            Transport::close(fd);
+            return false;
+        }
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    result.p50_us = samples[samples.size() / 2];
+    result.p99_us = samples[samples.size() * 99 / 100];
+    result.max_us = samples.back();
+
+    // Throughput: keep the pipeline full
+    int sent = 0, received = 0;
+    auto start = Clock::now();
+    while (received < options.messages) {
+        std::string batch;
+        while (sent < options.messages && sent - received < options.pipeline) {
+            batch += command + std::to_string(sent++) + "\n";
+        }
+        if (!batch.empty()) send_message(fd, batch);
+        if (next_echo(reader, echo_marker) < 0) {
+            std::cerr << "[" << transport << "] Connection lost.\n";
+            Transport::close(fd);
+            return false;
+        }
+        ++received;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.messages_per_sec = options.messages / seconds;
+
+    send_message(fd, "/exit\n");
+    Transport::close(fd);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--messages" && i + 1 < argc) {
+            options.messages = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--pipeline" && i + 1 < argc) {
+            options.pipeline = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--user" && i + 1 < argc) {
+            options.user = argv[++i];
+        } else if (arg == "--password" && i + 1 < argc) {
+            options.password = argv[++i];
+        } else if (arg == "--unix" && i + 1 < argc) {
+            options.unix_path = argv[++i];
+        } else if (arg == "--transports" && i + 1 < argc) {
+            options.transports.clear();
+            std::stringstream list(argv[++i]);
+            std::string name;
+            while (std::getline(list, name, ',')) options.transports.push_back(name);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--messages N] [--pipeline W] [--user U --password P]"
+                      << " [--unix PATH] [--transports tcp,unix,shm]\n";
+            return 1;
+        }
+    }
+
+    std::cout << std::left << std::setw(10) << "Transport"
+              << std::setw(14) << "Msgs/sec"
+              << std::setw(12) << "p50 (us)"
+              << std::setw(12) << "p99 (us)"
+              << "max (us)" << "\n";
+
+    bool ok = true;
+    for (const std::string& transport : options.transports) {
+        BenchResult result;
+        if (!run_transport(transport, options, result)) {
+            ok = false;
+            continue;
+        }
+        std::cout << std::left << std::fixed << std::setprecision(1)
+                  << std::setw(10) << transport
+                  << std::setw(14) << result.messages_per_sec
+                  << std::setw(12) << result.p50_us
+                  << std::setw(12) << result.p99_us
+                  << result.max_us << "\n";
+    }
+    return ok ? 0 : 1;
+}
@@ -6,12 +6,79 @@
 #include <sstream>
 #include <iomanip>
 #include <cassert>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 
 // A large value to represent 'infinite' distance (i.e., no direct link)
 static const int INF = 9999;
 
+// DVR keeps an n x n table per node; above this many routers only LSR runs
+static const int DVR_MAX_NODES = 1000;
+
+/**
+ * Network topology in compressed sparse row (CSR) form.
+ * The links leaving router u are entries offset[u] .. offset[u+1]-1 of
+ * target[] and cost[], sorted by target. Memory is O(n + E), so topologies
+ * far too large for an adjacency matrix fit.
+ */
+struct Graph {
+    int n = 0;
+    vector<int> offset;  // n + 1 entries
+    vector<int> target;
+    vector<int> cost;
+
+    int edges() const { return static_cast<int>(target.size()); }
+};
+
+/**
+ * One directed link, used while building a Graph.
+ */
+struct Link {
+    int from, to, cost;
+
+    bool operator<(const Link& other) const
+    {
+        if (from != other.from) return from < other.from;
+        if (to != other.to) return to < other.to;
+        return cost < other.cost;
+    }
+};
+
+/**
+ * Build the CSR graph from a list of directed links.
+ * Duplicate links between the same pair of routers keep the lowest cost.
+ */
+Graph buildGraph(int n, vector<Link>& links)
+{
+    sort(links.begin(), links.end());
+
+    Graph g;
+    g.n = n;
+    g.offset.assign(n + 1, 0);
+    g.target.reserve(links.size());
+    g.cost.reserve(links.size());
+
+    for (size_t i = 0; i < links.size(); ++i) {
+        // After sorting, the cheapest duplicate comes first
+        if (i > 0 && links[i].from == links[i - 1].from && links[i].to == links[i - 1].to)
+            continue;
+        g.target.push_back(links[i].to);
+        g.cost.push_back(links[i].cost);
+        ++g.offset[links[i].from + 1];
+    }
+
+    // Turn per-router link counts into row offsets
+    for (int u = 0; u < n; ++u) {
+        g.offset[u + 1] += g.offset[u];
+    }
+    return g;
+}
+
 /**
  * Print the routing table for a single node under DVR.
  * Shows destination, cost, and next hop for each entry.
@@ -46,20 +113,20 @@ void printDVRTable(
  * Each node updates its table by exchanging info with neighbors.
  * Converges in at most (n-1) iterations for n nodes.
  */
-void simulateDVR(const vector<vector<int>>& graph)
+void simulateDVR(const Graph& graph)
 {
-    int n = graph.size();
+    int n = graph.n;
 
     // dist[u][v] = current best cost from u to v
-    vector<vector<int>> dist = graph;
+    vector<vector<int>> dist(n, vector<int>(n, INF));
 
     // nextHop[u][v] = the immediate neighbor on the best path from u to v
     vector<vector<int>> nextHop(n, vector<int>(n, -1));
     for (int u = 0; u < n; ++u) {
-        for (int v = 0; v < n; ++v) {
-            if (graph[u][v] != INF && u != v) {
-                nextHop[u][v] = v;
-            }
+        dist[u][u] = 0;
+        for (int e = graph.offset[u]; e < graph.offset[u + 1]; ++e) {
+            dist[u][graph.target[e]] = graph.cost[e];
+            nextHop[u][graph.target[e]] = graph.target[e];
         }
     }
 
@@ -74,9 +141,8 @@ void simulateDVR(const vector<vector<int>>& graph)
 
         // For every source-destination pair, try all neighbors as intermediates
         for (int u = 0; u < n; ++u) {
-            for (int neighbor = 0; neighbor < n; ++neighbor) {
-                if (graph[u][neighbor] == INF || u == neighbor)
-                    continue;  // skip non-neighbors & self
+            for (int e = graph.offset[u]; e < graph.offset[u + 1]; ++e) {
+                int neighbor = graph.target[e];
 
                 for (int dest = 0; dest < n; ++dest) {
                     if (dist[neighbor][dest] == INF)
@@ -114,7 +180,7 @@ void simulateDVR(const vector<vector<int>>& graph)
  */
 void printLSRTable(
     const int src,
-    const vector<int>& dist,
+    const vector<long long>& dist,
     const vector<int>& nextHop)
 {
     cout << left << setw(8) << "Dest"
@@ -125,13 +191,13 @@ void printLSRTable(
         if (dest == static_cast<size_t>(src)) continue;
 
 
-        cout << left << setw(8) << dest
-             << setw(8) << dist[dest];
+        cout << left << setw(8) << dest;
 
+        // Unreachable destinations show INF, as in the input
         if (nextHop[dest] == -1) {
-            cout << "-";
+            cout << setw(8) << INF << "-";
         } else {
-            cout << nextHop[dest];
+            cout << setw(8) << dist[dest] << nextHop[dest];
         }
         cout << "\n";
     }
@@ -141,45 +207,51 @@ void printLSRTable(
 /**
  * Simulate Link State Routing (Dijkstra's algorithm).
  * Each router floods the entire topology and independently computes shortest paths.
+ * Dijkstra walks each router's link list, so one source costs O(E log V).
+ * With onlySource >= 0, only that router's table is computed.
  */
-void simulateLSR(const vector<vector<int>>& graph)
+void simulateLSR(const Graph& graph, int onlySource = -1)
 {
-    int n = graph.size();
+    int n = graph.n;
+
+    // Path costs are 64-bit: long paths in large topologies can exceed INF
+    const long long UNREACHABLE = numeric_limits<long long>::max();
 
     // Run Dijkstra for each source router
     for (int src = 0; src < n; ++src) {
-        vector<int> dist(n, INF), prev(n, -1), nextHop(n, -1);
+        if (onlySource >= 0 && src != onlySource) continue;
+
+        vector<long long> dist(n, UNREACHABLE);
+        vector<int> prev(n, -1), nextHop(n, -1);
         vector<bool> visited(n, false);
 
         // Distance to self is zero
         dist[src] = 0;
 
-        // Prepare a min-heap (distance, node)
-        vector<pair<int,int>> buffer;
-        buffer.reserve(n * n);  // avoid realloc overhead on large graphs
+        // Prepare a min-heap (distance, node); every relaxation pushes at most once
+        vector<pair<long long,int>> buffer;
+        buffer.reserve(graph.edges() + 1);  // avoid realloc overhead on large graphs
         priority_queue<
-            pair<int,int>,
-            vector<pair<int,int>>,
-            greater<pair<int,int>>
-        > pq(greater<pair<int,int>>(), move(buffer));
-        pq.push(make_pair(0, src));
+            pair<long long,int>,
+            vector<pair<long long,int>>,
+            greater<pair<long long,int>>
+        > pq(greater<pair<long long,int>>(), move(buffer));
+        pq.push(make_pair(0LL, src));
 
         while (!pq.empty()) {
             // Extract top without structured bindings for C++11 compatibility
-            pair<int,int> top = pq.top();
+            pair<long long,int> top = pq.top();
             pq.pop();
-            int currentDist = top.first;
+            long long currentDist = top.first;
             int u = top.second;
 
             if (visited[u]) continue;
             visited[u] = true;
 
-            // Relax edges from u to all neighbors
-            for (int v = 0; v < n; ++v) {
-                if (graph[u][v] == INF || u == v)
-                    continue;
-
-                int candidate = currentDist + graph[u][v];
+            // Relax the links from u to its neighbors
+            for (int e = graph.offset[u]; e < graph.offset[u + 1]; ++e) {
+                int v = graph.target[e];
+                long long candidate = currentDist + graph.cost[e];
                 if (candidate < dist[v]) {
                     dist[v] = candidate;
                     prev[v] = u;
@@ -199,57 +271,162 @@ void simulateLSR(const vector<vector<int>>& graph)
 }
 
 /**
- * Read adjacency matrix from a file. Enforces non-negative and zero-diagonal.
- * Throws error and exits on bad input.
+ * Read the n x n adjacency matrix that follows the first line.
+ * Enforces non-negative and zero-diagonal; INF entries are not links.
+ * Exits on bad input.
  */
-vector<vector<int>> readGraphFromFile(const string& filename)
+Graph readMatrix(istream& file, int n)
 {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error: Could not open file '" << filename << "'\n";
-        exit(EXIT_FAILURE);
-    }
-
-    int n;
-    file >> n;
-    vector<vector<int>> g(n, vector<int>(n));
+    vector<Link> links;
 
     for (int i = 0; i < n; ++i) {
         for (int j = 0; j < n; ++j) {
-            file >> g[i][j];
+            int cost;
+            if (!(file >> cost)) {
+                cerr << "Error: Matrix ends before row " << i << ", column " << j << "\n";
+                exit(EXIT_FAILURE);
+            }
 
             // Disallow negative weights
-            if (g[i][j] < 0) {
+            if (cost < 0) {
                 cerr << "Error: Negative weights not supported\n";
                 exit(EXIT_FAILURE);
             }
 
             // Enforce zero on diagonal (no self-loop cost)
-            if (i == j && g[i][j] != 0) {
+            if (i == j && cost != 0) {
                 cerr << "Error: Self-loop detected at (" << i << "," << j << ")\n";
                 exit(EXIT_FAILURE);
             }
+
+            if (i != j && cost != INF) {
+                Link link = {i, j, cost};
+                links.push_back(link);
+            }
         }
     }
-    return g;
+    return buildGraph(n, links);
+}
+
+/**
+ * Read m undirected links, one "u v cost" line each.
+ * Routers are numbered 0 .. n-1; costs must be non-negative and below INF.
+ * Exits on bad input.
+ */
+Graph readEdgeList(istream& file, int n, int m)
+{
+    vector<Link> links;
+    links.reserve(2 * static_cast<size_t>(m));
+
+    for (int i = 0; i < m; ++i) {
+        int u, v, cost;
+        if (!(file >> u >> v >> cost)) {
+            cerr << "Error: Edge list ends after " << i << " of " << m << " links\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (u < 0 || u >= n || v < 0 || v >= n) {
+            cerr << "Error: Link " << u << "-" << v << " names a router outside 0.." << n - 1 << "\n";
+            exit(EXIT_FAILURE);
+        }
+
+        // Disallow negative weights
+        if (cost < 0) {
+            cerr << "Error: Negative weights not supported\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (cost >= INF) {
+            cerr << "Error: Link " << u << "-" << v << " costs " << cost << ", links must cost less than " << INF << "\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (u == v) {
+            cerr << "Error: Self-loop detected at (" << u << "," << v << ")\n";
+            exit(EXIT_FAILURE);
+        }
+
+        // Links are symmetric, as in the matrix format
+        Link forward = {u, v, cost}, backward = {v, u, cost};
+        links.push_back(forward);
+        links.push_back(backward);
+    }
+    return buildGraph(n, links);
+}
+
+/**
+ * Read the topology from a file.
+ * A first line "n" is followed by an adjacency matrix; a first line "n m"
+ * by an edge list of m links.
+ * Exits on bad input.
+ */
+Graph readGraphFromFile(const string& filename)
+{
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Error: Could not open file '" << filename << "'\n";
+        exit(EXIT_FAILURE);
+    }
+
+    // The header line decides the format
+    string header;
+    getline(file, header);
+    istringstream fields(header);
+    int n, m;
+    if (!(fields >> n) || n < 0) {
+        cerr << "Error: First line must give the number of routers\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if (fields >> m) {
+        if (m < 0) {
+            cerr << "Error: Negative number of links\n";
+            exit(EXIT_FAILURE);
+        }
+        return readEdgeList(file, n, m);
+    }
+    return readMatrix(file, n);
 }
 
 int main(int argc, char* argv[])
 {
-    // Expect exactly one argument: the input file path
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <input_file>\n";
+    // Expect the input file path, optionally followed by --source N
+    int onlySource = -1;
+    bool validArgs = (argc == 2);
+    if (argc == 4 && strcmp(argv[2], "--source") == 0) {
+        // The whole argument must be a number: "1x" or "" are usage errors
+        string arg = argv[3];
+        size_t used = 0;
+        try {
+            onlySource = stoi(arg, &used);
+            validArgs = (used == arg.size());
+        } catch (const exception&) {
+            validArgs = false;
+        }
+    }
+    if (!validArgs) {
+        cerr << "Usage: " << argv[0] << " <input_file> [--source N]\n";
         return EXIT_FAILURE;
     }
 
     // Parse the network graph from file
-    auto graph = readGraphFromFile(argv[1]);
+    Graph graph = readGraphFromFile(argv[1]);
+
+    if (onlySource >= graph.n || (argc == 4 && onlySource < 0)) {
+        cerr << "Error: Source must be a router in 0.." << graph.n - 1 << "\n";
+        return EXIT_FAILURE;
+    }
 
     cout << "\n--- Distance Vector Routing Simulation ---\n";
-    simulateDVR(graph);
+    if (graph.n <= DVR_MAX_NODES) {
+        simulateDVR(graph);
+    } else {
+        cout << "Skipped: " << graph.n << " routers, DVR tables are limited to "
+             << DVR_MAX_NODES << "\n";
+    }
 
     cout << "\n--- Link State Routing Simulation ---\n";
-    simulateLSR(graph);
+    simulateLSR(graph, onlySource);
 
     return EXIT_SUCCESS;
 }
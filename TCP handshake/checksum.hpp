@@ -0,0 +1,213 @@
+// checksum.hpp
+/**
+ * Internet checksum (RFC 1071) for the handshake tools.
+ *
+ * Three kernels sum the data as 32-bit words into 64-bit accumulators, which
+ * the ones' complement sum allows (RFC 1071, section 2) and which cannot
+ * overflow for any packet size:
+ * - scalar: portable, four 32-bit loads per step
+ * - SSE2:   16 bytes per load, widened into two 64-bit lanes
+ * - AVX2:   32 bytes per load, widened into four 64-bit lanes
+ * The widest kernel the CPU supports is picked at runtime. Short inputs
+ * always take the scalar path, which is faster below CHECKSUM_VECTOR_MIN
+ * bytes.
+ *
+ * Sums work on 16-bit words exactly as they are stored, so the results are
+ * in network byte order and can be written straight into a header on any
+ * host. Fields that change between packets can be patched with RFC 1624
+ * incremental updates instead of summing the header again.
+ */
+
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+#define CHECKSUM_VECTOR_MIN 128      ///< Inputs shorter than this use the scalar kernel
+
+enum class ChecksumKernel { SCALAR, SSE2, AVX2 };
+
+inline const char *checksum_kernel_name(ChecksumKernel kernel) {
+    switch (kernel) {
+        case ChecksumKernel::SCALAR: return "scalar";
+        case ChecksumKernel::SSE2: return "sse2";
+        case ChecksumKernel::AVX2: return "avx2";
+    }
+    return "?";
+}
+
+/// Folds a partial sum to 16 bits with end-around carries (not complemented)
+inline uint16_t checksum_fold(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/// Sums the bytes left after the last full 32-bit word
+inline uint64_t checksum_tail(const uint8_t *p, size_t len, uint64_t sum) {
+    if (len >= 2) {
+        uint16_t word;
+        memcpy(&word, p, 2);
+        sum += word;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        // A trailing byte is padded with a zero byte to a full word
+        uint8_t last[2] = {*p, 0};
+        uint16_t word;
+        memcpy(&word, last, 2);
+        sum += word;
+    }
+    return sum;
+}
+
+inline uint64_t checksum_partial_scalar(const void *data, size_t len, uint64_t sum = 0) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t w[4];
+    while (len >= 16) {
+        memcpy(w, p, 16);
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        memcpy(w, p, 4);
+        sum += w[0];
+        p += 4;
+        len -= 4;
+    }
+    return checksum_tail(p, len, sum);
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse2")))
+inline uint64_t checksum_partial_sse2(const void *data, size_t len, uint64_t sum = 0) {
+    const uint8_t *p = (const uint8_t *)data;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    while (len >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+        p += 32;
+        len -= 32;
+    }
+    __m128i acc = _mm_add_epi64(acc0, acc1);
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    // Each lane may hold up to 2^64 - 1; fold before adding them together
+    sum += checksum_fold(lanes[0]);
+    sum += checksum_fold(lanes[1]);
+    return checksum_partial_scalar(p, len, sum);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t checksum_partial_avx2(const void *data, size_t len, uint64_t sum = 0) {
+    const uint8_t *p = (const uint8_t *)data;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    while (len >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+        p += 64;
+        len -= 64;
+    }
+    uint64_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc0);
+    _mm256_storeu_si256((__m256i *)(lanes + 4), acc1);
+    for (uint64_t lane : lanes) sum += checksum_fold(lane);
+    return checksum_partial_scalar(p, len, sum);
+}
+#endif
+
+/// The widest kernel this CPU runs
+inline ChecksumKernel checksum_best_kernel() {
+#ifdef CHECKSUM_X86
+    static const ChecksumKernel best = __builtin_cpu_supports("avx2")   ? ChecksumKernel::AVX2
+                                       : __builtin_cpu_supports("sse2") ? ChecksumKernel::SSE2
+                                                                        : ChecksumKernel::SCALAR;
+    return best;
+#else
+    return ChecksumKernel::SCALAR;
+#endif
+}
+
+inline bool checksum_kernel_supported(ChecksumKernel kernel) {
+#ifdef CHECKSUM_X86
+    if (kernel == ChecksumKernel::AVX2) return checksum_best_kernel() == ChecksumKernel::AVX2;
+    if (kernel == ChecksumKernel::SSE2) return checksum_best_kernel() != ChecksumKernel::SCALAR;
+    return true;
+#else
+    return kernel == ChecksumKernel::SCALAR;
+#endif
+}
+
+/**
+ * Adds `data` to a running partial sum with the given kernel. Buffers summed
+ * one after another must all have even lengths, except the last.
+ */
+inline uint64_t checksum_partial(ChecksumKernel kernel, const void *data, size_t len, uint64_t sum = 0) {
+#ifdef CHECKSUM_X86
+    if (kernel == ChecksumKernel::AVX2) return checksum_partial_avx2(data, len, sum);
+    if (kernel == ChecksumKernel::SSE2) return checksum_partial_sse2(data, len, sum);
+#endif
+    (void)kernel;
+    return checksum_partial_scalar(data, len, sum);
+}
+
+/// checksum_partial() with the best kernel for the length
+inline uint64_t checksum_partial(const void *data, size_t len, uint64_t sum = 0) {
+    if (len < CHECKSUM_VECTOR_MIN) return checksum_partial_scalar(data, len, sum);
+    return checksum_partial(checksum_best_kernel(), data, len, sum);
+}
+
+/// Checksum of a complete buffer, e.g. an IP header (with its check field zeroed)
+inline uint16_t internet_checksum(const void *data, size_t len) {
+    return (uint16_t)~checksum_fold(checksum_partial(data, len));
+}
+
+/// Partial sum of the TCP pseudo-header (RFC 793); addresses as stored in the IP header
+inline uint64_t tcp_pseudo_header_sum(uint32_t saddr, uint32_t daddr, size_t tcp_len) {
+    return (uint64_t)saddr + daddr + htons(IPPROTO_TCP) + htons((uint16_t)tcp_len);
+}
+
+/// TCP checksum of a segment (header with check zeroed, plus payload)
+inline uint16_t tcp_checksum(uint32_t saddr, uint32_t daddr, const void *segment, size_t len) {
+    return (uint16_t)~checksum_fold(checksum_partial(segment, len, tcp_pseudo_header_sum(saddr, daddr, len)));
+}
+
+// ---------------- RFC 1624 Incremental Updates ----------------
+// HC' = ~(~HC + ~m + m'), with every value as stored in the packet
+
+/// New checksum after a 16-bit field changes from `old_value` to `new_value`
+inline uint16_t checksum_update16(uint16_t check, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = (uint32_t)(uint16_t)~check + (uint16_t)~old_value + new_value;
+    return (uint16_t)~checksum_fold(sum);
+}
+
+/// New checksum after a 32-bit field (a sequence number, an address) changes
+inline uint16_t checksum_update32(uint16_t check, uint32_t old_value, uint32_t new_value) {
+    uint32_t sum = (uint32_t)(uint16_t)~check + (uint16_t)~(old_value >> 16) + (uint16_t)~(old_value & 0xffff) +
+                   (new_value >> 16) + (new_value & 0xffff);
+    return (uint16_t)~checksum_fold(sum);
+}
+
+#endif // CHECKSUM_HPP
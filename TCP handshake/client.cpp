@@ -3,14 +3,28 @@
  * TCP Three-Way Handshake Client using Raw Sockets
  * 
  * This program performs a simplified TCP three-way handshake by:
- * 1. Sending a SYN packet with sequence number 200
- * 2. Receiving a SYN-ACK with sequence number 400 (expected)
- * 3. Sending the final ACK with sequence number 600
+ * 1. Sending a SYN packet with a random initial sequence number (ISN)
+ * 2. Receiving a SYN-ACK that acknowledges ISN + 1
+ * 3. Sending the final ACK (SEQ = ISN + 1, ACK_SEQ = server ISN + 1)
  *
  * Notes:
- * - Designed for educational use, primarily for localhost (127.0.0.1)
- * - Sequence numbers (200, 400, 600) are predefined for controlled testing
+ * - Designed for educational use, primarily for localhost (127.0.0.1); the
+ *   source address is the one the host would use to reach the server, so a
+ *   server on a TUN device (server --io tun) is reached at TUN_PEER_ADDRESS
+ * - The server picks its own ISN per connection, so any value is accepted
  * - Raw socket manipulation bypasses kernel TCP/IP stack
+ * - A BPF filter on the socket lets only the server's SYN-ACKs through
+ *
+ * With --send BYTES the handshake is followed by a bulk transfer with
+ * retransmission and congestion control, and an orderly FIN teardown
+ * (see run_transfer()).
+ *
+ * With --load N the client instead opens N handshakes from many source
+ * ports at a configurable rate and concurrency, and reports the completion
+ * rate and SYN -> SYN-ACK latency percentiles (see run_load()).
+ *
+ * --capture FILE records every packet sent and received, in any mode, as
+ * pcap-ng with nanosecond timestamps (pcap_writer.hpp).
  */
 
  #include <iostream>
@@ -22,49 +36,49 @@
  #include <arpa/inet.h>
  #include <sys/socket.h>
  #include <sys/time.h>
- #include <vector>
  #include <thread>
  #include <chrono>
+ #include <random>
+ #include <algorithm>
+ #include <deque>
+ #include <memory>
+ #include <string>
+ #include <unordered_map>
+ #include <vector>
+ #include <poll.h>
+ 
+ #include "packet_builder.hpp"
+ #include "packet_io.hpp"
+ #include "pcap_writer.hpp"
+ #include "tcp_filter.hpp"
+ #include "tcp_stream.hpp"
  
  // ---------------- Constants & Configuration ----------------
  #define DEFAULT_DEST_PORT 12345           ///< Port server listens on
  #define DEFAULT_SRC_PORT 54321            ///< Client source port
  #define DEFAULT_SERVER_IP "127.0.0.1"     ///< Default server IP for localhost tests
- #define DEFAULT_CLIENT_IP "127.0.0.1"     ///< Use the loopback interface as source IP
- #define CLIENT_SEQ_NUM 200                ///< Initial client sequence number (SYN)
- #define CLIENT_FINAL_SEQ 600              ///< Final ACK packet sequence number
- #define SERVER_EXPECTED_SEQ 400           ///< Expected SYN-ACK server sequence
  #define TIMEOUT_SECONDS 5                 ///< Timeout for SYN-ACK reception
- #define SEND_BUFFER_SIZE 4096             ///< Max size for outgoing datagram
+ #define CLIENT_WINDOW 5840                ///< Advertised window
  #define RECV_BUFFER_SIZE 65536            ///< Max size for incoming datagram
  #define MAX_RETRY 3                       ///< Max retries on failure
+ #define LOAD_PORT_FIRST 20000             ///< Load mode source ports: LOAD_PORT_FIRST..LOAD_PORT_LAST
+ #define LOAD_PORT_LAST 60999
+ #define LOAD_DEFAULT_RATE 10000           ///< Load mode SYNs per second
+ #define LOAD_DEFAULT_CONCURRENCY 4096     ///< Load mode handshakes waiting for a SYN-ACK at once
+ #define LOAD_TIMEOUT_MS 3000              ///< A load mode handshake with no SYN-ACK by then has failed
+ #define DEFAULT_CONGESTION "cubic"        ///< Congestion controller of the data phase
+ #define TRANSFER_MAX_TIMEOUTS 8           ///< Retransmission timeouts in a row before a transfer gives up
  
- // ---------------- TCP Pseudo Header ----------------
- struct pseudo_header {
-     u_int32_t source_address;
-     u_int32_t dest_address;
-     u_int8_t placeholder;
-     u_int8_t protocol;
-     u_int16_t tcp_length;
- };
+ uint64_t packets_delivered = 0;           ///< Packets the socket handed to us (after the BPF filter)
+ PcapWriter capture;                       ///< --capture file, if one was given
  
- /**
-  * Computes the Internet checksum (used for IP/TCP).
-  * @param ptr Pointer to data buffer
-  * @param nbytes Number of bytes to checksum
-  * @return Computed checksum value
-  */
- unsigned short compute_checksum(unsigned short *ptr, int nbytes) {
-     long sum = 0;
-     while (nbytes > 1) {
-         sum += *ptr++;
-         nbytes -= 2;
-     }
-     if (nbytes) sum += *(unsigned char *)ptr;
-     sum = (sum >> 16) + (sum & 0xffff);
-     sum += (sum >> 16);
-     return (unsigned short)(~sum);
- }
+ // Prebuilt headers, patched per packet; our SYN offers an MSS and SACK
+ using SynPacket = TcpPacketTemplate<TCP_OPT_MSS | TCP_OPT_SACK_PERMITTED>;
+ using AckPacket = TcpPacketTemplate<TCP_OPT_NONE>;
+ const SynPacket SYN_PACKET(TH_SYN, CLIENT_WINDOW);
+ const AckPacket ACK_PACKET(TH_ACK, CLIENT_WINDOW);
+ const AckPacket DATA_PACKET(TH_ACK | TH_PUSH, CLIENT_WINDOW);
+ const AckPacket FIN_PACKET(TH_FIN | TH_ACK, CLIENT_WINDOW);
  
  /**
   * Constructs and sends a TCP packet with given parameters.
@@ -73,63 +87,35 @@
   * @param daddr Destination IP address (uint32)
   * @param seq Sequence number to use
   * @param ack_seq Acknowledgement number to use
-  * @param syn SYN flag value (bool)
-  * @param ack ACK flag value (bool)
+  * @param syn SYN flag value (bool); a SYN has no ACK flag
+  * @param ack ACK flag value (bool); an ACK has no SYN flag
   * @param raw_seq For display/logging
   * @param raw_ack For display/logging
   * @param src_port Source port number
   * @param dest_port Destination port number
   */
  void send_tcp_packet(int sockfd, uint32_t saddr, uint32_t daddr, uint32_t seq, uint32_t ack_seq,
-                      bool syn, bool ack, int raw_seq, int raw_ack, uint16_t src_port, uint16_t dest_port) {
-     char datagram[SEND_BUFFER_SIZE];
-     memset(datagram, 0, sizeof(datagram));
+                      bool syn, bool ack, uint32_t raw_seq, uint32_t raw_ack, uint16_t src_port, uint16_t dest_port) {
+     char datagram[SynPacket::SIZE];
+     size_t length;
+     PacketAddress address{saddr, daddr, htons(src_port), htons(dest_port)};
+     if (syn) {
+         SYN_PACKET.build(datagram, address, seq, ack_seq);
+         length = SynPacket::SIZE;
+     } else {
+         ACK_PACKET.build(datagram, address, seq, ack_seq);
+         length = AckPacket::SIZE;
+     }
  
-     struct iphdr *iph = (struct iphdr *)datagram;
-     struct tcphdr *tcph = (struct tcphdr *)(datagram + sizeof(struct iphdr));
      struct sockaddr_in dest;
-     pseudo_header psh;
- 
-     iph->ihl = 5;
-     iph->version = 4;
-     iph->tos = 0;
-     iph->tot_len = htons(sizeof(struct iphdr) + sizeof(struct tcphdr));
-     iph->id = htons(54321);
-     iph->frag_off = 0;
-     iph->ttl = 64;
-     iph->protocol = IPPROTO_TCP;
-     iph->saddr = saddr;
-     iph->daddr = daddr;
-     iph->check = compute_checksum((unsigned short *)datagram, iph->ihl * 4);
- 
-     tcph->source = htons(src_port);
-     tcph->dest = htons(dest_port);
-     tcph->seq = htonl(seq);
-     tcph->ack_seq = htonl(ack_seq);
-     tcph->doff = 5;
-     tcph->syn = syn ? 1 : 0;
-     tcph->ack = ack ? 1 : 0;
-     tcph->window = htons(5840);
-     tcph->check = 0;
- 
-     psh.source_address = saddr;
-     psh.dest_address = daddr;
-     psh.placeholder = 0;
-     psh.protocol = IPPROTO_TCP;
-     psh.tcp_length = htons(sizeof(struct tcphdr));
- 
-     std::vector<unsigned char> pseudogram(sizeof(pseudo_header) + sizeof(struct tcphdr));
-     memcpy(&pseudogram[0], &psh, sizeof(pseudo_header));
-     memcpy(&pseudogram[sizeof(pseudo_header)], tcph, sizeof(struct tcphdr));
-     tcph->check = compute_checksum((unsigned short *)&pseudogram[0], pseudogram.size());
- 
      dest.sin_family = AF_INET;
      dest.sin_port = htons(dest_port);
      dest.sin_addr.s_addr = daddr;
  
-     if (sendto(sockfd, datagram, ntohs(iph->tot_len), 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+     if (sendto(sockfd, datagram, length, 0, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
          perror("sendto failed");
      } else {
+         if (capture.is_open()) capture.write(PacketDirection::OUTBOUND, wall_clock_ns(), datagram, length);
          std::cout << "[+] Packet Sent - SYN: " << syn
                    << " ACK: " << ack
                    << " SEQ: " << raw_seq
@@ -141,23 +127,37 @@
   * Waits for a valid SYN-ACK response from the server.
   * @param sockfd Raw socket descriptor
   * @param server_seq Sequence number received from server
+  * @param server_window Window the server advertised
   * @param expected_src_port Port server should be responding from
+  * @param client_isn Sequence number of our SYN, which the SYN-ACK must acknowledge
   * @return true if valid SYN-ACK received, false otherwise
   */
- bool wait_for_syn_ack(int sockfd, uint32_t &server_seq, uint16_t expected_src_port) {
+ bool wait_for_syn_ack(int sockfd, uint32_t &server_seq, uint16_t &server_window, uint16_t expected_src_port,
+                       uint32_t client_isn) {
      char buffer[RECV_BUFFER_SIZE];
-     struct sockaddr saddr;
-     socklen_t saddr_len = sizeof(saddr);
+     char control[CAPTURE_CONTROL_SIZE];
  
      struct timeval timeout = {TIMEOUT_SECONDS, 0};
      setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
  
      while (true) {
-         int data_size = recvfrom(sockfd, buffer, sizeof(buffer), 0, &saddr, &saddr_len);
+         // recvmsg() rather than recvfrom() for the kernel's receive timestamp
+         struct iovec iov{buffer, sizeof(buffer)};
+         struct msghdr msg{};
+         msg.msg_iov = &iov;
+         msg.msg_iovlen = 1;
+         msg.msg_control = control;
+         msg.msg_controllen = sizeof(control);
+         int data_size = recvmsg(sockfd, &msg, 0);
          if (data_size < 0) {
-             perror("recvfrom() failed or timed out");
+             perror("recvmsg() failed or timed out");
              return false;
          }
+         ++packets_delivered;
+         if (capture.is_open()) {
+             int64_t stamp = control_timestamp_ns(msg);
+             capture.write(PacketDirection::INBOUND, stamp ? stamp : wall_clock_ns(), buffer, data_size);
+         }
  
          if (data_size < (int)(sizeof(struct iphdr) + sizeof(struct tcphdr))) {
              std::cerr << "[-] Packet too small, skipping.\n";
@@ -169,23 +169,396 @@
              struct tcphdr *tcph = (struct tcphdr *)(buffer + iph->ihl * 4);
  
              if (ntohs(tcph->dest) == DEFAULT_SRC_PORT && ntohs(tcph->source) == expected_src_port &&
-                 tcph->syn == 1 && tcph->ack == 1 && ntohl(tcph->ack_seq) == CLIENT_SEQ_NUM + 1) {
+                 tcph->syn == 1 && tcph->ack == 1 && ntohl(tcph->ack_seq) == client_isn + 1) {
                  server_seq = ntohl(tcph->seq);
+                 server_window = ntohs(tcph->window);
                  std::cout << "[+] Received SYN-ACK with SEQ: " << server_seq
                            << " ACK_SEQ: " << ntohl(tcph->ack_seq) << std::endl;
-                 if (server_seq != SERVER_EXPECTED_SEQ) {
-                     std::cerr << "[-] Unexpected server SEQ. Expected: " << SERVER_EXPECTED_SEQ << std::endl;
-                     return false;
-                 }
                  return true;
              }
          }
      }
  }
  
+ // ---------------- Data Transfer ----------------
+ struct TransferConfig {
+     uint64_t bytes = 0;                            ///< Bytes to send after the handshake (0: none)
+     std::string congestion = DEFAULT_CONGESTION;   ///< "reno" or "cubic"
+     double loss = 0;                               ///< Fraction of our segments dropped instead of sent
+     IoMode io_mode = IoMode::MMSG;
+ };
+ 
+ /**
+  * Sends config.bytes of the benchmark stream over the established
+  * connection, then closes it with a FIN and waits for the server's.
+  *
+  * A config.loss fraction of the segments is dropped at random instead of
+  * being sent, to exercise retransmission and congestion control. Progress
+  * is reported every second. The summary gives goodput (bytes acknowledged
+  * until our FIN was) and the share of segments that had to be sent again.
+  * @param client_next Our next sequence number (ISN + 1)
+  * @param server_next Server ISN + 1
+  * @param server_window Window from the server's SYN-ACK
+  * @return true if every byte was acknowledged and the server closed too
+  */
+ bool run_transfer(uint32_t saddr, uint32_t daddr, uint32_t client_next, uint32_t server_next, uint16_t server_window,
+                   const TransferConfig &config) {
+     using Clock = std::chrono::steady_clock;
+ 
+     // ACKs and the FIN from the server port to ours
+     TcpFilter filter;
+     filter.dest_port = DEFAULT_SRC_PORT;
+     filter.source_port = DEFAULT_DEST_PORT;
+     filter.flags_mask = TH_SYN | TH_ACK | TH_RST;
+     filter.flags_values = {TH_ACK};
+     std::string error;
+     std::unique_ptr<PacketIO> backend = open_packet_io(config.io_mode, "", &filter, error);
+     if (!backend) {
+         std::cerr << "[-] " << error << std::endl;
+         return false;
+     }
+     PacketIO &io = *backend;
+     if (capture.is_open()) io.set_capture(&capture);
+ 
+     TcpSender sender(client_next, config.bytes, PACKET_DEFAULT_MSS,
+                      make_congestion_control(config.congestion, PACKET_DEFAULT_MSS), server_window);
+     PacketAddress address{saddr, daddr, htons(DEFAULT_SRC_PORT), htons(DEFAULT_DEST_PORT)};
+     std::mt19937 rng(std::random_device{}());
+     std::uniform_real_distribution<double> uniform(0, 1);
+     const uint32_t server_fin_seq = server_next;   // the server sends no data, so its FIN comes next
+     bool server_fin = false;
+     uint64_t dropped = 0;
+     char packet[AckPacket::SIZE + TCP_MAX_SEGMENT];
+ 
+     auto emit = [&](uint32_t seq, const char *payload, size_t length, bool fin) {
+         if (config.loss > 0 && uniform(rng) < config.loss) {
+             ++dropped;
+             return;
+         }
+         size_t size = AckPacket::SIZE;
+         if (fin) FIN_PACKET.build(packet, address, seq, server_next);
+         else size = DATA_PACKET.build(packet, address, seq, server_next, payload, length);
+         io.send(packet, size, daddr);
+     };
+ 
+     Clock::time_point now = Clock::now(), start = now, last_report = now, finished{};
+     auto handle_reply = [&](const char *buffer, int length) {
+         const struct iphdr *ip = (const struct iphdr *)buffer;
+         if (length < (int)sizeof(struct iphdr) || length < ip->ihl * 4 + (int)sizeof(struct tcphdr)) return;
+         const struct tcphdr *tcp = (const struct tcphdr *)(buffer + ip->ihl * 4);
+         if (ntohs(tcp->source) != DEFAULT_DEST_PORT || ntohs(tcp->dest) != DEFAULT_SRC_PORT || !tcp->ack || tcp->syn) {
+             return;
+         }
+         sender.on_ack(ntohl(tcp->ack_seq), ntohs(tcp->window), now);
+         if (tcp->fin && ntohl(tcp->seq) == server_fin_seq) {
+             // Acknowledge the server's FIN, again if it was retransmitted
+             server_fin = true;
+             server_next = server_fin_seq + 1;
+             ACK_PACKET.build(packet, address, sender.next_seq(), server_next);
+             io.send(packet, AckPacket::SIZE, daddr);
+         }
+     };
+ 
+     std::cout << "[+] Sending " << config.bytes << " bytes (" << sender.congestion().name() << ", "
+               << config.loss * 100 << "% induced loss, " << io_mode_name(config.io_mode) << " I/O)" << std::endl;
+     uint64_t last_acked = 0;
+     bool gave_up = false;
+     while (!(sender.done() && server_fin)) {
+         now = Clock::now();
+         if (now >= sender.timer()) {
+             if (sender.timeouts_in_a_row() >= TRANSFER_MAX_TIMEOUTS) {
+                 std::cerr << "[-] No ACK after " << TRANSFER_MAX_TIMEOUTS << " timeouts, giving up" << std::endl;
+                 gave_up = true;
+                 break;
+             }
+             sender.on_timeout(now);
+         }
+         if (sender.done() && now - finished >= std::chrono::seconds(TIMEOUT_SECONDS)) {
+             std::cerr << "[-] The server did not close its side" << std::endl;
+             break;
+         }
+         sender.transmit(now, emit);
+         io.flush();
+ 
+         Clock::time_point wake = std::min(sender.timer(), last_report + std::chrono::seconds(1));
+         if (sender.done()) wake = std::min(wake, finished + std::chrono::seconds(TIMEOUT_SECONDS));
+         int wait_ms = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count());
+         struct pollfd pfd{io.poll_fd(), POLLIN, 0};
+         poll(&pfd, 1, wait_ms);
+         now = Clock::now();
+         while (io.receive(handle_reply) > 0) {}
+         io.flush();
+         if (sender.done() && finished == Clock::time_point{}) finished = now;
+ 
+         if (now - last_report >= std::chrono::seconds(1)) {
+             double seconds = std::chrono::duration<double>(now - last_report).count();
+             std::cout << "[+] acked: " << sender.bytes_acked() << " bytes ("
+                       << (sender.bytes_acked() - last_acked) * 8 / seconds / 1e6 << " Mbit/s) cwnd: "
+                       << sender.congestion().window() << " srtt: "
+                       << std::chrono::duration_cast<std::chrono::microseconds>(sender.rto_estimator().smoothed()).count()
+                       << " us retransmits: " << sender.sender_stats().retransmits << std::endl;
+             last_report = now;
+             last_acked = sender.bytes_acked();
+         }
+     }
+ 
+     if (finished == Clock::time_point{}) finished = now;
+     double seconds = std::chrono::duration<double>(finished - start).count();
+     const SenderStats &stats = sender.sender_stats();
+     std::cout << "[+] Transfer: " << sender.bytes_acked() << " of " << config.bytes << " bytes acknowledged in "
+               << seconds << " s, goodput " << sender.bytes_acked() * 8 / seconds / 1e6 << " Mbit/s" << std::endl;
+     std::cout << "[+] Segments sent: " << stats.segments_sent << ", retransmitted: " << stats.retransmits << " ("
+               << (stats.segments_sent ? 100.0 * stats.retransmits / stats.segments_sent : 0)
+               << "%), fast retransmits: " << stats.fast_retransmits << ", timeouts: " << stats.timeouts
+               << ", dropped on purpose: " << dropped << std::endl;
+     std::cout << "[+] Final cwnd: " << sender.congestion().window() << " bytes, srtt: "
+               << std::chrono::duration_cast<std::chrono::microseconds>(sender.rto_estimator().smoothed()).count()
+               << " us, RTO: "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(sender.rto_estimator().rto()).count()
+               << " ms; " << (server_fin ? "connection closed by both sides" : "server FIN missing") << std::endl;
+     return !gave_up && sender.done() && server_fin;
+ }
+ 
+ /// A byte count with an optional K, M or G suffix (powers of 1024)
+ uint64_t parse_bytes(const std::string &text) {
+     size_t end;
+     uint64_t value = std::stoull(text, &end);
+     switch (end < text.size() ? text[end] : 0) {
+         case 'k': case 'K': return value << 10;
+         case 'm': case 'M': return value << 20;
+         case 'g': case 'G': return value << 30;
+     }
+     return value;
+ }
+ 
+ // ---------------- Load Generation ----------------
+ struct LoadConfig {
+     uint64_t handshakes = 0;                       ///< Total handshakes to attempt
+     uint64_t rate = LOAD_DEFAULT_RATE;             ///< SYNs per second (0: as fast as concurrency allows)
+     size_t concurrency = LOAD_DEFAULT_CONCURRENCY; ///< Max handshakes waiting for a SYN-ACK
+     int timeout_ms = LOAD_TIMEOUT_MS;
+     IoMode io_mode = IoMode::MMSG;
+ };
+ 
+ /// A SYN sent and not yet answered; the source port is its key
+ struct PendingHandshake {
+     uint32_t isn;
+     std::chrono::steady_clock::time_point sent;
+ };
+ 
+ /**
+  * Opens config.handshakes handshakes to the server and reports the outcome.
+  *
+  * Each handshake takes a free source port (used in FIFO order, so a port
+  * rests as long as possible before it is reused) and a random ISN. SYNs are
+  * paced to config.rate while at most config.concurrency are pending. A
+  * SYN-ACK is matched to its handshake by destination port through a hash
+  * table, checked against the ISN, and answered with the final ACK at once.
+  * Handshakes unanswered after config.timeout_ms count as failed.
+  * @return true if every handshake completed
+  */
+ bool run_load(uint32_t saddr, uint32_t daddr, const LoadConfig &config) {
+     using Clock = std::chrono::steady_clock;
+ 
+     // SYN-ACKs from the server port, to any of our ports
+     TcpFilter filter;
+     filter.source_port = DEFAULT_DEST_PORT;
+     filter.flags_mask = TH_SYN | TH_ACK | TH_RST;
+     filter.flags_values = {TH_SYN | TH_ACK};
+     std::string error;
+     std::unique_ptr<PacketIO> backend = open_packet_io(config.io_mode, "", &filter, error);
+     if (!backend) {
+         std::cerr << "[-] " << error << std::endl;
+         return false;
+     }
+     PacketIO &io = *backend;
+     if (capture.is_open()) io.set_capture(&capture);
+ 
+     std::deque<uint16_t> free_ports;
+     for (uint32_t port = LOAD_PORT_FIRST; port <= LOAD_PORT_LAST; ++port) free_ports.push_back(port);
+     size_t concurrency = std::min(config.concurrency, free_ports.size());
+     std::unordered_map<uint16_t, PendingHandshake> pending;
+     pending.reserve(concurrency * 2);
+     std::deque<std::pair<Clock::time_point, uint16_t>> deadlines;   ///< in send order; stale ones are skipped
+     std::vector<uint32_t> latencies_us;
+     latencies_us.reserve(config.handshakes);
+     std::mt19937 rng(std::random_device{}());
+ 
+     uint64_t sent = 0, completed = 0, failed = 0, stale = 0;
+     uint64_t last_completed = 0;
+     Clock::time_point start = Clock::now(), last_report = start;
+     Clock::duration timeout = std::chrono::milliseconds(config.timeout_ms);
+     char packet[SynPacket::SIZE];
+ 
+     auto handle_syn_ack = [&](const char *buffer, int length) {
+         const struct iphdr *ip = (const struct iphdr *)buffer;
+         if (length < (int)sizeof(struct iphdr) || length < ip->ihl * 4 + (int)sizeof(struct tcphdr)) return;
+         const struct tcphdr *tcp = (const struct tcphdr *)(buffer + ip->ihl * 4);
+         if (ntohs(tcp->source) != DEFAULT_DEST_PORT || !tcp->syn || !tcp->ack) return;
+ 
+         uint16_t port = ntohs(tcp->dest);
+         auto it = pending.find(port);
+         if (it == pending.end() || ntohl(tcp->ack_seq) != it->second.isn + 1) {
+             ++stale;   // a retransmission for a finished handshake, or not ours
+             return;
+         }
+         Clock::time_point now = Clock::now();
+         latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.sent).count());
+         ACK_PACKET.build(packet, {saddr, daddr, tcp->dest, tcp->source}, it->second.isn + 1, ntohl(tcp->seq) + 1);
+         io.send(packet, AckPacket::SIZE, daddr);
+         pending.erase(it);
+         free_ports.push_back(port);
+         ++completed;
+     };
+ 
+     std::cout << "[+] Load: " << config.handshakes << " handshakes, " << (config.rate ? std::to_string(config.rate) : "unlimited")
+               << " SYNs/s, concurrency " << concurrency << ", " << io_mode_name(config.io_mode) << " I/O" << std::endl;
+     while (completed + failed < config.handshakes) {
+         Clock::time_point now = Clock::now();
+         double elapsed = std::chrono::duration<double>(now - start).count();
+ 
+         // Send the SYNs that are due by now
+         uint64_t due = config.rate ? std::min<uint64_t>(config.handshakes, uint64_t(elapsed * config.rate) + 1)
+                                    : config.handshakes;
+         while (sent < due && pending.size() < concurrency) {
+             uint16_t port = free_ports.front();
+             free_ports.pop_front();
+             uint32_t isn = rng();
+             SYN_PACKET.build(packet, {saddr, daddr, htons(port), htons(DEFAULT_DEST_PORT)}, isn, 0);
+             io.send(packet, SynPacket::SIZE, daddr);
+             pending[port] = PendingHandshake{isn, now};
+             deadlines.emplace_back(now + timeout, port);
+             ++sent;
+         }
+         io.flush();
+ 
+         // Sleep until the next SYN is due, a deadline passes or a packet arrives
+         Clock::time_point wake = last_report + std::chrono::seconds(1);
+         if (sent < config.handshakes && pending.size() < concurrency && config.rate) {
+             wake = std::min(wake, start + std::chrono::duration_cast<Clock::duration>(
+                                               std::chrono::duration<double>(double(sent) / config.rate)));
+         }
+         if (!deadlines.empty()) wake = std::min(wake, deadlines.front().first);
+         int wait_ms = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count());
+         struct pollfd pfd{io.poll_fd(), POLLIN, 0};
+         poll(&pfd, 1, wait_ms);
+         while (io.receive(handle_syn_ack) > 0) io.flush();
+         io.flush();
+ 
+         now = Clock::now();
+         while (!deadlines.empty() && deadlines.front().first <= now) {
+             uint16_t port = deadlines.front().second;
+             auto it = pending.find(port);
+             if (it != pending.end() && it->second.sent + timeout == deadlines.front().first) {
+                 pending.erase(it);
+                 free_ports.push_back(port);
+                 ++failed;
+             }
+             deadlines.pop_front();
+         }
+ 
+         if (now - last_report >= std::chrono::seconds(1)) {
+             double seconds = std::chrono::duration<double>(now - last_report).count();
+             std::cout << "[+] sent: " << sent << " completed: " << completed << " ("
+                       << uint64_t((completed - last_completed) / seconds) << "/s) pending: " << pending.size()
+                       << " timed out: " << failed << std::endl;
+             last_report = now;
+             last_completed = completed;
+         }
+     }
+ 
+     double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+     std::cout << "[+] Completed " << completed << " of " << config.handshakes << " handshakes ("
+               << 100.0 * completed / config.handshakes << "%) in " << seconds << " s: "
+               << uint64_t(completed / seconds) << " handshakes/s, " << failed << " timed out, "
+               << stale << " stale SYN-ACKs" << std::endl;
+     if (!latencies_us.empty()) {
+         std::sort(latencies_us.begin(), latencies_us.end());
+         auto percentile = [&](double p) { return latencies_us[std::min(latencies_us.size() - 1, size_t(p * latencies_us.size()))]; };
+         std::cout << "[+] SYN -> SYN-ACK latency (us): p50 " << percentile(0.50) << " p90 " << percentile(0.90)
+                   << " p99 " << percentile(0.99) << " p99.9 " << percentile(0.999) << " max " << latencies_us.back()
+                   << std::endl;
+     }
+     const IoStats &io_stats = io.io_stats();
+     std::cout << "[+] Packets sent: " << io_stats.packets_sent << " received: " << io_stats.packets_received
+               << std::endl;
+     return completed == config.handshakes;
+ }
+ 
+ /// The local address the host routes `daddr` from (what connect() would bind to)
+ uint32_t source_address(uint32_t daddr) {
+     struct sockaddr_in peer{}, local{};
+     peer.sin_family = AF_INET;
+     peer.sin_addr.s_addr = daddr;
+     peer.sin_port = htons(DEFAULT_DEST_PORT);
+     socklen_t length = sizeof(local);
+     int probe = socket(AF_INET, SOCK_DGRAM, 0);
+     // A UDP connect() only picks the route; nothing is sent
+     bool ok = probe >= 0 && connect(probe, (struct sockaddr *)&peer, sizeof(peer)) == 0 &&
+               getsockname(probe, (struct sockaddr *)&local, &length) == 0;
+     if (probe >= 0) close(probe);
+     return ok ? local.sin_addr.s_addr : inet_addr("127.0.0.1");
+ }
+ 
+ void usage(const char *program) {
+     std::cerr << "Usage: " << program << " [server_ip] [--send BYTES [--cc reno|cubic] [--loss PERCENT]]"
+               << " [--load N [--rate SYNS_PER_SEC] [--concurrency N] [--timeout-ms MS]]"
+               << " [--io recvfrom|mmsg|ring] [--capture FILE]" << std::endl;
+     exit(1);
+ }
+ 
  // ---------------- Main Function ----------------
  int main(int argc, char *argv[]) {
-     const char *dest_ip = (argc > 1) ? argv[1] : DEFAULT_SERVER_IP;
+     const char *dest_ip = DEFAULT_SERVER_IP;
+     LoadConfig load;
+     TransferConfig transfer;
+     std::string capture_path;
+     for (int i = 1; i < argc; ++i) {
+         std::string arg = argv[i];
+         if (arg == "--load" && i + 1 < argc) {
+             load.handshakes = std::stoull(argv[++i]);
+         } else if (arg == "--rate" && i + 1 < argc) {
+             load.rate = std::stoull(argv[++i]);
+         } else if (arg == "--concurrency" && i + 1 < argc) {
+             load.concurrency = std::max(1, std::stoi(argv[++i]));
+         } else if (arg == "--timeout-ms" && i + 1 < argc) {
+             load.timeout_ms = std::stoi(argv[++i]);
+         } else if (arg == "--send" && i + 1 < argc) {
+             transfer.bytes = parse_bytes(argv[++i]);
+         } else if (arg == "--cc" && i + 1 < argc) {
+             transfer.congestion = argv[++i];
+             if (!make_congestion_control(transfer.congestion, PACKET_DEFAULT_MSS)) usage(argv[0]);
+         } else if (arg == "--loss" && i + 1 < argc) {
+             transfer.loss = std::stod(argv[++i]) / 100;
+         } else if (arg == "--io" && i + 1 < argc) {
+             // The TUN device belongs to the server; the client talks to it through the host
+             if (!parse_io_mode(argv[++i], load.io_mode) || load.io_mode == IoMode::TUN) usage(argv[0]);
+             transfer.io_mode = load.io_mode;
+         } else if (arg == "--capture" && i + 1 < argc) {
+             capture_path = argv[++i];
+         } else if (arg[0] != '-') {
+             dest_ip = argv[i];
+         } else {
+             usage(argv[0]);
+         }
+     }
+ 
+     uint32_t daddr = inet_addr(dest_ip);
+     uint32_t saddr = source_address(daddr);
+     if (!capture_path.empty()) {
+         std::string error;
+         if (!capture.open(capture_path, "client", error)) {
+             std::cerr << "[-] " << error << std::endl;
+             return 1;
+         }
+         // Flush and report however main() ends
+         atexit([] {
+             capture.close();
+             std::cout << "[+] Captured " << capture.packets() << " packets (" << capture.packets_dropped()
+                       << " dropped)" << std::endl;
+         });
+     }
+     if (load.handshakes) return run_load(saddr, daddr, load) ? 0 : 1;
  
      int sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
      if (sockfd < 0) {
@@ -199,18 +572,31 @@
          return 1;
      }
  
-     uint32_t saddr = inet_addr(DEFAULT_CLIENT_IP);
-     uint32_t daddr = inet_addr(dest_ip);
+     // Let the kernel drop everything but SYN-ACKs from the server port to ours
+     TcpFilter filter;
+     filter.dest_port = DEFAULT_SRC_PORT;
+     filter.source_port = DEFAULT_DEST_PORT;
+     filter.flags_mask = TH_SYN | TH_ACK | TH_RST;
+     filter.flags_values = {TH_SYN | TH_ACK};
+     std::string filter_error;
+     if (!attach_tcp_filter(sockfd, filter, filter_error)) {
+         std::cerr << "[!] " << filter_error << "; filtering in userspace only" << std::endl;
+     }
+     if (capture.is_open() && !enable_rx_timestamps(sockfd)) perror("setsockopt(SO_TIMESTAMPING) failed");
+     uint64_t host_segments_at_start = host_tcp_segments();
  
-     // Step 1: Send SYN with sequence 200
-     send_tcp_packet(sockfd, saddr, daddr, CLIENT_SEQ_NUM, 0, true, false,
-                     CLIENT_SEQ_NUM, 0, DEFAULT_SRC_PORT, DEFAULT_DEST_PORT);
+     // Step 1: Send SYN with a random ISN
+     std::random_device rd;
+     uint32_t client_isn = rd();
+     send_tcp_packet(sockfd, saddr, daddr, client_isn, 0, true, false,
+                     client_isn, 0, DEFAULT_SRC_PORT, DEFAULT_DEST_PORT);
  
      // Step 2: Retry SYN-ACK reception if needed
      uint32_t server_seq;
+     uint16_t server_window;
      bool success = false;
      for (int i = 0; i < MAX_RETRY; ++i) {
-         if (wait_for_syn_ack(sockfd, server_seq, DEFAULT_DEST_PORT)) {
+         if (wait_for_syn_ack(sockfd, server_seq, server_window, DEFAULT_DEST_PORT, client_isn)) {
              success = true;
              break;
          } else {
@@ -225,11 +611,19 @@
          return 1;
      }
  
-     // Step 3: Final ACK with sequence 600
-     send_tcp_packet(sockfd, saddr, daddr, CLIENT_FINAL_SEQ, server_seq + 1, false, true,
-                     CLIENT_FINAL_SEQ, server_seq + 1, DEFAULT_SRC_PORT, DEFAULT_DEST_PORT);
+     // Step 3: Final ACK, one past our ISN
+     send_tcp_packet(sockfd, saddr, daddr, client_isn + 1, server_seq + 1, false, true,
+                     client_isn + 1, server_seq + 1, DEFAULT_SRC_PORT, DEFAULT_DEST_PORT);
+ 
+     uint64_t host_segments = host_tcp_segments() - host_segments_at_start;
+     std::cout << "[+] Filter: delivered " << packets_delivered << ", filtered in kernel "
+               << (host_segments > packets_delivered ? host_segments - packets_delivered : 0)
+               << " of " << host_segments << " host TCP segments" << std::endl;
  
      close(sockfd);
+     if (transfer.bytes) {
+         return run_transfer(saddr, daddr, client_isn + 1, server_seq + 1, server_window, transfer) ? 0 : 1;
+     }
      return 0;
  }
  
\ No newline at end of file
@@ -0,0 +1,185 @@
+// congestion.hpp
+/**
+ * Congestion controllers for the data phase (tcp_stream.hpp).
+ *
+ * The sender asks its controller for the congestion window and reports each
+ * event that changes it: new data acknowledged, a loss detected by duplicate
+ * ACKs, and a retransmission timeout. Windows are in bytes.
+ * - Reno (RFC 5681): slow start, then one MSS per window of acknowledged
+ *   data; half the flight size after a loss.
+ * - CUBIC (RFC 9438): after a loss the window follows a cubic function of
+ *   the time since, centred on the window where the loss happened, so it
+ *   climbs back quickly, flattens out near that window and only then probes
+ *   beyond it. The reduction is to 0.7 of the window, and it never grows
+ *   slower than Reno would (the Reno-friendly region).
+ * Both start from TCP_INITIAL_WINDOW segments (RFC 6928) and restart from one
+ * segment after a timeout. New controllers derive from CongestionControl and
+ * are added to make_congestion_control().
+ */
+
+#ifndef CONGESTION_HPP
+#define CONGESTION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define TCP_INITIAL_WINDOW 10        ///< Initial congestion window in segments
+#define CUBIC_C 0.4                  ///< CUBIC scaling constant (segments / s^3)
+#define CUBIC_BETA 0.7               ///< CUBIC multiplicative decrease factor
+
+using TcpClock = std::chrono::steady_clock;
+
+class CongestionControl {
+public:
+    explicit CongestionControl(uint32_t mss) : mss(mss), cwnd(TCP_INITIAL_WINDOW * mss) {}
+    virtual ~CongestionControl() = default;
+
+    virtual const char *name() const = 0;
+    uint32_t window() const { return cwnd; }
+    uint32_t slow_start_threshold() const { return ssthresh; }
+
+    /**
+     * New data was acknowledged (not called during fast recovery).
+     * @param acked Bytes newly acknowledged
+     * @param srtt Smoothed round-trip time (zero before the first sample)
+     */
+    virtual void on_ack(uint32_t acked, TcpClock::duration srtt, TcpClock::time_point now) = 0;
+
+    /// A loss detected by duplicate ACKs, with `flight` bytes outstanding
+    virtual void on_fast_retransmit(uint32_t flight, TcpClock::time_point now) = 0;
+
+    /// The retransmission timer expired with `flight` bytes outstanding
+    virtual void on_timeout(uint32_t flight, TcpClock::time_point now) = 0;
+
+protected:
+    uint32_t mss;
+    uint32_t cwnd;
+    uint32_t ssthresh = UINT32_MAX;
+
+    // Slow start grows by at most one MSS per ACK (RFC 5681, section 3.1)
+    bool slow_start(uint32_t acked) {
+        if (cwnd >= ssthresh) return false;
+        cwnd += std::min(acked, mss);
+        return true;
+    }
+};
+
+class RenoControl : public CongestionControl {
+public:
+    using CongestionControl::CongestionControl;
+
+    const char *name() const override { return "reno"; }
+
+    void on_ack(uint32_t acked, TcpClock::duration, TcpClock::time_point) override {
+        if (slow_start(acked)) return;
+        // Congestion avoidance with byte counting: one MSS per window acknowledged
+        bytes_acked += acked;
+        if (bytes_acked >= cwnd) {
+            bytes_acked -= cwnd;
+            cwnd += mss;
+        }
+    }
+
+    void on_fast_retransmit(uint32_t flight, TcpClock::time_point) override {
+        ssthresh = std::max(flight / 2, 2 * mss);
+        cwnd = ssthresh;
+        bytes_acked = 0;
+    }
+
+    void on_timeout(uint32_t flight, TcpClock::time_point) override {
+        ssthresh = std::max(flight / 2, 2 * mss);
+        cwnd = mss;
+        bytes_acked = 0;
+    }
+
+private:
+    uint32_t bytes_acked = 0;        ///< acknowledged since the last increase in congestion avoidance
+};
+
+class CubicControl : public CongestionControl {
+public:
+    using CongestionControl::CongestionControl;
+
+    const char *name() const override { return "cubic"; }
+
+    void on_ack(uint32_t acked, TcpClock::duration srtt, TcpClock::time_point now) override {
+        if (slow_start(acked)) {
+            segments = double(cwnd) / mss;
+            return;
+        }
+        if (!in_epoch) {
+            // First ACK of a congestion avoidance epoch
+            in_epoch = true;
+            epoch_start = now;
+            if (w_max < segments) {
+                w_max = segments;
+                k = 0;
+            } else {
+                k = std::cbrt((w_max - segments) / CUBIC_C);
+            }
+            w_est = segments;
+        }
+
+        // Target for one RTT from now, at most 1.5 times the window
+        double t = std::chrono::duration<double>(now - epoch_start + srtt).count();
+        double w_cubic = CUBIC_C * (t - k) * (t - k) * (t - k) + w_max;
+        double target = std::min(std::max(w_cubic, segments), 1.5 * segments);
+        double acked_segments = double(acked) / mss;
+
+        // What Reno with the same decrease factor would have reached
+        const double alpha = 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA);
+        w_est += alpha * acked_segments / segments;
+
+        if (w_cubic < w_est) {
+            segments = std::max(segments, w_est);
+        } else {
+            segments += (target - segments) / segments * acked_segments;
+        }
+        cwnd = uint32_t(segments * mss);
+    }
+
+    void on_fast_retransmit(uint32_t, TcpClock::time_point) override {
+        reduce();
+        segments = std::max(segments * CUBIC_BETA, 2.0);
+        cwnd = uint32_t(segments * mss);
+        ssthresh = cwnd;
+    }
+
+    void on_timeout(uint32_t, TcpClock::time_point) override {
+        reduce();
+        ssthresh = uint32_t(std::max(segments * CUBIC_BETA, 2.0) * mss);
+        segments = 1;
+        cwnd = mss;
+    }
+
+private:
+    double segments = TCP_INITIAL_WINDOW;  ///< cwnd in segments, with the fractions ACKs add
+    double w_max = 0;                ///< window before the last reduction (segments)
+    double k = 0;                    ///< seconds the cubic takes to climb back to w_max
+    double w_est = 0;                ///< Reno-friendly estimate (segments)
+    bool in_epoch = false;
+    TcpClock::time_point epoch_start;
+
+    void reduce() {
+        // Fast convergence: a flow losing before its previous maximum releases bandwidth
+        if (segments < w_max) {
+            w_max = segments * (1 + CUBIC_BETA) / 2;
+        } else {
+            w_max = segments;
+        }
+        in_epoch = false;
+    }
+};
+
+/// The controller called `name` ("reno" or "cubic"), or nullptr if there is none
+inline std::unique_ptr<CongestionControl> make_congestion_control(const std::string &name, uint32_t mss) {
+    if (name == "reno") return std::make_unique<RenoControl>(mss);
+    if (name == "cubic") return std::make_unique<CubicControl>(mss);
+    return nullptr;
+}
+
+#endif // CONGESTION_HPP
@@ -0,0 +1,694 @@
+// handshake_listener.hpp
+/**
+ * The server's protocol logic, independent of where packets come from.
+ *
+ * HandshakeListener answers SYNs, tracks half-open and established
+ * connections, and runs their timers (see server.cpp for the behaviour).
+ * It reads and writes through a PacketIO and takes the current time from
+ * its caller, so the same code runs on raw sockets or a TUN device under
+ * server.cpp's poll loop, and on a MemoryLink under stack_bench.cpp's
+ * virtual clock.
+ */
+
+#ifndef HANDSHAKE_LISTENER_HPP
+#define HANDSHAKE_LISTENER_HPP
+
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "packet_builder.hpp"
+#include "packet_io.hpp"
+#include "tcp_stream.hpp"
+
+#define SERVER_PORT 12345            ///< Listening port
+#define DEFAULT_BACKLOG 65536        ///< Half-open connections kept before falling back to SYN cookies
+#define SYNACK_TIMEOUT_MS 1000       ///< First SYN-ACK retransmission timeout; doubles on every retry
+#define SYNACK_RETRIES 3             ///< Retransmissions before a half-open connection expires
+#define COOKIE_PERIOD_SECONDS 64     ///< SYN cookie counter tick
+#define COOKIE_MAX_AGE 2             ///< Cookies stay valid for this many ticks after the current one
+#define DEFAULT_MSS 536              ///< RFC 1122 default when the SYN carries no MSS option
+#define SERVER_WINDOW 65535          ///< Receive window we advertise (no window scaling)
+#define DEFAULT_MAX_CONNECTIONS 65536  ///< Established connections tracked for their data phase
+#define CONNECTION_IDLE_SECONDS 10   ///< An established connection silent this long is dropped
+#define FIN_TIMEOUT_MS 1000          ///< First FIN retransmission timeout; doubles on every retry
+#define FIN_RETRIES 3                ///< FIN retransmissions before the connection is dropped
+
+using Clock = std::chrono::steady_clock;
+
+// ---------------- SipHash-2-4 ----------------
+/**
+ * Keyed 64-bit hash (Aumasson & Bernstein) for ISNs, cookies and the table.
+ * @param key 128-bit secret
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ */
+inline uint64_t siphash24(const uint64_t key[2], const uint8_t *data, size_t len) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0], v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0], v3 = 0x7465646279746573ULL ^ key[1];
+    auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+    auto round = [&] {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    };
+    size_t blocks = len / 8;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t m;
+        memcpy(&m, data + i * 8, 8);
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    }
+    uint64_t last = uint64_t(len) << 56;
+    for (size_t i = 0; i < len % 8; ++i) last |= uint64_t(data[blocks * 8 + i]) << (8 * i);
+    v3 ^= last;
+    round();
+    round();
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// ---------------- Connection Table ----------------
+/// Addresses and ports as they appear on the wire (network byte order), from the client's side
+struct FourTuple {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+
+    bool operator==(const FourTuple &other) const {
+        return saddr == other.saddr && daddr == other.daddr && sport == other.sport && dport == other.dport;
+    }
+};
+
+/// A SYN we answered and whose final ACK has not arrived yet
+struct HalfOpen {
+    uint32_t client_isn;
+    uint32_t server_isn;
+    uint16_t mss;
+    bool sack_permitted;         ///< the SYN offered SACK, so the SYN-ACK accepts it
+    int retries;                 ///< SYN-ACKs retransmitted so far
+    Clock::time_point deadline;  ///< next retransmission, or expiry after the last one
+};
+
+/// An established connection in its data phase
+struct Connection {
+    TcpReceiver receiver;
+    uint32_t seq;                ///< our sequence number: server ISN + 1 (our FIN takes it)
+    uint32_t client_isn;         ///< tells a retransmitted SYN from a restarted client
+    bool ack_pending = false;    ///< a delayed ACK is owed at the end of the receive batch
+    bool fin_sent = false;
+    int retries = 0;             ///< FINs retransmitted so far
+    Clock::time_point deadline;  ///< FIN retransmission, or the next idle check
+    Clock::time_point opened, last_activity;
+};
+
+struct ServerConfig {
+    uint16_t port = SERVER_PORT;
+    size_t backlog = DEFAULT_BACKLOG;
+    size_t max_connections = DEFAULT_MAX_CONNECTIONS;
+    enum { COOKIES_AUTO, COOKIES_ALWAYS, COOKIES_NEVER } syncookies = COOKIES_AUTO;
+    bool quiet = false;
+    uint64_t count = 0;            ///< exit after this many handshakes (0: run until interrupted)
+    int stats_interval = 1;        ///< seconds between rate reports in quiet mode
+    IoMode io_mode = IoMode::RECVFROM;
+    bool filter = true;            ///< attach the BPF filter to the receiving socket
+    std::string interface;         ///< interface the ring is bound to, or the TUN device (empty: default)
+    uint64_t seed = 0;             ///< derive the secret keys from this instead of random_device (0: don't)
+    std::string capture;           ///< pcap-ng file for every packet (empty: none)
+};
+
+struct ServerStats {
+    uint64_t syns = 0;
+    uint64_t syn_acks = 0;
+    uint64_t retransmits = 0;
+    uint64_t expired = 0;
+    uint64_t established = 0;
+    uint64_t cookies_sent = 0;
+    uint64_t cookies_accepted = 0;
+    uint64_t bad_acks = 0;         ///< ACKs matching no connection and no valid cookie
+    uint64_t ignored = 0;          ///< delivered packets that are not for us (other ports, RSTs, ...)
+    uint64_t closed = 0;           ///< connections closed by FIN
+    uint64_t dropped = 0;          ///< connections expired idle or with their FIN unacknowledged
+    uint64_t untracked = 0;        ///< established while the connection table was full
+    uint64_t data_bytes = 0;       ///< in-order bytes received
+    uint64_t data_segments = 0;
+    uint64_t out_of_order = 0;
+    uint64_t duplicates = 0;
+    uint64_t corrupt = 0;
+    uint64_t acks_sent = 0;        ///< data-phase ACKs and FINs
+    uint64_t challenge_acks = 0;   ///< ACKs answering a duplicate SYN on an established connection
+};
+
+// MSS values a cookie can encode in its 3-bit index (as in Linux)
+const uint16_t COOKIE_MSS[8] = {536, 1300, 1440, 1460, 4312, 8960, 9000, 65495};
+
+class HandshakeListener {
+public:
+    /**
+     * @param io Where packets come from and replies go; it outlives the listener
+     * @param now Start of the cookie counter (the backend's clock)
+     */
+    HandshakeListener(const ServerConfig &config, PacketIO &io, Clock::time_point now = Clock::now())
+        : config(config), io(io), start(now) {
+        std::random_device rd;
+        std::mt19937_64 seeded(config.seed);
+        for (uint64_t *key : {isn_key, cookie_key, table_key}) {
+            for (int i = 0; i < 2; ++i) key[i] = config.seed ? seeded() : (uint64_t(rd()) << 32) | rd();
+        }
+        half_open = Table(1024, TupleHash{table_key});
+        connections = ConnectionTable(1024, TupleHash{table_key});
+    }
+
+    /**
+     * Handles every packet queued on the PacketIO, batch by batch, and sends
+     * what each batch produced. Stops early once config.count handshakes are done.
+     * @return number of packets handled
+     */
+    uint64_t receive(Clock::time_point now);
+
+    /// Runs the SYN-ACK, FIN and idle timers due by `now` and sends what they produced
+    void run_timers(Clock::time_point now);
+
+    /// Earliest pending timer (time_point::max() if none)
+    Clock::time_point next_timer() const;
+
+    /// Counts host TCP segments from now on, so report() can tell how many the filter dropped
+    void watch_host_segments() {
+        watching_host = true;
+        host_segments_at_start = host_tcp_segments();
+    }
+
+    const ServerStats &server_stats() const { return stats; }
+    size_t open_connections() const { return connections.size(); }
+    size_t half_open_connections() const { return half_open.size(); }
+    bool done() const { return config.count && stats.established >= config.count; }
+
+    void report(double seconds, uint64_t handshakes) const;
+
+private:
+    struct TupleHash {
+        const uint64_t *key;
+        size_t operator()(const FourTuple &t) const {
+            return siphash24(key, reinterpret_cast<const uint8_t *>(&t), sizeof(t));
+        }
+    };
+    using Table = std::unordered_map<FourTuple, HalfOpen, TupleHash>;
+    using ConnectionTable = std::unordered_map<FourTuple, Connection, TupleHash>;
+    using Timer = std::pair<Clock::time_point, FourTuple>;
+    struct LaterDeadline {
+        bool operator()(const Timer &a, const Timer &b) const { return a.first > b.first; }
+    };
+
+    ServerConfig config;
+    PacketIO &io;
+    uint64_t isn_key[2], cookie_key[2], table_key[2];
+    Table half_open;
+    /// SYN-ACK deadlines, one FIFO per retry count. Every deadline in level r is now + (SYNACK_TIMEOUT_MS << r),
+    /// so each level stays sorted even though the levels interleave. Stale entries are skipped.
+    std::array<std::deque<Timer>, SYNACK_RETRIES + 1> timers;
+    ConnectionTable connections;
+    /// FIN and idle deadlines mix, so these need a heap; stale ones are skipped as above
+    std::priority_queue<Timer, std::vector<Timer>, LaterDeadline> connection_timers;
+    std::vector<FourTuple> delayed_acks;   ///< connections owing an ACK at the end of this batch
+    Clock::time_point start;
+    bool watching_host = false;
+    uint64_t host_segments_at_start = 0;
+    ServerStats stats;
+
+    uint32_t generate_isn(const FourTuple &t, Clock::time_point now) const;
+    uint32_t cookie_counter(Clock::time_point now) const;
+    uint32_t make_cookie(const FourTuple &t, uint32_t client_isn, uint32_t mss_index, uint32_t counter) const;
+    bool check_cookie(const FourTuple &t, uint32_t client_isn, uint32_t cookie, Clock::time_point now,
+                      uint16_t &mss) const;
+    void send_syn_ack(const FourTuple &t, uint32_t server_isn, uint32_t client_isn, bool sack_permitted);
+    void handle_packet(const char *buffer, int data_size, Clock::time_point now);
+    void handle_syn(const FourTuple &t, const struct tcphdr *tcp, Clock::time_point now);
+    void handle_ack(const FourTuple &t, const struct tcphdr *tcp, const char *payload, int payload_size,
+                    Clock::time_point now);
+    void open_connection(const FourTuple &t, const struct tcphdr *tcp, const char *payload, int payload_size,
+                         Clock::time_point now);
+    void handle_segment(ConnectionTable::iterator it, const struct tcphdr *tcp, const char *payload,
+                        int payload_size, Clock::time_point now);
+    void send_ack(const FourTuple &t, Connection &conn);
+    void send_fin(const FourTuple &t, Connection &conn);
+    void send_delayed_acks();
+    void close_connection(ConnectionTable::iterator it, Clock::time_point now, bool orderly);
+    void run_handshake_timers(Clock::time_point now);
+    void run_connection_timers(Clock::time_point now);
+};
+
+// ---------------- Sequence Numbers & Cookies ----------------
+inline uint32_t HandshakeListener::generate_isn(const FourTuple &t, Clock::time_point now) const {
+    // RFC 6528: ISN = M + F(4-tuple, secret), M a timer ticking every 4 microseconds
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    return uint32_t(micros / 4) + uint32_t(siphash24(isn_key, reinterpret_cast<const uint8_t *>(&t), sizeof(t)));
+}
+
+inline uint32_t HandshakeListener::cookie_counter(Clock::time_point now) const {
+    return uint32_t(std::chrono::duration_cast<std::chrono::seconds>(now - start).count() / COOKIE_PERIOD_SECONDS);
+}
+
+/**
+ * Bernstein's layout: the top 5 bits are the counter mod 32, the next 3 the
+ * MSS index, and the low 24 a keyed hash of the 4-tuple, the client's ISN
+ * and the counter.
+ */
+inline uint32_t HandshakeListener::make_cookie(const FourTuple &t, uint32_t client_isn, uint32_t mss_index,
+                                               uint32_t counter) const {
+    uint8_t input[sizeof(FourTuple) + 8];
+    memcpy(input, &t, sizeof(t));
+    memcpy(input + sizeof(t), &client_isn, 4);
+    memcpy(input + sizeof(t) + 4, &counter, 4);
+    uint32_t hash = uint32_t(siphash24(cookie_key, input, sizeof(input))) & 0xffffff;
+    return ((counter & 31) << 27) | (mss_index << 24) | hash;
+}
+
+inline bool HandshakeListener::check_cookie(const FourTuple &t, uint32_t client_isn, uint32_t cookie,
+                                            Clock::time_point now, uint16_t &mss) const {
+    uint32_t current = cookie_counter(now);
+    for (uint32_t age = 0; age <= COOKIE_MAX_AGE && age <= current; ++age) {
+        uint32_t counter = current - age;
+        if ((counter & 31) != cookie >> 27) continue;
+        uint32_t mss_index = (cookie >> 24) & 7;
+        if (make_cookie(t, client_isn, mss_index, counter) == cookie) {
+            mss = COOKIE_MSS[mss_index];
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Options of a SYN we act on: MSS (DEFAULT_MSS without one) and SACK-permitted
+inline void parse_syn_options(const struct tcphdr *tcp, uint16_t &mss, bool &sack_permitted) {
+    mss = DEFAULT_MSS;
+    sack_permitted = false;
+    const uint8_t *opt = reinterpret_cast<const uint8_t *>(tcp) + sizeof(struct tcphdr);
+    const uint8_t *end = reinterpret_cast<const uint8_t *>(tcp) + tcp->doff * 4;
+    while (opt < end) {
+        if (*opt == TCPOPT_EOL) break;
+        if (*opt == TCPOPT_NOP) {
+            ++opt;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end) break;
+        if (*opt == TCPOPT_MAXSEG && opt[1] == TCPOLEN_MAXSEG) mss = (opt[2] << 8) | opt[3];
+        if (*opt == TCPOPT_SACK_PERMITTED && opt[1] == TCPOLEN_SACK_PERMITTED) sack_permitted = true;
+        opt += opt[1];
+    }
+}
+
+// ---------------- Packet I/O ----------------
+inline void print_tcp_flags(const struct tcphdr *tcp) {
+    std::cout << "[+] TCP Flags: "
+              << " SYN: " << tcp->syn
+              << " ACK: " << tcp->ack
+              << " FIN: " << tcp->fin
+              << " RST: " << tcp->rst
+              << " PSH: " << tcp->psh
+              << " SEQ: " << ntohl(tcp->seq) << std::endl;
+}
+
+// SYN-ACKs always carry our MSS, and SACK-permitted when the client offered it
+using SynAckPacket = TcpPacketTemplate<TCP_OPT_MSS>;
+using SynAckSackPacket = TcpPacketTemplate<TCP_OPT_MSS | TCP_OPT_SACK_PERMITTED>;
+const SynAckPacket SYN_ACK(TH_SYN | TH_ACK, SERVER_WINDOW);
+const SynAckSackPacket SYN_ACK_SACK(TH_SYN | TH_ACK, SERVER_WINDOW);
+
+// Data phase: bare ACKs, and the FIN that answers the client's
+using AckPacket = TcpPacketTemplate<TCP_OPT_NONE>;
+const AckPacket ACK_PACKET(TH_ACK, SERVER_WINDOW);
+const AckPacket FIN_ACK_PACKET(TH_FIN | TH_ACK, SERVER_WINDOW);
+
+inline void HandshakeListener::send_syn_ack(const FourTuple &t, uint32_t server_isn, uint32_t client_isn,
+                                            bool sack_permitted) {
+    // Back to where the SYN came from
+    PacketAddress to{t.daddr, t.saddr, t.dport, t.sport};
+    char packet[SynAckSackPacket::SIZE];
+    if (sack_permitted) {
+        SYN_ACK_SACK.build(packet, to, server_isn, client_isn + 1);
+        io.send(packet, SynAckSackPacket::SIZE, t.saddr);
+    } else {
+        SYN_ACK.build(packet, to, server_isn, client_isn + 1);
+        io.send(packet, SynAckPacket::SIZE, t.saddr);
+    }
+    ++stats.syn_acks;
+    if (!config.quiet) std::cout << "[+] Sent SYN-ACK with SEQ: " << server_isn << std::endl;
+}
+
+// The BPF filter normally keeps everything else out; these checks remain
+// for --no-filter and for packets the filter cannot judge (truncated ones)
+inline void HandshakeListener::handle_packet(const char *buffer, int data_size, Clock::time_point now) {
+    const struct iphdr *ip = (const struct iphdr *)buffer;
+    if (data_size < (int)sizeof(struct iphdr) || ip->protocol != IPPROTO_TCP ||
+        data_size < ip->ihl * 4 + (int)sizeof(struct tcphdr)) {
+        ++stats.ignored;
+        return;
+    }
+    int ip_len = ip->ihl * 4;
+    const struct tcphdr *tcp = (const struct tcphdr *)(buffer + ip_len);
+
+    // Only process packets for the correct destination port
+    if (ntohs(tcp->dest) != config.port || tcp->doff < 5 || data_size < ip_len + tcp->doff * 4 || tcp->rst) {
+        ++stats.ignored;
+        return;
+    }
+
+    if (!config.quiet) print_tcp_flags(tcp);
+
+    FourTuple t{ip->saddr, ip->daddr, tcp->source, tcp->dest};
+    int header_size = ip_len + tcp->doff * 4;
+    int payload_size = std::min<int>(data_size, ntohs(ip->tot_len)) - header_size;
+    if (tcp->syn && !tcp->ack) {
+        handle_syn(t, tcp, now);
+    } else if (tcp->ack && !tcp->syn) {
+        handle_ack(t, tcp, buffer + header_size, std::max(payload_size, 0), now);
+    } else {
+        ++stats.ignored;
+    }
+}
+
+inline void HandshakeListener::handle_syn(const FourTuple &t, const struct tcphdr *tcp, Clock::time_point now) {
+    ++stats.syns;
+    uint32_t client_isn = ntohl(tcp->seq);
+    if (!config.quiet) {
+        struct in_addr from{t.saddr};
+        std::cout << "[+] Received SYN from " << inet_ntoa(from) << ":" << ntohs(t.sport) << std::endl;
+    }
+
+    // A late copy of the SYN that opened a connection leaves it alone and gets
+    // a challenge ACK (RFC 5961 section 4). A SYN with another ISN starts a new
+    // incarnation: the client restarted.
+    auto conn = connections.find(t);
+    if (conn != connections.end()) {
+        if (conn->second.client_isn == client_isn) {
+            ++stats.challenge_acks;
+            send_ack(t, conn->second);
+            return;
+        }
+        close_connection(conn, now, false);
+    }
+
+    // A repeated SYN (our SYN-ACK was lost) gets the same SYN-ACK again
+    auto it = half_open.find(t);
+    if (it != half_open.end() && it->second.client_isn == client_isn) {
+        send_syn_ack(t, it->second.server_isn, client_isn, it->second.sack_permitted);
+        return;
+    }
+
+    uint16_t mss;
+    bool sack_permitted;
+    parse_syn_options(tcp, mss, sack_permitted);
+    bool use_cookie = config.syncookies == ServerConfig::COOKIES_ALWAYS ||
+                      (config.syncookies == ServerConfig::COOKIES_AUTO && half_open.size() >= config.backlog);
+    if (use_cookie) {
+        // Largest encodable MSS not above the client's. A cookie has no room
+        // for SACK-permitted, so those connections go without SACK.
+        uint32_t mss_index = 0;
+        while (mss_index < 7 && COOKIE_MSS[mss_index + 1] <= mss) ++mss_index;
+        send_syn_ack(t, make_cookie(t, client_isn, mss_index, cookie_counter(now)), client_isn, false);
+        ++stats.cookies_sent;
+        return;
+    }
+    if (half_open.size() >= config.backlog) return;   // table full and cookies disabled: drop
+
+    Clock::time_point deadline = now + std::chrono::milliseconds(SYNACK_TIMEOUT_MS);
+    HalfOpen &entry = half_open[t];
+    entry = HalfOpen{client_isn, generate_isn(t, now), mss, sack_permitted, 0, deadline};
+    timers[0].emplace_back(deadline, t);
+    send_syn_ack(t, entry.server_isn, client_isn, sack_permitted);
+}
+
+inline void HandshakeListener::handle_ack(const FourTuple &t, const struct tcphdr *tcp, const char *payload,
+                                          int payload_size, Clock::time_point now) {
+    auto conn = connections.find(t);
+    if (conn != connections.end()) {
+        handle_segment(conn, tcp, payload, payload_size, now);
+        return;
+    }
+
+    uint32_t seq = ntohl(tcp->seq), ack_seq = ntohl(tcp->ack_seq);
+    auto it = half_open.find(t);
+    bool from_cookie = false;
+    if (it != half_open.end()) {
+        if (seq != it->second.client_isn + 1 || ack_seq != it->second.server_isn + 1) {
+            ++stats.bad_acks;
+            return;
+        }
+        half_open.erase(it);
+    } else {
+        uint16_t mss;
+        if (config.syncookies == ServerConfig::COOKIES_NEVER || !check_cookie(t, seq - 1, ack_seq - 1, now, mss)) {
+            ++stats.bad_acks;
+            return;
+        }
+        from_cookie = true;
+        ++stats.cookies_accepted;
+    }
+
+    ++stats.established;
+    if (!config.quiet) {
+        std::cout << "[+] Received ACK, handshake complete" << (from_cookie ? " (SYN cookie)." : ".") << std::endl;
+    }
+    open_connection(t, tcp, payload, payload_size, now);
+}
+
+// ---------------- Data Phase ----------------
+inline void HandshakeListener::open_connection(const FourTuple &t, const struct tcphdr *tcp, const char *payload,
+                                               int payload_size, Clock::time_point now) {
+    if (connections.size() >= config.max_connections) {
+        ++stats.untracked;
+        return;
+    }
+    uint32_t client_next = ntohl(tcp->seq), server_next = ntohl(tcp->ack_seq);
+    auto it = connections.emplace(t, Connection{TcpReceiver(client_next, SERVER_WINDOW), server_next, client_next - 1})
+                  .first;
+    Connection &conn = it->second;
+    conn.opened = conn.last_activity = now;
+    conn.deadline = now + std::chrono::seconds(CONNECTION_IDLE_SECONDS);
+    connection_timers.emplace(conn.deadline, t);
+    // The final ACK of the handshake may already carry data
+    if (payload_size > 0 || tcp->fin) handle_segment(it, tcp, payload, payload_size, now);
+}
+
+inline void HandshakeListener::handle_segment(ConnectionTable::iterator it, const struct tcphdr *tcp,
+                                              const char *payload, int payload_size, Clock::time_point now) {
+    const FourTuple &t = it->first;
+    Connection &conn = it->second;
+    conn.last_activity = now;
+    if (conn.fin_sent && ntohl(tcp->ack_seq) == conn.seq + 1) {
+        close_connection(it, now, true);   // our FIN is acknowledged
+        return;
+    }
+    if (payload_size == 0 && !tcp->fin) return;
+
+    uint64_t bytes = conn.receiver.bytes();
+    ReceiverStats before = conn.receiver.receiver_stats();
+    TcpReceiver::Ack ack = conn.receiver.on_segment(ntohl(tcp->seq), payload, payload_size, tcp->fin);
+    const ReceiverStats &after = conn.receiver.receiver_stats();
+    stats.data_bytes += conn.receiver.bytes() - bytes;
+    stats.data_segments += after.segments - before.segments;
+    stats.out_of_order += after.out_of_order - before.out_of_order;
+    stats.duplicates += after.duplicates - before.duplicates;
+    stats.corrupt += after.corrupt - before.corrupt;
+
+    if (conn.receiver.fin_received()) {
+        // We have nothing to send, so our FIN goes out with the ACK of theirs;
+        // a retransmitted FIN from the client gets the same answer again
+        if (!conn.fin_sent) {
+            conn.fin_sent = true;
+            conn.deadline = now + std::chrono::milliseconds(FIN_TIMEOUT_MS);
+            connection_timers.emplace(conn.deadline, t);
+        }
+        send_fin(t, conn);
+    } else if (ack == TcpReceiver::Ack::NOW) {
+        send_ack(t, conn);
+    } else if (ack == TcpReceiver::Ack::DELAYED && !conn.ack_pending) {
+        conn.ack_pending = true;
+        delayed_acks.push_back(t);
+    }
+}
+
+inline void HandshakeListener::send_ack(const FourTuple &t, Connection &conn) {
+    PacketAddress to{t.daddr, t.saddr, t.dport, t.sport};
+    char packet[AckPacket::SIZE];
+    ACK_PACKET.build(packet, to, conn.seq + (conn.fin_sent ? 1 : 0), conn.receiver.ack_number());
+    io.send(packet, AckPacket::SIZE, t.saddr);
+    conn.ack_pending = false;
+    ++stats.acks_sent;
+}
+
+inline void HandshakeListener::send_fin(const FourTuple &t, Connection &conn) {
+    PacketAddress to{t.daddr, t.saddr, t.dport, t.sport};
+    char packet[AckPacket::SIZE];
+    FIN_ACK_PACKET.build(packet, to, conn.seq, conn.receiver.ack_number());
+    io.send(packet, AckPacket::SIZE, t.saddr);
+    conn.ack_pending = false;
+    ++stats.acks_sent;
+}
+
+// ACKs delayed during a receive batch go out once it is processed
+inline void HandshakeListener::send_delayed_acks() {
+    for (const FourTuple &t : delayed_acks) {
+        auto it = connections.find(t);
+        if (it != connections.end() && it->second.ack_pending) send_ack(t, it->second);
+    }
+    delayed_acks.clear();
+}
+
+inline void HandshakeListener::close_connection(ConnectionTable::iterator it, Clock::time_point now, bool orderly) {
+    const Connection &conn = it->second;
+    if (orderly) {
+        ++stats.closed;
+    } else {
+        ++stats.dropped;
+    }
+    if (!config.quiet) {
+        struct in_addr from{it->first.saddr};
+        double seconds = std::chrono::duration<double>(now - conn.opened).count();
+        const ReceiverStats &receiver = conn.receiver.receiver_stats();
+        std::cout << "[+] Connection from " << inet_ntoa(from) << ":" << ntohs(it->first.sport)
+                  << (orderly ? " closed: " : " dropped: ") << conn.receiver.bytes() << " bytes in " << seconds
+                  << " s (" << conn.receiver.bytes() * 8 / seconds / 1e6 << " Mbit/s), out-of-order: "
+                  << receiver.out_of_order << " duplicates: " << receiver.duplicates << std::endl;
+    }
+    connections.erase(it);
+}
+
+// Retransmit FINs, and drop connections out of FIN retries or idle too long
+inline void HandshakeListener::run_connection_timers(Clock::time_point now) {
+    while (!connection_timers.empty() && connection_timers.top().first <= now) {
+        auto [deadline, t] = connection_timers.top();
+        connection_timers.pop();
+        auto it = connections.find(t);
+        if (it == connections.end() || it->second.deadline != deadline) continue;   // closed or re-armed
+
+        Connection &conn = it->second;
+        if (conn.fin_sent) {
+            if (conn.retries >= FIN_RETRIES) {
+                close_connection(it, now, false);
+                continue;
+            }
+            ++conn.retries;
+            conn.deadline = now + std::chrono::milliseconds(FIN_TIMEOUT_MS << conn.retries);
+            connection_timers.emplace(conn.deadline, t);
+            send_fin(t, conn);
+        } else if (now - conn.last_activity >= std::chrono::seconds(CONNECTION_IDLE_SECONDS)) {
+            close_connection(it, now, false);
+        } else {
+            // Segments do not touch the heap; the idle check just comes back later
+            conn.deadline = conn.last_activity + std::chrono::seconds(CONNECTION_IDLE_SECONDS);
+            connection_timers.emplace(conn.deadline, t);
+        }
+    }
+}
+
+// Retransmit SYN-ACKs whose deadline passed, and expire those out of retries
+inline void HandshakeListener::run_handshake_timers(Clock::time_point now) {
+    for (auto &level : timers) {
+        while (!level.empty() && level.front().first <= now) {
+            auto [deadline, t] = level.front();
+            level.pop_front();
+            auto it = half_open.find(t);
+            if (it == half_open.end() || it->second.deadline != deadline) continue;   // completed or re-armed
+
+            HalfOpen &entry = it->second;
+            if (entry.retries >= SYNACK_RETRIES) {
+                half_open.erase(it);
+                ++stats.expired;
+                continue;
+            }
+            ++entry.retries;
+            ++stats.retransmits;
+            entry.deadline = now + std::chrono::milliseconds(SYNACK_TIMEOUT_MS << entry.retries);
+            // Not due yet, so the next level's pass leaves it queued
+            timers[entry.retries].emplace_back(entry.deadline, t);
+            send_syn_ack(t, entry.server_isn, entry.client_isn, entry.sack_permitted);
+        }
+    }
+}
+
+// ---------------- Driving ----------------
+// Drain everything queued before looking at the clock again; the SYN-ACKs
+// and ACKs each batch produces go out together
+inline uint64_t HandshakeListener::receive(Clock::time_point now) {
+    uint64_t handled = 0;
+    auto handler = [&](const char *packet, int length) { handle_packet(packet, length, now); };
+    while (!done()) {
+        int count = io.receive(handler);
+        if (count == 0) break;
+        handled += count;
+        send_delayed_acks();
+        io.flush();
+    }
+    return handled;
+}
+
+inline void HandshakeListener::run_timers(Clock::time_point now) {
+    run_handshake_timers(now);
+    run_connection_timers(now);
+    io.flush();
+}
+
+inline Clock::time_point HandshakeListener::next_timer() const {
+    Clock::time_point next = Clock::time_point::max();
+    for (const auto &level : timers) {
+        if (!level.empty()) next = std::min(next, level.front().first);
+    }
+    if (!connection_timers.empty()) next = std::min(next, connection_timers.top().first);
+    return next;
+}
+
+inline void HandshakeListener::report(double seconds, uint64_t handshakes) const {
+    std::cout << "[+] handshakes/s: " << uint64_t(handshakes / seconds)
+              << " established: " << stats.established
+              << " half-open: " << half_open.size()
+              << " SYNs: " << stats.syns
+              << " SYN-ACKs: " << stats.syn_acks
+              << " retransmits: " << stats.retransmits
+              << " expired: " << stats.expired
+              << " cookies sent/accepted: " << stats.cookies_sent << "/" << stats.cookies_accepted
+              << " bad ACKs: " << stats.bad_acks;
+    const IoStats &io_stats = io.io_stats();
+    if (io_stats.receive_calls) {
+        std::cout << " packets/receive: " << double(io_stats.packets_received) / io_stats.receive_calls;
+    }
+    if (io_stats.send_calls) {
+        std::cout << " packets/send: " << double(io_stats.packets_sent) / io_stats.send_calls;
+    }
+    std::cout << std::endl;
+    std::cout << "    connections: " << connections.size() << " open, " << stats.closed << " closed, " << stats.dropped
+              << " dropped, " << stats.untracked << " untracked; data bytes: " << stats.data_bytes
+              << " segments: " << stats.data_segments << " out-of-order: " << stats.out_of_order
+              << " duplicates: " << stats.duplicates << " corrupt: " << stats.corrupt << " ACKs sent: " << stats.acks_sent
+              << " (challenge: " << stats.challenge_acks << ")" << std::endl;
+
+    std::cout << "    delivered: " << io_stats.packets_received << " (ignored after delivery: " << stats.ignored << ")";
+    if (watching_host) {
+        // Every TCP segment the host received reached the socket, or was dropped by the filter
+        uint64_t host_segments = host_tcp_segments() - host_segments_at_start;
+        std::cout << " filtered in kernel: "
+                  << (host_segments > io_stats.packets_received ? host_segments - io_stats.packets_received : 0)
+                  << " of " << host_segments << " host TCP segments";
+    }
+    std::cout << std::endl;
+}
+
+#endif // HANDSHAKE_LISTENER_HPP
@@ -0,0 +1,187 @@
+// packet_builder.hpp
+/**
+ * Zero-allocation IPv4/TCP packet construction from precomputed templates.
+ *
+ * A TcpPacketTemplate is built once per kind of packet (a SYN, a SYN-ACK,
+ * an ACK). It holds the complete header image, including the TCP options
+ * chosen at compile time, with every per-packet field zeroed, together
+ * with the partial checksums of that image. build() copies the image
+ * (a fixed-size copy of 40-64 bytes, no memset), patches addresses, ports,
+ * sequence numbers and timestamps, and finishes both checksums by adding
+ * only the patched fields. This is RFC 1624's incremental update from a
+ * template whose patched fields are all zero.
+ *
+ *   using SynPacket = TcpPacketTemplate<TCP_OPT_MSS | TCP_OPT_SACK_PERMITTED>;
+ *   const SynPacket syn(TH_SYN, 5840);
+ *   char packet[SynPacket::SIZE];
+ *   syn.build(packet, {saddr, daddr, htons(sport), htons(dport)}, isn, 0);
+ *
+ * Option layout follows Linux, so the headers look familiar in captures:
+ *   MSS                   02 04 mss
+ *   SACK-permitted + TS   04 02 08 0a tsval tsecr
+ *   TS only               01 01 08 0a tsval tsecr
+ *   SACK-permitted only   01 01 04 02
+ */
+
+#ifndef PACKET_BUILDER_HPP
+#define PACKET_BUILDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "checksum.hpp"
+
+#define PACKET_IP_ID 54321           ///< IP identification of every packet (all are unfragmented)
+#define PACKET_TTL 64
+#define PACKET_DEFAULT_MSS 1460      ///< MSS advertised by TCP_OPT_MSS unless given
+
+// Compile-time TCP option selection
+enum : unsigned {
+    TCP_OPT_NONE = 0,
+    TCP_OPT_MSS = 1 << 0,
+    TCP_OPT_SACK_PERMITTED = 1 << 1,
+    TCP_OPT_TIMESTAMPS = 1 << 2,
+};
+
+/// Addresses and ports as stored in the headers (network byte order)
+struct PacketAddress {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+};
+
+template <unsigned Options>
+class TcpPacketTemplate {
+public:
+    static constexpr bool HAS_MSS = (Options & TCP_OPT_MSS) != 0;
+    static constexpr bool HAS_SACK = (Options & TCP_OPT_SACK_PERMITTED) != 0;
+    static constexpr bool HAS_TIMESTAMPS = (Options & TCP_OPT_TIMESTAMPS) != 0;
+
+    static constexpr size_t IP_SIZE = sizeof(struct iphdr);
+    static constexpr size_t OPTIONS_SIZE = (HAS_MSS ? 4 : 0) + (HAS_TIMESTAMPS ? 12 : HAS_SACK ? 4 : 0);
+    static constexpr size_t TCP_SIZE = sizeof(struct tcphdr) + OPTIONS_SIZE;
+    static constexpr size_t SIZE = IP_SIZE + TCP_SIZE;
+    /// Offset of TSval within the packet (TSecr follows it)
+    static constexpr size_t TIMESTAMP_OFFSET = IP_SIZE + sizeof(struct tcphdr) + (HAS_MSS ? 4 : 0) + 4;
+
+    static_assert(OPTIONS_SIZE % 4 == 0 && TCP_SIZE <= 60, "TCP options must fit the data offset");
+
+    /**
+     * @param flags TCP flags (TH_SYN, TH_ACK, ...)
+     * @param window Advertised window
+     * @param mss MSS option value (with TCP_OPT_MSS)
+     */
+    explicit TcpPacketTemplate(uint8_t flags, uint16_t window, uint16_t mss = PACKET_DEFAULT_MSS) {
+        memset(image, 0, sizeof(image));
+        struct iphdr *ip = (struct iphdr *)image;
+        ip->ihl = 5;
+        ip->version = 4;
+        ip->tot_len = htons(SIZE);
+        ip->id = htons(PACKET_IP_ID);
+        ip->ttl = PACKET_TTL;
+        ip->protocol = IPPROTO_TCP;
+
+        struct tcphdr *tcp = (struct tcphdr *)(image + IP_SIZE);
+        tcp->doff = TCP_SIZE / 4;
+        ((uint8_t *)tcp)[13] = flags;
+        tcp->window = htons(window);
+
+        uint8_t *opt = image + IP_SIZE + sizeof(struct tcphdr);
+        if (HAS_MSS) {
+            opt[0] = TCPOPT_MAXSEG;
+            opt[1] = TCPOLEN_MAXSEG;
+            opt[2] = mss >> 8;
+            opt[3] = mss & 0xff;
+            opt += 4;
+        }
+        if (HAS_TIMESTAMPS) {
+            opt[0] = HAS_SACK ? TCPOPT_SACK_PERMITTED : TCPOPT_NOP;
+            opt[1] = HAS_SACK ? TCPOLEN_SACK_PERMITTED : TCPOPT_NOP;
+            opt[2] = TCPOPT_TIMESTAMP;
+            opt[3] = TCPOLEN_TIMESTAMP;
+        } else if (HAS_SACK) {
+            opt[0] = TCPOPT_NOP;
+            opt[1] = TCPOPT_NOP;
+            opt[2] = TCPOPT_SACK_PERMITTED;
+            opt[3] = TCPOLEN_SACK_PERMITTED;
+        }
+
+        ip_sum = checksum_partial(image, IP_SIZE);
+        tcp_sum = checksum_partial(image + IP_SIZE, TCP_SIZE, tcp_pseudo_header_sum(0, 0, TCP_SIZE));
+    }
+
+    /**
+     * Writes a complete packet (SIZE bytes) into `out`.
+     * @param seq Sequence number (host byte order)
+     * @param ack_seq Acknowledgement number (host byte order)
+     */
+    void build(char *out, const PacketAddress &address, uint32_t seq, uint32_t ack_seq) const {
+        static_assert(!HAS_TIMESTAMPS, "packets with timestamps need tsval and tsecr");
+        uint64_t sum = patch(out, address, seq, ack_seq);
+        finish(out, address, sum);
+    }
+
+    /// build() for templates with TCP_OPT_TIMESTAMPS
+    void build(char *out, const PacketAddress &address, uint32_t seq, uint32_t ack_seq, uint32_t tsval,
+               uint32_t tsecr) const {
+        static_assert(HAS_TIMESTAMPS, "template has no timestamp option");
+        uint64_t sum = patch(out, address, seq, ack_seq);
+        uint32_t stamps[2] = {htonl(tsval), htonl(tsecr)};
+        memcpy(out + TIMESTAMP_OFFSET, stamps, sizeof(stamps));
+        finish(out, address, sum + stamps[0] + stamps[1]);
+    }
+
+    /**
+     * build() for a segment with `length` bytes of payload after the header.
+     * `out` needs room for SIZE + length bytes.
+     * @return size of the packet
+     */
+    size_t build(char *out, const PacketAddress &address, uint32_t seq, uint32_t ack_seq, const void *payload,
+                 size_t length) const {
+        static_assert(!HAS_TIMESTAMPS, "packets with timestamps need tsval and tsecr");
+        uint64_t sum = patch(out, address, seq, ack_seq);
+        memcpy(out + SIZE, payload, length);
+        // The image's lengths cover the header alone; both sums gain the payload length
+        struct iphdr *ip = (struct iphdr *)out;
+        ip->tot_len = htons(SIZE + length);
+        uint64_t extra = htons((uint16_t)length);
+        finish(out, address, sum + extra + checksum_partial(payload, length), extra);
+        return SIZE + length;
+    }
+
+private:
+    alignas(8) uint8_t image[SIZE];
+    uint64_t ip_sum;    ///< partial sum of the IP header with zero addresses and checksum
+    uint64_t tcp_sum;   ///< partial sum of the TCP header and pseudo-header with zero per-packet fields
+
+    // Copies the image and writes the TCP fields; returns their checksum contribution
+    uint64_t patch(char *out, const PacketAddress &address, uint32_t seq, uint32_t ack_seq) const {
+        memcpy(out, image, SIZE);
+        struct tcphdr *tcp = (struct tcphdr *)(out + IP_SIZE);
+        tcp->source = address.sport;
+        tcp->dest = address.dport;
+        tcp->seq = htonl(seq);
+        tcp->ack_seq = htonl(ack_seq);
+        return (uint64_t)address.sport + address.dport + tcp->seq + tcp->ack_seq;
+    }
+
+    // Writes the addresses and both checksums
+    void finish(char *out, const PacketAddress &address, uint64_t tcp_fields, uint64_t ip_fields = 0) const {
+        struct iphdr *ip = (struct iphdr *)out;
+        ip->saddr = address.saddr;
+        ip->daddr = address.daddr;
+        uint64_t addresses = (uint64_t)address.saddr + address.daddr;
+        ip->check = (uint16_t)~checksum_fold(ip_sum + addresses + ip_fields);
+
+        struct tcphdr *tcp = (struct tcphdr *)(out + IP_SIZE);
+        tcp->check = (uint16_t)~checksum_fold(tcp_sum + addresses + tcp_fields);
+    }
+};
+
+#endif // PACKET_BUILDER_HPP
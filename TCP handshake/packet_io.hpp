@@ -0,0 +1,680 @@
+// packet_io.hpp
+/**
+ * IPv4 packet I/O for the handshake tools. PacketIO is the interface the
+ * server, the client and the benchmarks use, and open_packet_io() picks the
+ * backend for an IoMode. RawPacketIO has three receive paths:
+ * - recvfrom: one recvfrom() per packet on a raw TCP socket, and one
+ *   sendto() per reply (the original path)
+ * - mmsg:     recvmmsg() fills IO_BATCH packets per call, and replies are
+ *   queued and sent with sendmmsg()
+ * - ring:     a PACKET_MMAP TPACKET_V3 ring on an AF_PACKET socket; the
+ *   kernel fills blocks of packets in shared memory, so receiving needs no
+ *   system call at all while packets keep arriving. Replies use sendmmsg()
+ *   on a send-only raw socket.
+ * TunPacketIO (tun) reads and writes a TUN device instead. The host routes
+ * the TUN network to it, so we see just the packets sent there, the host
+ * stack never sees them, and our replies enter the host as if they came
+ * from a real peer behind a network interface.
+ * MemoryLink joins two in-process MemoryPacketIO endpoints with configurable
+ * delay, loss and reordering on a clock the caller advances, so benchmarks
+ * repeat exactly and need neither privileges nor a network.
+ *
+ * Every path hands out whole IPv4 packets starting at the IP header. An
+ * optional TcpFilter (tcp_filter.hpp) is attached to the receiving socket
+ * as soon as it exists, so the kernel only queues matching packets (TUN
+ * devices take no filter).
+ *
+ * set_capture() logs every packet received and sent to a PcapWriter
+ * (pcap_writer.hpp). Received packets keep the kernel's receive timestamp
+ * where the backend has one (raw sockets and the ring); sent packets are
+ * logged when they actually leave, after the sendmmsg() of their batch.
+ */
+
+#ifndef PACKET_IO_HPP
+#define PACKET_IO_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "pcap_writer.hpp"
+#include "tcp_filter.hpp"
+
+#define IO_BATCH 64                  ///< Packets per recvmmsg()/sendmmsg() call
+#define IO_SLOT_SIZE 2048            ///< Receive slot per packet (headers are all we read)
+#define IO_SEND_SLOT_SIZE 1536       ///< Largest packet the send queue holds (a full-sized data segment)
+#define SOCKET_BUFFER_SIZE (8 * 1024 * 1024)  ///< Receive buffer of the raw socket
+#define RING_BLOCK_SIZE (1 << 16)    ///< TPACKET_V3 block size; smaller blocks fill (and are handed over) sooner
+#define RING_BLOCK_COUNT 64          ///< Blocks in the ring (4 MB in total)
+#define RING_FRAME_SIZE 2048         ///< Nominal frame size (V3 packs variable-length frames)
+#define RING_RETIRE_MS 1             ///< Hand a partly filled block to userspace after this long
+#define TUN_DEFAULT_NAME "hs0"       ///< TUN device created when no interface is given
+#define TUN_HOST_ADDRESS "10.77.0.1" ///< The host's end of the TUN device
+#define TUN_NETMASK "255.255.255.0"  ///< The rest of 10.77.0.0/24 is routed to us
+#define TUN_PEER_ADDRESS "10.77.0.2" ///< Suggested address for the process on the TUN device
+
+enum class IoMode { RECVFROM, MMSG, RING, TUN };
+
+inline bool parse_io_mode(const std::string &name, IoMode &mode) {
+    if (name == "recvfrom") mode = IoMode::RECVFROM;
+    else if (name == "mmsg") mode = IoMode::MMSG;
+    else if (name == "ring") mode = IoMode::RING;
+    else if (name == "tun") mode = IoMode::TUN;
+    else return false;
+    return true;
+}
+
+inline const char *io_mode_name(IoMode mode) {
+    switch (mode) {
+        case IoMode::RECVFROM: return "recvfrom";
+        case IoMode::MMSG: return "mmsg";
+        case IoMode::RING: return "ring";
+        case IoMode::TUN: return "tun";
+    }
+    return "?";
+}
+
+struct IoStats {
+    uint64_t packets_received = 0;
+    uint64_t receive_calls = 0;      ///< recvfrom()/recvmmsg()/read() calls, or ring blocks consumed
+    uint64_t packets_sent = 0;
+    uint64_t send_calls = 0;         ///< sendto()/sendmmsg()/write() calls
+    uint64_t packets_lost = 0;       ///< sent, but dropped on purpose by a MemoryLink
+};
+
+/// A received packet, valid until the next receive_batch() on the same PacketIO
+struct PacketView {
+    const char *data;
+    int length;
+    int64_t timestamp_ns = 0;        ///< kernel receive time while capturing (0: none)
+};
+
+class PacketIO {
+public:
+    PacketIO() = default;
+    PacketIO(const PacketIO &) = delete;
+    PacketIO &operator=(const PacketIO &) = delete;
+    virtual ~PacketIO() = default;
+
+    /**
+     * Hands out up to `max` packets that are already queued, without blocking.
+     * @return number of packets; 0 once nothing is queued
+     */
+    virtual int receive_batch(PacketView *packets, int max) = 0;
+
+    /**
+     * Sends an IPv4 packet (IP header included) to `daddr`. Backends that
+     * batch queue it until flush() or a full batch.
+     */
+    virtual void send(const char *packet, size_t length, uint32_t daddr) = 0;
+
+    /// Sends everything queued by send()
+    virtual void flush() = 0;
+
+    /// Descriptor that polls readable when packets arrive (-1 for in-memory endpoints)
+    virtual int poll_fd() const = 0;
+
+    const IoStats &io_stats() const { return stats; }
+
+    /// Logs every packet received and sent from now on to `writer` (nullptr: stop); it outlives us
+    void set_capture(PcapWriter *writer) {
+        capture = writer;
+        if (capture) enable_timestamps();
+    }
+
+    /**
+     * Receives one batch of packets that are already queued, without blocking,
+     * and calls handler(const char *packet, int length) for each.
+     * @return number of packets handled; 0 once nothing is queued
+     */
+    template <class Handler>
+    int receive(Handler &&handler) {
+        PacketView batch[IO_BATCH];
+        int count = receive_batch(batch, IO_BATCH);
+        if (capture) {
+            int64_t now = clock_ns();
+            for (int i = 0; i < count; ++i) {
+                int64_t stamp = batch[i].timestamp_ns ? batch[i].timestamp_ns : now;
+                capture->write(PacketDirection::INBOUND, stamp, batch[i].data, batch[i].length);
+            }
+        }
+        for (int i = 0; i < count; ++i) handler(batch[i].data, batch[i].length);
+        return count;
+    }
+
+protected:
+    IoStats stats;
+    PcapWriter *capture = nullptr;
+
+    /// Asks the kernel for receive timestamps, once a capture starts
+    virtual void enable_timestamps() {}
+
+    /// The time packets without a kernel timestamp are logged at
+    virtual int64_t clock_ns() const { return wall_clock_ns(); }
+
+    /// Logs a packet that has just been sent
+    void sent(const char *packet, size_t length, int64_t timestamp_ns) {
+        if (capture) capture->write(PacketDirection::OUTBOUND, timestamp_ns, packet, length);
+    }
+
+    static bool fail(std::string &error, const std::string &what) {
+        error = what + ": " + strerror(errno);
+        return false;
+    }
+
+    static int received_nothing() {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("Packet reception failed");
+        return 0;
+    }
+};
+
+// ---------------- Raw Sockets ----------------
+class RawPacketIO : public PacketIO {
+public:
+    ~RawPacketIO() override {
+        if (ring != MAP_FAILED) munmap(ring, RING_BLOCK_SIZE * RING_BLOCK_COUNT);
+        if (rx_fd >= 0 && rx_fd != tx_fd) close(rx_fd);
+        if (tx_fd >= 0) close(tx_fd);
+    }
+
+    /**
+     * Opens the sockets for `mode` (recvfrom, mmsg or ring).
+     * @param interface Interface the ring is bound to (ring mode only; empty for all)
+     * @param filter Packets to receive, or nullptr for all
+     * @return false with `error` set on failure
+     */
+    bool open(IoMode io_mode, const std::string &interface, const TcpFilter *filter, std::string &error) {
+        mode = io_mode;
+        if (mode == IoMode::RING) {
+            // Send-only raw socket: IPPROTO_RAW implies IP_HDRINCL and never receives
+            tx_fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+            if (tx_fd < 0) return fail(error, "Socket creation failed");
+            if (!open_ring(interface, filter, error)) return false;
+        } else {
+            tx_fd = rx_fd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+            if (tx_fd < 0) return fail(error, "Socket creation failed");
+            if (filter && !attach_tcp_filter(rx_fd, *filter, error)) return false;
+            int one = 1;
+            if (setsockopt(tx_fd, IPPROTO_IP, IP_HDRINCL, &one, sizeof(one)) < 0) {
+                return fail(error, "setsockopt(IP_HDRINCL) failed");
+            }
+            // As root the buffer may exceed net.core.rmem_max
+            int buffer_size = SOCKET_BUFFER_SIZE;
+            if (setsockopt(rx_fd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_size, sizeof(buffer_size)) < 0) {
+                setsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            }
+        }
+
+        if (mode == IoMode::MMSG) {
+            rx_slots.resize(IO_BATCH * IO_SLOT_SIZE);
+            rx_iov.resize(IO_BATCH);
+            rx_msgs.resize(IO_BATCH);
+            for (int i = 0; i < IO_BATCH; ++i) {
+                rx_iov[i] = {&rx_slots[i * IO_SLOT_SIZE], IO_SLOT_SIZE};
+                rx_msgs[i].msg_hdr = {};
+                rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+                rx_msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+        if (mode != IoMode::RECVFROM) {
+            tx_slots.resize(IO_BATCH * IO_SEND_SLOT_SIZE);
+            tx_iov.resize(IO_BATCH);
+            tx_addrs.resize(IO_BATCH);
+            tx_msgs.resize(IO_BATCH);
+        }
+        return true;
+    }
+
+    IoMode io_mode() const { return mode; }
+    int poll_fd() const override { return rx_fd; }
+
+    int receive_batch(PacketView *packets, int max) override {
+        switch (mode) {
+            case IoMode::RECVFROM: {
+                struct iovec iov{rx_buffer, sizeof(rx_buffer)};
+                struct msghdr msg{};
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                if (capture) {
+                    msg.msg_control = rx_control.data();
+                    msg.msg_controllen = CAPTURE_CONTROL_SIZE;
+                }
+                int data_size = recvmsg(rx_fd, &msg, MSG_DONTWAIT | MSG_TRUNC);
+                if (data_size < 0) return received_nothing();
+                ++stats.receive_calls;
+                ++stats.packets_received;
+                packets[0] = {rx_buffer, std::min(data_size, (int)sizeof(rx_buffer))};
+                if (capture) packets[0].timestamp_ns = control_timestamp_ns(msg);
+                return 1;
+            }
+            case IoMode::MMSG: {
+                int batch = std::min(max, IO_BATCH);
+                // The kernel shrinks each msg_controllen to what it wrote
+                if (capture) {
+                    for (int i = 0; i < batch; ++i) rx_msgs[i].msg_hdr.msg_controllen = CAPTURE_CONTROL_SIZE;
+                }
+                int count = recvmmsg(rx_fd, rx_msgs.data(), batch, MSG_DONTWAIT, nullptr);
+                if (count <= 0) return received_nothing();
+                ++stats.receive_calls;
+                stats.packets_received += count;
+                for (int i = 0; i < count; ++i) {
+                    packets[i] = {&rx_slots[i * IO_SLOT_SIZE], (int)rx_msgs[i].msg_len};
+                    if (capture) packets[i].timestamp_ns = control_timestamp_ns(rx_msgs[i].msg_hdr);
+                }
+                return count;
+            }
+            case IoMode::RING:
+                return receive_ring(packets, max);
+            case IoMode::TUN:
+                break;
+        }
+        return 0;
+    }
+
+    /// In recvfrom mode the packet goes out at once
+    void send(const char *packet, size_t length, uint32_t daddr) override {
+        struct sockaddr_in to{};
+        to.sin_family = AF_INET;
+        to.sin_addr.s_addr = daddr;
+        if (mode == IoMode::RECVFROM || length > IO_SEND_SLOT_SIZE) {
+            ++stats.send_calls;
+            if (sendto(tx_fd, packet, length, 0, (struct sockaddr *)&to, sizeof(to)) < 0) {
+                perror("sendto() failed");
+                return;
+            }
+            ++stats.packets_sent;
+            if (capture) sent(packet, length, wall_clock_ns());
+            return;
+        }
+        if (tx_count == IO_BATCH) flush();
+        char *slot = &tx_slots[tx_count * IO_SEND_SLOT_SIZE];
+        memcpy(slot, packet, length);
+        tx_iov[tx_count] = {slot, length};
+        tx_addrs[tx_count] = to;
+        struct msghdr &hdr = tx_msgs[tx_count].msg_hdr;
+        hdr = {};
+        hdr.msg_name = &tx_addrs[tx_count];
+        hdr.msg_namelen = sizeof(struct sockaddr_in);
+        hdr.msg_iov = &tx_iov[tx_count];
+        hdr.msg_iovlen = 1;
+        ++tx_count;
+    }
+
+    void flush() override {
+        int done = 0;
+        while (done < tx_count) {
+            ++stats.send_calls;
+            int sent = sendmmsg(tx_fd, &tx_msgs[done], tx_count - done, 0);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                perror("sendmmsg() failed");
+                break;
+            }
+            stats.packets_sent += sent;
+            if (capture) {
+                int64_t now = wall_clock_ns();
+                for (int i = done; i < done + sent; ++i) {
+                    PacketIO::sent((const char *)tx_iov[i].iov_base, tx_iov[i].iov_len, now);
+                }
+            }
+            done += sent;
+        }
+        tx_count = 0;
+    }
+
+private:
+    IoMode mode = IoMode::RECVFROM;
+    int rx_fd = -1;
+    int tx_fd = -1;
+
+    char rx_buffer[IO_SLOT_SIZE];
+    std::vector<char> rx_control;    ///< control data (timestamps) per receive slot, while capturing
+    std::vector<char> rx_slots;
+    std::vector<struct iovec> rx_iov;
+    std::vector<struct mmsghdr> rx_msgs;
+
+    std::vector<char> tx_slots;
+    std::vector<struct iovec> tx_iov;
+    std::vector<struct sockaddr_in> tx_addrs;
+    std::vector<struct mmsghdr> tx_msgs;
+    int tx_count = 0;
+
+    void *ring = MAP_FAILED;
+    unsigned ring_block = 0;         ///< block being read, or the next one to read
+    bool ring_held = false;          ///< ring_block is ours until all its packets are handed out
+    uint32_t ring_left = 0;          ///< packets of ring_block not handed out yet
+    struct tpacket3_hdr *ring_frame = nullptr;
+
+    bool open_ring(const std::string &interface, const TcpFilter *filter, std::string &error) {
+        // SOCK_DGRAM strips the link-layer header, so frames start at the IP header
+        rx_fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+        if (rx_fd < 0) return fail(error, "Packet socket creation failed");
+        if (filter && !attach_tcp_filter(rx_fd, *filter, error)) return false;
+
+        int version = TPACKET_V3;
+        if (setsockopt(rx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            return fail(error, "setsockopt(PACKET_VERSION) failed");
+        }
+        // On loopback every packet would otherwise show up twice: going out and coming in
+        int one = 1;
+        setsockopt(rx_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+        struct tpacket_req3 req{};
+        req.tp_block_size = RING_BLOCK_SIZE;
+        req.tp_block_nr = RING_BLOCK_COUNT;
+        req.tp_frame_size = RING_FRAME_SIZE;
+        req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_COUNT;
+        req.tp_retire_blk_tov = RING_RETIRE_MS;
+        if (setsockopt(rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            return fail(error, "setsockopt(PACKET_RX_RING) failed");
+        }
+        ring = mmap(nullptr, RING_BLOCK_SIZE * RING_BLOCK_COUNT, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_LOCKED | MAP_POPULATE, rx_fd, 0);
+        if (ring == MAP_FAILED) {
+            ring = mmap(nullptr, RING_BLOCK_SIZE * RING_BLOCK_COUNT, PROT_READ | PROT_WRITE, MAP_SHARED, rx_fd, 0);
+        }
+        if (ring == MAP_FAILED) return fail(error, "mmap() of the packet ring failed");
+
+        struct sockaddr_ll bind_addr{};
+        bind_addr.sll_family = AF_PACKET;
+        bind_addr.sll_protocol = htons(ETH_P_IP);
+        if (!interface.empty()) {
+            bind_addr.sll_ifindex = if_nametoindex(interface.c_str());
+            if (bind_addr.sll_ifindex == 0) return fail(error, "Unknown interface " + interface);
+        }
+        if (bind(rx_fd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0) {
+            return fail(error, "bind() of the packet socket failed");
+        }
+        return true;
+    }
+
+    void enable_timestamps() override {
+        if (mode == IoMode::RING) {
+            // Frames always carry a timestamp; this makes it the NIC's where there is one
+            int source = SOF_TIMESTAMPING_RAW_HARDWARE;
+            setsockopt(rx_fd, SOL_PACKET, PACKET_TIMESTAMP, &source, sizeof(source));
+            return;
+        }
+        if (!enable_rx_timestamps(rx_fd)) perror("setsockopt(SO_TIMESTAMPING) failed");
+        rx_control.assign(IO_BATCH * CAPTURE_CONTROL_SIZE, 0);
+        for (size_t i = 0; i < rx_msgs.size(); ++i) {
+            rx_msgs[i].msg_hdr.msg_control = &rx_control[i * CAPTURE_CONTROL_SIZE];
+            rx_msgs[i].msg_hdr.msg_controllen = CAPTURE_CONTROL_SIZE;
+        }
+    }
+
+    struct tpacket_block_desc *ring_block_at(unsigned index) const {
+        return (struct tpacket_block_desc *)((char *)ring + index * RING_BLOCK_SIZE);
+    }
+
+    void release_ring_block() {
+        __atomic_store_n(&ring_block_at(ring_block)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring_block = (ring_block + 1) % RING_BLOCK_COUNT;
+        ring_held = false;
+    }
+
+    // Hands out the packets of one block; the block goes back to the kernel
+    // on the call after its last packet, when no view into it is alive
+    int receive_ring(PacketView *packets, int max) {
+        if (ring_held && ring_left == 0) release_ring_block();
+        while (!ring_held) {
+            struct tpacket_block_desc *block = ring_block_at(ring_block);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) return 0;
+            ++stats.receive_calls;
+            ring_held = true;
+            ring_left = block->hdr.bh1.num_pkts;
+            ring_frame = (struct tpacket3_hdr *)((char *)block + block->hdr.bh1.offset_to_first_pkt);
+            if (ring_left == 0) release_ring_block();   // retired empty by the timeout
+        }
+
+        int count = 0;
+        while (count < max && ring_left > 0) {
+            packets[count++] = {(const char *)ring_frame + ring_frame->tp_net, (int)ring_frame->tp_snaplen,
+                                int64_t(ring_frame->tp_sec) * 1000000000 + ring_frame->tp_nsec};
+            ring_frame = (struct tpacket3_hdr *)((char *)ring_frame + ring_frame->tp_next_offset);
+            --ring_left;
+        }
+        stats.packets_received += count;
+        return count;
+    }
+};
+
+// ---------------- TUN Device ----------------
+class TunPacketIO : public PacketIO {
+public:
+    ~TunPacketIO() override {
+        if (fd >= 0) close(fd);
+    }
+
+    /**
+     * Creates (or attaches to) TUN device `name`, gives the host
+     * TUN_HOST_ADDRESS on it and brings it up. There is no filter: the
+     * kernel attaches classic BPF only to TAP devices, and a TUN device
+     * carries nothing but what the host routes to its network anyway.
+     * @return false with `error` set on failure
+     */
+    bool open(const std::string &name, std::string &error) {
+        fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) return fail(error, "Opening /dev/net/tun failed");
+        struct ifreq ifr{};
+        ifr.ifr_flags = IFF_TUN | IFF_NO_PI;   // packets start at the IP header
+        strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) return fail(error, "ioctl(TUNSETIFF) failed");
+
+        int control = socket(AF_INET, SOCK_DGRAM, 0);
+        if (control < 0) return fail(error, "Socket creation failed");
+        bool ok = set_address(control, ifr.ifr_name, SIOCSIFADDR, TUN_HOST_ADDRESS) &&
+                  set_address(control, ifr.ifr_name, SIOCSIFNETMASK, TUN_NETMASK);
+        struct ifreq flags{};
+        strncpy(flags.ifr_name, ifr.ifr_name, IFNAMSIZ - 1);
+        ok = ok && ioctl(control, SIOCGIFFLAGS, &flags) == 0;
+        flags.ifr_flags |= IFF_UP | IFF_RUNNING;
+        ok = ok && ioctl(control, SIOCSIFFLAGS, &flags) == 0;
+        if (!ok) fail(error, std::string("Configuring ") + ifr.ifr_name + " failed");
+        close(control);
+        return ok;
+    }
+
+    int poll_fd() const override { return fd; }
+
+    int receive_batch(PacketView *packets, int max) override {
+        int count = 0;
+        while (count < std::min(max, IO_BATCH)) {
+            char *slot = &slots[count * IO_SLOT_SIZE];
+            ssize_t length = read(fd, slot, IO_SLOT_SIZE);
+            if (length < 0) {
+                if (count == 0) return received_nothing();
+                break;
+            }
+            ++stats.receive_calls;
+            if (length == 0 || (slot[0] >> 4) != 4) continue;   // the host also sends IPv6 (router solicitations)
+            packets[count++] = {slot, (int)length};
+        }
+        stats.packets_received += count;
+        return count;
+    }
+
+    /// A TUN device takes one packet per write(), so nothing is queued
+    void send(const char *packet, size_t length, uint32_t) override {
+        ++stats.send_calls;
+        if (write(fd, packet, length) < 0) {
+            perror("write() to the TUN device failed");
+            return;
+        }
+        ++stats.packets_sent;
+        if (capture) sent(packet, length, wall_clock_ns());
+    }
+
+    void flush() override {}
+
+private:
+    int fd = -1;
+    std::vector<char> slots = std::vector<char>(IO_BATCH * IO_SLOT_SIZE);
+
+    static bool set_address(int control, const char *name, unsigned long request, const char *address) {
+        struct ifreq ifr{};
+        strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = inet_addr(address);
+        return ioctl(control, request, &ifr) == 0;
+    }
+};
+
+// ---------------- In-Memory Link ----------------
+/// Impairments of one direction of a MemoryLink
+struct LinkProfile {
+    std::chrono::nanoseconds delay{0};   ///< one-way delay of every packet
+    double loss = 0;                     ///< fraction of packets dropped
+    double reorder = 0;                  ///< fraction of packets held back by reorder_delay more
+    std::chrono::nanoseconds reorder_delay{0};
+};
+
+class MemoryLink;
+
+/// One end of a MemoryLink
+class MemoryPacketIO : public PacketIO {
+public:
+    MemoryPacketIO(MemoryLink &link, int side) : link(link), side(side) {}
+
+    int receive_batch(PacketView *packets, int max) override;
+    void send(const char *packet, size_t length, uint32_t daddr) override;
+    void flush() override {}
+    int poll_fd() const override { return -1; }
+
+protected:
+    /// Captures are stamped with the link's virtual time
+    int64_t clock_ns() const override;
+
+private:
+    MemoryLink &link;
+    int side;
+    std::vector<std::vector<char>> held;   ///< packets handed out by the last receive_batch()
+};
+
+/**
+ * Two in-process endpoints joined back to back. A packet sent on one end is
+ * received on the other once the link's clock reaches its delivery time.
+ * The clock only moves when the caller sets it, and loss and reordering
+ * come from a seeded generator, so a run repeats exactly however fast or
+ * slow the host is.
+ */
+class MemoryLink {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// `forward` shapes packets from end A to end B, `backward` the replies
+    MemoryLink(const LinkProfile &forward, const LinkProfile &backward, uint32_t seed)
+        : profile{forward, backward}, rng(seed), ends{{*this, 0}, {*this, 1}} {}
+    MemoryLink(const MemoryLink &) = delete;
+    MemoryLink &operator=(const MemoryLink &) = delete;
+
+    MemoryPacketIO &end_a() { return ends[0]; }
+    MemoryPacketIO &end_b() { return ends[1]; }
+
+    void set_time(Clock::time_point time) { now = time; }
+    Clock::time_point time() const { return now; }
+
+    /// Earliest pending delivery, or time_point::max() if nothing is in flight
+    Clock::time_point next_delivery() const {
+        Clock::time_point next = Clock::time_point::max();
+        for (const std::deque<Packet> &inbox : inboxes) {
+            if (!inbox.empty()) next = std::min(next, inbox.front().due);
+        }
+        return next;
+    }
+
+private:
+    friend class MemoryPacketIO;
+
+    struct Packet {
+        Clock::time_point due;
+        std::vector<char> bytes;
+    };
+
+    LinkProfile profile[2];          ///< by sending side
+    std::mt19937 rng;
+    Clock::time_point now;
+    std::deque<Packet> inboxes[2];   ///< by receiving side, in delivery order
+    MemoryPacketIO ends[2];
+
+    // Queues a packet from side `from`; false if the link lost it
+    bool transmit(int from, const char *packet, size_t length) {
+        const LinkProfile &link = profile[from];
+        std::uniform_real_distribution<double> uniform(0, 1);
+        if (link.loss > 0 && uniform(rng) < link.loss) return false;
+        Clock::time_point due = now + link.delay;
+        if (link.reorder > 0 && uniform(rng) < link.reorder) due += link.reorder_delay;
+        // Packets due at the same time keep the order they were sent in
+        std::deque<Packet> &inbox = inboxes[1 - from];
+        auto it = inbox.end();
+        while (it != inbox.begin() && std::prev(it)->due > due) --it;
+        inbox.insert(it, Packet{due, std::vector<char>(packet, packet + length)});
+        return true;
+    }
+};
+
+inline int MemoryPacketIO::receive_batch(PacketView *packets, int max) {
+    held.clear();
+    std::deque<MemoryLink::Packet> &inbox = link.inboxes[side];
+    while ((int)held.size() < max && !inbox.empty() && inbox.front().due <= link.now) {
+        held.push_back(std::move(inbox.front().bytes));
+        inbox.pop_front();
+    }
+    for (size_t i = 0; i < held.size(); ++i) packets[i] = {held[i].data(), (int)held[i].size()};
+    if (!held.empty()) ++stats.receive_calls;
+    stats.packets_received += held.size();
+    return (int)held.size();
+}
+
+inline void MemoryPacketIO::send(const char *packet, size_t length, uint32_t) {
+    ++stats.send_calls;
+    ++stats.packets_sent;
+    if (capture) sent(packet, length, clock_ns());   // lost packets too: they did leave
+    if (!link.transmit(side, packet, length)) ++stats.packets_lost;
+}
+
+inline int64_t MemoryPacketIO::clock_ns() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(link.now.time_since_epoch()).count();
+}
+
+/**
+ * Opens the backend for `mode`.
+ * @param interface Interface the ring is bound to, or the TUN device to create
+ *                  (empty: all interfaces / TUN_DEFAULT_NAME)
+ * @param filter Packets to receive, or nullptr for all (ignored on a TUN device)
+ * @return nullptr with `error` set on failure
+ */
+inline std::unique_ptr<PacketIO> open_packet_io(IoMode mode, const std::string &interface, const TcpFilter *filter,
+                                                std::string &error) {
+    if (mode == IoMode::TUN) {
+        auto tun = std::make_unique<TunPacketIO>();
+        if (!tun->open(interface.empty() ? TUN_DEFAULT_NAME : interface, error)) return nullptr;
+        return tun;
+    }
+    auto raw = std::make_unique<RawPacketIO>();
+    if (!raw->open(mode, interface, filter, error)) return nullptr;
+    return raw;
+}
+
+#endif // PACKET_IO_HPP
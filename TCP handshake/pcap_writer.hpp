@@ -0,0 +1,241 @@
+// pcap_writer.hpp
+/**
+ * pcap-ng capture of the packets the tools send and receive.
+ *
+ * PcapWriter writes one section with one interface of link type
+ * LINKTYPE_IPV4 (packets start at the IP header, as everywhere in these
+ * tools) and nanosecond timestamps (if_tsresol = 9). Every packet is an
+ * Enhanced Packet Block whose epb_flags option says whether it was
+ * received or sent, so Wireshark can tell the directions apart
+ * (`frame.packet_flags_direction == 2` shows what a tool sent).
+ *
+ * write() only appends the block to an in-memory buffer; a background
+ * thread swaps buffers and does the file I/O, so the packet path never
+ * waits for the disk. If the disk falls behind by CAPTURE_MAX_BUFFER bytes,
+ * packets are dropped from the capture (and counted) rather than slowing
+ * the tools down.
+ *
+ * Timestamps are nanoseconds since the Unix epoch. Received packets carry
+ * the kernel's: a raw hardware timestamp when the NIC provides one (after
+ * hardware timestamping was enabled on it, e.g. with hwstamp_ctl), the
+ * kernel's software receive time otherwise. enable_rx_timestamps() asks for
+ * both and control_timestamp_ns() picks the best from a received message.
+ * Sent packets are stamped in software when the send call returns.
+ */
+
+#ifndef PCAP_WRITER_HPP
+#define PCAP_WRITER_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#define CAPTURE_FLUSH_BYTES (256 * 1024)      ///< Wake the writer thread once this much is buffered
+#define CAPTURE_FLUSH_MS 100                  ///< ... or this long after the last write to disk
+#define CAPTURE_MAX_BUFFER (64 * 1024 * 1024) ///< Drop packets beyond this much unwritten data
+#define CAPTURE_CONTROL_SIZE 256              ///< Control buffer for one received message's timestamps
+
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_IPV4 228
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+enum class PacketDirection : uint32_t { INBOUND = 1, OUTBOUND = 2 };   ///< epb_flags bits 0-1
+
+/// The wall clock in nanoseconds since the Unix epoch (the clock kernel timestamps use)
+inline int64_t wall_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/// Asks the kernel to attach receive timestamps, hardware and software, to every packet read from `fd`
+inline bool enable_rx_timestamps(int fd) {
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                SOF_TIMESTAMPING_SOFTWARE;
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+}
+
+/// The receive timestamp in a message's control data (hardware if present), or 0 if there is none
+inline int64_t control_timestamp_ns(const struct msghdr &msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR((struct msghdr *)&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) continue;
+        struct scm_timestamping stamps;
+        memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+        // ts[0] is software, ts[2] raw hardware
+        const struct timespec &best = stamps.ts[2].tv_sec || stamps.ts[2].tv_nsec ? stamps.ts[2] : stamps.ts[0];
+        return int64_t(best.tv_sec) * 1000000000 + best.tv_nsec;
+    }
+    return 0;
+}
+
+class PcapWriter {
+public:
+    PcapWriter() = default;
+    PcapWriter(const PcapWriter &) = delete;
+    PcapWriter &operator=(const PcapWriter &) = delete;
+    ~PcapWriter() { close(); }
+
+    /**
+     * Creates `path` and starts the writer thread.
+     * @param interface Name recorded for the capture interface (if_name)
+     * @return false with `error` set on failure
+     */
+    bool open(const std::string &path, const std::string &interface, std::string &error) {
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+            error = "Opening " + path + " failed: " + strerror(errno);
+            return false;
+        }
+        filling.reserve(2 * CAPTURE_FLUSH_BYTES);
+        draining.reserve(2 * CAPTURE_FLUSH_BYTES);
+
+        // Section Header Block
+        std::vector<char> block;
+        put32(block, PCAPNG_SECTION_HEADER);
+        put32(block, 0);   // total length, patched by finish_block()
+        put32(block, PCAPNG_BYTE_ORDER_MAGIC);
+        put16(block, 1);   // version 1.0
+        put16(block, 0);
+        put32(block, 0xffffffff);   // section length unknown
+        put32(block, 0xffffffff);
+        put_option(block, PCAPNG_OPT_SHB_USERAPPL, "TCP handshake tools", 19);
+        put_option_end(block);
+        finish_block(block);
+
+        // Interface Description Block: IPv4 packets, nanosecond timestamps
+        size_t idb = block.size();
+        put32(block, PCAPNG_INTERFACE_DESCRIPTION);
+        put32(block, 0);
+        put16(block, PCAPNG_LINKTYPE_IPV4);
+        put16(block, 0);
+        put32(block, 0);   // no snap length
+        put_option(block, PCAPNG_OPT_IF_NAME, interface.data(), interface.size());
+        const char nanoseconds = 9;
+        put_option(block, PCAPNG_OPT_IF_TSRESOL, &nanoseconds, 1);
+        put_option_end(block);
+        finish_block(block, idb);
+
+        filling = std::move(block);
+        running = true;
+        writer = std::thread([this] { drain(); });
+        return true;
+    }
+
+    bool is_open() const { return file != nullptr; }
+
+    /// Records one IPv4 packet; cheap enough for the packet path
+    void write(PacketDirection direction, int64_t timestamp_ns, const char *packet, size_t length) {
+        uint32_t data_size = uint32_t((length + 3) & ~size_t(3));
+        uint32_t total = 28 + data_size + 12 + 4;   // header, data, epb_flags + end of options, trailing length
+        uint64_t ticks = uint64_t(timestamp_ns);
+
+        std::unique_lock<std::mutex> guard(lock);
+        if (filling.size() + total > CAPTURE_MAX_BUFFER) {
+            ++dropped;
+            return;
+        }
+        size_t at = filling.size();
+        filling.resize(at + total);
+        char *out = &filling[at];
+        uint32_t header[7] = {PCAPNG_ENHANCED_PACKET, total, 0, uint32_t(ticks >> 32), uint32_t(ticks),
+                              uint32_t(length), uint32_t(length)};
+        memcpy(out, header, sizeof(header));
+        memcpy(out + 28, packet, length);
+        memset(out + 28 + length, 0, data_size - length);
+        uint32_t trailer[4] = {PCAPNG_OPT_EPB_FLAGS | (4u << 16), uint32_t(direction), PCAPNG_OPT_END, total};
+        memcpy(out + 28 + data_size, trailer, sizeof(trailer));
+        ++written;
+        if (filling.size() >= CAPTURE_FLUSH_BYTES) {
+            guard.unlock();
+            wake.notify_one();
+        }
+    }
+
+    /// Writes out everything buffered, stops the thread and closes the file
+    void close() {
+        if (!file) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+        }
+        wake.notify_one();
+        writer.join();
+        fclose(file);
+        file = nullptr;
+    }
+
+    uint64_t packets() const { return written; }
+    uint64_t packets_dropped() const { return dropped; }
+
+private:
+    FILE *file = nullptr;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running = false;
+    std::vector<char> filling;       ///< blocks appended by write(), under `lock`
+    std::vector<char> draining;      ///< blocks being written to the file, by the writer thread only
+    uint64_t written = 0, dropped = 0;
+
+    // The writer thread: swap the buffers, then write without holding the lock
+    void drain() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            wake.wait_for(guard, std::chrono::milliseconds(CAPTURE_FLUSH_MS),
+                          [this] { return !running || filling.size() >= CAPTURE_FLUSH_BYTES; });
+            bool stopping = !running;
+            filling.swap(draining);
+            guard.unlock();
+            if (!draining.empty() && fwrite(draining.data(), 1, draining.size(), file) != draining.size()) {
+                perror("Writing the capture failed");
+            }
+            draining.clear();
+            if (stopping) {
+                fflush(file);
+                return;
+            }
+            guard.lock();
+        }
+    }
+
+    static void put16(std::vector<char> &out, uint16_t value) {
+        out.insert(out.end(), (const char *)&value, (const char *)&value + 2);
+    }
+    static void put32(std::vector<char> &out, uint32_t value) {
+        out.insert(out.end(), (const char *)&value, (const char *)&value + 4);
+    }
+    static void put_option(std::vector<char> &out, uint16_t code, const char *value, size_t length) {
+        put16(out, code);
+        put16(out, uint16_t(length));
+        out.insert(out.end(), value, value + length);
+        out.resize((out.size() + 3) & ~size_t(3), 0);
+    }
+    static void put_option_end(std::vector<char> &out) { put32(out, PCAPNG_OPT_END); }
+
+    // Appends the trailing length and patches the leading one of the block starting at `start`
+    static void finish_block(std::vector<char> &out, size_t start = 0) {
+        uint32_t total = uint32_t(out.size() - start + 4);
+        put32(out, total);
+        memcpy(&out[start + 4], &total, 4);
+    }
+};
+
+#endif // PCAP_WRITER_HPP
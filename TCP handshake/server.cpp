@@ -1,112 +1,170 @@
+// server.cpp
+/**
+ * TCP Handshake Listener using Raw Sockets
+ *
+ * Answers SYNs on SERVER_PORT and completes three-way handshakes for many
+ * clients at once:
+ * - Half-open connections live in a hash table keyed by the 4-tuple until
+ *   the final ACK arrives. SYN-ACKs are retransmitted with exponential
+ *   backoff, and a handshake that gets no ACK after SYNACK_RETRIES expires.
+ * - Initial sequence numbers follow RFC 6528: a 4 microsecond clock plus a
+ *   keyed hash (SipHash-2-4) of the 4-tuple, so they are unpredictable per
+ *   connection but never repeat quickly for the same one.
+ * - Once the table holds --backlog entries, SYNs are answered statelessly
+ *   with SYN cookies, and an ACK that matches no entry is checked as one.
+ * - A classic BPF filter (tcp_filter.hpp) makes the kernel drop every packet
+ *   but SYNs and ACKs for SERVER_PORT before they reach the socket.
+ * - Packets are read one at a time, in batches with recvmmsg(), from a
+ *   TPACKET_V3 ring, or from a TUN device (--io, see packet_io.hpp); in the
+ *   batched modes the SYN-ACKs a batch produces go out together with
+ *   sendmmsg().
+ * - Established connections stay in a second table for their data phase
+ *   (tcp_stream.hpp): data is checked and acknowledged cumulatively, with
+ *   ACKs delayed to the end of a receive batch, and a FIN from the client
+ *   is answered with our own FIN. Silent connections expire.
+ * The protocol logic is HandshakeListener (handshake_listener.hpp); this
+ * file opens the I/O backend and runs the poll loop around it.
+ *
+ * Notes:
+ * - On raw sockets the host's own TCP stack also sees these packets and
+ *   answers them with RSTs (nothing is listening on SERVER_PORT), so RSTs
+ *   are ignored here. With --io tun the server owns TUN_PEER_ADDRESS and
+ *   the host stack stays out of it.
+ * - Per-packet logging is on by default; use --quiet at high rates.
+ *   --capture FILE records every packet, with kernel timestamps, as pcap-ng.
+ */
+
 #include <iostream>
-#include <cstring>
+#include <algorithm>
 #include <cstdlib>
-#include <sys/socket.h>
-#include <netinet/ip.h>
-#include <netinet/tcp.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-
-#define SERVER_PORT 12345  // Listening port
-
-void print_tcp_flags(struct tcphdr *tcp) {
-    std::cout << "[+] TCP Flags: "
-              << " SYN: " << tcp->syn
-              << " ACK: " << tcp->ack
-              << " FIN: " << tcp->fin
-              << " RST: " << tcp->rst
-              << " PSH: " << tcp->psh
-              << " SEQ: " << ntohl(tcp->seq) << std::endl;
-}
-
-void send_syn_ack(int sock, struct sockaddr_in *client_addr, struct tcphdr *tcp) {
-    char packet[sizeof(struct iphdr) + sizeof(struct tcphdr)];
-    memset(packet, 0, sizeof(packet));
-
-    struct iphdr *ip = (struct iphdr *)packet;
-    struct tcphdr *tcp_response = (struct tcphdr *)(packet + sizeof(struct iphdr));
-
-    // Fill IP header
-    ip->ihl = 5;
-    ip->version = 4;
-    ip->tos = 0;
-    ip->tot_len = htons(sizeof(packet));
-    ip->id = htons(54321);
-    ip->frag_off = 0;
-    ip->ttl = 64;
-    ip->protocol = IPPROTO_TCP;
-    ip->saddr = client_addr->sin_addr.s_addr;
-    ip->daddr = inet_addr("127.0.0.1");  // Server address
-
-    // Fill TCP header
-    tcp_response->source = tcp->dest;
-    tcp_response->dest = tcp->source;
-    tcp_response->seq = htonl(400);
-    tcp_response->ack_seq = htonl(ntohl(tcp->seq) + 1);
-    tcp_response->doff = 5;
-    tcp_response->syn = 1;
-    tcp_response->ack = 1;
-    tcp_response->window = htons(8192);
-    tcp_response->check = 0;  // Kernel will compute the checksum
-
-    // Send packet
-    if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)client_addr, sizeof(*client_addr)) < 0) {
-        perror("sendto() failed");
-    } else {
-        std::cout << "[+] Sent SYN-ACK" << std::endl;
-    }
-}
-
-void receive_syn() {
-    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
-    if (sock < 0) {
-        perror("Socket creation failed");
+#include <cstdint>
+#include <csignal>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <poll.h>
+
+#include "handshake_listener.hpp"
+#include "packet_io.hpp"
+#include "pcap_writer.hpp"
+
+volatile sig_atomic_t stop_requested = 0;
+
+void run(const ServerConfig &config) {
+    // Handshake packets only: SYNs and ACKs to our port, no RSTs
+    TcpFilter filter;
+    filter.dest_port = config.port;
+    filter.flags_mask = TH_SYN | TH_ACK | TH_RST;
+    filter.flags_values = {TH_SYN, TH_ACK};
+
+    std::string error;
+    std::unique_ptr<PacketIO> io = open_packet_io(config.io_mode, config.interface,
+                                                  config.filter ? &filter : nullptr, error);
+    if (!io) {
+        std::cerr << "[-] " << error << std::endl;
         exit(EXIT_FAILURE);
     }
-
-    // Enable IP header inclusion
-    int one = 1;
-    if (setsockopt(sock, IPPROTO_IP, IP_HDRINCL, &one, sizeof(one)) < 0) {
-        perror("setsockopt() failed");
-        exit(EXIT_FAILURE);
+    PcapWriter capture;
+    if (!config.capture.empty()) {
+        std::string name = config.interface.empty() ? std::string(io_mode_name(config.io_mode)) : config.interface;
+        if (!capture.open(config.capture, name, error)) {
+            std::cerr << "[-] " << error << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        io->set_capture(&capture);
     }
-
-    char buffer[65536];
-    struct sockaddr_in source_addr;
-    socklen_t addr_len = sizeof(source_addr);
-
-    while (true) {
-        int data_size = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_addr, &addr_len);
-        if (data_size < 0) {
-            perror("Packet reception failed");
-            continue;
+    HandshakeListener listener(config, *io);
+    // On a TUN device the host stack never receives the clients' packets
+    if (config.io_mode != IoMode::TUN) listener.watch_host_segments();
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point last_report = start;
+    uint64_t last_established = 0;
+
+    while (!stop_requested && !listener.done()) {
+        Clock::time_point now = Clock::now();
+        Clock::time_point wake = std::min(last_report + std::chrono::seconds(config.stats_interval),
+                                          listener.next_timer());
+        int timeout_ms =
+            std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1);
+
+        struct pollfd pfd{io->poll_fd(), POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+            perror("poll() failed");
+            break;
         }
+        if (pfd.revents & POLLIN) listener.receive(Clock::now());
+
+        now = Clock::now();
+        listener.run_timers(now);
+        if (now - last_report >= std::chrono::seconds(config.stats_interval)) {
+            uint64_t established = listener.server_stats().established;
+            if (config.quiet) {
+                listener.report(std::chrono::duration<double>(now - last_report).count(),
+                                established - last_established);
+            }
+            last_report = now;
+            last_established = established;
+        }
+    }
 
-        struct iphdr *ip = (struct iphdr *)buffer;
-        struct tcphdr *tcp = (struct tcphdr *)(buffer + (ip->ihl * 4));
-
-        // Only process packets for the correct destination port
-        if (ntohs(tcp->dest) != SERVER_PORT) continue;
-
-        print_tcp_flags(tcp);
+    listener.report(std::chrono::duration<double>(Clock::now() - start).count(), listener.server_stats().established);
+    if (capture.is_open()) {
+        capture.close();
+        std::cout << "[+] Captured " << capture.packets() << " packets to " << config.capture << " ("
+                  << capture.packets_dropped() << " dropped)" << std::endl;
+    }
+}
 
-        if (tcp->syn == 1 && tcp->ack == 0 && ntohl(tcp->seq) == 200) {
-            std::cout << "[+] Received SYN from " << inet_ntoa(source_addr.sin_addr) << std::endl;
-            send_syn_ack(sock, &source_addr, tcp);
-        }
+void usage(const char *program) {
+    std::cerr << "Usage: " << program << " [--port N] [--backlog N] [--max-connections N]"
+              << " [--syncookies auto|always|never]"
+              << " [--quiet] [--stats-interval SECONDS] [--count N] [--io recvfrom|mmsg|ring|tun]"
+              << " [--interface NAME] [--no-filter] [--capture FILE]" << std::endl;
+    exit(EXIT_FAILURE);
+}
 
-        if (tcp->ack == 1 && tcp->syn == 0 && ntohl(tcp->seq) == 600) {
-            std::cout << "[+] Received ACK, handshake complete." << std::endl;
-            break;
+int main(int argc, char *argv[]) {
+    ServerConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            config.port = std::stoi(argv[++i]);
+        } else if (arg == "--backlog" && i + 1 < argc) {
+            config.backlog = std::stoul(argv[++i]);
+        } else if (arg == "--max-connections" && i + 1 < argc) {
+            config.max_connections = std::stoul(argv[++i]);
+        } else if (arg == "--syncookies" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "auto") config.syncookies = ServerConfig::COOKIES_AUTO;
+            else if (mode == "always") config.syncookies = ServerConfig::COOKIES_ALWAYS;
+            else if (mode == "never") config.syncookies = ServerConfig::COOKIES_NEVER;
+            else usage(argv[0]);
+        } else if (arg == "--quiet") {
+            config.quiet = true;
+        } else if (arg == "--stats-interval" && i + 1 < argc) {
+            config.stats_interval = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--count" && i + 1 < argc) {
+            config.count = std::stoull(argv[++i]);
+        } else if (arg == "--io" && i + 1 < argc) {
+            if (!parse_io_mode(argv[++i], config.io_mode)) usage(argv[0]);
+        } else if (arg == "--interface" && i + 1 < argc) {
+            config.interface = argv[++i];
+        } else if (arg == "--no-filter") {
+            config.filter = false;
+        } else if (arg == "--capture" && i + 1 < argc) {
+            config.capture = argv[++i];
+        } else {
+            usage(argv[0]);
         }
     }
 
-    close(sock);
-}
+    signal(SIGINT, [](int) { stop_requested = 1; });
+    signal(SIGTERM, [](int) { stop_requested = 1; });
 
-int main() {
-    std::cout << "[+] Server listening on port " << SERVER_PORT << "..." << std::endl;
-    receive_syn();
+    std::cout << "[+] Server listening on port " << config.port << " (" << io_mode_name(config.io_mode)
+              << " I/O)..." << std::endl;
+    run(config);
     return 0;
 }
-
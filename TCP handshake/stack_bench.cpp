@@ -0,0 +1,439 @@
+// stack_bench.cpp
+/**
+ * Deterministic benchmark of the whole stack over an in-memory link.
+ *
+ * The server's HandshakeListener and a client made of the same parts as
+ * client.cpp (packet templates, TcpSender, the congestion controllers) talk
+ * over a MemoryLink (packet_io.hpp) instead of a network: no root, no
+ * sockets, no host TCP stack and its RSTs. Time is virtual. The loop jumps
+ * straight to the next delivery or timer, so a link with milliseconds of
+ * delay runs as fast as the CPU allows, and because loss and reordering come
+ * from --seed, two runs with the same options exchange exactly the same
+ * packets (compare the digest lines).
+ *
+ * Two phases, one after the other:
+ * 1. --handshakes N handshakes from distinct source ports, at most
+ *    --concurrency waiting for their SYN-ACK. Lost SYNs are sent again after
+ *    SYN_TIMEOUT_MS, and a retransmitted SYN-ACK is acknowledged again.
+ * 2. A --bytes transfer on one more connection, closed with FINs.
+ * Before either phase, TcpReceiver is fed segments larger than
+ * TCP_MAX_SEGMENT (as a peer with a bigger MSS would send), and the program
+ * exits with status 1 if one is misjudged.
+ * Results are reported in virtual time (what the link would give) together
+ * with the wall-clock time the stack needed to compute them. --capture FILE
+ * records the client's side of the link as pcap-ng, stamped with virtual
+ * time counted from the Unix epoch.
+ *
+ * Usage: ./stack_bench [--handshakes N] [--concurrency N] [--bytes N[K|M|G]] [--cc reno|cubic]
+ *                      [--delay-us US] [--loss PERCENT] [--reorder PERCENT] [--reorder-us US] [--seed N]
+ *                      [--capture FILE]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "handshake_listener.hpp"
+#include "packet_builder.hpp"
+#include "packet_io.hpp"
+#include "pcap_writer.hpp"
+#include "tcp_stream.hpp"
+
+#define CLIENT_ADDRESS "10.77.0.1"
+#define SERVER_ADDRESS "10.77.0.2"
+#define BENCH_PORT_FIRST 20000       ///< Handshake source ports count up from here
+#define BENCH_TRANSFER_PORT 54321    ///< Source port of the transfer connection
+#define CLIENT_WINDOW 5840
+#define DEFAULT_HANDSHAKES 10000
+#define DEFAULT_CONCURRENCY 256
+#define DEFAULT_BYTES (16 << 20)
+#define DEFAULT_DELAY_US 50          ///< One-way delay of the link
+#define DEFAULT_REORDER_US 200       ///< Extra delay of a reordered packet
+#define DEFAULT_SEED 1
+#define SYN_TIMEOUT_MS 1000          ///< First SYN retransmission timeout; doubles on every retry
+#define SYN_RETRIES 3
+#define TRANSFER_MAX_TIMEOUTS 8      ///< Retransmission timeouts in a row before the transfer gives up
+#define VIRTUAL_TIME_LIMIT_S 3600    ///< Stop a run that is stuck after this much virtual time
+
+using Clock = MemoryLink::Clock;
+
+using SynPacket = TcpPacketTemplate<TCP_OPT_MSS | TCP_OPT_SACK_PERMITTED>;
+using BarePacket = TcpPacketTemplate<TCP_OPT_NONE>;
+const SynPacket CLIENT_SYN(TH_SYN, CLIENT_WINDOW);
+const BarePacket CLIENT_ACK(TH_ACK, CLIENT_WINDOW);
+const BarePacket CLIENT_DATA(TH_ACK | TH_PUSH, CLIENT_WINDOW);
+const BarePacket CLIENT_FIN(TH_FIN | TH_ACK, CLIENT_WINDOW);
+
+struct BenchConfig {
+    uint64_t handshakes = DEFAULT_HANDSHAKES;
+    size_t concurrency = DEFAULT_CONCURRENCY;
+    uint64_t bytes = DEFAULT_BYTES;
+    std::string congestion = "cubic";
+    LinkProfile link;                ///< both directions alike
+    uint32_t seed = DEFAULT_SEED;
+    std::string capture;             ///< pcap-ng file of the client's packets (empty: none)
+};
+
+/// FNV-1a over every packet the client receives, to compare runs
+struct Digest {
+    uint64_t value = 0xcbf29ce484222325ULL;
+    void add(const char *data, int length) {
+        for (int i = 0; i < length; ++i) value = (value ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+    }
+};
+
+/**
+ * The client side: the handshakes of phase 1, then the transfer. It works
+ * like client.cpp's load and transfer modes, except that it never reads a
+ * clock: it is told `now` and reports its next timer.
+ */
+class BenchClient {
+public:
+    BenchClient(const BenchConfig &config, PacketIO &io)
+        : config(config), io(io), rng(config.seed) {}
+
+    void step(Clock::time_point now) {
+        auto handler = [&](const char *packet, int length) { handle_packet(packet, length, now); };
+        while (io.receive(handler) > 0) {}
+        run_timers(now);
+        if (handshakes_started < config.handshakes) {
+            while (pending.size() < config.concurrency && handshakes_started < config.handshakes) {
+                connect(uint16_t(BENCH_PORT_FIRST + handshakes_started++), now);
+            }
+        } else if (pending.empty() && !transfer_started) {
+            transfer_started = true;
+            connect(BENCH_TRANSFER_PORT, now);
+        }
+        if (sender) sender->transmit(now, [&](uint32_t seq, const char *payload, size_t length, bool fin) {
+            size_t size = BarePacket::SIZE;
+            if (fin) CLIENT_FIN.build(packet, address(BENCH_TRANSFER_PORT), seq, server_next);
+            else size = CLIENT_DATA.build(packet, address(BENCH_TRANSFER_PORT), seq, server_next, payload, length);
+            io.send(packet, size, server_addr);
+        });
+        io.flush();
+    }
+
+    Clock::time_point next_timer() const {
+        Clock::time_point next = syn_timers.empty() ? Clock::time_point::max() : syn_timers.front().first;
+        return sender ? std::min(next, sender->timer()) : next;
+    }
+
+    /// The transfer finished, or cannot
+    bool finished() const { return gave_up || (sender && sender->done() && server_fin); }
+
+    void report(Clock::time_point start) const {
+        std::vector<int64_t> sorted = latencies_us;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) { return sorted.empty() ? 0 : sorted[size_t(p * (sorted.size() - 1))]; };
+        double seconds = std::chrono::duration<double>(handshakes_finished - start).count();
+        std::cout << "[+] Handshakes: " << completed << " of " << config.handshakes << " completed, " << failed
+                  << " failed, SYNs retransmitted: " << syn_retransmits << ", in " << seconds << " s ("
+                  << uint64_t(seconds > 0 ? completed / seconds : 0) << "/s); SYN -> SYN-ACK p50 "
+                  << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max " << percentile(1) << " us"
+                  << std::endl;
+        if (!sender) {
+            std::cout << "[-] Transfer: no connection" << std::endl;
+            return;
+        }
+        const SenderStats &stats = sender->sender_stats();
+        seconds = std::chrono::duration<double>(transfer_finished - transfer_opened).count();
+        std::cout << "[+] Transfer (" << sender->congestion().name() << "): " << sender->bytes_acked() << " of "
+                  << config.bytes << " bytes acknowledged in " << seconds << " s, goodput "
+                  << (seconds > 0 ? sender->bytes_acked() * 8 / seconds / 1e6 : 0) << " Mbit/s; segments sent: "
+                  << stats.segments_sent << ", retransmitted: " << stats.retransmits << " ("
+                  << (stats.segments_sent ? 100.0 * stats.retransmits / stats.segments_sent : 0)
+                  << "%), fast retransmits: " << stats.fast_retransmits << ", timeouts: " << stats.timeouts << "; "
+                  << (server_fin ? "closed by both sides" : "server FIN missing") << std::endl;
+    }
+
+    uint64_t digest() const { return packets.value; }
+
+private:
+    struct Attempt {
+        uint32_t isn;
+        Clock::time_point first_sent;
+        Clock::time_point deadline;
+        int retries;
+    };
+
+    BenchConfig config;
+    PacketIO &io;
+    std::mt19937 rng;
+    uint32_t client_addr = inet_addr(CLIENT_ADDRESS), server_addr = inet_addr(SERVER_ADDRESS);
+    char packet[BarePacket::SIZE + TCP_MAX_SEGMENT];
+    Digest packets;
+
+    std::unordered_map<uint16_t, Attempt> pending;   ///< by source port
+    std::deque<std::pair<Clock::time_point, uint16_t>> syn_timers;   ///< in order; stale ones are skipped
+    uint64_t handshakes_started = 0, completed = 0, failed = 0, syn_retransmits = 0;
+    std::vector<int64_t> latencies_us;
+    Clock::time_point handshakes_finished;
+
+    bool transfer_started = false;
+    std::unique_ptr<TcpSender> sender;
+    uint32_t server_next = 0;
+    bool server_fin = false, gave_up = false;
+    Clock::time_point transfer_opened, transfer_finished;
+
+    PacketAddress address(uint16_t port) const {
+        return {client_addr, server_addr, htons(port), htons(SERVER_PORT)};
+    }
+
+    void connect(uint16_t port, Clock::time_point now) {
+        Clock::time_point deadline = now + std::chrono::milliseconds(SYN_TIMEOUT_MS);
+        Attempt &attempt = pending[port] = Attempt{uint32_t(rng()), now, deadline, 0};
+        syn_timers.emplace_back(deadline, port);
+        send_syn(port, attempt.isn);
+    }
+
+    void send_syn(uint16_t port, uint32_t isn) {
+        CLIENT_SYN.build(packet, address(port), isn, 0);
+        io.send(packet, SynPacket::SIZE, server_addr);
+    }
+
+    void run_timers(Clock::time_point now) {
+        while (!syn_timers.empty() && syn_timers.front().first <= now) {
+            auto [deadline, port] = syn_timers.front();
+            syn_timers.pop_front();
+            auto it = pending.find(port);
+            if (it == pending.end() || it->second.deadline != deadline) continue;   // answered or re-armed
+            Attempt &attempt = it->second;
+            if (attempt.retries >= SYN_RETRIES) {
+                pending.erase(it);
+                finish_handshake(port, now, false);
+                continue;
+            }
+            ++attempt.retries;
+            ++syn_retransmits;
+            attempt.deadline = now + std::chrono::milliseconds(SYN_TIMEOUT_MS << attempt.retries);
+            syn_timers.emplace_back(attempt.deadline, port);
+            send_syn(port, attempt.isn);
+        }
+
+        if (sender && now >= sender->timer()) {
+            if (sender->timeouts_in_a_row() >= TRANSFER_MAX_TIMEOUTS) {
+                gave_up = true;
+                transfer_finished = now;
+                return;
+            }
+            sender->on_timeout(now);
+        }
+    }
+
+    void finish_handshake(uint16_t port, Clock::time_point now, bool ok) {
+        if (port == BENCH_TRANSFER_PORT) {
+            if (!ok) gave_up = true;
+            return;
+        }
+        ++(ok ? completed : failed);
+        if (completed + failed == config.handshakes) handshakes_finished = now;
+    }
+
+    void handle_packet(const char *buffer, int length, Clock::time_point now) {
+        packets.add(buffer, length);
+        const struct iphdr *ip = (const struct iphdr *)buffer;
+        if (length < (int)sizeof(struct iphdr) || length < ip->ihl * 4 + (int)sizeof(struct tcphdr)) return;
+        const struct tcphdr *tcp = (const struct tcphdr *)(buffer + ip->ihl * 4);
+        uint16_t port = ntohs(tcp->dest);
+        if (!tcp->ack || tcp->rst) return;
+
+        if (tcp->syn) {
+            auto it = pending.find(port);
+            uint32_t ack = ntohl(tcp->seq) + 1;
+            if (it != pending.end()) {
+                if (ntohl(tcp->ack_seq) != it->second.isn + 1) return;
+                Clock::duration latency = now - it->second.first_sent;
+                pending.erase(it);
+                finish_handshake(port, now, true);
+                if (port != BENCH_TRANSFER_PORT) {
+                    latencies_us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+                } else {
+                    server_next = ack;
+                    transfer_opened = now;
+                    sender = std::make_unique<TcpSender>(ntohl(tcp->ack_seq), config.bytes, PACKET_DEFAULT_MSS,
+                                                         make_congestion_control(config.congestion,
+                                                                                 PACKET_DEFAULT_MSS),
+                                                         ntohs(tcp->window));
+                }
+            }
+            // The final ACK, again if the SYN-ACK was retransmitted because it got lost
+            CLIENT_ACK.build(packet, address(port), ntohl(tcp->ack_seq), ack);
+            io.send(packet, BarePacket::SIZE, server_addr);
+            return;
+        }
+
+        if (port != BENCH_TRANSFER_PORT || !sender) return;
+        sender->on_ack(ntohl(tcp->ack_seq), ntohs(tcp->window), now);
+        if (tcp->fin && ntohl(tcp->seq) == server_next - (server_fin ? 1 : 0)) {
+            if (!server_fin) transfer_finished = now;
+            server_fin = true;
+            server_next = ntohl(tcp->seq) + 1;
+            CLIENT_ACK.build(packet, address(port), sender->next_seq(), server_next);
+            io.send(packet, BarePacket::SIZE, server_addr);
+        }
+    }
+};
+
+/// A byte count with an optional K, M or G suffix (powers of 1024)
+uint64_t parse_bytes(const std::string &text) {
+    size_t end;
+    uint64_t value = std::stoull(text, &end);
+    switch (end < text.size() ? text[end] : 0) {
+        case 'k': case 'K': return value << 10;
+        case 'm': case 'M': return value << 20;
+        case 'g': case 'G': return value << 30;
+    }
+    return value;
+}
+
+void usage(const char *program) {
+    std::cerr << "Usage: " << program << " [--handshakes N] [--concurrency N] [--bytes N[K|M|G]] [--cc reno|cubic]"
+              << " [--delay-us US] [--loss PERCENT] [--reorder PERCENT] [--reorder-us US] [--seed N]"
+              << " [--capture FILE]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+/// Oversized segments: the intact one is taken in, the one with a wrong last byte is corrupt
+bool check_receiver() {
+    const size_t size = IO_SLOT_SIZE - BarePacket::SIZE;
+    std::vector<char> payload(size);
+    for (size_t done = 0; done < size; done += TCP_MAX_SEGMENT) {
+        memcpy(&payload[done], stream_data(done), std::min<size_t>(TCP_MAX_SEGMENT, size - done));
+    }
+    bool ok = true;
+
+    TcpReceiver intact(1000, UINT16_MAX);
+    intact.on_segment(1000, payload.data(), size, false);
+    if (intact.bytes() != size || intact.receiver_stats().corrupt != 0) {
+        std::cerr << "[-] FAIL: intact " << size << "-byte segment not delivered" << std::endl;
+        ok = false;
+    }
+
+    payload.back() ^= 1;
+    TcpReceiver damaged(1000, UINT16_MAX);
+    damaged.on_segment(1000, payload.data(), size, false);
+    if (damaged.bytes() != 0 || damaged.receiver_stats().corrupt != 1) {
+        std::cerr << "[-] FAIL: damaged " << size << "-byte segment not counted as corrupt" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config;
+    config.link.delay = std::chrono::microseconds(DEFAULT_DELAY_US);
+    config.link.reorder_delay = std::chrono::microseconds(DEFAULT_REORDER_US);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--handshakes" && i + 1 < argc) {
+            config.handshakes = std::stoull(argv[++i]);
+        } else if (arg == "--concurrency" && i + 1 < argc) {
+            config.concurrency = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--bytes" && i + 1 < argc) {
+            config.bytes = parse_bytes(argv[++i]);
+        } else if (arg == "--cc" && i + 1 < argc) {
+            config.congestion = argv[++i];
+            if (!make_congestion_control(config.congestion, PACKET_DEFAULT_MSS)) usage(argv[0]);
+        } else if (arg == "--delay-us" && i + 1 < argc) {
+            config.link.delay = std::chrono::microseconds(std::stoll(argv[++i]));
+        } else if (arg == "--loss" && i + 1 < argc) {
+            config.link.loss = std::stod(argv[++i]) / 100;
+        } else if (arg == "--reorder" && i + 1 < argc) {
+            config.link.reorder = std::stod(argv[++i]) / 100;
+        } else if (arg == "--reorder-us" && i + 1 < argc) {
+            config.link.reorder_delay = std::chrono::microseconds(std::stoll(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            config.seed = std::stoul(argv[++i]);
+        } else if (arg == "--capture" && i + 1 < argc) {
+            config.capture = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!check_receiver()) return 1;
+    // One source port per handshake, below the transfer's
+    if (config.handshakes > BENCH_TRANSFER_PORT - BENCH_PORT_FIRST) {
+        std::cerr << "[-] At most " << BENCH_TRANSFER_PORT - BENCH_PORT_FIRST << " handshakes" << std::endl;
+        return 1;
+    }
+
+    MemoryLink link(config.link, config.link, config.seed);
+    ServerConfig server_config;
+    server_config.quiet = true;
+    server_config.seed = config.seed;
+    server_config.max_connections = config.handshakes + 1;
+
+    // Any fixed origin makes the ISNs repeat; steady_clock's own epoch is as good as any
+    Clock::time_point start{}, now = start;
+    link.set_time(now);
+    HandshakeListener server(server_config, link.end_b(), now);
+    BenchClient client(config, link.end_a());
+    PcapWriter capture;
+    if (!config.capture.empty()) {
+        std::string error;
+        if (!capture.open(config.capture, "memory link", error)) {
+            std::cerr << "[-] " << error << std::endl;
+            return 1;
+        }
+        link.end_a().set_capture(&capture);
+    }
+
+    std::cout << "[+] " << config.handshakes << " handshakes, then " << config.bytes << " bytes ("
+              << config.congestion << ") over a " << config.link.delay.count() / 1000 << " us link, "
+              << config.link.loss * 100 << "% loss, " << config.link.reorder * 100 << "% reordered by "
+              << config.link.reorder_delay.count() / 1000 << " us, seed " << config.seed << std::endl;
+
+    uint64_t steps = 0;
+    std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+    while (true) {
+        server.receive(now);
+        client.step(now);
+        server.run_timers(now);
+        ++steps;
+        // Once the client is done, only what is still in flight matters (the ACK of the server's FIN),
+        // plus SYN-ACK retransmits for handshakes whose final ACK was lost, until the server completes them
+        Clock::time_point next = link.next_delivery();
+        if (!client.finished()) next = std::min({next, server.next_timer(), client.next_timer()});
+        else if (server.half_open_connections()) next = std::min(next, server.next_timer());
+        else if (next == Clock::time_point::max()) break;
+        if (next == Clock::time_point::max() || next - start > std::chrono::seconds(VIRTUAL_TIME_LIMIT_S)) {
+            std::cerr << "[-] Nothing left to happen; the run is stuck" << std::endl;
+            break;
+        }
+        now = std::max(now, next);
+        link.set_time(now);
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    client.report(start);
+    const IoStats &to_server = link.end_a().io_stats(), &to_client = link.end_b().io_stats();
+    std::cout << "[+] Link: " << to_server.packets_sent << " packets to the server (" << to_server.packets_lost
+              << " lost), " << to_client.packets_sent << " to the client (" << to_client.packets_lost
+              << " lost); virtual time " << std::chrono::duration<double>(now - start).count() << " s" << std::endl;
+    const ServerStats &stats = server.server_stats();
+    std::cout << "[+] Server: established " << stats.established << ", SYN-ACK retransmits " << stats.retransmits
+              << ", data bytes " << stats.data_bytes << ", out-of-order " << stats.out_of_order << ", duplicates "
+              << stats.duplicates << ", connections closed " << stats.closed << std::endl;
+    uint64_t processed = link.end_a().io_stats().packets_received + link.end_b().io_stats().packets_received;
+    std::cout << "[+] Wall clock: " << wall << " s for " << steps << " steps, " << uint64_t(processed / wall)
+              << " packets/s through both stacks; digest " << std::hex << std::setw(16) << std::setfill('0')
+              << client.digest() << std::dec << std::setfill(' ') << std::endl;
+    if (capture.is_open()) {
+        capture.close();
+        std::cout << "[+] Captured " << capture.packets() << " packets to " << config.capture << " ("
+                  << capture.packets_dropped() << " dropped)" << std::endl;
+    }
+    return client.finished() ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// tcp_filter.hpp
+/**
+ * Classic BPF socket filters for the handshake tools.
+ *
+ * A raw TCP socket gets a copy of every TCP packet the host receives, and a
+ * packet socket every IP packet on its interface. A filter attached with
+ * SO_ATTACH_FILTER makes the kernel drop everything except the handshake
+ * packets before they are queued or copied. The program is generated from
+ * a TcpFilter and expects packets to start at the IP header, as they do on
+ * raw IP sockets and SOCK_DGRAM packet sockets:
+ *
+ *       ldb  [9]                 ; IP protocol
+ *       jne  #6, drop
+ *       ldh  [6]                 ; fragment offset: only first fragments have a TCP header
+ *       jset #0x1fff, drop
+ *       ldxb 4*([0]&0xf)         ; X = IP header length
+ *       ldh  [x+2]               ; destination port   (if dest_port is set)
+ *       jne  #dest_port, drop
+ *       ldh  [x+0]               ; source port        (if source_port is set)
+ *       jne  #source_port, drop
+ *       ldb  [x+13]              ; flags              (if flags_mask is set)
+ *       and  #flags_mask
+ *       jeq  #value, accept      ; once per accepted value
+ *       ...
+ *       ret  #0                  ; drop
+ *   accept:
+ *       ret  #0x40000
+ */
+
+#ifndef TCP_FILTER_HPP
+#define TCP_FILTER_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+
+#define FILTER_ACCEPT_BYTES 0x40000  ///< Bytes of an accepted packet to keep (all of it)
+
+struct TcpFilter {
+    uint16_t dest_port = 0;             ///< host byte order; 0 matches any
+    uint16_t source_port = 0;           ///< host byte order; 0 matches any
+    uint8_t flags_mask = 0;             ///< TCP flag bits (TH_SYN, TH_ACK, ...) that are examined
+    std::vector<uint8_t> flags_values;  ///< accepted values of flags & flags_mask
+};
+
+/// Compiles `filter` to classic BPF
+inline std::vector<struct sock_filter> build_tcp_filter(const TcpFilter &filter) {
+    // Jumps to these labels are resolved once the program is complete
+    const uint8_t DROP = 0xff, ACCEPT = 0xfe;
+    std::vector<struct sock_filter> code;
+    auto stmt = [&](uint16_t op, uint32_t k) { code.push_back(BPF_STMT(op, k)); };
+    auto jump = [&](uint16_t op, uint32_t k, uint8_t jt, uint8_t jf) { code.push_back(BPF_JUMP(op, k, jt, jf)); };
+
+    stmt(BPF_LD | BPF_B | BPF_ABS, 9);
+    jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, DROP);
+    stmt(BPF_LD | BPF_H | BPF_ABS, 6);
+    jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, DROP, 0);
+    stmt(BPF_LDX | BPF_B | BPF_MSH, 0);
+    if (filter.dest_port) {
+        stmt(BPF_LD | BPF_H | BPF_IND, 2);
+        jump(BPF_JMP | BPF_JEQ | BPF_K, filter.dest_port, 0, DROP);
+    }
+    if (filter.source_port) {
+        stmt(BPF_LD | BPF_H | BPF_IND, 0);
+        jump(BPF_JMP | BPF_JEQ | BPF_K, filter.source_port, 0, DROP);
+    }
+    if (filter.flags_mask && !filter.flags_values.empty()) {
+        stmt(BPF_LD | BPF_B | BPF_IND, 13);
+        stmt(BPF_ALU | BPF_AND | BPF_K, filter.flags_mask);
+        for (size_t i = 0; i < filter.flags_values.size(); ++i) {
+            bool last = i + 1 == filter.flags_values.size();
+            jump(BPF_JMP | BPF_JEQ | BPF_K, filter.flags_values[i], ACCEPT, last ? DROP : 0);
+        }
+    } else {
+        stmt(BPF_RET | BPF_K, FILTER_ACCEPT_BYTES);
+    }
+    size_t drop = code.size();
+    stmt(BPF_RET | BPF_K, 0);
+    size_t accept = code.size();
+    stmt(BPF_RET | BPF_K, FILTER_ACCEPT_BYTES);
+
+    for (size_t i = 0; i < drop; ++i) {
+        if (BPF_CLASS(code[i].code) != BPF_JMP) continue;
+        for (uint8_t *target : {&code[i].jt, &code[i].jf}) {
+            if (*target == DROP) *target = uint8_t(drop - i - 1);
+            else if (*target == ACCEPT) *target = uint8_t(accept - i - 1);
+        }
+    }
+    return code;
+}
+
+/**
+ * Attaches `filter` to a socket whose packets start at the IP header.
+ * @return false with `error` set on failure
+ */
+inline bool attach_tcp_filter(int fd, const TcpFilter &filter, std::string &error) {
+    std::vector<struct sock_filter> code = build_tcp_filter(filter);
+    struct sock_fprog program{};
+    program.len = (unsigned short)code.size();
+    program.filter = code.data();
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0) {
+        error = std::string("setsockopt(SO_ATTACH_FILTER) failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * TCP segments received by the whole host so far (InSegs in /proc/net/snmp).
+ * A raw TCP socket sees every one of them, so the difference between two
+ * readings, minus what the socket delivered, is what the filter dropped.
+ */
+inline uint64_t host_tcp_segments() {
+    std::ifstream snmp("/proc/net/snmp");
+    std::string names, values;
+    while (std::getline(snmp, names)) {
+        if (names.rfind("Tcp:", 0) != 0 || !std::getline(snmp, values)) continue;
+        std::istringstream name_fields(names), value_fields(values);
+        std::string name, value;
+        while (name_fields >> name && value_fields >> value) {
+            if (name == "InSegs") return std::stoull(value);
+        }
+    }
+    return 0;
+}
+
+#endif // TCP_FILTER_HPP
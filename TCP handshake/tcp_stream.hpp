@@ -0,0 +1,361 @@
+// tcp_stream.hpp
+/**
+ * The data phase of a connection, for one direction of the byte stream and
+ * independent of how packets travel.
+ *
+ * TcpSender sends a bulk stream of a given length, then a FIN:
+ * - Sliding window: no more than min(congestion window, peer's advertised
+ *   window) bytes outstanding. The congestion window comes from a pluggable
+ *   CongestionControl (congestion.hpp).
+ * - Cumulative ACKs slide the window; RTT is sampled on one segment per
+ *   flight, never on a retransmitted one (Karn's algorithm).
+ * - Retransmission timeout per RFC 6298, doubled on every expiry; an expiry
+ *   resends everything from the first unacknowledged byte (go-back-N).
+ * - Fast retransmit after TCP_DUPACK_THRESHOLD duplicate ACKs, and NewReno
+ *   fast recovery (RFC 6582): each partial ACK resends the next hole. The
+ *   first duplicates already release new segments (Limited Transmit), so
+ *   small windows still get enough duplicates for a fast retransmit.
+ *
+ * TcpReceiver tracks what has arrived and what to acknowledge:
+ * - In-order data advances the cumulative ACK. Segments beyond a gap are
+ *   kept as ranges until the gap fills, and answered by an immediate
+ *   (duplicate) ACK so the sender notices the loss.
+ * - Every second full-sized segment is acknowledged at once. A delayed ACK
+ *   is left for the caller to send, e.g. at the end of a receive batch.
+ *
+ * The benchmark streams a fixed pattern (stream_data()), so the receiver
+ * checks every byte without buffering the payload.
+ */
+
+#ifndef TCP_STREAM_HPP
+#define TCP_STREAM_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "congestion.hpp"
+
+#define TCP_RTO_INITIAL_MS 1000      ///< RTO before the first RTT sample (RFC 6298)
+#define TCP_RTO_MIN_MS 200           ///< Lower bound of the RTO (Linux's; RFC 6298 suggests 1 s)
+#define TCP_RTO_MAX_MS 60000         ///< Upper bound of the backed-off RTO
+#define TCP_CLOCK_GRANULARITY_US 1000  ///< G in RFC 6298
+#define TCP_DUPACK_THRESHOLD 3       ///< Duplicate ACKs that trigger a fast retransmit
+#define TCP_MAX_SEGMENT 1460         ///< Largest payload a segment carries
+#define STREAM_PATTERN_PERIOD 251    ///< Period of the benchmark byte pattern (a prime, so it drifts across segments)
+
+/// Payload bytes starting at stream offset `offset` (TCP_MAX_SEGMENT of them are valid)
+inline const char *stream_data(uint64_t offset) {
+    static const std::vector<char> pattern = [] {
+        std::vector<char> bytes(STREAM_PATTERN_PERIOD + TCP_MAX_SEGMENT);
+        for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = char('a' + i % STREAM_PATTERN_PERIOD % 26);
+        return bytes;
+    }();
+    return &pattern[offset % STREAM_PATTERN_PERIOD];
+}
+
+/// Whether `size` bytes at `payload` are the stream from `offset` on; the peer picks `size`, so
+/// the pattern is compared TCP_MAX_SEGMENT bytes at a time
+inline bool matches_stream(uint64_t offset, const char *payload, size_t size) {
+    while (size > 0) {
+        size_t chunk = std::min<size_t>(size, TCP_MAX_SEGMENT);
+        if (memcmp(payload, stream_data(offset), chunk) != 0) return false;
+        offset += chunk;
+        payload += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// ---------------- RTO Estimation ----------------
+class RtoEstimator {
+public:
+    /// Adds an RTT measurement (RFC 6298, section 2)
+    void sample(TcpClock::duration rtt) {
+        if (!has_sample) {
+            srtt = rtt;
+            rttvar = rtt / 2;
+            has_sample = true;
+        } else {
+            TcpClock::duration error = srtt > rtt ? srtt - rtt : rtt - srtt;
+            rttvar = (3 * rttvar + error) / 4;
+            srtt = (7 * srtt + rtt) / 8;
+        }
+        base = srtt + std::max<TcpClock::duration>(std::chrono::microseconds(TCP_CLOCK_GRANULARITY_US), 4 * rttvar);
+        base = std::max<TcpClock::duration>(base, std::chrono::milliseconds(TCP_RTO_MIN_MS));
+    }
+
+    /// The current timeout, backed off by every expiry since the last new ACK
+    TcpClock::duration rto() const {
+        return std::min<TcpClock::duration>(base * (1 << shift), std::chrono::milliseconds(TCP_RTO_MAX_MS));
+    }
+
+    void backoff() { shift = std::min(shift + 1, 16); }
+    void reset_backoff() { shift = 0; }
+    TcpClock::duration smoothed() const { return has_sample ? srtt : TcpClock::duration::zero(); }
+
+private:
+    TcpClock::duration srtt{}, rttvar{};
+    TcpClock::duration base = std::chrono::milliseconds(TCP_RTO_INITIAL_MS);
+    int shift = 0;
+    bool has_sample = false;
+};
+
+// ---------------- Sender ----------------
+struct SenderStats {
+    uint64_t segments_sent = 0;      ///< including retransmissions and the FIN
+    uint64_t retransmits = 0;        ///< segments sent again
+    uint64_t fast_retransmits = 0;   ///< losses detected by duplicate ACKs
+    uint64_t timeouts = 0;
+};
+
+class TcpSender {
+public:
+    /**
+     * @param first_seq Sequence number of the first data byte (our ISN + 1)
+     * @param length Bytes to send before the FIN
+     * @param mss Largest payload per segment (at most TCP_MAX_SEGMENT)
+     * @param peer_window Window the peer advertised in its SYN-ACK
+     */
+    TcpSender(uint32_t first_seq, uint64_t length, uint32_t mss, std::unique_ptr<CongestionControl> cc,
+              uint32_t peer_window)
+        : first_seq(first_seq), length(length), mss(std::min<uint32_t>(mss, TCP_MAX_SEGMENT)), cc(std::move(cc)),
+          peer_window(peer_window) {}
+
+    /**
+     * Sends what the windows allow, the first unacknowledged segment first if
+     * a loss was detected. Calls emit(uint32_t seq, const char *payload,
+     * size_t length, bool fin) for each segment.
+     */
+    template <class Emit>
+    void transmit(TcpClock::time_point now, Emit &&emit) {
+        if (resend_first) {
+            resend_first = false;
+            send_segment(una, now, emit);
+        }
+        // One more segment per duplicate ACK: Limited Transmit (RFC 3042) for the first
+        // two, the inflated window of fast recovery (RFC 5681, section 3.2) after that
+        uint64_t congestion_window = cc->window() + uint64_t(dupacks) * mss;
+        uint64_t window = std::min<uint64_t>(congestion_window, peer_window);
+        while (nxt <= length) {
+            uint64_t segment = std::min<uint64_t>(mss, length - nxt);
+            if (segment && nxt - una + segment > window) {
+                cwnd_limited = congestion_window <= peer_window;
+                break;
+            }
+            send_segment(nxt, now, emit);
+            nxt += segment ? segment : 1;
+        }
+    }
+
+    /// Processes the acknowledgement number and window of a segment from the peer
+    void on_ack(uint32_t ack, uint16_t window, TcpClock::time_point now) {
+        peer_window = window;
+        int32_t advance = int32_t(ack - seq_at(una));
+        if (advance < 0 || una + advance > high) return;   // old, or for data never sent
+        if (advance > 0) {
+            uint64_t acked = advance;
+            if (timing && una + acked > timed_offset) {
+                rtt.sample(now - timed_at);
+                timing = false;
+            }
+            una += acked;
+            nxt = std::max(nxt, una);   // after a go-back-N the ACK may cover data not yet resent
+            rtt.reset_backoff();
+            consecutive_timeouts = 0;
+            if (in_recovery) {
+                if (una >= recover) {
+                    in_recovery = false;
+                } else {
+                    resend_first = true;   // partial ACK: the next hole is lost too
+                }
+            } else if (cwnd_limited) {
+                // A window the peer or the application keeps from filling has not been probed (RFC 7661)
+                cc->on_ack(uint32_t(acked), rtt.smoothed(), now);
+            }
+            dupacks = 0;
+            if (una == high) timer_armed = false;
+            else deadline = now + rtt.rto();
+        } else if (una < high) {
+            ++dupacks;
+            // After a timeout, duplicates of data sent before it are expected (RFC 6582, section 4.1)
+            if (!in_recovery && dupacks == TCP_DUPACK_THRESHOLD && una >= recover) {
+                in_recovery = true;
+                recover = high;
+                cc->on_fast_retransmit(uint32_t(high - una), now);
+                resend_first = true;
+                ++stats.fast_retransmits;
+            }
+        }
+    }
+
+    /// Call once timer() has passed
+    void on_timeout(TcpClock::time_point now) {
+        if (!timer_armed) return;
+        ++stats.timeouts;
+        ++consecutive_timeouts;
+        cc->on_timeout(uint32_t(high - una), now);
+        rtt.backoff();
+        in_recovery = false;
+        dupacks = 0;
+        recover = high;
+        timing = false;
+        nxt = una;
+        deadline = now + rtt.rto();
+    }
+
+    /// When the retransmission timer expires (time_point::max() if it is not running)
+    TcpClock::time_point timer() const { return timer_armed ? deadline : TcpClock::time_point::max(); }
+    /// Sequence number after everything sent, the FIN included
+    uint32_t next_seq() const { return seq_at(high); }
+    bool done() const { return una > length; }
+    uint64_t bytes_acked() const { return std::min(una, length); }
+    int timeouts_in_a_row() const { return consecutive_timeouts; }
+    const SenderStats &sender_stats() const { return stats; }
+    const CongestionControl &congestion() const { return *cc; }
+    const RtoEstimator &rto_estimator() const { return rtt; }
+
+private:
+    uint32_t first_seq;
+    uint64_t length;
+    uint32_t mss;
+    std::unique_ptr<CongestionControl> cc;
+    RtoEstimator rtt;
+    SenderStats stats;
+
+    // Stream offsets; the FIN occupies offset `length`
+    uint64_t una = 0;                ///< first unacknowledged
+    uint64_t nxt = 0;                ///< next to send (moved back by a timeout)
+    uint64_t high = 0;               ///< end of everything ever sent
+    uint64_t recover = 0;            ///< `high` when fast recovery or the last timeout began
+    uint32_t peer_window;
+    uint32_t dupacks = 0;
+    bool in_recovery = false;
+    bool resend_first = false;       ///< retransmit the segment at `una` on the next transmit()
+    bool cwnd_limited = false;       ///< the congestion window, not the peer's, last stopped transmit()
+    int consecutive_timeouts = 0;
+
+    bool timing = false;             ///< an RTT measurement is in progress
+    uint64_t timed_offset = 0;
+    TcpClock::time_point timed_at;
+
+    bool timer_armed = false;
+    TcpClock::time_point deadline;
+
+    uint32_t seq_at(uint64_t offset) const { return first_seq + uint32_t(offset); }
+
+    template <class Emit>
+    void send_segment(uint64_t offset, TcpClock::time_point now, Emit &&emit) {
+        bool fin = offset == length;
+        size_t segment = fin ? 0 : std::min<uint64_t>(mss, length - offset);
+        emit(seq_at(offset), stream_data(offset), segment, fin);
+        ++stats.segments_sent;
+        if (offset < high) {
+            ++stats.retransmits;
+            timing = false;   // Karn: an ACK could not tell which copy it answers
+        } else if (!timing) {
+            timing = true;
+            timed_offset = offset;
+            timed_at = now;
+        }
+        high = std::max(high, offset + (fin ? 1 : segment));
+        if (!timer_armed) {
+            timer_armed = true;
+            deadline = now + rtt.rto();
+        }
+    }
+};
+
+// ---------------- Receiver ----------------
+struct ReceiverStats {
+    uint64_t segments = 0;           ///< segments with data or a FIN
+    uint64_t out_of_order = 0;       ///< arrived beyond a gap
+    uint64_t duplicates = 0;         ///< held nothing new
+    uint64_t corrupt = 0;            ///< payload differs from the stream pattern (dropped)
+};
+
+class TcpReceiver {
+public:
+    enum class Ack { NONE, DELAYED, NOW };
+
+    /**
+     * @param first_seq Sequence number of the peer's first data byte (its ISN + 1)
+     * @param window Receive window we advertise
+     */
+    TcpReceiver(uint32_t first_seq, uint32_t window) : first_seq(first_seq), window(window) {}
+
+    /// Takes in a segment and says when to acknowledge it
+    Ack on_segment(uint32_t seq, const char *payload, size_t size, bool fin) {
+        if (size == 0 && !fin) return Ack::NONE;   // a pure ACK
+        ++stats.segments;
+        int32_t delta = int32_t(seq - (first_seq + uint32_t(delivered)));
+        if (delta > int32_t(window)) return Ack::NOW;   // beyond the window
+        if (delta < 0 && uint64_t(-int64_t(delta)) > delivered) return Ack::NOW;
+        uint64_t start = delivered + delta, end = start + size;
+        if (!matches_stream(start, payload, size)) {
+            ++stats.corrupt;
+            return Ack::NONE;
+        }
+        if (fin) fin_offset = end;
+        if (end <= delivered && !(fin && end == delivered)) {
+            ++stats.duplicates;
+            return Ack::NOW;
+        }
+
+        if (start > delivered) {
+            ++stats.out_of_order;
+            add_range(start, end);
+            return Ack::NOW;
+        }
+        delivered = std::max(delivered, end);
+        bool filled_gap = false;
+        auto it = out_of_order.begin();
+        while (it != out_of_order.end() && it->first <= delivered) {
+            delivered = std::max(delivered, it->second);
+            it = out_of_order.erase(it);
+            filled_gap = true;
+        }
+        if (filled_gap || fin_received() || size < TCP_MAX_SEGMENT || ++unacked >= 2) {
+            unacked = 0;
+            return Ack::NOW;
+        }
+        return Ack::DELAYED;
+    }
+
+    /// Acknowledgement number: next byte expected, plus one once the FIN is in
+    uint32_t ack_number() const { return first_seq + uint32_t(delivered) + (fin_received() ? 1 : 0); }
+    bool fin_received() const { return delivered == fin_offset; }
+    uint64_t bytes() const { return delivered; }
+    uint16_t advertised_window() const { return uint16_t(std::min<uint32_t>(window, UINT16_MAX)); }
+    const ReceiverStats &receiver_stats() const { return stats; }
+
+private:
+    uint32_t first_seq;
+    uint32_t window;
+    uint64_t delivered = 0;          ///< stream offset of the next byte expected
+    uint64_t fin_offset = UINT64_MAX;
+    std::map<uint64_t, uint64_t> out_of_order;   ///< received ranges beyond `delivered`: start -> end
+    int unacked = 0;                 ///< full segments received since the last ACK
+    ReceiverStats stats;
+
+    void add_range(uint64_t start, uint64_t end) {
+        auto it = out_of_order.upper_bound(start);
+        if (it != out_of_order.begin() && std::prev(it)->second >= start) {
+            --it;
+            start = it->first;
+            end = std::max(end, it->second);
+            it = out_of_order.erase(it);
+        }
+        while (it != out_of_order.end() && it->first <= end) {
+            end = std::max(end, it->second);
+            it = out_of_order.erase(it);
+        }
+        out_of_order[start] = end;
+    }
+};
+
+#endif // TCP_STREAM_HPP